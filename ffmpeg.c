@@ -34,8 +34,16 @@
 #include "libavcodec/opt.h"
 #include "libavutil/fifo.h"
 #include "libavutil/avstring.h"
+#include "libavutil/threadfifo.h"
+#include "libavutil/trace.h"
 #include "libavformat/os_support.h"
 
+#ifdef CONFIG_AVFILTER
+# include "libavfilter/avfilter.h"
+# include "libavfilter/avfiltergraph.h"
+# include "libavfilter/graphparser.h"
+#endif
+
 #ifdef HAVE_SYS_RESOURCE_H
 #include <sys/types.h>
 #include <sys/resource.h>
@@ -57,6 +65,10 @@
 
 #include "cmdutils.h"
 
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 #undef NDEBUG
 #include <assert.h>
 
@@ -90,7 +102,7 @@ static int nb_input_files = 0;
 static AVFormatContext *output_files[MAX_FILES];
 static int nb_output_files = 0;
 
-static AVStreamMap stream_maps[MAX_FILES];
+static AVStreamMap *stream_maps = NULL;
 static int nb_stream_maps;
 
 static AVMetaDataMap meta_data_maps[MAX_FILES];
@@ -100,6 +112,7 @@ static AVInputFormat *file_iformat;
 static AVOutputFormat *file_oformat;
 static int frame_width  = 0;
 static int frame_height = 0;
+static int frame_size_given = 0; /* -s was given after the last input file */
 static float frame_aspect_ratio = 0;
 static enum PixelFormat frame_pix_fmt = PIX_FMT_NONE;
 static int frame_padtop  = 0;
@@ -166,11 +179,13 @@ static char *str_comment = NULL;
 static char *str_genre = NULL;
 static char *str_album = NULL;
 static int do_benchmark = 0;
+static char *trace_filename = NULL;
 static int do_hex_dump = 0;
 static int do_pkt_dump = 0;
 static int do_psnr = 0;
 static int do_pass = 0;
 static char *pass_logfilename = NULL;
+static char *probe_cache_filename = NULL;
 static int audio_stream_copy = 0;
 static int video_stream_copy = 0;
 static int subtitle_stream_copy = 0;
@@ -193,14 +208,27 @@ static int audio_volume = 256;
 
 static int using_stdin = 0;
 static int using_vhook = 0;
+#ifdef CONFIG_AVFILTER
+static char *vfilters = NULL;
+#endif
 static int verbose = 1;
 static int thread_count= 1;
+static int threaded_transcode = 0;
 static int q_pressed = 0;
 static int64_t video_size = 0;
 static int64_t audio_size = 0;
 static int64_t extra_size = 0;
 static int nb_frames_dup = 0;
 static int nb_frames_drop = 0;
+#ifdef HAVE_PTHREADS
+/* the counters above are updated by all output threads */
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_STATS()   pthread_mutex_lock(&stats_mutex)
+#define UNLOCK_STATS() pthread_mutex_unlock(&stats_mutex)
+#else
+#define LOCK_STATS()
+#define UNLOCK_STATS()
+#endif
 static int input_sync;
 static uint64_t limit_filesize = 0; //
 
@@ -219,7 +247,8 @@ static int64_t timer_start;
 static AVBitStreamFilterContext *video_bitstream_filters=NULL;
 static AVBitStreamFilterContext *audio_bitstream_filters=NULL;
 static AVBitStreamFilterContext *subtitle_bitstream_filters=NULL;
-static AVBitStreamFilterContext *bitstream_filters[MAX_FILES][MAX_STREAMS];
+static AVBitStreamFilterContext **bitstream_filters[MAX_FILES];
+static int nb_bitstream_filters[MAX_FILES];
 
 #define DEFAULT_PASS_LOGFILENAME "ffmpeg2pass"
 
@@ -240,6 +269,10 @@ typedef struct AVOutputStream {
     /* video only */
     int video_resample;
     AVFrame pict_tmp;      /* temporary image for resampling */
+    struct AVOutputStream *format_source; /* stream converting the pictures of all
+                                             streams with the same source and format,
+                                             NULL if not shared */
+    AVFrame *formatted_picture; /* picture converted for the current frame, if format_source */
     struct SwsContext *img_resample_ctx; /* for image resampling */
     int resample_height;
 
@@ -264,6 +297,9 @@ typedef struct AVInputStream {
     int file_index;
     int index;
     AVStream *st;
+    AVCodecContext *dec;     /* context of the decoder, a copy of st->codec
+                                when a demuxing thread may read the file */
+    AVCodecParserContext *parser; /* for av_parser_change() when copying */
     int discard;             /* true if stream data should be discarded */
     int decoding_needed;     /* true if the packets must be decoded in 'raw_fifo' */
     int64_t sample_index;      /* current sample */
@@ -274,6 +310,14 @@ typedef struct AVInputStream {
                                 is not defined */
     int64_t       pts;       /* current pts */
     int is_start;            /* is 1 at the start and after a discontinuity */
+    int got_packet;          /* true once a packet was given to the decoder */
+    AVArena *frame_arena;    /* temporaries of the processing of a packet */
+#ifdef CONFIG_AVFILTER
+    AVFilterGraph *filter_graph;
+    AVFilterContext *input_video_filter;  /* source fed with the decoded pictures */
+    AVFilterContext *output_video_filter; /* sink holding the filtered pictures */
+    AVFilterPicRef *picref;  /* filtered picture held by the sink */
+#endif
 } AVInputStream;
 
 typedef struct AVInputFile {
@@ -281,8 +325,49 @@ typedef struct AVInputFile {
     int ist_index;        /* index of first stream in ist_table */
     int buffer_size;      /* current total buffer size */
     int nb_streams;       /* nb streams we are aware of */
+#ifdef HAVE_PTHREADS
+    /* demuxing thread, reading ahead into a bounded packet queue */
+    int file_index;
+    int thread_started;
+    pthread_t thread;
+    AVSPSCFifo *queue;    /* packets read ahead */
+    int read_ret;         /* av_read_frame() error which ended the thread, 0 while reading */
+    int nb_warmup_streams; /* decoded streams yet to get a packet before the thread starts */
+    int nb_warmup_packets; /* packets read by the main thread, -1 once the thread was started */
+#endif
 } AVInputFile;
 
+/* packets queued by each demuxing thread */
+#define INPUT_QUEUE_SIZE 128
+
+/* a decoded frame, or a packet for stream copy, to send to the outputs */
+typedef struct OutputFrame {
+    struct AVInputStream *ist;
+    int ist_index;
+    AVOutputStream **ost_table;
+    int nb_ostreams;
+    const AVPacket *pkt;
+    uint8_t *data_buf;
+    int data_size;
+    AVFrame *picture;
+    AVSubtitle *subtitle;
+} OutputFrame;
+
+#ifdef HAVE_PTHREADS
+/* encoding and muxing thread of one output file */
+typedef struct OutputThread {
+    int file_index;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    const OutputFrame *frame; /* frame being output, NULL when idle */
+    int quit;
+} OutputThread;
+
+static OutputThread output_threads[MAX_FILES];
+static int nb_output_threads = 0;
+#endif
+
 #ifdef HAVE_TERMIOS_H
 
 /* init terminal so that we can grab keys */
@@ -387,13 +472,16 @@ static int av_exit(int ret)
             av_free(s->streams[j]->codec);
             av_free(s->streams[j]);
         }
+        av_free(s->streams);
         av_free(s);
+        av_freep(&bitstream_filters[i]);
     }
     for(i=0;i<nb_input_files;i++)
         av_close_input_file(input_files[i]);
 
     av_free(intra_matrix);
     av_free(inter_matrix);
+    av_freep(&stream_maps);
 
     if (vstats_file)
         fclose(vstats_file);
@@ -407,6 +495,18 @@ static int av_exit(int ret)
 
     av_free(video_standard);
 
+    if (trace_filename) {
+        AVTraceStat stats[32];
+        int nb_stats;
+
+        av_trace_stop();
+        nb_stats = av_trace_get_stats(stats, sizeof(stats) / sizeof(stats[0]), 0);
+        for(i=0;i<nb_stats;i++)
+            fprintf(stderr, "trace: %-12s %8"PRId64" calls %10.3fs total %8.3fms max\n",
+                    stats[i].name, stats[i].count,
+                    stats[i].total / 1000000000.0, stats[i].max / 1000000.0);
+    }
+
 #ifdef CONFIG_POWERPC_PERF
     extern void powerpc_display_perf_report(void);
     powerpc_display_perf_report();
@@ -423,6 +523,25 @@ static int av_exit(int ret)
     return ret;
 }
 
+static void set_bitstream_filters(int file_index, int stream_index,
+                                  AVBitStreamFilterContext *bsfc)
+{
+    AVBitStreamFilterContext **tab = bitstream_filters[file_index];
+    int nb = nb_bitstream_filters[file_index];
+
+    if (stream_index >= nb) {
+        tab = av_realloc(tab, (stream_index + 1) * sizeof(*tab));
+        if (!tab) {
+            fprintf(stderr, "Could not alloc bitstream filter table\n");
+            av_exit(1);
+        }
+        memset(tab + nb, 0, (stream_index + 1 - nb) * sizeof(*tab));
+        bitstream_filters[file_index]    = tab;
+        nb_bitstream_filters[file_index] = stream_index + 1;
+    }
+    tab[stream_index] = bsfc;
+}
+
 static int read_ffserver_streams(AVFormatContext *s, const char *filename)
 {
     int i, err;
@@ -432,6 +551,11 @@ static int read_ffserver_streams(AVFormatContext *s, const char *filename)
     if (err < 0)
         return err;
     /* copy stream format */
+    s->streams = av_mallocz(ic->nb_streams * sizeof(*s->streams));
+    if (!s->streams) {
+        av_close_input_file(ic);
+        return AVERROR(ENOMEM);
+    }
     s->nb_streams = ic->nb_streams;
     for(i=0;i<ic->nb_streams;i++) {
         AVStream *st;
@@ -442,7 +566,10 @@ static int read_ffserver_streams(AVFormatContext *s, const char *filename)
         st->codec = avcodec_alloc_context();
         memcpy(st->codec, ic->streams[i]->codec, sizeof(AVCodecContext));
         s->streams[i] = st;
+        set_bitstream_filters(nb_output_files, i, NULL);
     }
+    /* send pages of the size ffserver stores the feed with */
+    s->packet_size = ic->packet_size;
 
     av_close_input_file(ic);
     return 0;
@@ -467,6 +594,7 @@ static void write_frame(AVFormatContext *s, AVPacket *pkt, AVCodecContext *avctx
         if(a>0){
             av_free_packet(pkt);
             new_pkt.destruct= av_destruct_packet;
+            new_pkt.priv= NULL;
         } else if(a<0){
             fprintf(stderr, "%s failed for stream %d, codec %s",
                     bsfc->filter->name, pkt->stream_index,
@@ -493,19 +621,23 @@ static void do_audio_out(AVFormatContext *s,
                          unsigned char *buf, int size)
 {
     uint8_t *buftmp;
-    static uint8_t *audio_buf = NULL;
-    static uint8_t *audio_out = NULL;
+    /* one set of buffers per output file, as files can be encoded in parallel */
+    static uint8_t *audio_buf_tab[MAX_FILES];
+    static uint8_t *audio_out_tab[MAX_FILES];
+    uint8_t *audio_buf, *audio_out;
     const int audio_out_size= 4*MAX_AUDIO_PACKET_SIZE;
 
     int size_out, frame_bytes, ret;
     AVCodecContext *enc= ost->st->codec;
-    AVCodecContext *dec= ist->st->codec;
+    AVCodecContext *dec= ist->dec;
 
     /* SC: dynamic allocation of buffers */
-    if (!audio_buf)
-        audio_buf = av_malloc(2*MAX_AUDIO_PACKET_SIZE);
-    if (!audio_out)
-        audio_out = av_malloc(audio_out_size);
+    if (!audio_buf_tab[ost->file_index])
+        audio_buf_tab[ost->file_index] = av_malloc(2*MAX_AUDIO_PACKET_SIZE);
+    if (!audio_out_tab[ost->file_index])
+        audio_out_tab[ost->file_index] = av_malloc(audio_out_size);
+    audio_buf = audio_buf_tab[ost->file_index];
+    audio_out = audio_out_tab[ost->file_index];
     if (!audio_buf || !audio_out)
         return;               /* Should signal an error ! */
 
@@ -526,8 +658,8 @@ static void do_audio_out(AVFormatContext *s,
     if(audio_sync_method){
         double delta = get_sync_ipts(ost) * enc->sample_rate - ost->sync_opts
                 - av_fifo_size(&ost->fifo)/(ost->st->codec->channels * 2);
-        double idelta= delta*ist->st->codec->sample_rate / enc->sample_rate;
-        int byte_delta= ((int)idelta)*2*ist->st->codec->channels;
+        double idelta= delta*ist->dec->sample_rate / enc->sample_rate;
+        int byte_delta= ((int)idelta)*2*ist->dec->channels;
 
         //FIXME resample delay
         if(fabs(delta) > 50){
@@ -574,7 +706,7 @@ static void do_audio_out(AVFormatContext *s,
         buftmp = audio_buf;
         size_out = audio_resample(ost->resample,
                                   (short *)buftmp, (short *)buf,
-                                  size / (ist->st->codec->channels * 2));
+                                  size / (ist->dec->channels * 2));
         size_out = size_out * enc->channels * 2;
     } else {
         buftmp = buf;
@@ -599,7 +731,9 @@ static void do_audio_out(AVFormatContext *s,
 
             ret = avcodec_encode_audio(enc, audio_out, audio_out_size,
                                        (short *)audio_buf);
+            LOCK_STATS();
             audio_size += ret;
+            UNLOCK_STATS();
             pkt.stream_index= ost->index;
             pkt.data= audio_out;
             pkt.size= ret;
@@ -644,7 +778,9 @@ static void do_audio_out(AVFormatContext *s,
         //FIXME pass ost->sync_opts as AVFrame.pts in avcodec_encode_audio()
         ret = avcodec_encode_audio(enc, audio_out, size_out,
                                    (short *)buftmp);
+        LOCK_STATS();
         audio_size += ret;
+        UNLOCK_STATS();
         pkt.stream_index= ost->index;
         pkt.data= audio_out;
         pkt.size= ret;
@@ -655,14 +791,14 @@ static void do_audio_out(AVFormatContext *s,
     }
 }
 
-static void pre_process_video_frame(AVInputStream *ist, AVPicture *picture, void **bufp)
+static void pre_process_video_frame(AVInputStream *ist, AVPicture *picture)
 {
     AVCodecContext *dec;
     AVPicture *picture2;
     AVPicture picture_tmp;
     uint8_t *buf = 0;
 
-    dec = ist->st->codec;
+    dec = ist->dec;
 
     /* deinterlace : must be done before any resize */
     if (do_deinterlace || using_vhook) {
@@ -670,7 +806,7 @@ static void pre_process_video_frame(AVInputStream *ist, AVPicture *picture, void
 
         /* create temporary picture */
         size = avpicture_get_size(dec->pix_fmt, dec->width, dec->height);
-        buf = av_malloc(size);
+        buf = av_arena_malloc(ist->frame_arena, size);
         if (!buf)
             return;
 
@@ -681,8 +817,6 @@ static void pre_process_video_frame(AVInputStream *ist, AVPicture *picture, void
             if(avpicture_deinterlace(picture2, picture,
                                      dec->pix_fmt, dec->width, dec->height) < 0) {
                 /* if error, do not deinterlace */
-                av_free(buf);
-                buf = NULL;
                 picture2 = picture;
             }
         } else {
@@ -698,7 +832,6 @@ static void pre_process_video_frame(AVInputStream *ist, AVPicture *picture, void
 
     if (picture != picture2)
         *picture = *picture2;
-    *bufp = buf;
 }
 
 /* we begin to correct av delay at this threshold */
@@ -710,7 +843,8 @@ static void do_subtitle_out(AVFormatContext *s,
                             AVSubtitle *sub,
                             int64_t pts)
 {
-    static uint8_t *subtitle_out = NULL;
+    static uint8_t *subtitle_out_tab[MAX_FILES];
+    uint8_t *subtitle_out;
     int subtitle_out_max_size = 65536;
     int subtitle_out_size, nb, i;
     AVCodecContext *enc;
@@ -723,9 +857,10 @@ static void do_subtitle_out(AVFormatContext *s,
 
     enc = ost->st->codec;
 
-    if (!subtitle_out) {
-        subtitle_out = av_malloc(subtitle_out_max_size);
+    if (!subtitle_out_tab[ost->file_index]) {
+        subtitle_out_tab[ost->file_index] = av_malloc(subtitle_out_max_size);
     }
+    subtitle_out = subtitle_out_tab[ost->file_index];
 
     /* Note: DVB subtitle need one packet to draw them and one other
        packet to clear them */
@@ -757,7 +892,67 @@ static void do_subtitle_out(AVFormatContext *s,
 }
 
 static int bit_buffer_size= 1024*256;
-static uint8_t *bit_buffer= NULL;
+static uint8_t *bit_buffer[MAX_FILES]; /* one per output file */
+
+/* crop, resample and pad a decoded picture for an output stream, returns
+   the picture to encode or NULL on error */
+static AVFrame *format_video_frame(AVOutputStream *ost,
+                                   AVInputStream *ist,
+                                   AVFrame *in_picture,
+                                   AVFrame *picture_crop_temp,
+                                   AVFrame *picture_pad_temp)
+{
+    AVFrame *final_picture, *formatted_picture, *resampling_dst, *padding_src;
+    AVCodecContext *enc, *dec;
+    int pix_fmt;
+
+    enc = ost->st->codec;
+    dec = ist->dec;
+    pix_fmt = dec->pix_fmt;
+#ifdef CONFIG_AVFILTER
+    if (ist->output_video_filter)
+        pix_fmt = ist->output_video_filter->inputs[0]->format;
+#endif
+
+    if (ost->video_crop) {
+        if (av_picture_crop((AVPicture *)picture_crop_temp, (AVPicture *)in_picture, pix_fmt, ost->topBand, ost->leftBand) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "error cropping picture\n");
+            return NULL;
+        }
+        formatted_picture = picture_crop_temp;
+    } else {
+        formatted_picture = in_picture;
+    }
+
+    final_picture = formatted_picture;
+    padding_src = formatted_picture;
+    resampling_dst = &ost->pict_tmp;
+    if (ost->video_pad) {
+        final_picture = &ost->pict_tmp;
+        if (ost->video_resample) {
+            if (av_picture_crop((AVPicture *)picture_pad_temp, (AVPicture *)final_picture, enc->pix_fmt, ost->padtop, ost->padleft) < 0) {
+                av_log(NULL, AV_LOG_ERROR, "error padding picture\n");
+                return NULL;
+            }
+            resampling_dst = picture_pad_temp;
+        }
+    }
+
+    if (ost->video_resample) {
+        padding_src = NULL;
+        final_picture = &ost->pict_tmp;
+        sws_scale(ost->img_resample_ctx, formatted_picture->data, formatted_picture->linesize,
+              0, ost->resample_height, resampling_dst->data, resampling_dst->linesize);
+    }
+
+    if (ost->video_pad) {
+        av_picture_pad((AVPicture*)final_picture, (AVPicture *)padding_src,
+                enc->height, enc->width, enc->pix_fmt,
+                ost->padtop, ost->padbottom, ost->padleft, ost->padright, padcolor);
+    }
+
+    return final_picture;
+}
 
 static void do_video_out(AVFormatContext *s,
                          AVOutputStream *ost,
@@ -766,7 +961,7 @@ static void do_video_out(AVFormatContext *s,
                          int *frame_size)
 {
     int nb_frames, i, ret;
-    AVFrame *final_picture, *formatted_picture, *resampling_dst, *padding_src;
+    AVFrame *final_picture;
     AVFrame picture_crop_temp, picture_pad_temp;
     AVCodecContext *enc, *dec;
 
@@ -774,7 +969,7 @@ static void do_video_out(AVFormatContext *s,
     avcodec_get_frame_defaults(&picture_pad_temp);
 
     enc = ost->st->codec;
-    dec = ist->st->codec;
+    dec = ist->dec;
 
     /* by default, we output a single frame */
     nb_frames = 1;
@@ -793,11 +988,15 @@ static void do_video_out(AVFormatContext *s,
             nb_frames = lrintf(vdelta);
 //fprintf(stderr, "vdelta:%f, ost->sync_opts:%"PRId64", ost->sync_ipts:%f nb_frames:%d\n", vdelta, ost->sync_opts, ost->sync_ipts, nb_frames);
         if (nb_frames == 0){
+            LOCK_STATS();
             ++nb_frames_drop;
+            UNLOCK_STATS();
             if (verbose>2)
                 fprintf(stderr, "*** drop!\n");
         }else if (nb_frames > 1) {
+            LOCK_STATS();
             nb_frames_dup += nb_frames;
+            UNLOCK_STATS();
             if (verbose>2)
                 fprintf(stderr, "*** %d dup!\n", nb_frames-1);
         }
@@ -808,42 +1007,13 @@ static void do_video_out(AVFormatContext *s,
     if (nb_frames <= 0)
         return;
 
-    if (ost->video_crop) {
-        if (av_picture_crop((AVPicture *)&picture_crop_temp, (AVPicture *)in_picture, dec->pix_fmt, ost->topBand, ost->leftBand) < 0) {
-            av_log(NULL, AV_LOG_ERROR, "error cropping picture\n");
-            return;
-        }
-        formatted_picture = &picture_crop_temp;
-    } else {
-        formatted_picture = in_picture;
-    }
-
-    final_picture = formatted_picture;
-    padding_src = formatted_picture;
-    resampling_dst = &ost->pict_tmp;
-    if (ost->video_pad) {
-        final_picture = &ost->pict_tmp;
-        if (ost->video_resample) {
-            if (av_picture_crop((AVPicture *)&picture_pad_temp, (AVPicture *)final_picture, enc->pix_fmt, ost->padtop, ost->padleft) < 0) {
-                av_log(NULL, AV_LOG_ERROR, "error padding picture\n");
-                return;
-            }
-            resampling_dst = &picture_pad_temp;
-        }
-    }
-
-    if (ost->video_resample) {
-        padding_src = NULL;
-        final_picture = &ost->pict_tmp;
-        sws_scale(ost->img_resample_ctx, formatted_picture->data, formatted_picture->linesize,
-              0, ost->resample_height, resampling_dst->data, resampling_dst->linesize);
-    }
-
-    if (ost->video_pad) {
-        av_picture_pad((AVPicture*)final_picture, (AVPicture *)padding_src,
-                enc->height, enc->width, enc->pix_fmt,
-                ost->padtop, ost->padbottom, ost->padleft, ost->padright, padcolor);
-    }
+    if (ost->format_source)
+        final_picture = ost->format_source->formatted_picture;
+    else
+        final_picture = format_video_frame(ost, ist, in_picture,
+                                           &picture_crop_temp, &picture_pad_temp);
+    if (!final_picture)
+        return;
 
     /* duplicates frame if needed */
     for(i=0;i<nb_frames;i++) {
@@ -891,7 +1061,7 @@ static void do_video_out(AVFormatContext *s,
 //            big_picture.pts= av_rescale(ost->sync_opts, AV_TIME_BASE*(int64_t)enc->time_base.num, enc->time_base.den);
 //av_log(NULL, AV_LOG_DEBUG, "%"PRId64" -> encoder\n", ost->sync_opts);
             ret = avcodec_encode_video(enc,
-                                       bit_buffer, bit_buffer_size,
+                                       bit_buffer[ost->file_index], bit_buffer_size,
                                        &big_picture);
             if (ret == -1) {
                 fprintf(stderr, "Video encoding failed\n");
@@ -899,7 +1069,7 @@ static void do_video_out(AVFormatContext *s,
             }
             //enc->frame_number = enc->real_pict_num;
             if(ret>0){
-                pkt.data= bit_buffer;
+                pkt.data= bit_buffer[ost->file_index];
                 pkt.size= ret;
                 if(enc->coded_frame->pts != AV_NOPTS_VALUE)
                     pkt.pts= av_rescale_q(enc->coded_frame->pts, enc->time_base, ost->st->time_base);
@@ -1090,6 +1260,453 @@ static void print_report(AVFormatContext **output_files,
     }
 }
 
+/* encode and write a decoded frame, or copy a packet, to the streams of
+   one output file */
+static void output_frame(int file_index, const OutputFrame *f)
+{
+    AVInputStream *ist = f->ist;
+    const AVPacket *pkt = f->pkt;
+    AVFormatContext *os;
+    AVOutputStream *ost;
+    int i;
+
+    for(i=0;i<f->nb_ostreams;i++) {
+        int frame_size;
+
+        ost = f->ost_table[i];
+        if (ost->file_index == file_index && ost->source_index == f->ist_index) {
+            os = output_files[ost->file_index];
+
+#if 0
+            printf("%d: got pts=%0.3f %0.3f\n", i,
+                   (double)pkt->pts / AV_TIME_BASE,
+                   ((double)ist->pts / AV_TIME_BASE) -
+                   ((double)ost->st->pts.val * ost->st->time_base.num / ost->st->time_base.den));
+#endif
+            /* set the input output pts pairs */
+            //ost->sync_ipts = (double)(ist->pts + input_files_ts_offset[ist->file_index] - start_time)/ AV_TIME_BASE;
+
+            if (ost->encoding_needed) {
+                switch(ost->st->codec->codec_type) {
+                case CODEC_TYPE_AUDIO:
+                    do_audio_out(os, ost, ist, f->data_buf, f->data_size);
+                    break;
+                case CODEC_TYPE_VIDEO:
+                    do_video_out(os, ost, ist, f->picture, &frame_size);
+                    LOCK_STATS();
+                    video_size += frame_size;
+                    if (vstats_filename && frame_size)
+                        do_video_stats(os, ost, frame_size);
+                    UNLOCK_STATS();
+                    break;
+                case CODEC_TYPE_SUBTITLE:
+                    do_subtitle_out(os, ost, ist, f->subtitle,
+                                    pkt->pts);
+                    break;
+                default:
+                    abort();
+                }
+            } else {
+                AVFrame avframe; //FIXME/XXX remove this
+                AVPacket opkt;
+                av_init_packet(&opkt);
+
+                if (!ost->frame_number && !(pkt->flags & PKT_FLAG_KEY))
+                    continue;
+
+                /* no reencoding needed : output the packet directly */
+                /* force the input stream PTS */
+
+                avcodec_get_frame_defaults(&avframe);
+                ost->st->codec->coded_frame= &avframe;
+                avframe.key_frame = pkt->flags & PKT_FLAG_KEY;
+
+                LOCK_STATS();
+                if(ost->st->codec->codec_type == CODEC_TYPE_AUDIO)
+                    audio_size += f->data_size;
+                else if (ost->st->codec->codec_type == CODEC_TYPE_VIDEO) {
+                    video_size += f->data_size;
+                    ost->sync_opts++;
+                }
+                UNLOCK_STATS();
+
+                opkt.stream_index= ost->index;
+                if(pkt->pts != AV_NOPTS_VALUE)
+                    opkt.pts= av_rescale_q(pkt->pts, ist->st->time_base, ost->st->time_base);
+                else
+                    opkt.pts= AV_NOPTS_VALUE;
+
+                    if (pkt->dts == AV_NOPTS_VALUE)
+                        opkt.dts = av_rescale_q(ist->next_pts, AV_TIME_BASE_Q, ost->st->time_base);
+                    else
+                        opkt.dts = av_rescale_q(pkt->dts, ist->st->time_base, ost->st->time_base);
+
+                opkt.duration = av_rescale_q(pkt->duration, ist->st->time_base, ost->st->time_base);
+                opkt.flags= pkt->flags;
+
+                //FIXME remove the following 2 lines they shall be replaced by the bitstream filters
+                if(av_parser_change(ist->parser, ost->st->codec, &opkt.data, &opkt.size, f->data_buf, f->data_size, pkt->flags & PKT_FLAG_KEY))
+                    opkt.destruct= av_destruct_packet;
+                else if(opkt.data == pkt->data && (pkt->destruct == av_destruct_packet ||
+                                                   pkt->destruct == av_destruct_packet_nofree))
+                    opkt.priv= pkt->priv; /* let the muxer share the input buffer */
+
+                write_frame(os, &opkt, ost->st->codec, bitstream_filters[ost->file_index][opkt.stream_index]);
+                ost->st->codec->frame_number++;
+                ost->frame_number++;
+                av_free_packet(&opkt);
+            }
+        }
+    }
+}
+
+#ifdef HAVE_PTHREADS
+static void *output_thread(void *arg)
+{
+    OutputThread *t = arg;
+
+    pthread_mutex_lock(&t->mutex);
+    for(;;) {
+        while (!t->frame && !t->quit)
+            pthread_cond_wait(&t->cond, &t->mutex);
+        if (t->quit)
+            break;
+        pthread_mutex_unlock(&t->mutex);
+        output_frame(t->file_index, t->frame);
+        pthread_mutex_lock(&t->mutex);
+        t->frame = NULL;
+        pthread_cond_broadcast(&t->cond);
+    }
+    pthread_mutex_unlock(&t->mutex);
+    return NULL;
+}
+
+/* output files 1 to nb_output_threads get their own encoding thread, the
+   first one is handled by the main thread */
+static void start_output_threads(void)
+{
+    int i;
+
+    if (!threaded_transcode)
+        return;
+    for(i=1;i<nb_output_files;i++) {
+        OutputThread *t = &output_threads[i];
+        t->file_index = i;
+        t->frame = NULL;
+        t->quit = 0;
+        pthread_mutex_init(&t->mutex, NULL);
+        pthread_cond_init(&t->cond, NULL);
+        if (pthread_create(&t->thread, NULL, output_thread, t)) {
+            fprintf(stderr, "Could not create the thread for output file #%d, encoding it in the main thread\n", i);
+            pthread_mutex_destroy(&t->mutex);
+            pthread_cond_destroy(&t->cond);
+            break;
+        }
+        nb_output_threads = i;
+    }
+}
+
+static void stop_output_threads(void)
+{
+    int i;
+
+    for(i=1;i<=nb_output_threads;i++) {
+        OutputThread *t = &output_threads[i];
+        pthread_mutex_lock(&t->mutex);
+        t->quit = 1;
+        pthread_cond_signal(&t->cond);
+        pthread_mutex_unlock(&t->mutex);
+        pthread_join(t->thread, NULL);
+        pthread_mutex_destroy(&t->mutex);
+        pthread_cond_destroy(&t->cond);
+    }
+    nb_output_threads = 0;
+}
+#endif
+
+/* convert the decoded picture once for each group of output streams
+   sharing the same conversion, before they are encoded in parallel */
+static void format_shared_pictures(const OutputFrame *f)
+{
+    AVFrame picture_crop_temp, picture_pad_temp;
+    int i;
+
+    for(i=0;i<f->nb_ostreams;i++) {
+        AVOutputStream *ost = f->ost_table[i];
+        if (ost->format_source == ost && ost->source_index == f->ist_index) {
+            avcodec_get_frame_defaults(&picture_crop_temp);
+            avcodec_get_frame_defaults(&picture_pad_temp);
+            ost->formatted_picture = format_video_frame(ost, f->ist, f->picture,
+                                                        &picture_crop_temp,
+                                                        &picture_pad_temp);
+        }
+    }
+}
+
+/* send a frame to all output files and return once all of them are done
+   with it, so the caller may reuse the decoder buffers */
+static void output_frame_all(const OutputFrame *f)
+{
+    int i;
+#ifdef HAVE_PTHREADS
+    int used[MAX_FILES] = {0};
+#endif
+
+    if (f->ist->dec->codec_type == CODEC_TYPE_VIDEO)
+        format_shared_pictures(f);
+#ifdef HAVE_PTHREADS
+    /* do_audio_out() clears is_start, which the following output files
+       must see in serial order */
+    if (nb_output_threads &&
+        !(f->ist->is_start && f->ist->dec->codec_type == CODEC_TYPE_AUDIO)) {
+        for(i=0;i<f->nb_ostreams;i++)
+            if (f->ost_table[i]->source_index == f->ist_index)
+                used[f->ost_table[i]->file_index] = 1;
+
+        for(i=1;i<=nb_output_threads;i++) {
+            if (used[i]) {
+                pthread_mutex_lock(&output_threads[i].mutex);
+                output_threads[i].frame = f;
+                pthread_cond_signal(&output_threads[i].cond);
+                pthread_mutex_unlock(&output_threads[i].mutex);
+            }
+        }
+        for(i=0;i<nb_output_files;i++)
+            if (used[i] && (i == 0 || i > nb_output_threads))
+                output_frame(i, f);
+        for(i=1;i<=nb_output_threads;i++) {
+            if (used[i]) {
+                pthread_mutex_lock(&output_threads[i].mutex);
+                while (output_threads[i].frame)
+                    pthread_cond_wait(&output_threads[i].cond, &output_threads[i].mutex);
+                pthread_mutex_unlock(&output_threads[i].mutex);
+            }
+        }
+        return;
+    }
+#endif
+    for(i=0;i<nb_output_files;i++)
+        output_frame(i, f);
+}
+
+#ifdef CONFIG_AVFILTER
+/* source of the filters of an input stream, sends on the picture just
+   decoded and returns AVERROR(EAGAIN) until there is another one */
+typedef struct {
+    AVInputStream *ist;
+    AVFrame *frame;          /* decoded picture not yet sent, or NULL */
+    int eof;                 /* set once the decoder is flushed */
+} FilterInputContext;
+
+static int input_init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    FilterInputContext *priv = ctx->priv;
+
+    if (!opaque)
+        return -1;
+    priv->ist = opaque;
+    return 0;
+}
+
+static int input_query_formats(AVFilterContext *ctx)
+{
+    FilterInputContext *priv = ctx->priv;
+
+    avfilter_set_common_formats(ctx,
+        avfilter_make_format_list(1, priv->ist->dec->pix_fmt));
+    return 0;
+}
+
+static int input_config_props(AVFilterLink *link)
+{
+    FilterInputContext *priv = link->src->priv;
+    AVCodecContext *c = priv->ist->dec;
+
+    link->w = c->width;
+    link->h = c->height;
+    return 0;
+}
+
+static int input_request_frame(AVFilterLink *link)
+{
+    FilterInputContext *priv = link->src->priv;
+    AVCodecContext *c = priv->ist->dec;
+    AVFilterPicRef *picref;
+
+    if (!priv->frame)
+        return priv->eof ? -1 : AVERROR(EAGAIN);
+
+    /* pictures the decoder rendered into a filter buffer are not copied */
+    picref = avfilter_codec_ref_frame(priv->frame, ~0);
+    if (!picref) {
+        AVPicture dst;
+
+        picref = avfilter_get_video_buffer(link, AV_PERM_WRITE);
+        if (!picref)
+            return AVERROR(ENOMEM);
+        memcpy(dst.data,     picref->data,     sizeof(dst.data));
+        memcpy(dst.linesize, picref->linesize, sizeof(dst.linesize));
+        av_picture_copy(&dst, (AVPicture *)priv->frame, c->pix_fmt,
+                        c->width, c->height);
+    }
+    picref->pts          = priv->ist->pts;
+    picref->pixel_aspect = c->sample_aspect_ratio;
+    priv->frame = NULL;
+
+    avfilter_start_frame(link, picref);
+    avfilter_draw_slice(link, 0, link->h);
+    avfilter_end_frame(link);
+
+    return 0;
+}
+
+static AVFilter input_filter =
+{
+    .name      = "ffmpeg_input",
+
+    .priv_size = sizeof(FilterInputContext),
+
+    .init      = input_init,
+
+    .query_formats = input_query_formats,
+
+    .inputs    = (AVFilterPad[]) {{ .name = NULL }},
+    .outputs   = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .request_frame   = input_request_frame,
+                                    .config_props    = input_config_props, },
+                                  { .name = NULL }},
+};
+
+/* sink of the filters of an input stream, holds the filtered picture in
+   ist->picref */
+static int output_init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    if (!opaque)
+        return -1;
+    *(AVInputStream **)ctx->priv = opaque;
+    return 0;
+}
+
+static int output_query_formats(AVFilterContext *ctx)
+{
+    /* the output streams convert to their own format anyway */
+    avfilter_set_common_formats(ctx, avfilter_all_colorspaces());
+    return 0;
+}
+
+static void output_end_frame(AVFilterLink *link)
+{
+    AVInputStream *ist = *(AVInputStream **)link->dst->priv;
+
+    if (ist->picref)
+        avfilter_unref_pic(ist->picref);
+    ist->picref = link->cur_pic;
+    link->cur_pic = NULL;
+}
+
+static AVFilter output_filter =
+{
+    .name      = "ffmpeg_output",
+
+    .priv_size = sizeof(AVInputStream *),
+
+    .init      = output_init,
+
+    .query_formats = output_query_formats,
+
+    .inputs    = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .end_frame       = output_end_frame,
+                                    .min_perms       = AV_PERM_READ, },
+                                  { .name = NULL }},
+    .outputs   = (AVFilterPad[]) {{ .name = NULL }},
+};
+
+static int configure_filters(AVInputStream *ist)
+{
+    AVCodecContext *codec = ist->dec;
+    AVFilterInOut *outputs, *inputs;
+    AVFilterGraph *graph;
+    AVCodec *dec;
+
+    ist->filter_graph = graph = av_mallocz(sizeof(AVFilterGraph));
+
+    ist->input_video_filter  = avfilter_open(&input_filter,  "src");
+    ist->output_video_filter = avfilter_open(&output_filter, "out");
+    if (!ist->input_video_filter || !ist->output_video_filter ||
+        avfilter_init_filter(ist->input_video_filter,  NULL, ist) ||
+        avfilter_init_filter(ist->output_video_filter, NULL, ist))
+        return -1;
+    avfilter_graph_add_filter(graph, ist->input_video_filter);
+    avfilter_graph_add_filter(graph, ist->output_video_filter);
+
+    outputs = av_mallocz(sizeof(AVFilterInOut));
+    outputs->name    = av_strdup("in");
+    outputs->filter  = ist->input_video_filter;
+    outputs->pad_idx = 0;
+    inputs  = av_mallocz(sizeof(AVFilterInOut));
+    inputs->name     = av_strdup("out");
+    inputs->filter   = ist->output_video_filter;
+    inputs->pad_idx  = 0;
+
+    if (avfilter_parse_graph(graph, vfilters, inputs, outputs, NULL) < 0) {
+        /* the graph and its filters are gone */
+        ist->input_video_filter = ist->output_video_filter = NULL;
+        return -1;
+    }
+    if (avfilter_graph_config_formats(graph) ||
+        avfilter_config_links(ist->output_video_filter))
+        return -1;
+    avfilter_graph_thread_init(graph, thread_count);
+
+    /* let the decoder render straight into the pictures of the filters,
+       which have no edges; deinterlacing and vhooks need a copy anyway */
+    dec = avcodec_find_decoder(codec->codec_id);
+    if (dec && (dec->capabilities & CODEC_CAP_DR1) &&
+        !do_deinterlace && !using_vhook) {
+        codec->flags         |= CODEC_FLAG_EMU_EDGE;
+        codec->opaque         = ist->input_video_filter->outputs[0];
+        codec->get_buffer     = avfilter_codec_get_buffer;
+        codec->release_buffer = avfilter_codec_release_buffer;
+    }
+
+    return 0;
+}
+
+/* send the pictures coming out of the filters of an input stream to the
+   outputs, until the filters need another decoded picture */
+static void output_filtered_pictures(OutputFrame *f)
+{
+    AVInputStream *ist = f->ist;
+    FilterInputContext *in = ist->input_video_filter->priv;
+    AVFrame picture;
+
+    while (!avfilter_request_frame(ist->output_video_filter->inputs[0])) {
+        AVFilterPicRef *pic = ist->picref;
+
+        avcodec_get_frame_defaults(&picture);
+        memcpy(picture.data,     pic->data,     sizeof(picture.data));
+        memcpy(picture.linesize, pic->linesize, sizeof(picture.linesize));
+        if (f->picture) {
+            picture.interlaced_frame = f->picture->interlaced_frame;
+            picture.top_field_first  = f->picture->top_field_first;
+        }
+        ist->pts = pic->pts;
+
+        if (start_time == 0 || ist->pts >= start_time) {
+            OutputFrame filtered = *f;
+            filtered.picture = &picture;
+            output_frame_all(&filtered);
+        }
+        avfilter_unref_pic(pic);
+        ist->picref = NULL;
+    }
+    /* the decoded picture is only valid until the next one */
+    in->frame = NULL;
+}
+#endif
+
 /* pkt = NULL means EOF (needed to flush decoder buffers) */
 static int output_packet(AVInputStream *ist, int ist_index,
                          AVOutputStream **ost_table, int nb_ostreams,
@@ -1102,7 +1719,6 @@ static int output_packet(AVInputStream *ist, int ist_index,
     uint8_t *data_buf;
     int data_size, got_picture;
     AVFrame picture;
-    void *buffer_to_free;
     static unsigned int samples_size= 0;
     static short *samples= NULL;
     AVSubtitle subtitle, *subtitle_to_free;
@@ -1135,14 +1751,14 @@ static int output_packet(AVInputStream *ist, int ist_index,
         data_size = 0;
         subtitle_to_free = NULL;
         if (ist->decoding_needed) {
-            switch(ist->st->codec->codec_type) {
+            switch(ist->dec->codec_type) {
             case CODEC_TYPE_AUDIO:{
                 if(pkt)
                     samples= av_fast_realloc(samples, &samples_size, FFMAX(pkt->size*sizeof(*samples), AVCODEC_MAX_AUDIO_FRAME_SIZE));
                 data_size= samples_size;
                     /* XXX: could avoid copy if PCM 16 bits with same
                        endianness as CPU */
-                ret = avcodec_decode_audio2(ist->st->codec, samples, &data_size,
+                ret = avcodec_decode_audio2(ist->dec, samples, &data_size,
                                            ptr, len);
                 if (ret < 0)
                     goto fail_decode;
@@ -1156,14 +1772,14 @@ static int output_packet(AVInputStream *ist, int ist_index,
                 }
                 data_buf = (uint8_t *)samples;
                 ist->next_pts += ((int64_t)AV_TIME_BASE/2 * data_size) /
-                    (ist->st->codec->sample_rate * ist->st->codec->channels);
+                    (ist->dec->sample_rate * ist->dec->channels);
                 break;}
             case CODEC_TYPE_VIDEO:
-                    data_size = (ist->st->codec->width * ist->st->codec->height * 3) / 2;
+                    data_size = (ist->dec->width * ist->dec->height * 3) / 2;
                     /* XXX: allocate picture correctly */
                     avcodec_get_frame_defaults(&picture);
 
-                    ret = avcodec_decode_video(ist->st->codec,
+                    ret = avcodec_decode_video(ist->dec,
                                                &picture, &got_picture, ptr, len);
                     ist->st->quality= picture.quality;
                     if (ret < 0)
@@ -1172,15 +1788,15 @@ static int output_packet(AVInputStream *ist, int ist_index,
                         /* no picture yet */
                         goto discard_packet;
                     }
-                    if (ist->st->codec->time_base.num != 0) {
+                    if (ist->dec->time_base.num != 0) {
                         ist->next_pts += ((int64_t)AV_TIME_BASE *
-                                          ist->st->codec->time_base.num) /
-                            ist->st->codec->time_base.den;
+                                          ist->dec->time_base.num) /
+                            ist->dec->time_base.den;
                     }
                     len = 0;
                     break;
             case CODEC_TYPE_SUBTITLE:
-                ret = avcodec_decode_subtitle(ist->st->codec,
+                ret = avcodec_decode_subtitle(ist->dec,
                                               &subtitle, &got_subtitle, ptr, len);
                 if (ret < 0)
                     goto fail_decode;
@@ -1194,16 +1810,16 @@ static int output_packet(AVInputStream *ist, int ist_index,
                 goto fail_decode;
             }
         } else {
-            switch(ist->st->codec->codec_type) {
+            switch(ist->dec->codec_type) {
             case CODEC_TYPE_AUDIO:
-                ist->next_pts += ((int64_t)AV_TIME_BASE * ist->st->codec->frame_size) /
-                    ist->st->codec->sample_rate;
+                ist->next_pts += ((int64_t)AV_TIME_BASE * ist->dec->frame_size) /
+                    ist->dec->sample_rate;
                 break;
             case CODEC_TYPE_VIDEO:
-                if (ist->st->codec->time_base.num != 0) {
+                if (ist->dec->time_base.num != 0) {
                     ist->next_pts += ((int64_t)AV_TIME_BASE *
-                                      ist->st->codec->time_base.num) /
-                        ist->st->codec->time_base.den;
+                                      ist->dec->time_base.num) /
+                        ist->dec->time_base.den;
                 }
                 break;
             }
@@ -1213,14 +1829,16 @@ static int output_packet(AVInputStream *ist, int ist_index,
             len = 0;
         }
 
-        buffer_to_free = NULL;
-        if (ist->st->codec->codec_type == CODEC_TYPE_VIDEO) {
-            pre_process_video_frame(ist, (AVPicture *)&picture,
-                                    &buffer_to_free);
+        if (ist->dec->codec_type == CODEC_TYPE_VIDEO) {
+            pre_process_video_frame(ist, (AVPicture *)&picture);
+#ifdef CONFIG_AVFILTER
+            if (ist->input_video_filter)
+                ((FilterInputContext *)ist->input_video_filter->priv)->frame = &picture;
+#endif
         }
 
         // preprocess audio (volume)
-        if (ist->st->codec->codec_type == CODEC_TYPE_AUDIO) {
+        if (ist->dec->codec_type == CODEC_TYPE_AUDIO) {
             if (audio_volume != 256) {
                 short *volp;
                 volp = samples;
@@ -1234,8 +1852,8 @@ static int output_packet(AVInputStream *ist, int ist_index,
         }
 
         /* frame rate emulation */
-        if (ist->st->codec->rate_emu) {
-            int64_t pts = av_rescale((int64_t) ist->frame * ist->st->codec->time_base.num, 1000000, ist->st->codec->time_base.den);
+        if (ist->dec->rate_emu) {
+            int64_t pts = av_rescale((int64_t) ist->frame * ist->dec->time_base.num, 1000000, ist->dec->time_base.den);
             int64_t now = av_gettime() - ist->start;
             if (pts > now)
                 usleep(pts - now);
@@ -1247,8 +1865,8 @@ static int output_packet(AVInputStream *ist, int ist_index,
         /* mpeg PTS deordering : if it is a P or I frame, the PTS
            is the one of the next displayed one */
         /* XXX: add mpeg4 too ? */
-        if (ist->st->codec->codec_id == CODEC_ID_MPEG1VIDEO) {
-            if (ist->st->codec->pict_type != B_TYPE) {
+        if (ist->dec->codec_id == CODEC_ID_MPEG1VIDEO) {
+            if (ist->dec->pict_type != B_TYPE) {
                 int64_t tmp;
                 tmp = ist->last_ip_pts;
                 ist->last_ip_pts  = ist->frac_pts.val;
@@ -1258,89 +1876,27 @@ static int output_packet(AVInputStream *ist, int ist_index,
 #endif
         /* if output time reached then transcode raw format,
            encode packets and output them */
-        if (start_time == 0 || ist->pts >= start_time)
-            for(i=0;i<nb_ostreams;i++) {
-                int frame_size;
-
-                ost = ost_table[i];
-                if (ost->source_index == ist_index) {
-                    os = output_files[ost->file_index];
-
-#if 0
-                    printf("%d: got pts=%0.3f %0.3f\n", i,
-                           (double)pkt->pts / AV_TIME_BASE,
-                           ((double)ist->pts / AV_TIME_BASE) -
-                           ((double)ost->st->pts.val * ost->st->time_base.num / ost->st->time_base.den));
+        {
+            OutputFrame f;
+            f.ist         = ist;
+            f.ist_index   = ist_index;
+            f.ost_table   = ost_table;
+            f.nb_ostreams = nb_ostreams;
+            f.pkt         = pkt;
+            f.data_buf    = data_buf;
+            f.data_size   = data_size;
+            f.picture     = &picture;
+            f.subtitle    = &subtitle;
+#ifdef CONFIG_AVFILTER
+            if (ist->input_video_filter &&
+                ist->dec->codec_type == CODEC_TYPE_VIDEO)
+                output_filtered_pictures(&f);
+            else
 #endif
-                    /* set the input output pts pairs */
-                    //ost->sync_ipts = (double)(ist->pts + input_files_ts_offset[ist->file_index] - start_time)/ AV_TIME_BASE;
-
-                    if (ost->encoding_needed) {
-                        switch(ost->st->codec->codec_type) {
-                        case CODEC_TYPE_AUDIO:
-                            do_audio_out(os, ost, ist, data_buf, data_size);
-                            break;
-                        case CODEC_TYPE_VIDEO:
-                            do_video_out(os, ost, ist, &picture, &frame_size);
-                            video_size += frame_size;
-                            if (vstats_filename && frame_size)
-                                do_video_stats(os, ost, frame_size);
-                            break;
-                        case CODEC_TYPE_SUBTITLE:
-                            do_subtitle_out(os, ost, ist, &subtitle,
-                                            pkt->pts);
-                            break;
-                        default:
-                            abort();
-                        }
-                    } else {
-                        AVFrame avframe; //FIXME/XXX remove this
-                        AVPacket opkt;
-                        av_init_packet(&opkt);
-
-                        if (!ost->frame_number && !(pkt->flags & PKT_FLAG_KEY))
-                            continue;
-
-                        /* no reencoding needed : output the packet directly */
-                        /* force the input stream PTS */
-
-                        avcodec_get_frame_defaults(&avframe);
-                        ost->st->codec->coded_frame= &avframe;
-                        avframe.key_frame = pkt->flags & PKT_FLAG_KEY;
-
-                        if(ost->st->codec->codec_type == CODEC_TYPE_AUDIO)
-                            audio_size += data_size;
-                        else if (ost->st->codec->codec_type == CODEC_TYPE_VIDEO) {
-                            video_size += data_size;
-                            ost->sync_opts++;
-                        }
-
-                        opkt.stream_index= ost->index;
-                        if(pkt->pts != AV_NOPTS_VALUE)
-                            opkt.pts= av_rescale_q(pkt->pts, ist->st->time_base, ost->st->time_base);
-                        else
-                            opkt.pts= AV_NOPTS_VALUE;
-
-                            if (pkt->dts == AV_NOPTS_VALUE)
-                                opkt.dts = av_rescale_q(ist->next_pts, AV_TIME_BASE_Q, ost->st->time_base);
-                            else
-                                opkt.dts = av_rescale_q(pkt->dts, ist->st->time_base, ost->st->time_base);
-
-                        opkt.duration = av_rescale_q(pkt->duration, ist->st->time_base, ost->st->time_base);
-                        opkt.flags= pkt->flags;
-
-                        //FIXME remove the following 2 lines they shall be replaced by the bitstream filters
-                        if(av_parser_change(ist->st->parser, ost->st->codec, &opkt.data, &opkt.size, data_buf, data_size, pkt->flags & PKT_FLAG_KEY))
-                            opkt.destruct= av_destruct_packet;
-
-                        write_frame(os, &opkt, ost->st->codec, bitstream_filters[ost->file_index][opkt.stream_index]);
-                        ost->st->codec->frame_number++;
-                        ost->frame_number++;
-                        av_free_packet(&opkt);
-                    }
-                }
-            }
-        av_free(buffer_to_free);
+            if (start_time == 0 || ist->pts >= start_time)
+                output_frame_all(&f);
+        }
+        av_arena_reset(ist->frame_arena);
         /* XXX: allocate the subtitles in the codec ? */
         if (subtitle_to_free) {
             if (subtitle_to_free->rects != NULL) {
@@ -1357,6 +1913,19 @@ static int output_packet(AVInputStream *ist, int ist_index,
  discard_packet:
     if (pkt == NULL) {
         /* EOF handling */
+#ifdef CONFIG_AVFILTER
+        if (ist->input_video_filter) {
+            /* pictures held back by the filters */
+            OutputFrame f;
+            memset(&f, 0, sizeof(f));
+            f.ist         = ist;
+            f.ist_index   = ist_index;
+            f.ost_table   = ost_table;
+            f.nb_ostreams = nb_ostreams;
+            ((FilterInputContext *)ist->input_video_filter->priv)->eof = 1;
+            output_filtered_pictures(&f);
+        }
+#endif
 
         for(i=0;i<nb_ostreams;i++) {
             ost = ost_table[i];
@@ -1385,17 +1954,17 @@ static int output_packet(AVInputStream *ist, int ist_index,
                                 int fs_tmp = enc->frame_size;
                                 enc->frame_size = fifo_bytes / (2 * enc->channels);
                                 av_fifo_read(&ost->fifo, (uint8_t *)samples, fifo_bytes);
-                                    ret = avcodec_encode_audio(enc, bit_buffer, bit_buffer_size, samples);
+                                    ret = avcodec_encode_audio(enc, bit_buffer[ost->file_index], bit_buffer_size, samples);
                                 enc->frame_size = fs_tmp;
                             }
                             if(ret <= 0) {
-                                ret = avcodec_encode_audio(enc, bit_buffer, bit_buffer_size, NULL);
+                                ret = avcodec_encode_audio(enc, bit_buffer[ost->file_index], bit_buffer_size, NULL);
                             }
                             audio_size += ret;
                             pkt.flags |= PKT_FLAG_KEY;
                             break;
                         case CODEC_TYPE_VIDEO:
-                            ret = avcodec_encode_video(enc, bit_buffer, bit_buffer_size, NULL);
+                            ret = avcodec_encode_video(enc, bit_buffer[ost->file_index], bit_buffer_size, NULL);
                             video_size += ret;
                             if(enc->coded_frame && enc->coded_frame->key_frame)
                                 pkt.flags |= PKT_FLAG_KEY;
@@ -1409,7 +1978,7 @@ static int output_packet(AVInputStream *ist, int ist_index,
 
                         if(ret<=0)
                             break;
-                        pkt.data= bit_buffer;
+                        pkt.data= bit_buffer[ost->file_index];
                         pkt.size= ret;
                         if(enc->coded_frame && enc->coded_frame->pts != AV_NOPTS_VALUE)
                             pkt.pts= av_rescale_q(enc->coded_frame->pts, enc->time_base, ost->st->time_base);
@@ -1459,6 +2028,176 @@ static int stream_index_from_inputs(AVFormatContext **input_files,
     return -1;
 }
 
+#ifdef HAVE_PTHREADS
+static void *input_thread(void *arg)
+{
+    AVInputFile *f = arg;
+    AVFormatContext *is = input_files[f->file_index];
+    int ret;
+
+    for(;;) {
+        AVPacket pkt;
+
+        ret = av_read_frame(is, &pkt);
+        if (ret >= 0) {
+            /* the demuxer may reuse its buffers on the next read */
+            ret = av_dup_packet(&pkt);
+            if (ret < 0)
+                av_free_packet(&pkt);
+        }
+        if (ret < 0) {
+            /* seen by the reader once the queue is closed */
+            f->read_ret = ret;
+            break;
+        }
+        /* fails once stop_input_threads() closed the queue */
+        if (av_spsc_fifo_write(f->queue, &pkt, 1, AV_THREAD_FIFO_BLOCK) != 1) {
+            av_free_packet(&pkt);
+            break;
+        }
+    }
+    av_spsc_fifo_close(f->queue);
+    return NULL;
+}
+
+/* start a demuxing thread for an input file, so that reading and parsing
+   the input runs in parallel with decoding and encoding */
+static void start_input_thread(AVInputFile *f)
+{
+    f->nb_warmup_packets = -1;
+    f->read_ret = 0;
+    f->queue = av_spsc_fifo_alloc(INPUT_QUEUE_SIZE, sizeof(AVPacket));
+    if (!f->queue || pthread_create(&f->thread, NULL, input_thread, f)) {
+        fprintf(stderr, "Could not create the thread for input file #%d, reading it in the main thread\n", f->file_index);
+        av_spsc_fifo_free(&f->queue);
+        return;
+    }
+    f->thread_started = 1;
+}
+
+/* the demuxing thread of a file is started once the decoders of its
+   streams have seen their first packet, which is where they usually set
+   the fields av_read_frame() guesses the timestamps from; until then the
+   main thread reads the file itself */
+static void start_input_threads(AVInputFile *file_table, int nb_input_files,
+                                AVInputStream **ist_table)
+{
+    int i, j;
+
+    for(i=0;i<nb_input_files;i++) {
+        AVInputFile *f = &file_table[i];
+        f->file_index = i;
+        f->nb_warmup_packets = threaded_transcode ? 0 : -1;
+        f->nb_warmup_streams = 0;
+        for(j=0;j<f->nb_streams;j++)
+            if (ist_table[f->ist_index + j]->decoding_needed)
+                f->nb_warmup_streams++;
+        if (!f->nb_warmup_streams && threaded_transcode)
+            start_input_thread(f);
+    }
+}
+
+/* while the main thread still reads a file, makes the decoder and the
+   demuxer see each other's updates of the fields av_read_frame() uses,
+   as they would if they shared st->codec; the demuxing thread then keeps
+   the values they had when it was started */
+static void sync_demuxer_context(AVInputStream *ist, int from_decoder)
+{
+    AVCodecContext *src = from_decoder ? ist->dec : ist->st->codec;
+    AVCodecContext *dst = from_decoder ? ist->st->codec : ist->dec;
+
+    if (src == dst)
+        return;
+    dst->has_b_frames = src->has_b_frames;
+    dst->time_base    = src->time_base;
+    dst->sample_rate  = src->sample_rate;
+    dst->channels     = src->channels;
+    dst->frame_size   = src->frame_size;
+    dst->bit_rate     = src->bit_rate;
+}
+
+static void stop_input_threads(AVInputFile *file_table, int nb_input_files)
+{
+    int i;
+
+    for(i=0;i<nb_input_files;i++) {
+        AVInputFile *f = &file_table[i];
+        AVPacket pkt;
+
+        if (!f->thread_started)
+            continue;
+        av_spsc_fifo_close(f->queue);
+        pthread_join(f->thread, NULL);
+        while (av_spsc_fifo_read(f->queue, &pkt, 1, 0) > 0)
+            av_free_packet(&pkt);
+        av_spsc_fifo_free(&f->queue);
+        f->thread_started = 0;
+    }
+}
+
+/* copy of the codec context of an input stream for its decoder, as
+   av_read_frame() in the demuxing thread keeps reading st->codec */
+static AVCodecContext *alloc_decoder_context(AVStream *st)
+{
+    AVCodecContext *src = st->codec;
+    AVCodecContext *dec = avcodec_alloc_context();
+
+    if (!dec)
+        return NULL;
+    memcpy(dec, src, sizeof(*dec));
+    if (src->extradata) {
+        dec->extradata = av_mallocz(src->extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!dec->extradata) {
+            av_free(dec);
+            return NULL;
+        }
+        memcpy(dec->extradata, src->extradata, src->extradata_size);
+    }
+    /* the slice threads run on the context they were started for */
+    dec->thread_opaque = NULL;
+    dec->execute = avcodec_default_execute;
+    if (src->thread_opaque) {
+        avcodec_thread_free(src);
+        src->execute = avcodec_default_execute;
+        avcodec_thread_init(dec, dec->thread_count);
+    }
+    return dec;
+}
+#endif
+
+/* read the next packet of an input file, from its demuxing thread if
+   there is one */
+static int get_input_packet(AVInputFile *f, AVFormatContext *is, AVPacket *pkt)
+{
+#ifdef HAVE_PTHREADS
+    if (f->thread_started) {
+        if (av_spsc_fifo_read(f->queue, pkt, 1, AV_THREAD_FIFO_BLOCK) < 0)
+            return f->read_ret;
+        return 0;
+    }
+#endif
+    return av_read_frame(is, pkt);
+}
+
+/* true if both output streams crop, resample and pad the same way */
+static int same_video_format(const AVOutputStream *a, const AVOutputStream *b)
+{
+    const AVCodecContext *ca = a->st->codec, *cb = b->st->codec;
+
+    return ca->width   == cb->width  &&
+           ca->height  == cb->height &&
+           ca->pix_fmt == cb->pix_fmt &&
+           a->video_crop     == b->video_crop     &&
+           a->topBand        == b->topBand        &&
+           a->leftBand       == b->leftBand       &&
+           a->video_pad      == b->video_pad      &&
+           a->padtop         == b->padtop         &&
+           a->padbottom      == b->padbottom      &&
+           a->padleft        == b->padleft        &&
+           a->padright       == b->padright       &&
+           a->video_resample == b->video_resample;
+}
+
 /*
  * The following code is the main loop of the file converter
  */
@@ -1500,6 +2239,9 @@ static int av_encode(AVFormatContext **output_files,
         if (!ist)
             goto fail;
         ist_table[i] = ist;
+        ist->frame_arena = av_arena_alloc(4096);
+        if (!ist->frame_arena)
+            goto fail;
     }
     j = 0;
     for(i=0;i<nb_input_files;i++) {
@@ -1511,8 +2253,18 @@ static int av_encode(AVFormatContext **output_files,
             ist->index = k;
             ist->discard = 1; /* the stream is discarded by default
                                  (changed later) */
+            ist->dec = ist->st->codec;
+#ifdef HAVE_PTHREADS
+            if (threaded_transcode) {
+                ist->dec = alloc_decoder_context(ist->st);
+                if (!ist->dec)
+                    goto fail;
+            }
+#endif
+            if (ist->st->need_parsing)
+                ist->parser = av_parser_init(ist->st->codec->codec_id);
 
-            if (ist->st->codec->rate_emu) {
+            if (ist->dec->rate_emu) {
                 ist->start = av_gettime();
                 ist->frame = 0;
             }
@@ -1639,7 +2391,7 @@ static int av_encode(AVFormatContext **output_files,
         ist = ist_table[ost->source_index];
 
         codec = ost->st->codec;
-        icodec = ist->st->codec;
+        icodec = ist->dec;
 
         if (!ost->st->language[0])
             av_strlcpy(ost->st->language, ist->st->language,
@@ -1682,6 +2434,12 @@ static int av_encode(AVFormatContext **output_files,
                     fprintf(stderr,"-vcodec copy and -vhook are incompatible (frames are not decoded)\n");
                     av_exit(1);
                 }
+#ifdef CONFIG_AVFILTER
+                if(vfilters) {
+                    fprintf(stderr,"-vcodec copy and -vfilters are incompatible (frames are not decoded)\n");
+                    av_exit(1);
+                }
+#endif
                 codec->pix_fmt = icodec->pix_fmt;
                 codec->width = icodec->width;
                 codec->height = icodec->height;
@@ -1702,16 +2460,38 @@ static int av_encode(AVFormatContext **output_files,
                 ist->decoding_needed = 1;
                 ost->encoding_needed = 1;
                 break;
-            case CODEC_TYPE_VIDEO:
+            case CODEC_TYPE_VIDEO: {
+                /* size and format of the pictures given to the outputs */
+                int in_width   = icodec->width;
+                int in_height  = icodec->height;
+                int in_pix_fmt = icodec->pix_fmt;
+#ifdef CONFIG_AVFILTER
+                if (vfilters) {
+                    if (!ist->filter_graph && configure_filters(ist)) {
+                        fprintf(stderr, "Error opening filters!\n");
+                        av_exit(1);
+                    }
+                    in_width   = ist->output_video_filter->inputs[0]->w;
+                    in_height  = ist->output_video_filter->inputs[0]->h;
+                    in_pix_fmt = ist->output_video_filter->inputs[0]->format;
+                    /* the encoder gets the size of the filtered pictures */
+                    if (!frame_size_given) {
+                        codec->width  = in_width  - (frame_leftBand + frame_rightBand) +
+                                                    (frame_padleft + frame_padright);
+                        codec->height = in_height - (frame_topBand  + frame_bottomBand) +
+                                                    (frame_padtop + frame_padbottom);
+                    }
+                }
+#endif
                 ost->video_crop = ((frame_leftBand + frame_rightBand + frame_topBand + frame_bottomBand) != 0);
                 ost->video_pad = ((frame_padleft + frame_padright + frame_padtop + frame_padbottom) != 0);
-                ost->video_resample = ((codec->width != icodec->width -
+                ost->video_resample = ((codec->width != in_width -
                                 (frame_leftBand + frame_rightBand) +
                                 (frame_padleft + frame_padright)) ||
-                        (codec->height != icodec->height -
+                        (codec->height != in_height -
                                 (frame_topBand  + frame_bottomBand) +
                                 (frame_padtop + frame_padbottom)) ||
-                        (codec->pix_fmt != icodec->pix_fmt));
+                        (codec->pix_fmt != in_pix_fmt));
                 if (ost->video_crop) {
                     ost->topBand = frame_topBand;
                     ost->leftBand = frame_leftBand;
@@ -1721,6 +2501,24 @@ static int av_encode(AVFormatContext **output_files,
                     ost->padleft = frame_padleft;
                     ost->padbottom = frame_padbottom;
                     ost->padright = frame_padright;
+                }
+                if (ost->video_resample || ost->video_pad) {
+                    /* reuse the pictures converted for an earlier stream
+                       from the same source in the same format */
+                    for(j=0;j<i;j++) {
+                        AVOutputStream *ost2 = ost_table[j];
+                        if (ost2->source_index == ost->source_index &&
+                            ost2->encoding_needed &&
+                            ost2->st->codec->codec_type == CODEC_TYPE_VIDEO &&
+                            same_video_format(ost, ost2)) {
+                            if (!ost2->format_source)
+                                ost2->format_source = ost2;
+                            ost->format_source = ost2->format_source;
+                            break;
+                        }
+                    }
+                }
+                if (ost->video_pad && !ost->format_source) {
                     if (!ost->video_resample) {
                         avcodec_get_frame_defaults(&ost->pict_tmp);
                         if(avpicture_alloc((AVPicture*)&ost->pict_tmp, codec->pix_fmt,
@@ -1728,7 +2526,7 @@ static int av_encode(AVFormatContext **output_files,
                             goto fail;
                     }
                 }
-                if (ost->video_resample) {
+                if (ost->video_resample && !ost->format_source) {
                     avcodec_get_frame_defaults(&ost->pict_tmp);
                     if(avpicture_alloc((AVPicture*)&ost->pict_tmp, codec->pix_fmt,
                                          codec->width, codec->height)) {
@@ -1737,9 +2535,9 @@ static int av_encode(AVFormatContext **output_files,
                     }
                     sws_flags = av_get_int(sws_opts, "sws_flags", NULL);
                     ost->img_resample_ctx = sws_getContext(
-                            icodec->width - (frame_leftBand + frame_rightBand),
-                            icodec->height - (frame_topBand + frame_bottomBand),
-                            icodec->pix_fmt,
+                            in_width - (frame_leftBand + frame_rightBand),
+                            in_height - (frame_topBand + frame_bottomBand),
+                            in_pix_fmt,
                             codec->width - (frame_padleft + frame_padright),
                             codec->height - (frame_padtop + frame_padbottom),
                             codec->pix_fmt,
@@ -1748,11 +2546,12 @@ static int av_encode(AVFormatContext **output_files,
                         fprintf(stderr, "Cannot get resampling context\n");
                         av_exit(1);
                     }
-                    ost->resample_height = icodec->height - (frame_topBand + frame_bottomBand);
+                    ost->resample_height = in_height - (frame_topBand + frame_bottomBand);
                 }
                 ost->encoding_needed = 1;
                 ist->decoding_needed = 1;
                 break;
+            }
             case CODEC_TYPE_SUBTITLE:
                 ost->encoding_needed = 1;
                 ist->decoding_needed = 1;
@@ -1807,10 +2606,11 @@ static int av_encode(AVFormatContext **output_files,
         }
     }
 
-    if (!bit_buffer)
-        bit_buffer = av_malloc(bit_buffer_size);
-    if (!bit_buffer)
-        goto fail;
+    for(i=0;i<nb_output_files;i++) {
+        bit_buffer[i] = av_malloc(bit_buffer_size);
+        if (!bit_buffer[i])
+            goto fail;
+    }
 
     /* dump the file output parameters - cannot be done before in case
        of stream copy */
@@ -1861,19 +2661,20 @@ static int av_encode(AVFormatContext **output_files,
         ist = ist_table[i];
         if (ist->decoding_needed) {
             AVCodec *codec;
-            codec = avcodec_find_decoder(ist->st->codec->codec_id);
+            codec = avcodec_find_decoder(ist->dec->codec_id);
             if (!codec) {
                 fprintf(stderr, "Unsupported codec (id=%d) for input stream #%d.%d\n",
-                        ist->st->codec->codec_id, ist->file_index, ist->index);
+                        ist->dec->codec_id, ist->file_index, ist->index);
                 av_exit(1);
             }
-            if (avcodec_open(ist->st->codec, codec) < 0) {
+            if (avcodec_open(ist->dec, codec) < 0) {
                 fprintf(stderr, "Error while opening codec for input stream #%d.%d\n",
                         ist->file_index, ist->index);
                 av_exit(1);
             }
-            //if (ist->st->codec->codec_type == CODEC_TYPE_VIDEO)
-            //    ist->st->codec->flags |= CODEC_FLAG_REPEAT_FIELD;
+            ist->dec->mem.parent = &input_files[ist->file_index]->mem;
+            //if (ist->dec->codec_type == CODEC_TYPE_VIDEO)
+            //    ist->dec->flags |= CODEC_FLAG_REPEAT_FIELD;
         }
     }
 
@@ -1942,6 +2743,11 @@ static int av_encode(AVFormatContext **output_files,
     key = -1;
     timer_start = av_gettime();
 
+#ifdef HAVE_PTHREADS
+    start_input_threads(file_table, nb_input_files, ist_table);
+    start_output_threads();
+#endif
+
     for(; received_sigterm == 0;) {
         int file_index, ist_index;
         AVPacket pkt;
@@ -2004,7 +2810,7 @@ static int av_encode(AVFormatContext **output_files,
 
         /* read a frame from it and output it in the fifo */
         is = input_files[file_index];
-        if (av_read_frame(is, &pkt) < 0) {
+        if (get_input_packet(&file_table[file_index], is, &pkt) < 0) {
             file_table[file_index].eof_reached = 1;
             if (opt_shortest)
                 break;
@@ -2043,8 +2849,22 @@ static int av_encode(AVFormatContext **output_files,
             }
         }
 
+#ifdef HAVE_PTHREADS
+        if (file_table[file_index].nb_warmup_packets >= 0)
+            sync_demuxer_context(ist, 0);
+#endif
         //fprintf(stderr,"read #%d.%d size=%d\n", ist->file_index, ist->index, pkt.size);
-        if (output_packet(ist, ist_index, ost_table, nb_ostreams, &pkt) < 0) {
+        ret = output_packet(ist, ist_index, ost_table, nb_ostreams, &pkt);
+#ifdef HAVE_PTHREADS
+        if (file_table[file_index].nb_warmup_packets >= 0) {
+            sync_demuxer_context(ist, 1);
+            if (ist->decoding_needed && !ist->got_packet) {
+                ist->got_packet = 1;
+                file_table[file_index].nb_warmup_streams--;
+            }
+        }
+#endif
+        if (ret < 0) {
 
             if (verbose >= 0)
                 fprintf(stderr, "Error while decoding stream #%d.%d\n",
@@ -2056,11 +2876,23 @@ static int av_encode(AVFormatContext **output_files,
 
     discard_packet:
         av_free_packet(&pkt);
+#ifdef HAVE_PTHREADS
+        {
+            AVInputFile *f = &file_table[file_index];
+            if (f->nb_warmup_packets >= 0 &&
+                (!f->nb_warmup_streams || ++f->nb_warmup_packets >= INPUT_QUEUE_SIZE))
+                start_input_thread(f);
+        }
+#endif
 
         /* dump report by using the output first video and audio streams */
         print_report(output_files, ost_table, nb_ostreams, 0);
     }
 
+#ifdef HAVE_PTHREADS
+    stop_input_threads(file_table, nb_input_files);
+#endif
+
     /* at the end of stream, we must flush the decoder buffers */
     for(i=0;i<nb_istreams;i++) {
         ist = ist_table[i];
@@ -2068,13 +2900,19 @@ static int av_encode(AVFormatContext **output_files,
             output_packet(ist, i, ost_table, nb_ostreams, NULL);
         }
     }
+#ifdef HAVE_PTHREADS
+    stop_output_threads();
+#endif
 
     term_exit();
 
     /* write the trailer if needed and close file */
     for(i=0;i<nb_output_files;i++) {
         os = output_files[i];
-        av_write_trailer(os);
+        if ((ret = av_write_trailer(os)) < 0) {
+            print_error(os->filename, ret);
+            av_exit(1);
+        }
     }
 
     /* dump report by using the first video and audio streams */
@@ -2093,7 +2931,7 @@ static int av_encode(AVFormatContext **output_files,
     for(i=0;i<nb_istreams;i++) {
         ist = ist_table[i];
         if (ist->decoding_needed) {
-            avcodec_close(ist->st->codec);
+            avcodec_close(ist->dec);
         }
     }
 
@@ -2101,12 +2939,37 @@ static int av_encode(AVFormatContext **output_files,
 
     ret = 0;
  fail1:
-    av_freep(&bit_buffer);
+#ifdef HAVE_PTHREADS
+    if (file_table)
+        stop_input_threads(file_table, nb_input_files);
+    stop_output_threads();
+#endif
+    for(i=0;i<nb_output_files;i++)
+        av_freep(&bit_buffer[i]);
     av_free(file_table);
 
     if (ist_table) {
         for(i=0;i<nb_istreams;i++) {
             ist = ist_table[i];
+#ifdef CONFIG_AVFILTER
+            /* after the decoder, which may still hold filter buffers */
+            if (ist->picref)
+                avfilter_unref_pic(ist->picref);
+            if (ist->filter_graph) {
+                avfilter_destroy_graph(ist->filter_graph);
+                av_free(ist->filter_graph);
+            }
+#endif
+            if (ist) {
+                av_arena_free(&ist->frame_arena);
+                av_parser_close(ist->parser);
+                if (ist->dec && ist->dec != ist->st->codec) {
+                    if (ist->dec->thread_opaque)
+                        avcodec_thread_free(ist->dec);
+                    av_free(ist->dec->extradata);
+                    av_free(ist->dec);
+                }
+            }
             av_free(ist);
         }
         av_free(ist_table);
@@ -2122,7 +2985,7 @@ static int av_encode(AVFormatContext **output_files,
                 av_fifo_free(&ost->fifo); /* works even if fifo is not
                                              initialized but set to zero */
                 av_free(ost->pict_tmp.data[0]);
-                if (ost->video_resample)
+                if (ost->img_resample_ctx)
                     sws_freeContext(ost->img_resample_ctx);
                 if (ost->resample)
                     audio_resample_close(ost->resample);
@@ -2341,6 +3204,7 @@ static void opt_frame_size(const char *arg)
         fprintf(stderr, "Frame size must be a multiple of 2\n");
         av_exit(1);
     }
+    frame_size_given = 1;
 }
 
 
@@ -2606,6 +3470,11 @@ static void opt_map(const char *arg)
     AVStreamMap *m;
     char *p;
 
+    stream_maps = av_realloc(stream_maps, (nb_stream_maps + 1) * sizeof(*stream_maps));
+    if (!stream_maps) {
+        fprintf(stderr, "Could not alloc stream map\n");
+        av_exit(1);
+    }
     m = &stream_maps[nb_stream_maps++];
 
     m->file_index = strtol(arg, &p, 0);
@@ -2745,11 +3614,16 @@ static void opt_input_file(const char *filename)
 
     /* If not enough info to get the stream parameters, we decode the
        first frames to get it. (used in mpeg case for example) */
-    ret = av_find_stream_info(ic);
-    if (ret < 0 && verbose >= 0) {
-        fprintf(stderr, "%s: could not find codec parameters\n", filename);
-        av_exit(1);
+    if (!probe_cache_filename || av_probe_cache_read(ic, probe_cache_filename) < 0) {
+        ret = av_find_stream_info(ic);
+        if (ret < 0 && verbose >= 0) {
+            fprintf(stderr, "%s: could not find codec parameters\n", filename);
+            av_exit(1);
+        }
+        if (probe_cache_filename && av_probe_cache_write(ic, probe_cache_filename) < 0)
+            fprintf(stderr, "%s: could not write probe cache %s\n", filename, probe_cache_filename);
     }
+    av_freep(&probe_cache_filename);
 
     timestamp = start_time;
     /* add the stream start time */
@@ -2799,6 +3673,7 @@ static void opt_input_file(const char *filename)
             }
             frame_height = enc->height;
             frame_width = enc->width;
+            frame_size_given = 0;
             frame_aspect_ratio = av_q2d(enc->sample_aspect_ratio) * enc->width / enc->height;
             frame_pix_fmt = enc->pix_fmt;
             rfps      = ic->streams[i]->r_frame_rate.num;
@@ -2894,7 +3769,7 @@ static void check_audio_video_sub_inputs(int *has_video_ptr, int *has_audio_ptr,
     *has_subtitle_ptr = has_subtitle;
 }
 
-static void new_video_stream(AVFormatContext *oc)
+static void new_video_stream(AVFormatContext *oc, int file_idx)
 {
     AVStream *st;
     AVCodecContext *video_enc;
@@ -2906,7 +3781,7 @@ static void new_video_stream(AVFormatContext *oc)
         av_exit(1);
     }
     avcodec_get_context_defaults2(st->codec, CODEC_TYPE_VIDEO);
-    bitstream_filters[nb_output_files][oc->nb_streams - 1]= video_bitstream_filters;
+    set_bitstream_filters(file_idx, oc->nb_streams - 1, video_bitstream_filters);
     video_bitstream_filters= NULL;
 
     if(thread_count>1)
@@ -3049,7 +3924,7 @@ static void new_video_stream(AVFormatContext *oc)
     video_stream_copy = 0;
 }
 
-static void new_audio_stream(AVFormatContext *oc)
+static void new_audio_stream(AVFormatContext *oc, int file_idx)
 {
     AVStream *st;
     AVCodecContext *audio_enc;
@@ -3062,7 +3937,7 @@ static void new_audio_stream(AVFormatContext *oc)
     }
     avcodec_get_context_defaults2(st->codec, CODEC_TYPE_AUDIO);
 
-    bitstream_filters[nb_output_files][oc->nb_streams - 1]= audio_bitstream_filters;
+    set_bitstream_filters(file_idx, oc->nb_streams - 1, audio_bitstream_filters);
     audio_bitstream_filters= NULL;
 
     if(thread_count>1)
@@ -3118,7 +3993,7 @@ static void new_audio_stream(AVFormatContext *oc)
     audio_stream_copy = 0;
 }
 
-static void new_subtitle_stream(AVFormatContext *oc)
+static void new_subtitle_stream(AVFormatContext *oc, int file_idx)
 {
     AVStream *st;
     AVCodecContext *subtitle_enc;
@@ -3131,7 +4006,7 @@ static void new_subtitle_stream(AVFormatContext *oc)
     }
     avcodec_get_context_defaults2(st->codec, CODEC_TYPE_SUBTITLE);
 
-    bitstream_filters[nb_output_files][oc->nb_streams - 1]= subtitle_bitstream_filters;
+    set_bitstream_filters(file_idx, oc->nb_streams - 1, subtitle_bitstream_filters);
     subtitle_bitstream_filters= NULL;
 
     subtitle_enc = st->codec;
@@ -3168,7 +4043,7 @@ static void opt_new_audio_stream(void)
         av_exit(1);
     }
     oc = output_files[nb_output_files - 1];
-    new_audio_stream(oc);
+    new_audio_stream(oc, nb_output_files - 1);
 }
 
 static void opt_new_video_stream(void)
@@ -3179,7 +4054,7 @@ static void opt_new_video_stream(void)
         av_exit(1);
     }
     oc = output_files[nb_output_files - 1];
-    new_video_stream(oc);
+    new_video_stream(oc, nb_output_files - 1);
 }
 
 static void opt_new_subtitle_stream(void)
@@ -3190,7 +4065,7 @@ static void opt_new_subtitle_stream(void)
         av_exit(1);
     }
     oc = output_files[nb_output_files - 1];
-    new_subtitle_stream(oc);
+    new_subtitle_stream(oc, nb_output_files - 1);
 }
 
 static void opt_output_file(const char *filename)
@@ -3255,15 +4130,15 @@ static void opt_output_file(const char *filename)
         }
 
         if (use_video) {
-            new_video_stream(oc);
+            new_video_stream(oc, nb_output_files);
         }
 
         if (use_audio) {
-            new_audio_stream(oc);
+            new_audio_stream(oc, nb_output_files);
         }
 
         if (use_subtitle) {
-            new_subtitle_stream(oc);
+            new_subtitle_stream(oc, nb_output_files);
         }
 
         oc->timestamp = rec_timestamp;
@@ -3378,6 +4253,18 @@ static int64_t getutime(void)
 #endif
 }
 
+static int64_t getmaxrss(void)
+{
+#ifdef HAVE_GETRUSAGE
+    struct rusage rusage;
+
+    getrusage(RUSAGE_SELF, &rusage);
+    return (int64_t)rusage.ru_maxrss * 1024;
+#else
+    return 0;
+#endif
+}
+
 static void parse_matrix_coeffs(uint16_t *dest, const char *str)
 {
     int i;
@@ -3660,16 +4547,19 @@ static const OptionDef options[] = {
     { "album", HAS_ARG | OPT_STRING, {(void*)&str_album}, "set the album", "string" },
     { "benchmark", OPT_BOOL | OPT_EXPERT, {(void*)&do_benchmark},
       "add timings for benchmarking" },
+    { "trace", HAS_ARG | OPT_STRING | OPT_EXPERT, {(void*)&trace_filename}, "write a trace of the time spent in each processing step to file", "file" },
     { "dump", OPT_BOOL | OPT_EXPERT, {(void*)&do_pkt_dump},
       "dump each input packet" },
     { "hex", OPT_BOOL | OPT_EXPERT, {(void*)&do_hex_dump},
       "when dumping packets, also dump the payload" },
     { "re", OPT_BOOL | OPT_EXPERT, {(void*)&rate_emu}, "read input at native frame rate", "" },
+    { "probecache", HAS_ARG | OPT_STRING | OPT_EXPERT, {(void*)&probe_cache_filename}, "load the stream parameters of the next input from file, or probe and store them there", "file" },
     { "loop_input", OPT_BOOL | OPT_EXPERT, {(void*)&loop_input}, "loop (current only works with images)" },
     { "loop_output", HAS_ARG | OPT_INT | OPT_EXPERT, {(void*)&loop_output}, "number of times to loop output in formats that support looping (0 loops forever)", "" },
     { "v", HAS_ARG | OPT_FUNC2, {(void*)opt_verbose}, "set the logging verbosity level", "number" },
     { "target", HAS_ARG, {(void*)opt_target}, "specify target file type (\"vcd\", \"svcd\", \"dvd\", \"dv\", \"dv50\", \"pal-vcd\", \"ntsc-svcd\", ...)", "type" },
     { "threads", HAS_ARG | OPT_EXPERT, {(void*)opt_thread_count}, "thread count", "count" },
+    { "threaded", OPT_BOOL | OPT_EXPERT, {(void*)&threaded_transcode}, "demux each input file and encode each output file after the first in its own thread" },
     { "vsync", HAS_ARG | OPT_INT | OPT_EXPERT, {(void*)&video_sync_method}, "video sync method", "" },
     { "async", HAS_ARG | OPT_INT | OPT_EXPERT, {(void*)&audio_sync_method}, "audio sync method", "" },
     { "adrift_threshold", HAS_ARG | OPT_FLOAT | OPT_EXPERT, {(void*)&audio_drift_threshold}, "audio drift threshold", "threshold" },
@@ -3717,6 +4607,9 @@ static const OptionDef options[] = {
     { "vstats_file", HAS_ARG | OPT_EXPERT | OPT_VIDEO, {(void*)opt_vstats_file}, "dump video coding statistics to file", "file" },
 #ifdef CONFIG_VHOOK
     { "vhook", HAS_ARG | OPT_EXPERT | OPT_VIDEO, {(void*)add_frame_hooker}, "insert video processing module", "module" },
+#endif
+#ifdef CONFIG_AVFILTER
+    { "vfilters", OPT_STRING | HAS_ARG | OPT_VIDEO, {(void*)&vfilters}, "video filters", "filter list" },
 #endif
     { "intra_matrix", HAS_ARG | OPT_EXPERT | OPT_VIDEO, {(void*)opt_intra_matrix}, "specify intra matrix coeffs", "matrix" },
     { "inter_matrix", HAS_ARG | OPT_EXPERT | OPT_VIDEO, {(void*)opt_inter_matrix}, "specify inter matrix coeffs", "matrix" },
@@ -3765,11 +4658,14 @@ static const OptionDef options[] = {
 int main(int argc, char **argv)
 {
     int i;
-    int64_t ti;
+    int64_t ti, rti;
 
     avcodec_register_all();
     avdevice_register_all();
     av_register_all();
+#ifdef CONFIG_AVFILTER
+    avfilter_register_all();
+#endif
 
     for(i=0; i<CODEC_TYPE_NB; i++){
         avctx_opts[i]= avcodec_alloc_context2(i);
@@ -3797,12 +4693,21 @@ int main(int argc, char **argv)
         av_exit(1);
     }
 
+    if (trace_filename && av_trace_start(trace_filename) < 0) {
+        fprintf(stderr, "Could not start the trace to %s\n", trace_filename);
+        trace_filename = NULL;
+        av_exit(1);
+    }
+
     ti = getutime();
+    rti = av_gettime();
     av_encode(output_files, nb_output_files, input_files, nb_input_files,
               stream_maps, nb_stream_maps);
     ti = getutime() - ti;
+    rti = av_gettime() - rti;
     if (do_benchmark) {
-        printf("bench: utime=%0.3fs\n", ti / 1000000.0);
+        printf("bench: utime=%0.3fs rtime=%0.3fs maxrss=%"PRId64"kB\n",
+               ti / 1000000.0, rti / 1000000.0, getmaxrss() / 1024);
     }
 
     return av_exit(0);
@@ -37,9 +37,16 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #ifdef HAVE_POLL_H
 #include <poll.h>
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include <errno.h>
 #include <sys/time.h>
 #undef time //needed because HAVE_AV_CONFIG_H is defined on top
@@ -62,6 +69,15 @@ static const OptionDef options[];
 /* maximum number of simultaneous HTTP connections */
 #define HTTP_MAX_CONNECTIONS 2000
 
+/* maximum number of threads serving the connections */
+#define MAX_WORKERS 64
+
+/* number of muxed chunks kept for the viewers of a live stream */
+#define CACHE_CHUNKS 1024
+
+/* maximum number of chunks sent by one writev() */
+#define CHUNK_BATCH 16
+
 enum HTTPState {
     HTTPSTATE_WAIT_REQUEST,
     HTTPSTATE_SEND_HEADER,
@@ -106,12 +122,29 @@ typedef struct {
     int64_t time1, time2;
 } DataRateData;
 
+/* fields of a connection shown on the status page; the worker serving
+   the connection copies them under its lock, so that any worker can read
+   them */
+typedef struct ConnectionStats {
+    enum HTTPState state;
+    struct FFStream *stream;
+    int bitrate; /* target bit rate */
+    int64_t data_count;
+    DataRateData datarate;
+    char protocol[16];
+} ConnectionStats;
+
 /* context associated with one connection */
 typedef struct HTTPContext {
     enum HTTPState state;
     int fd; /* socket file descriptor */
     struct sockaddr_in from_addr; /* origin */
-    struct pollfd *poll_entry; /* used when polling */
+    struct HTTPWorker *worker; /* thread serving the connection */
+    int events; /* POLLIN/POLLOUT the connection waits for */
+    int revents; /* events which occurred */
+#ifdef HAVE_SYS_EPOLL_H
+    int epoll_events; /* events registered in the epoll set */
+#endif
     int64_t timeout;
     uint8_t *buffer_ptr, *buffer_end;
     int http_error;
@@ -138,10 +171,20 @@ typedef struct HTTPContext {
     int feed_streams[MAX_STREAMS]; /* index of streams in the feed */
     int switch_feed_streams[MAX_STREAMS]; /* index of streams in the feed */
     int switch_pending;
+    /* rates requested through another connection, applied by the worker
+       serving this one, both protected by its lock */
+    char posted_rates[MAX_STREAMS];
+    int rates_posted;
     AVFormatContext fmt_ctx; /* instance of FFStream for one user */
+    /* output shared with the other viewers of the stream, if any */
+    struct StreamCache *cache;
+    int64_t cache_seq;           /* next chunk of the cache to send */
+    struct StreamChunk *chunks[CHUNK_BATCH]; /* chunks being sent */
+    int nb_chunks;
     int last_packet_sent; /* true if last data packet was sent */
     int suppress_log;
     DataRateData datarate;
+    ConnectionStats stats; /* protected by the lock of the worker */
     int wmp_client_id;
     char protocol[16];
     char method[16];
@@ -169,6 +212,32 @@ typedef struct HTTPContext {
     uint8_t *packet_buffer, *packet_buffer_ptr, *packet_buffer_end;
 } HTTPContext;
 
+/* a thread serving a share of the connections. The first worker runs in
+   the main thread, it accepts the new connections and serves the RTSP
+   and RTP connections itself */
+typedef struct HTTPWorker {
+    HTTPContext *first_http_ctx; /* connections served by the worker */
+    HTTPContext *new_http_ctx;   /* connections handed over by the first
+                                    worker, not yet served */
+    int nb_connections;
+    int current_bandwidth;
+    int64_t cur_time;            /* in ms, updated after each wait */
+    AVRandomState random_state;
+    int listen_fd[2];            /* HTTP and RTSP server sockets, or -1 */
+    int listen_revents[2];
+    int wakeup_fd[2];            /* pipe written to by the other workers */
+    int wakeup_revents;
+#ifdef HAVE_SYS_EPOLL_H
+    int epoll_fd;
+#else
+    struct pollfd *poll_table;
+#endif
+#ifdef HAVE_PTHREADS
+    pthread_t thread;
+    pthread_mutex_t lock;        /* protects the two connection lists */
+#endif
+} HTTPWorker;
+
 /* each generated stream is described here */
 enum StreamType {
     STREAM_TYPE_LIVE,
@@ -189,6 +258,33 @@ typedef struct IPAddressACL {
     struct in_addr last;
 } IPAddressACL;
 
+/* output of the muxer for one packet of a live stream */
+typedef struct StreamChunk {
+    uint8_t *data;
+    int size;
+    int key;            /* a viewer can start with this chunk */
+    int64_t pts;        /* time of the packet in AV_TIME_BASE units */
+    int ref_count;      /* held by the cache and by each connection
+                           sending the chunk */
+} StreamChunk;
+
+/* output of a live stream, read from the feed and muxed once for all its
+   HTTP viewers. It is protected by the lock of the stream */
+typedef struct StreamCache {
+    struct FFStream *stream;
+    AVFormatContext *fmt_in;  /* feed reader */
+    AVFormatContext fmt_ctx;  /* muxer */
+    uint8_t *header, *trailer;
+    int header_size, trailer_size;
+    StreamChunk *chunks[CACHE_CHUNKS]; /* chunk n is at n % CACHE_CHUNKS */
+    int64_t next_seq;         /* number of chunks muxed so far */
+    int64_t key_seq;          /* latest key chunk still kept, or -1 */
+    int key_pending;          /* a key packet gave no output yet */
+    int64_t last_pts;         /* time of the latest packet muxed */
+    int eof;                  /* the trailer was written */
+    int nb_viewers;
+} StreamCache;
+
 /* description of each stream of the ffserver.conf file */
 typedef struct FFStream {
     enum StreamType stream_type;
@@ -234,7 +330,16 @@ typedef struct FFStream {
     int64_t feed_max_size;      /* maximum storage size, zero means unlimited */
     int64_t feed_write_index;   /* current write position in feed (it wraps around) */
     int64_t feed_size;          /* current size of feed */
+    int feed_page_size;         /* size of the pages of the feed file */
+    int64_t *page_pts;          /* pts of the pages written to the feed
+                                   file since the server started */
+    int nb_page_pts;
     struct FFStream *next_feed;
+    StreamCache *cache;  /* output shared by the viewers, if any */
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t lock;       /* protects the feed state and the counters
+                                   shared by the workers */
+#endif
 } FFStream;
 
 typedef struct FeedData {
@@ -246,11 +351,12 @@ static struct sockaddr_in my_http_addr;
 static struct sockaddr_in my_rtsp_addr;
 
 static char logfilename[1024];
-static HTTPContext *first_http_ctx;
+static HTTPWorker *workers;    /* the first one runs in the main thread */
+static int nb_workers;
 static FFStream *first_feed;   /* contains only feeds */
 static FFStream *first_stream; /* contains all streams, including feeds */
 
-static void new_connection(int server_fd, int is_rtsp);
+static void new_connection(HTTPWorker *w, int server_fd, int is_rtsp);
 static void close_connection(HTTPContext *c);
 
 /* HTTP handling */
@@ -259,8 +365,13 @@ static int http_parse_request(HTTPContext *c);
 static int http_send_data(HTTPContext *c);
 static void compute_stats(HTTPContext *c);
 static int open_input_stream(HTTPContext *c, const char *info);
+static void close_stream_input(AVFormatContext *s);
+static int use_stream_cache(FFStream *stream, const char *info);
+static int open_stream_cache(HTTPContext *c);
+static void close_stream_cache(HTTPContext *c);
 static int http_start_receive_data(HTTPContext *c);
 static int http_receive_data(HTTPContext *c);
+static int modify_current_stream(HTTPContext *c, char *rates);
 
 /* RTSP handling */
 static int rtsp_parse_request(HTTPContext *c);
@@ -276,7 +387,8 @@ static int prepare_sdp_description(FFStream *stream, uint8_t **pbuffer,
                                    struct in_addr my_ip);
 
 /* RTP handling */
-static HTTPContext *rtp_new_connection(struct sockaddr_in *from_addr,
+static HTTPContext *rtp_new_connection(HTTPWorker *w,
+                                       struct sockaddr_in *from_addr,
                                        FFStream *stream, const char *session_id,
                                        enum RTSPProtocol rtp_protocol);
 static int rtp_new_av_stream(HTTPContext *c,
@@ -293,14 +405,26 @@ static int no_launch;
 static int need_to_start_children;
 
 static int nb_max_connections;
-static int nb_connections;
 
 static int max_bandwidth;
-static int current_bandwidth;
 
-static int64_t cur_time;           // Making this global saves on passing it around everywhere
-
-static AVRandomState random_state;
+#ifdef HAVE_PTHREADS
+/* avcodec_open() and avcodec_close() must not run concurrently */
+static pthread_mutex_t codec_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_CODECS()     pthread_mutex_lock(&codec_mutex)
+#define UNLOCK_CODECS()   pthread_mutex_unlock(&codec_mutex)
+#define LOCK_WORKER(w)    pthread_mutex_lock(&(w)->lock)
+#define UNLOCK_WORKER(w)  pthread_mutex_unlock(&(w)->lock)
+#define LOCK_STREAM(s)    pthread_mutex_lock(&(s)->lock)
+#define UNLOCK_STREAM(s)  pthread_mutex_unlock(&(s)->lock)
+#else
+#define LOCK_CODECS()
+#define UNLOCK_CODECS()
+#define LOCK_WORKER(w)
+#define UNLOCK_WORKER(w)
+#define LOCK_STREAM(s)
+#define UNLOCK_STREAM(s)
+#endif
 
 static FILE *logfile = NULL;
 
@@ -322,8 +446,7 @@ static char *ctime1(char *buf2)
     char *p;
 
     ti = time(NULL);
-    p = ctime(&ti);
-    strcpy(buf2, p);
+    p = ctime_r(&ti, buf2);
     p = buf2 + strlen(p) - 1;
     if (*p == '\n')
         *p = '\0';
@@ -332,18 +455,19 @@ static char *ctime1(char *buf2)
 
 static void log_connection(HTTPContext *c)
 {
-    char buf2[32];
+    char buf2[32], ipaddr[INET_ADDRSTRLEN];
 
     if (c->suppress_log)
         return;
 
+    inet_ntop(AF_INET, &c->from_addr.sin_addr, ipaddr, sizeof(ipaddr));
     http_log("%s - - [%s] \"%s %s %s\" %d %"PRId64"\n",
-             inet_ntoa(c->from_addr.sin_addr),
+             ipaddr,
              ctime1(buf2), c->method, c->url,
              c->protocol, (c->http_error ? c->http_error : 200), c->data_count);
 }
 
-static void update_datarate(DataRateData *drd, int64_t count)
+static void update_datarate(DataRateData *drd, int64_t count, int64_t cur_time)
 {
     if (!drd->time1 && !drd->count1) {
         drd->time1 = drd->time2 = cur_time;
@@ -357,7 +481,7 @@ static void update_datarate(DataRateData *drd, int64_t count)
 }
 
 /* In bytes per second */
-static int compute_datarate(DataRateData *drd, int64_t count)
+static int compute_datarate(DataRateData *drd, int64_t count, int64_t cur_time)
 {
     if (cur_time == drd->time1)
         return 0;
@@ -455,7 +579,7 @@ static int socket_open_listen(struct sockaddr_in *my_addr)
 }
 
 /* start all multicast streams */
-static void start_multicast(void)
+static void start_multicast(HTTPWorker *w)
 {
     FFStream *stream;
     char session_id[32];
@@ -468,7 +592,7 @@ static void start_multicast(void)
         if (stream->is_multicast) {
             /* open the RTP connection */
             snprintf(session_id, sizeof(session_id), "%08x%08x",
-                     av_random(&random_state), av_random(&random_state));
+                     av_random(&w->random_state), av_random(&w->random_state));
 
             /* choose a port if none given */
             if (stream->multicast_port == 0) {
@@ -480,7 +604,7 @@ static void start_multicast(void)
             dest_addr.sin_addr = stream->multicast_ip;
             dest_addr.sin_port = htons(stream->multicast_port);
 
-            rtp_c = rtp_new_connection(&dest_addr, stream, session_id,
+            rtp_c = rtp_new_connection(w, &dest_addr, stream, session_id,
                                        RTSP_PROTOCOL_RTP_UDP_MULTICAST);
             if (!rtp_c)
                 continue;
@@ -509,68 +633,245 @@ static void start_multicast(void)
     }
 }
 
-/* main loop of the http server */
-static int http_server(void)
+/* wake up a worker blocked in wait_events() */
+static void signal_worker(HTTPWorker *w)
+{
+    uint8_t b = 0;
+
+    /* a full pipe means that a wake up is pending anyway */
+    if (write(w->wakeup_fd[1], &b, 1) < 0 && errno != EAGAIN)
+        http_log("Could not wake up a worker: %s\n", strerror(errno));
+}
+
+/* called when another worker signalled the worker: serve the connections
+   handed over to it, switch the streams whose rates were changed, and let
+   the connections waiting for a feed check whether it received data or
+   was closed */
+static void wake_up_worker(HTTPWorker *w)
 {
-    int server_fd, ret, rtsp_server_fd, delay, delay1;
-    struct pollfd poll_table[HTTP_MAX_CONNECTIONS + 2], *poll_entry;
     HTTPContext *c, *c_next;
+    uint8_t buf[64];
 
-    server_fd = socket_open_listen(&my_http_addr);
-    if (server_fd < 0)
+    while (read(w->wakeup_fd[0], buf, sizeof(buf)) > 0);
+
+    LOCK_WORKER(w);
+    for(c = w->new_http_ctx; c != NULL; c = c_next) {
+        c_next = c->next;
+        c->next = w->first_http_ctx;
+        w->first_http_ctx = c;
+    }
+    w->new_http_ctx = NULL;
+    for(c = w->first_http_ctx; c != NULL; c = c->next) {
+        if (c->rates_posted) {
+            c->rates_posted = 0;
+            if (modify_current_stream(c, c->posted_rates))
+                c->switch_pending = 1;
+        }
+    }
+    UNLOCK_WORKER(w);
+
+    for(c = w->first_http_ctx; c != NULL; c = c->next) {
+        if (c->state == HTTPSTATE_WAIT_FEED)
+            c->state = HTTPSTATE_SEND_DATA;
+    }
+}
+
+static int total_connections(void)
+{
+    int i, n = 0;
+
+    for(i = 0; i < nb_workers; i++) {
+        LOCK_WORKER(&workers[i]);
+        n += workers[i].nb_connections;
+        UNLOCK_WORKER(&workers[i]);
+    }
+    return n;
+}
+
+static int total_bandwidth(void)
+{
+    int i, n = 0;
+
+    for(i = 0; i < nb_workers; i++) {
+        LOCK_WORKER(&workers[i]);
+        n += workers[i].current_bandwidth;
+        UNLOCK_WORKER(&workers[i]);
+    }
+    return n;
+}
+
+/* copy the fields shown on the status page, called by the worker serving
+   the connection with its lock held */
+static void update_connection_stats(HTTPContext *c)
+{
+    ConnectionStats *s = &c->stats;
+    int i;
+
+    s->state = c->state;
+    s->stream = c->stream;
+    s->bitrate = 0;
+    if (c->stream) {
+        for (i = 0; i < c->stream->nb_streams; i++) {
+            if (!c->stream->feed)
+                s->bitrate += c->stream->streams[i]->codec->bit_rate;
+            else if (c->feed_streams[i] >= 0)
+                s->bitrate += c->stream->feed->streams[c->feed_streams[i]]->codec->bit_rate;
+        }
+    }
+    s->data_count = c->data_count;
+    s->datarate = c->datarate;
+    av_strlcpy(s->protocol, c->protocol, sizeof(s->protocol));
+}
+
+static int open_worker(HTTPWorker *w, int server_fd, int rtsp_server_fd)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev;
+    int i;
+#endif
+
+    w->listen_fd[0] = server_fd;
+    w->listen_fd[1] = rtsp_server_fd;
+    w->cur_time = av_gettime() / 1000;
+    av_init_random(av_gettime() + (getpid() << 16) + (w - workers), &w->random_state);
+
+    if (pipe(w->wakeup_fd) < 0)
         return -1;
+    fcntl(w->wakeup_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(w->wakeup_fd[1], F_SETFL, O_NONBLOCK);
 
-    rtsp_server_fd = socket_open_listen(&my_rtsp_addr);
-    if (rtsp_server_fd < 0)
+#ifdef HAVE_SYS_EPOLL_H
+    w->epoll_fd = epoll_create(HTTP_MAX_CONNECTIONS);
+    if (w->epoll_fd < 0)
         return -1;
 
-    http_log("ffserver started.\n");
+    /* the events of these descriptors are stored in the worker, those of
+       the connections in their context */
+    ev.events   = EPOLLIN;
+    ev.data.ptr = &w->wakeup_revents;
+    if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->wakeup_fd[0], &ev) < 0)
+        return -1;
+    for(i = 0; i < 2; i++) {
+        if (w->listen_fd[i] < 0)
+            continue;
+        ev.data.ptr = &w->listen_revents[i];
+        if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->listen_fd[i], &ev) < 0)
+            return -1;
+    }
+#else
+    w->poll_table = av_malloc((nb_max_connections + 3) * sizeof(struct pollfd));
+    if (!w->poll_table)
+        return -1;
+#endif
+#ifdef HAVE_PTHREADS
+    pthread_mutex_init(&w->lock, NULL);
+#endif
+    return 0;
+}
 
-    start_children(first_feed);
+/* wait at most delay ms for the events the connections of the worker
+   ask for, and store the events which occurred in their revents */
+static int wait_events(HTTPWorker *w, int delay)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event ev[256];
+    HTTPContext *c;
+    int i, ret, op;
+
+    /* only the connections which wait for other events than in the last
+       round cost a system call */
+    for(c = w->first_http_ctx; c != NULL; c = c->next) {
+        if (c->fd < 0 || c->events == c->epoll_events)
+            continue;
+        op = !c->epoll_events ? EPOLL_CTL_ADD :
+             !c->events       ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+        ev[0].events   = c->events;
+        ev[0].data.ptr = &c->revents;
+        if (epoll_ctl(w->epoll_fd, op, c->fd, &ev[0]) < 0)
+            return -1;
+        c->epoll_events = c->events;
+    }
 
-    first_http_ctx = NULL;
-    nb_connections = 0;
+    ret = epoll_wait(w->epoll_fd, ev, sizeof(ev) / sizeof(ev[0]), delay);
+    /* the EPOLL flags have the values of the POLL flags */
+    for(i = 0; i < ret; i++)
+        *(int *)ev[i].data.ptr = ev[i].events;
+    return ret;
+#else
+    struct pollfd *poll_entry = w->poll_table;
+    HTTPContext *c;
+    int i, ret;
 
-    start_multicast();
+    poll_entry->fd = w->wakeup_fd[0];
+    poll_entry->events = POLLIN;
+    poll_entry++;
 
-    for(;;) {
-        poll_entry = poll_table;
-        poll_entry->fd = server_fd;
-        poll_entry->events = POLLIN;
-        poll_entry++;
+    for(i = 0; i < 2; i++) {
+        if (w->listen_fd[i] >= 0) {
+            poll_entry->fd = w->listen_fd[i];
+            poll_entry->events = POLLIN;
+            poll_entry++;
+        }
+    }
+
+    for(c = w->first_http_ctx; c != NULL; c = c->next) {
+        if (c->fd >= 0 && c->events) {
+            poll_entry->fd = c->fd;
+            poll_entry->events = c->events;
+            poll_entry++;
+        }
+    }
+
+    ret = poll(w->poll_table, poll_entry - w->poll_table, delay);
+    if (ret <= 0)
+        return ret;
+
+    poll_entry = w->poll_table;
+    w->wakeup_revents = poll_entry++->revents;
+    for(i = 0; i < 2; i++) {
+        if (w->listen_fd[i] >= 0)
+            w->listen_revents[i] = poll_entry++->revents;
+    }
+    for(c = w->first_http_ctx; c != NULL; c = c->next) {
+        if (c->fd >= 0 && c->events)
+            c->revents = poll_entry++->revents;
+    }
+    return ret;
+#endif
+}
+
+/* main loop of a worker */
+static int http_worker_loop(HTTPWorker *w)
+{
+    int ret, delay, delay1, i;
+    HTTPContext *c, *c_next;
 
-        poll_entry->fd = rtsp_server_fd;
-        poll_entry->events = POLLIN;
-        poll_entry++;
+    for(;;) {
+        w->wakeup_revents = 0;
+        w->listen_revents[0] = w->listen_revents[1] = 0;
 
         /* wait for events on each HTTP handle */
-        c = first_http_ctx;
+        c = w->first_http_ctx;
         delay = 1000;
         while (c != NULL) {
-            int fd;
-            fd = c->fd;
+            c->revents = 0;
             switch(c->state) {
             case HTTPSTATE_SEND_HEADER:
             case RTSPSTATE_SEND_REPLY:
             case RTSPSTATE_SEND_PACKET:
-                c->poll_entry = poll_entry;
-                poll_entry->fd = fd;
-                poll_entry->events = POLLOUT;
-                poll_entry++;
+                c->events = POLLOUT;
                 break;
             case HTTPSTATE_SEND_DATA_HEADER:
             case HTTPSTATE_SEND_DATA:
             case HTTPSTATE_SEND_DATA_TRAILER:
                 if (!c->is_packetized) {
                     /* for TCP, we output as much as we can (may need to put a limit) */
-                    c->poll_entry = poll_entry;
-                    poll_entry->fd = fd;
-                    poll_entry->events = POLLOUT;
-                    poll_entry++;
+                    c->events = POLLOUT;
                 } else {
                     /* when ffserver is doing the timing, we work by
                        looking at which packet need to be sent every
                        10 ms */
+                    c->events = 0;
                     delay1 = 10; /* one tick wait XXX: 10 ms assumed */
                     if (delay1 < delay)
                         delay = delay1;
@@ -581,13 +882,10 @@ static int http_server(void)
             case HTTPSTATE_WAIT_FEED:
             case RTSPSTATE_WAIT_REQUEST:
                 /* need to catch errors */
-                c->poll_entry = poll_entry;
-                poll_entry->fd = fd;
-                poll_entry->events = POLLIN;/* Maybe this will work */
-                poll_entry++;
+                c->events = POLLIN;/* Maybe this will work */
                 break;
             default:
-                c->poll_entry = NULL;
+                c->events = 0;
                 break;
             }
             c = c->next;
@@ -596,21 +894,24 @@ static int http_server(void)
         /* wait for an event on one connection. We poll at least every
            second to handle timeouts */
         do {
-            ret = poll(poll_table, poll_entry - poll_table, delay);
+            ret = wait_events(w, delay);
             if (ret < 0 && ff_neterrno() != FF_NETERROR(EAGAIN) &&
                 ff_neterrno() != FF_NETERROR(EINTR))
                 return -1;
         } while (ret < 0);
 
-        cur_time = av_gettime() / 1000;
+        w->cur_time = av_gettime() / 1000;
 
-        if (need_to_start_children) {
+        if (w == workers && need_to_start_children) {
             need_to_start_children = 0;
             start_children(first_feed);
         }
 
+        if (w->wakeup_revents & POLLIN)
+            wake_up_worker(w);
+
         /* now handle the events */
-        for(c = first_http_ctx; c != NULL; c = c_next) {
+        for(c = w->first_http_ctx; c != NULL; c = c_next) {
             c_next = c->next;
             if (handle_connection(c) < 0) {
                 /* close and free the connection */
@@ -619,15 +920,74 @@ static int http_server(void)
             }
         }
 
-        poll_entry = poll_table;
-        /* new HTTP connection request ? */
-        if (poll_entry->revents & POLLIN)
-            new_connection(server_fd, 0);
-        poll_entry++;
-        /* new RTSP connection request ? */
-        if (poll_entry->revents & POLLIN)
-            new_connection(rtsp_server_fd, 1);
+        /* new HTTP or RTSP connection request ? */
+        for(i = 0; i < 2; i++) {
+            if (w->listen_revents[i] & POLLIN)
+                new_connection(w, w->listen_fd[i], i);
+        }
+
+        LOCK_WORKER(w);
+        for(c = w->first_http_ctx; c != NULL; c = c->next)
+            update_connection_stats(c);
+        UNLOCK_WORKER(w);
+    }
+}
+
+#ifdef HAVE_PTHREADS
+static void *http_worker_thread(void *arg)
+{
+    if (http_worker_loop(arg) < 0) {
+        http_log("Worker failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    return NULL;
+}
+#endif
+
+/* start the workers, the first one runs in the calling thread */
+static int http_server(void)
+{
+    int server_fd, rtsp_server_fd, i;
+
+    server_fd = socket_open_listen(&my_http_addr);
+    if (server_fd < 0)
+        return -1;
+
+    rtsp_server_fd = socket_open_listen(&my_rtsp_addr);
+    if (rtsp_server_fd < 0)
+        return -1;
+
+    http_log("ffserver started.\n");
+
+    start_children(first_feed);
+
+#ifdef HAVE_PTHREADS
+    {
+        FFStream *stream;
+        for(stream = first_stream; stream != NULL; stream = stream->next)
+            pthread_mutex_init(&stream->lock, NULL);
     }
+#endif
+
+    workers = av_mallocz(nb_workers * sizeof(HTTPWorker));
+    if (!workers)
+        return -1;
+    for(i = 0; i < nb_workers; i++) {
+        if (open_worker(&workers[i], i ? -1 : server_fd,
+                                     i ? -1 : rtsp_server_fd) < 0)
+            return -1;
+    }
+
+    start_multicast(workers);
+
+#ifdef HAVE_PTHREADS
+    for(i = 1; i < nb_workers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, http_worker_thread, &workers[i]))
+            return -1;
+    }
+#endif
+
+    return http_worker_loop(workers);
 }
 
 /* start waiting for a new HTTP/RTSP request */
@@ -637,19 +997,20 @@ static void start_wait_request(HTTPContext *c, int is_rtsp)
     c->buffer_end = c->buffer + c->buffer_size - 1; /* leave room for '\0' */
 
     if (is_rtsp) {
-        c->timeout = cur_time + RTSP_REQUEST_TIMEOUT;
+        c->timeout = c->worker->cur_time + RTSP_REQUEST_TIMEOUT;
         c->state = RTSPSTATE_WAIT_REQUEST;
     } else {
-        c->timeout = cur_time + HTTP_REQUEST_TIMEOUT;
+        c->timeout = c->worker->cur_time + HTTP_REQUEST_TIMEOUT;
         c->state = HTTPSTATE_WAIT_REQUEST;
     }
 }
 
-static void new_connection(int server_fd, int is_rtsp)
+static void new_connection(HTTPWorker *w, int server_fd, int is_rtsp)
 {
     struct sockaddr_in from_addr;
-    int fd, len;
+    int fd, len, i, n, min_connections;
     HTTPContext *c = NULL;
+    HTTPWorker *w1;
 
     len = sizeof(from_addr);
     fd = accept(server_fd, (struct sockaddr *)&from_addr,
@@ -660,7 +1021,7 @@ static void new_connection(int server_fd, int is_rtsp)
 
     /* XXX: should output a warning page when coming
        close to the connection limit */
-    if (nb_connections >= nb_max_connections)
+    if (total_connections() >= nb_max_connections)
         goto fail;
 
     /* add a new connection */
@@ -669,18 +1030,48 @@ static void new_connection(int server_fd, int is_rtsp)
         goto fail;
 
     c->fd = fd;
-    c->poll_entry = NULL;
     c->from_addr = from_addr;
     c->buffer_size = IOBUFFER_INIT_SIZE;
     c->buffer = av_malloc(c->buffer_size);
     if (!c->buffer)
         goto fail;
 
-    c->next = first_http_ctx;
-    first_http_ctx = c;
-    nb_connections++;
+    /* the RTSP connections and their RTP sessions refer to each other,
+       they all stay in this worker; HTTP connections go to the worker
+       serving the fewest connections */
+    w1 = w;
+    if (!is_rtsp) {
+        min_connections = INT_MAX;
+        for(i = 0; i < nb_workers; i++) {
+            LOCK_WORKER(&workers[i]);
+            n = workers[i].nb_connections;
+            UNLOCK_WORKER(&workers[i]);
+            if (n < min_connections) {
+                min_connections = n;
+                w1 = &workers[i];
+            }
+        }
+    }
 
+    /* the clock of the other worker may be being updated */
+    c->worker = w;
     start_wait_request(c, is_rtsp);
+    c->worker = w1;
+
+    LOCK_WORKER(w1);
+    update_connection_stats(c);
+    if (w1 == w) {
+        c->next = w->first_http_ctx;
+        w->first_http_ctx = c;
+    } else {
+        c->next = w1->new_http_ctx;
+        w1->new_http_ctx = c;
+    }
+    w1->nb_connections++;
+    UNLOCK_WORKER(w1);
+
+    if (w1 != w)
+        signal_worker(w1);
 
     return;
 
@@ -694,14 +1085,15 @@ static void new_connection(int server_fd, int is_rtsp)
 
 static void close_connection(HTTPContext *c)
 {
+    HTTPWorker *w = c->worker;
     HTTPContext **cp, *c1;
     int i, nb_streams;
     AVFormatContext *ctx;
     URLContext *h;
-    AVStream *st;
 
     /* remove connection from list */
-    cp = &first_http_ctx;
+    LOCK_WORKER(w);
+    cp = &w->first_http_ctx;
     while ((*cp) != NULL) {
         c1 = *cp;
         if (c1 == c)
@@ -709,25 +1101,29 @@ static void close_connection(HTTPContext *c)
         else
             cp = &c1->next;
     }
+    w->nb_connections--;
+    UNLOCK_WORKER(w);
 
     /* remove references, if any (XXX: do it faster) */
-    for(c1 = first_http_ctx; c1 != NULL; c1 = c1->next) {
+    for(c1 = w->first_http_ctx; c1 != NULL; c1 = c1->next) {
         if (c1->rtsp_c == c)
             c1->rtsp_c = NULL;
     }
 
     /* remove connection associated resources */
-    if (c->fd >= 0)
+    if (c->fd >= 0) {
+#ifdef HAVE_SYS_EPOLL_H
+        /* a child process may still share the socket, which would keep
+           it in the epoll set */
+        if (c->epoll_events)
+            epoll_ctl(w->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+#endif
         closesocket(c->fd);
-    if (c->fmt_in) {
-        /* close each frame parser */
-        for(i=0;i<c->fmt_in->nb_streams;i++) {
-            st = c->fmt_in->streams[i];
-            if (st->codec->codec)
-                avcodec_close(st->codec);
-        }
-        av_close_input_file(c->fmt_in);
     }
+    if (c->fmt_in)
+        close_stream_input(c->fmt_in);
+    if (c->cache)
+        close_stream_cache(c);
 
     /* free RTP output streams if any */
     nb_streams = 0;
@@ -738,6 +1134,7 @@ static void close_connection(HTTPContext *c)
         ctx = c->rtp_ctx[i];
         if (ctx) {
             av_write_trailer(ctx);
+            av_free(ctx->streams);
             av_free(ctx);
         }
         h = c->rtp_handles[i];
@@ -759,13 +1156,19 @@ static void close_connection(HTTPContext *c)
 
     for(i=0; i<ctx->nb_streams; i++)
         av_free(ctx->streams[i]);
+    av_freep(&ctx->streams);
 
-    if (c->stream && !c->post && c->stream->stream_type == STREAM_TYPE_LIVE)
-        current_bandwidth -= c->stream->bandwidth;
+    if (c->stream && !c->post && c->stream->stream_type == STREAM_TYPE_LIVE) {
+        LOCK_WORKER(w);
+        w->current_bandwidth -= c->stream->bandwidth;
+        UNLOCK_WORKER(w);
+    }
 
     /* signal that there is no feed if we are the feeder socket */
     if (c->state == HTTPSTATE_RECEIVE_DATA && c->stream) {
+        LOCK_STREAM(c->stream);
         c->stream->feed_opened = 0;
+        UNLOCK_STREAM(c->stream);
         close(c->feed_fd);
     }
 
@@ -773,7 +1176,6 @@ static void close_connection(HTTPContext *c)
     av_freep(&c->packet_buffer);
     av_free(c->buffer);
     av_free(c);
-    nb_connections--;
 }
 
 static int handle_connection(HTTPContext *c)
@@ -784,13 +1186,13 @@ static int handle_connection(HTTPContext *c)
     case HTTPSTATE_WAIT_REQUEST:
     case RTSPSTATE_WAIT_REQUEST:
         /* timeout ? */
-        if ((c->timeout - cur_time) < 0)
+        if ((c->timeout - c->worker->cur_time) < 0)
             return -1;
-        if (c->poll_entry->revents & (POLLERR | POLLHUP))
+        if (c->revents & (POLLERR | POLLHUP))
             return -1;
 
         /* no need to read if no events */
-        if (!(c->poll_entry->revents & POLLIN))
+        if (!(c->revents & POLLIN))
             return 0;
         /* read the data */
     read_loop:
@@ -824,11 +1226,11 @@ static int handle_connection(HTTPContext *c)
         break;
 
     case HTTPSTATE_SEND_HEADER:
-        if (c->poll_entry->revents & (POLLERR | POLLHUP))
+        if (c->revents & (POLLERR | POLLHUP))
             return -1;
 
         /* no need to write if no events */
-        if (!(c->poll_entry->revents & POLLOUT))
+        if (!(c->revents & POLLOUT))
             return 0;
         len = send(c->fd, c->buffer_ptr, c->buffer_end - c->buffer_ptr, 0);
         if (len < 0) {
@@ -840,8 +1242,11 @@ static int handle_connection(HTTPContext *c)
             }
         } else {
             c->buffer_ptr += len;
-            if (c->stream)
+            if (c->stream) {
+                LOCK_STREAM(c->stream);
                 c->stream->bytes_served += len;
+                UNLOCK_STREAM(c->stream);
+            }
             c->data_count += len;
             if (c->buffer_ptr >= c->buffer_end) {
                 av_freep(&c->pb_buffer);
@@ -862,11 +1267,11 @@ static int handle_connection(HTTPContext *c)
            input streams sets the speed). It may be better to verify
            that we do not rely too much on the kernel queues */
         if (!c->is_packetized) {
-            if (c->poll_entry->revents & (POLLERR | POLLHUP))
+            if (c->revents & (POLLERR | POLLHUP))
                 return -1;
 
             /* no need to read if no events */
-            if (!(c->poll_entry->revents & POLLOUT))
+            if (!(c->revents & POLLOUT))
                 return 0;
         }
         if (http_send_data(c) < 0)
@@ -877,28 +1282,28 @@ static int handle_connection(HTTPContext *c)
         break;
     case HTTPSTATE_RECEIVE_DATA:
         /* no need to read if no events */
-        if (c->poll_entry->revents & (POLLERR | POLLHUP))
+        if (c->revents & (POLLERR | POLLHUP))
             return -1;
-        if (!(c->poll_entry->revents & POLLIN))
+        if (!(c->revents & POLLIN))
             return 0;
         if (http_receive_data(c) < 0)
             return -1;
         break;
     case HTTPSTATE_WAIT_FEED:
         /* no need to read if no events */
-        if (c->poll_entry->revents & (POLLIN | POLLERR | POLLHUP))
+        if (c->revents & (POLLIN | POLLERR | POLLHUP))
             return -1;
 
         /* nothing to do, we'll be waken up by incoming feed packets */
         break;
 
     case RTSPSTATE_SEND_REPLY:
-        if (c->poll_entry->revents & (POLLERR | POLLHUP)) {
+        if (c->revents & (POLLERR | POLLHUP)) {
             av_freep(&c->pb_buffer);
             return -1;
         }
         /* no need to write if no events */
-        if (!(c->poll_entry->revents & POLLOUT))
+        if (!(c->revents & POLLOUT))
             return 0;
         len = send(c->fd, c->buffer_ptr, c->buffer_end - c->buffer_ptr, 0);
         if (len < 0) {
@@ -919,12 +1324,12 @@ static int handle_connection(HTTPContext *c)
         }
         break;
     case RTSPSTATE_SEND_PACKET:
-        if (c->poll_entry->revents & (POLLERR | POLLHUP)) {
+        if (c->revents & (POLLERR | POLLHUP)) {
             av_freep(&c->packet_buffer);
             return -1;
         }
         /* no need to write if no events */
-        if (!(c->poll_entry->revents & POLLOUT))
+        if (!(c->revents & POLLOUT))
             return 0;
         len = send(c->fd, c->packet_buffer_ptr,
                     c->packet_buffer_end - c->packet_buffer_ptr, 0);
@@ -1304,10 +1709,13 @@ static int http_parse_request(HTTPContext *c)
         goto send_error;
     }
 
-    if (c->post == 0 && stream->stream_type == STREAM_TYPE_LIVE)
-        current_bandwidth += stream->bandwidth;
+    if (c->post == 0 && stream->stream_type == STREAM_TYPE_LIVE) {
+        LOCK_WORKER(c->worker);
+        c->worker->current_bandwidth += stream->bandwidth;
+        UNLOCK_WORKER(c->worker);
+    }
 
-    if (c->post == 0 && max_bandwidth < current_bandwidth) {
+    if (c->post == 0 && max_bandwidth < total_bandwidth()) {
         c->http_error = 200;
         q = c->buffer;
         q += snprintf(q, q - (char *) c->buffer + c->buffer_size, "HTTP/1.0 200 Server too busy\r\n");
@@ -1316,7 +1724,7 @@ static int http_parse_request(HTTPContext *c)
         q += snprintf(q, q - (char *) c->buffer + c->buffer_size, "<html><head><title>Too busy</title></head><body>\r\n");
         q += snprintf(q, q - (char *) c->buffer + c->buffer_size, "<p>The server is too busy to serve your request at this time.</p>\r\n");
         q += snprintf(q, q - (char *) c->buffer + c->buffer_size, "<p>The bandwidth being served (including your stream) is %dkbit/sec, and this exceeds the limit of %dkbit/sec.</p>\r\n",
-            current_bandwidth, max_bandwidth);
+            total_bandwidth(), max_bandwidth);
         q += snprintf(q, q - (char *) c->buffer + c->buffer_size, "</body></html>\r\n");
 
         /* prepare output buffer */
@@ -1446,7 +1854,9 @@ static int http_parse_request(HTTPContext *c)
         goto send_error;
     }
 
+    LOCK_STREAM(stream);
     stream->conns_served++;
+    UNLOCK_STREAM(stream);
 
     /* XXX: add there authenticate and IP match */
 
@@ -1491,16 +1901,27 @@ static int http_parse_request(HTTPContext *c)
 #endif
 
             if (client_id && extract_rates(ratebuf, sizeof(ratebuf), c->buffer)) {
-                HTTPContext *wmpc;
-
-                /* Now we have to find the client_id */
-                for (wmpc = first_http_ctx; wmpc; wmpc = wmpc->next) {
-                    if (wmpc->wmp_client_id == client_id)
+                HTTPContext *wmpc = NULL;
+                HTTPWorker *w;
+
+                /* Now we have to find the client_id. The rates are posted
+                   to the worker serving it, which switches the streams */
+                for (w = workers; w < workers + nb_workers; w++) {
+                    LOCK_WORKER(w);
+                    for (wmpc = w->first_http_ctx; wmpc; wmpc = wmpc->next) {
+                        if (wmpc->wmp_client_id == client_id) {
+                            memcpy(wmpc->posted_rates, ratebuf,
+                                   sizeof(wmpc->posted_rates));
+                            wmpc->rates_posted = 1;
+                            break;
+                        }
+                    }
+                    UNLOCK_WORKER(w);
+                    if (wmpc) {
+                        signal_worker(w);
                         break;
+                    }
                 }
-
-                if (wmpc && modify_current_stream(wmpc, ratebuf))
-                    wmpc->switch_pending = 1;
             }
 
             snprintf(msg, sizeof(msg), "POST command not handled");
@@ -1525,7 +1946,13 @@ static int http_parse_request(HTTPContext *c)
         goto send_stats;
 
     /* open input stream */
-    if (open_input_stream(c, info) < 0) {
+    if (use_stream_cache(c->stream, info)) {
+        if (open_stream_cache(c) < 0) {
+            snprintf(msg, sizeof(msg), "Input stream corresponding to '%s' not found", url);
+            goto send_error;
+        }
+        c->start_time = c->worker->cur_time;
+    } else if (open_input_stream(c, info) < 0) {
         snprintf(msg, sizeof(msg), "Input stream corresponding to '%s' not found", url);
         goto send_error;
     }
@@ -1542,7 +1969,7 @@ static int http_parse_request(HTTPContext *c)
     if (!strcmp(c->stream->fmt->name,"asf_stream")) {
         /* Need to allocate a client id */
 
-        c->wmp_client_id = av_random(&random_state) & 0x7fffffff;
+        c->wmp_client_id = av_random(&c->worker->random_state) & 0x7fffffff;
 
         q += snprintf(q, q - (char *) c->buffer + c->buffer_size, "Server: Cougar 4.1.0.3923\r\nCache-Control: no-cache\r\nPragma: client-id=%d\r\nPragma: features=\"broadcast\"\r\n", c->wmp_client_id);
     }
@@ -1592,7 +2019,9 @@ static void fmt_bytecount(ByteIOContext *pb, int64_t count)
 static void compute_stats(HTTPContext *c)
 {
     HTTPContext *c1;
+    HTTPWorker *w;
     FFStream *stream;
+    char buf[32], ipaddr[INET_ADDRSTRLEN];
     char *p;
     time_t ti;
     int i, len;
@@ -1809,51 +2238,46 @@ static void compute_stats(HTTPContext *c)
     url_fprintf(pb, "<H2>Connection Status</H2>\n");
 
     url_fprintf(pb, "Number of connections: %d / %d<BR>\n",
-                 nb_connections, nb_max_connections);
+                 total_connections(), nb_max_connections);
 
     url_fprintf(pb, "Bandwidth in use: %dk / %dk<BR>\n",
-                 current_bandwidth, max_bandwidth);
+                 total_bandwidth(), max_bandwidth);
 
     url_fprintf(pb, "<TABLE>\n");
-    url_fprintf(pb, "<TR><th>#<th>File<th>IP<th>Proto<th>State<th>Target bits/sec<th>Actual bits/sec<th>Bytes transferred\n");
-    c1 = first_http_ctx;
+    url_fprintf(pb, "<TR><th>#<th>File<th>IP<th>Proto<th>State<th>Thread<th>Target bits/sec<th>Actual bits/sec<th>Bytes transferred\n");
     i = 0;
-    while (c1 != NULL) {
-        int bitrate;
-        int j;
-
-        bitrate = 0;
-        if (c1->stream) {
-            for (j = 0; j < c1->stream->nb_streams; j++) {
-                if (!c1->stream->feed)
-                    bitrate += c1->stream->streams[j]->codec->bit_rate;
-                else if (c1->feed_streams[j] >= 0)
-                    bitrate += c1->stream->feed->streams[c1->feed_streams[j]]->codec->bit_rate;
-            }
+    /* the connections of all workers, including this one, are shown as
+       their workers last copied them */
+    for (w = workers; w < workers + nb_workers; w++) {
+        LOCK_WORKER(w);
+        for (c1 = w->first_http_ctx; c1 != NULL; c1 = c1->next) {
+            ConnectionStats *s = &c1->stats;
+
+            i++;
+            inet_ntop(AF_INET, &c1->from_addr.sin_addr, ipaddr, sizeof(ipaddr));
+            url_fprintf(pb, "<TR><TD><B>%d</B><TD>%s%s<TD>%s<TD>%s<TD>%s<TD>%d<td align=right>",
+                        i,
+                        s->stream ? s->stream->filename : "",
+                        s->state == HTTPSTATE_RECEIVE_DATA ? "(input)" : "",
+                        ipaddr,
+                        s->protocol,
+                        http_state[s->state],
+                        (int)(w - workers));
+            fmt_bytecount(pb, s->bitrate);
+            url_fprintf(pb, "<td align=right>");
+            fmt_bytecount(pb, compute_datarate(&s->datarate, s->data_count,
+                                               c->worker->cur_time) * 8);
+            url_fprintf(pb, "<td align=right>");
+            fmt_bytecount(pb, s->data_count);
+            url_fprintf(pb, "\n");
         }
-
-        i++;
-        p = inet_ntoa(c1->from_addr.sin_addr);
-        url_fprintf(pb, "<TR><TD><B>%d</B><TD>%s%s<TD>%s<TD>%s<TD>%s<td align=right>",
-                    i,
-                    c1->stream ? c1->stream->filename : "",
-                    c1->state == HTTPSTATE_RECEIVE_DATA ? "(input)" : "",
-                    p,
-                    c1->protocol,
-                    http_state[c1->state]);
-        fmt_bytecount(pb, bitrate);
-        url_fprintf(pb, "<td align=right>");
-        fmt_bytecount(pb, compute_datarate(&c1->datarate, c1->data_count) * 8);
-        url_fprintf(pb, "<td align=right>");
-        fmt_bytecount(pb, c1->data_count);
-        url_fprintf(pb, "\n");
-        c1 = c1->next;
+        UNLOCK_WORKER(w);
     }
     url_fprintf(pb, "</TABLE>\n");
 
     /* date */
     ti = time(NULL);
-    p = ctime(&ti);
+    p = ctime_r(&ti, buf);
     url_fprintf(pb, "<HR size=1 noshade>Generated at %s", p);
     url_fprintf(pb, "</BODY>\n</HTML>\n");
 
@@ -1872,13 +2296,16 @@ static void open_parser(AVFormatContext *s, int i)
         codec = avcodec_find_decoder(st->codec->codec_id);
         if (codec && (codec->capabilities & CODEC_CAP_PARSE_ONLY)) {
             st->codec->parse_only = 1;
+            LOCK_CODECS();
             if (avcodec_open(st->codec, codec) < 0)
                 st->codec->parse_only = 0;
+            UNLOCK_CODECS();
         }
     }
 }
 
-static int open_input_stream(HTTPContext *c, const char *info)
+/* open the input of stream at the position requested in info */
+static AVFormatContext *open_stream_input(FFStream *stream, const char *info)
 {
     char buf[128];
     char input_filename[1024];
@@ -1887,36 +2314,36 @@ static int open_input_stream(HTTPContext *c, const char *info)
     int64_t stream_pos;
 
     /* find file name */
-    if (c->stream->feed) {
-        strcpy(input_filename, c->stream->feed->feed_filename);
-        buf_size = FFM_PACKET_SIZE;
+    if (stream->feed) {
+        strcpy(input_filename, stream->feed->feed_filename);
+        buf_size = stream->feed->feed_page_size;
         /* compute position (absolute time) */
         if (find_info_tag(buf, sizeof(buf), "date", info))
         {
             stream_pos = parse_date(buf, 0);
             if (stream_pos == INT64_MIN)
-                return -1;
+                return NULL;
         }
         else if (find_info_tag(buf, sizeof(buf), "buffer", info)) {
             int prebuffer = strtol(buf, 0, 10);
             stream_pos = av_gettime() - prebuffer * (int64_t)1000000;
         } else
-            stream_pos = av_gettime() - c->stream->prebuffer * (int64_t)1000;
+            stream_pos = av_gettime() - stream->prebuffer * (int64_t)1000;
     } else {
-        strcpy(input_filename, c->stream->feed_filename);
+        strcpy(input_filename, stream->feed_filename);
         buf_size = 0;
         /* compute position (relative time) */
         if (find_info_tag(buf, sizeof(buf), "date", info))
         {
             stream_pos = parse_date(buf, 1);
             if (stream_pos == INT64_MIN)
-                return -1;
+                return NULL;
         }
         else
             stream_pos = 0;
     }
     if (input_filename[0] == '\0')
-        return -1;
+        return NULL;
 
 #if 0
     { time_t when = stream_pos / 1000000;
@@ -1925,19 +2352,60 @@ static int open_input_stream(HTTPContext *c, const char *info)
 #endif
 
     /* open stream */
-    if ((ret = av_open_input_file(&s, input_filename, c->stream->ifmt,
-                                  buf_size, c->stream->ap_in)) < 0) {
+    if ((ret = av_open_input_file(&s, input_filename, stream->ifmt,
+                                  buf_size, stream->ap_in)) < 0) {
         http_log("could not open %s: %d\n", input_filename, ret);
-        return -1;
+        return NULL;
     }
     s->flags |= AVFMT_FLAG_GENPTS;
-    c->fmt_in = s;
-    av_find_stream_info(c->fmt_in);
+    LOCK_CODECS();
+    av_find_stream_info(s);
+    UNLOCK_CODECS();
 
     /* open each parser */
     for(i=0;i<s->nb_streams;i++)
         open_parser(s, i);
 
+    if (stream->feed) {
+        FFStream *feed = stream->feed;
+
+        /* seek with the pts of the pages in memory, the pages of the
+           feed may not change meanwhile */
+        LOCK_STREAM(feed);
+        ffm_set_write_index(s, feed->feed_write_index, feed->feed_size);
+        ffm_set_page_index(s, feed->page_pts, feed->nb_page_pts);
+        s->iformat->read_seek(s, 0, stream_pos, 0);
+        ffm_set_page_index(s, NULL, 0);
+        UNLOCK_STREAM(feed);
+    } else if (s->iformat->read_seek)
+        s->iformat->read_seek(s, 0, stream_pos, 0);
+    return s;
+}
+
+static void close_stream_input(AVFormatContext *s)
+{
+    AVStream *st;
+    int i;
+
+    /* close each frame parser */
+    LOCK_CODECS();
+    for(i=0;i<s->nb_streams;i++) {
+        st = s->streams[i];
+        if (st->codec->codec)
+            avcodec_close(st->codec);
+    }
+    UNLOCK_CODECS();
+    av_close_input_file(s);
+}
+
+static int open_input_stream(HTTPContext *c, const char *info)
+{
+    int i;
+
+    c->fmt_in = open_stream_input(c->stream, info);
+    if (!c->fmt_in)
+        return -1;
+
     /* choose stream as clock source (we favorize video stream if
        present) for packet sending */
     c->pts_stream_index = 0;
@@ -1948,12 +2416,8 @@ static int open_input_stream(HTTPContext *c, const char *info)
         }
     }
 
-#if 1
-    if (c->fmt_in->iformat->read_seek)
-        c->fmt_in->iformat->read_seek(c->fmt_in, 0, stream_pos, 0);
-#endif
     /* set the start time (needed for maxtime and RTP packet timing) */
-    c->start_time = cur_time;
+    c->start_time = c->worker->cur_time;
     c->first_pts = AV_NOPTS_VALUE;
     return 0;
 }
@@ -1962,7 +2426,7 @@ static int open_input_stream(HTTPContext *c, const char *info)
 static int64_t get_server_clock(HTTPContext *c)
 {
     /* compute current pts value from system time */
-    return (cur_time - c->start_time) * 1000;
+    return (c->worker->cur_time - c->start_time) * 1000;
 }
 
 /* return the estimated time at which the current packet must be sent
@@ -1981,6 +2445,383 @@ static int64_t get_packet_send_clock(HTTPContext *c)
     }
 }
 
+/* set up ctx to mux the streams of stream and write its header, return the
+   header size and the header in *pbuffer, or -1 on error */
+static int open_output_stream(FFStream *stream, AVFormatContext *ctx,
+                              uint8_t **pbuffer)
+{
+    int i;
+
+    memset(ctx, 0, sizeof(*ctx));
+    av_strlcpy(ctx->author, stream->author, sizeof(ctx->author));
+    av_strlcpy(ctx->comment, stream->comment, sizeof(ctx->comment));
+    av_strlcpy(ctx->copyright, stream->copyright, sizeof(ctx->copyright));
+    av_strlcpy(ctx->title, stream->title, sizeof(ctx->title));
+
+    /* open output stream by using specified codecs */
+    ctx->oformat = stream->fmt;
+    /* a feed is sent with the page size it is stored with */
+    if (stream->feed == stream)
+        ctx->packet_size = stream->feed_page_size;
+    ctx->streams = av_mallocz(stream->nb_streams * sizeof(AVStream *));
+    if (!ctx->streams)
+        return -1;
+    ctx->nb_streams = stream->nb_streams;
+    for(i=0;i<ctx->nb_streams;i++) {
+        AVStream *st;
+        AVStream *src;
+        st = av_mallocz(sizeof(AVStream));
+        st->codec= avcodec_alloc_context();
+        ctx->streams[i] = st;
+        /* if file or feed, then just take streams from FFStream struct */
+        if (!stream->feed ||
+            stream->feed == stream)
+            src = stream->streams[i];
+        else
+            src = stream->feed->streams[stream->feed_streams[i]];
+
+        *st = *src;
+        st->priv_data = 0;
+        st->codec->frame_number = 0; /* XXX: should be done in
+                                       AVStream, not in codec */
+    }
+
+    /* prepare header and save header data in a stream */
+    if (url_open_dyn_buf(&ctx->pb) < 0) {
+        /* XXX: potential leak */
+        return -1;
+    }
+    ctx->pb->is_streamed = 1;
+
+    av_set_parameters(ctx, NULL);
+    if (av_write_header(ctx) < 0) {
+        http_log("Error writing output header\n");
+        url_close_dyn_buf(ctx->pb, pbuffer);
+        av_freep(pbuffer);
+        return -1;
+    }
+
+    return url_close_dyn_buf(ctx->pb, pbuffer);
+}
+
+/* viewers of a live stream share its output, unless they ask for another
+   position in the feed */
+static int use_stream_cache(FFStream *stream, const char *info)
+{
+    char buf[128];
+
+    return stream->feed && stream->feed != stream &&
+           !find_info_tag(buf, sizeof(buf), "date", info) &&
+           !find_info_tag(buf, sizeof(buf), "buffer", info);
+}
+
+static void release_chunk(StreamChunk *chunk)
+{
+    if (--chunk->ref_count == 0) {
+        av_free(chunk->data);
+        av_free(chunk);
+    }
+}
+
+static void free_stream_cache(StreamCache *cache)
+{
+    AVFormatContext *ctx = &cache->fmt_ctx;
+    uint8_t *buf;
+    int i;
+
+    if (cache->fmt_in)
+        close_stream_input(cache->fmt_in);
+
+    /* let the muxer free its data */
+    if (cache->header && !cache->eof && url_open_dyn_buf(&ctx->pb) >= 0) {
+        av_write_trailer(ctx);
+        url_close_dyn_buf(ctx->pb, &buf);
+        av_free(buf);
+    }
+    for(i=0; i<ctx->nb_streams; i++)
+        av_free(ctx->streams[i]);
+    av_free(ctx->streams);
+    av_free(ctx->priv_data);
+
+    for(i = 0; i < CACHE_CHUNKS; i++) {
+        if (cache->chunks[i])
+            release_chunk(cache->chunks[i]);
+    }
+    av_free(cache->header);
+    av_free(cache->trailer);
+    av_free(cache);
+}
+
+/* make c a viewer of the shared output of its stream, which is opened
+   by the first viewer */
+static int open_stream_cache(HTTPContext *c)
+{
+    FFStream *stream = c->stream;
+    StreamCache *cache;
+    int ret = 0;
+
+    LOCK_STREAM(stream);
+    cache = stream->cache;
+    /* once the feed ended, new viewers start over */
+    if (!cache || cache->eof) {
+        cache = av_mallocz(sizeof(StreamCache));
+        if (!cache) {
+            ret = -1;
+            goto end;
+        }
+        cache->stream = stream;
+        cache->key_seq = -1;
+        cache->fmt_in = open_stream_input(stream, "");
+        if (cache->fmt_in)
+            cache->header_size = open_output_stream(stream, &cache->fmt_ctx,
+                                                    &cache->header);
+        if (!cache->fmt_in || cache->header_size < 0) {
+            free_stream_cache(cache);
+            ret = -1;
+            goto end;
+        }
+        stream->cache = cache;
+    }
+    cache->nb_viewers++;
+    c->cache = cache;
+ end:
+    UNLOCK_STREAM(stream);
+    return ret;
+}
+
+static void close_stream_cache(HTTPContext *c)
+{
+    StreamCache *cache = c->cache;
+    int i;
+
+    LOCK_STREAM(c->stream);
+    for(i = 0; i < c->nb_chunks; i++)
+        release_chunk(c->chunks[i]);
+    c->nb_chunks = 0;
+    if (--cache->nb_viewers == 0) {
+        if (c->stream->cache == cache)
+            c->stream->cache = NULL;
+        free_stream_cache(cache);
+    }
+    UNLOCK_STREAM(c->stream);
+    c->cache = NULL;
+}
+
+/* mux the next packet of the feed which gives some output into a new
+   chunk. Return 1 if a chunk was added, 0 if the feed has no data for now
+   and -1 at the end of the stream. The lock of the stream must be held */
+static int fill_stream_cache(StreamCache *cache)
+{
+    FFStream *stream = cache->stream, *feed = stream->feed;
+    AVFormatContext *ctx = &cache->fmt_ctx;
+    StreamChunk *chunk, **slot;
+    AVStream *st;
+    AVPacket pkt;
+    uint8_t *data;
+    int i, len, opened;
+
+    if (cache->eof)
+        return -1;
+
+    for(;;) {
+        LOCK_STREAM(feed);
+        ffm_set_write_index(cache->fmt_in,
+                            feed->feed_write_index, feed->feed_size);
+        UNLOCK_STREAM(feed);
+
+        if (av_read_frame(cache->fmt_in, &pkt) < 0) {
+            /* the end of the ffm file, wait for more data */
+            LOCK_STREAM(feed);
+            opened = feed->feed_opened;
+            UNLOCK_STREAM(feed);
+            if (opened)
+                return 0;
+            break;
+        }
+
+        /* select the streams of the feed we output */
+        for(i = 0; i < stream->nb_streams; i++) {
+            if (stream->feed_streams[i] == pkt.stream_index)
+                break;
+        }
+        if (i == stream->nb_streams) {
+            av_free_packet(&pkt);
+            continue;
+        }
+        st = cache->fmt_in->streams[pkt.stream_index];
+        if (pkt.flags & PKT_FLAG_KEY &&
+            (st->codec->codec_type == CODEC_TYPE_VIDEO ||
+             stream->nb_streams == 1))
+            cache->key_pending = 1;
+
+        pkt.stream_index = i;
+        if (pkt.dts != AV_NOPTS_VALUE) {
+            cache->last_pts = av_rescale_q(pkt.dts, st->time_base,
+                                           AV_TIME_BASE_Q);
+            pkt.dts = av_rescale_q(pkt.dts, st->time_base,
+                                   ctx->streams[i]->time_base);
+        }
+        if (pkt.pts != AV_NOPTS_VALUE)
+            pkt.pts = av_rescale_q(pkt.pts, st->time_base,
+                                   ctx->streams[i]->time_base);
+        if (url_open_dyn_buf(&ctx->pb) < 0) {
+            av_free_packet(&pkt);
+            break;
+        }
+        ctx->pb->is_streamed = 1;
+        if (av_write_frame(ctx, &pkt) < 0)
+            http_log("Error writing frame to output\n");
+        len = url_close_dyn_buf(ctx->pb, &data);
+        ctx->streams[i]->codec->frame_number++;
+        av_free_packet(&pkt);
+        if (len == 0) {
+            av_free(data);
+            continue;
+        }
+
+        chunk = av_mallocz(sizeof(StreamChunk));
+        if (!chunk) {
+            av_free(data);
+            break;
+        }
+        chunk->data = data;
+        chunk->size = len;
+        chunk->key = cache->key_pending;
+        chunk->pts = cache->last_pts;
+        chunk->ref_count = 1;
+        cache->key_pending = 0;
+
+        /* replace the oldest chunk */
+        slot = &cache->chunks[cache->next_seq % CACHE_CHUNKS];
+        if (*slot)
+            release_chunk(*slot);
+        *slot = chunk;
+        if (chunk->key)
+            cache->key_seq = cache->next_seq;
+        else if (cache->key_seq >= 0 &&
+                 cache->key_seq <= cache->next_seq - CACHE_CHUNKS)
+            cache->key_seq = -1;
+        cache->next_seq++;
+        return 1;
+    }
+
+    if (url_open_dyn_buf(&ctx->pb) >= 0) {
+        ctx->pb->is_streamed = 1;
+        av_write_trailer(ctx);
+        cache->trailer_size = url_close_dyn_buf(ctx->pb, &cache->trailer);
+    }
+    cache->eof = 1;
+    return -1;
+}
+
+/* return the chunk a new viewer starts with: the latest key chunk which
+   is at least the prebuffer time old, or the oldest key chunk kept */
+static int64_t find_join_point(StreamCache *cache)
+{
+    int64_t seq, join = cache->next_seq;
+    int64_t start = FFMAX(cache->next_seq - CACHE_CHUNKS, 0);
+    int64_t join_pts = cache->last_pts - cache->stream->prebuffer * (int64_t)1000;
+    StreamChunk *chunk;
+
+    for(seq = cache->next_seq - 1; seq >= start; seq--) {
+        chunk = cache->chunks[seq % CACHE_CHUNKS];
+        if (chunk->key) {
+            join = seq;
+            if (chunk->pts <= join_pts)
+                break;
+        }
+    }
+    return join;
+}
+
+/* take the next chunks of the shared output of the stream, same return
+   values as http_prepare_data() */
+static int http_prepare_cached_data(HTTPContext *c)
+{
+    StreamCache *cache = c->cache;
+    StreamChunk *chunk;
+    int ret = -1;
+
+    if (c->stream->max_time &&
+        c->stream->max_time + c->start_time - c->worker->cur_time < 0) {
+        /* We have timed out */
+        c->state = HTTPSTATE_SEND_DATA_TRAILER;
+        return 0;
+    }
+
+    LOCK_STREAM(c->stream);
+    while (c->nb_chunks < CHUNK_BATCH) {
+        if (c->cache_seq < cache->next_seq - CACHE_CHUNKS) {
+            /* the viewer is too slow, the chunks it needs were dropped */
+            c->cache_seq = cache->key_seq >= 0 ? cache->key_seq :
+                                                 cache->next_seq;
+            c->got_key_frame = 0;
+        }
+        if (c->cache_seq == cache->next_seq &&
+            (ret = fill_stream_cache(cache)) <= 0)
+            break;
+
+        /* start with a key chunk */
+        chunk = cache->chunks[c->cache_seq++ % CACHE_CHUNKS];
+        if (chunk->key)
+            c->got_key_frame = 1;
+        if (c->got_key_frame) {
+            chunk->ref_count++;
+            c->chunks[c->nb_chunks++] = chunk;
+        }
+    }
+    UNLOCK_STREAM(c->stream);
+
+    if (c->nb_chunks) {
+        c->buffer_ptr = c->chunks[0]->data;
+        c->buffer_end = c->chunks[0]->data + c->chunks[0]->size;
+        return 0;
+    }
+    if (ret == 0) {
+        /* wait for the feed */
+        c->state = HTTPSTATE_WAIT_FEED;
+        return 1; /* state changed */
+    }
+    c->state = HTTPSTATE_SEND_DATA_TRAILER;
+    return 0;
+}
+
+/* send the chunks taken from the stream cache with one system call */
+static int send_chunks(HTTPContext *c)
+{
+    struct iovec iov[CHUNK_BATCH];
+    int i, n, len, left;
+
+    iov[0].iov_base = c->buffer_ptr;
+    iov[0].iov_len  = c->buffer_end - c->buffer_ptr;
+    for(i = 1; i < c->nb_chunks; i++) {
+        iov[i].iov_base = c->chunks[i]->data;
+        iov[i].iov_len  = c->chunks[i]->size;
+    }
+    len = writev(c->fd, iov, c->nb_chunks);
+    if (len <= 0)
+        return len;
+
+    /* release the chunks entirely sent */
+    left = len;
+    for(n = 0; n < c->nb_chunks && left >= (int)iov[n].iov_len; n++)
+        left -= iov[n].iov_len;
+    if (n > 0) {
+        LOCK_STREAM(c->stream);
+        for(i = 0; i < n; i++)
+            release_chunk(c->chunks[i]);
+        UNLOCK_STREAM(c->stream);
+        c->nb_chunks -= n;
+        memmove(c->chunks, c->chunks + n, c->nb_chunks * sizeof(StreamChunk *));
+        if (c->nb_chunks) {
+            c->buffer_ptr = c->chunks[0]->data;
+            c->buffer_end = c->chunks[0]->data + c->chunks[0]->size;
+        } else
+            c->buffer_ptr = c->buffer_end = c->buffer;
+    }
+    c->buffer_ptr += left;
+    return len;
+}
 
 static int http_prepare_data(HTTPContext *c)
 {
@@ -1990,76 +2831,54 @@ static int http_prepare_data(HTTPContext *c)
     av_freep(&c->pb_buffer);
     switch(c->state) {
     case HTTPSTATE_SEND_DATA_HEADER:
-        memset(&c->fmt_ctx, 0, sizeof(c->fmt_ctx));
-        av_strlcpy(c->fmt_ctx.author, c->stream->author,
-                   sizeof(c->fmt_ctx.author));
-        av_strlcpy(c->fmt_ctx.comment, c->stream->comment,
-                   sizeof(c->fmt_ctx.comment));
-        av_strlcpy(c->fmt_ctx.copyright, c->stream->copyright,
-                   sizeof(c->fmt_ctx.copyright));
-        av_strlcpy(c->fmt_ctx.title, c->stream->title,
-                   sizeof(c->fmt_ctx.title));
-
-        /* open output stream by using specified codecs */
-        c->fmt_ctx.oformat = c->stream->fmt;
-        c->fmt_ctx.nb_streams = c->stream->nb_streams;
-        for(i=0;i<c->fmt_ctx.nb_streams;i++) {
-            AVStream *st;
-            AVStream *src;
-            st = av_mallocz(sizeof(AVStream));
-            st->codec= avcodec_alloc_context();
-            c->fmt_ctx.streams[i] = st;
-            /* if file or feed, then just take streams from FFStream struct */
-            if (!c->stream->feed ||
-                c->stream->feed == c->stream)
-                src = c->stream->streams[i];
-            else
-                src = c->stream->feed->streams[c->stream->feed_streams[i]];
-
-            *st = *src;
-            st->priv_data = 0;
-            st->codec->frame_number = 0; /* XXX: should be done in
-                                           AVStream, not in codec */
-        }
         c->got_key_frame = 0;
-
-        /* prepare header and save header data in a stream */
-        if (url_open_dyn_buf(&c->fmt_ctx.pb) < 0) {
-            /* XXX: potential leak */
-            return -1;
-        }
-        c->fmt_ctx.pb->is_streamed = 1;
-
-        av_set_parameters(&c->fmt_ctx, NULL);
-        if (av_write_header(&c->fmt_ctx) < 0) {
-            http_log("Error writing output header\n");
-            return -1;
+        if (c->cache) {
+            /* the header was written once for all the viewers */
+            LOCK_STREAM(c->stream);
+            c->cache_seq = find_join_point(c->cache);
+            UNLOCK_STREAM(c->stream);
+            c->buffer_ptr = c->cache->header;
+            c->buffer_end = c->cache->header + c->cache->header_size;
+        } else {
+            len = open_output_stream(c->stream, &c->fmt_ctx, &c->pb_buffer);
+            if (len < 0)
+                return -1;
+            c->buffer_ptr = c->pb_buffer;
+            c->buffer_end = c->pb_buffer + len;
         }
 
-        len = url_close_dyn_buf(c->fmt_ctx.pb, &c->pb_buffer);
-        c->buffer_ptr = c->pb_buffer;
-        c->buffer_end = c->pb_buffer + len;
-
         c->state = HTTPSTATE_SEND_DATA;
         c->last_packet_sent = 0;
         break;
     case HTTPSTATE_SEND_DATA:
+        if (c->cache)
+            return http_prepare_cached_data(c);
+
         /* find a new packet */
         /* read a packet from the input stream */
-        if (c->stream->feed)
+        if (c->stream->feed) {
+            LOCK_STREAM(c->stream->feed);
             ffm_set_write_index(c->fmt_in,
                                 c->stream->feed->feed_write_index,
                                 c->stream->feed->feed_size);
+            UNLOCK_STREAM(c->stream->feed);
+        }
 
         if (c->stream->max_time &&
-            c->stream->max_time + c->start_time - cur_time < 0)
+            c->stream->max_time + c->start_time - c->worker->cur_time < 0)
             /* We have timed out */
             c->state = HTTPSTATE_SEND_DATA_TRAILER;
         else {
             AVPacket pkt;
         redo:
             if (av_read_frame(c->fmt_in, &pkt) < 0) {
-                if (c->stream->feed && c->stream->feed->feed_opened) {
+                int feed_opened = 0;
+                if (c->stream->feed) {
+                    LOCK_STREAM(c->stream->feed);
+                    feed_opened = c->stream->feed->feed_opened;
+                    UNLOCK_STREAM(c->stream->feed);
+                }
+                if (feed_opened) {
                     /* if coming from feed, it means we reached the end of the
                        ffm file, so must wait for more data */
                     c->state = HTTPSTATE_WAIT_FEED;
@@ -2082,7 +2901,7 @@ static int http_prepare_data(HTTPContext *c)
                 /* update first pts if needed */
                 if (c->first_pts == AV_NOPTS_VALUE) {
                     c->first_pts = av_rescale_q(pkt.dts, c->fmt_in->streams[pkt.stream_index]->time_base, AV_TIME_BASE_Q);
-                    c->start_time = cur_time;
+                    c->start_time = c->worker->cur_time;
                 }
                 /* send it to the appropriate stream */
                 if (c->stream->feed) {
@@ -2112,6 +2931,11 @@ static int http_prepare_data(HTTPContext *c)
                 } else {
                     AVCodecContext *codec;
 
+                    /* streams the file added after ffserver started */
+                    if (pkt.stream_index >= c->stream->nb_streams) {
+                        av_free_packet(&pkt);
+                        break;
+                    }
                 send_it:
                     /* specific handling for RTP: we use several
                        output stream (one for each RTP
@@ -2162,7 +2986,7 @@ static int http_prepare_data(HTTPContext *c)
                         /* XXX: potential leak */
                         return -1;
                     }
-                    c->fmt_ctx.pb->is_streamed = 1;
+                    ctx->pb->is_streamed = 1;
                     if (pkt.dts != AV_NOPTS_VALUE)
                         pkt.dts = av_rescale_q(pkt.dts,
                                                c->fmt_in->streams[source_index]->time_base,
@@ -2196,6 +3020,15 @@ static int http_prepare_data(HTTPContext *c)
         /* last packet test ? */
         if (c->last_packet_sent || c->is_packetized)
             return -1;
+        if (c->cache) {
+            /* the trailer is only there if the feed ended */
+            LOCK_STREAM(c->stream);
+            c->buffer_ptr = c->cache->trailer;
+            c->buffer_end = c->cache->trailer + c->cache->trailer_size;
+            UNLOCK_STREAM(c->stream);
+            c->last_packet_sent = 1;
+            break;
+        }
         ctx = &c->fmt_ctx;
         /* prepare header */
         if (url_open_dyn_buf(&ctx->pb) < 0) {
@@ -2251,9 +3084,12 @@ static int http_send_data(HTTPContext *c)
                 }
 
                 c->data_count += len;
-                update_datarate(&c->datarate, c->data_count);
-                if (c->stream)
+                update_datarate(&c->datarate, c->data_count, c->worker->cur_time);
+                if (c->stream) {
+                    LOCK_STREAM(c->stream);
                     c->stream->bytes_served += len;
+                    UNLOCK_STREAM(c->stream);
+                }
 
                 if (c->rtp_protocol == RTSP_PROTOCOL_RTP_TCP) {
                     /* RTP packets are sent inside the RTSP TCP connection */
@@ -2314,7 +3150,10 @@ static int http_send_data(HTTPContext *c)
                 }
             } else {
                 /* TCP data output */
-                len = send(c->fd, c->buffer_ptr, c->buffer_end - c->buffer_ptr, 0);
+                if (c->nb_chunks)
+                    len = send_chunks(c);
+                else if ((len = send(c->fd, c->buffer_ptr, c->buffer_end - c->buffer_ptr, 0)) > 0)
+                    c->buffer_ptr += len;
                 if (len < 0) {
                     if (ff_neterrno() != FF_NETERROR(EAGAIN) &&
                         ff_neterrno() != FF_NETERROR(EINTR))
@@ -2322,13 +3161,15 @@ static int http_send_data(HTTPContext *c)
                         return -1;
                     else
                         return 0;
-                } else
-                    c->buffer_ptr += len;
+                }
 
                 c->data_count += len;
-                update_datarate(&c->datarate, c->data_count);
-                if (c->stream)
+                update_datarate(&c->datarate, c->data_count, c->worker->cur_time);
+                if (c->stream) {
+                    LOCK_STREAM(c->stream);
                     c->stream->bytes_served += len;
+                    UNLOCK_STREAM(c->stream);
+                }
                 break;
             }
         }
@@ -2347,12 +3188,29 @@ static int http_start_receive_data(HTTPContext *c)
     if (c->stream->readonly)
         return -1;
 
+    /* the pages are received whole */
+    if (c->buffer_size < c->stream->feed_page_size) {
+        uint8_t *buffer = av_realloc(c->buffer, c->stream->feed_page_size);
+        if (!buffer)
+            return -1;
+        c->buffer = buffer;
+        c->buffer_size = c->stream->feed_page_size;
+    }
+
     /* open feed */
     fd = open(c->stream->feed_filename, O_RDWR);
     if (fd < 0) {
         http_log("Error opening feeder file: %s\n", strerror(errno));
         return -1;
     }
+
+    /* another worker may have opened the feed meanwhile */
+    LOCK_STREAM(c->stream);
+    if (c->stream->feed_opened) {
+        UNLOCK_STREAM(c->stream);
+        close(fd);
+        return -1;
+    }
     c->feed_fd = fd;
 
     c->stream->feed_write_index = ffm_read_write_index(fd);
@@ -2361,14 +3219,57 @@ static int http_start_receive_data(HTTPContext *c)
 
     /* init buffer input */
     c->buffer_ptr = c->buffer;
-    c->buffer_end = c->buffer + FFM_PACKET_SIZE;
+    c->buffer_end = c->buffer + c->stream->feed_page_size;
     c->stream->feed_opened = 1;
+    UNLOCK_STREAM(c->stream);
     return 0;
 }
 
-static int http_receive_data(HTTPContext *c)
+/* wake up the connections waiting for the feed c is writing to */
+static void wake_up_feed_readers(HTTPContext *c, enum HTTPState state)
 {
     HTTPContext *c1;
+    int i;
+
+    for(c1 = c->worker->first_http_ctx; c1 != NULL; c1 = c1->next) {
+        if (c1->state == HTTPSTATE_WAIT_FEED &&
+            c1->stream->feed == c->stream->feed)
+            /* the viewers of a stream cache first send what is left
+               in it, then its trailer */
+            c1->state = c1->cache ? HTTPSTATE_SEND_DATA : state;
+    }
+
+    /* the connections of the other workers find out themselves whether
+       the feed has data or was closed */
+    for(i = 0; i < nb_workers; i++) {
+        if (&workers[i] != c->worker)
+            signal_worker(&workers[i]);
+    }
+}
+
+/* remember the pts of the page written at pos, so that seeking in the
+   feed needs not read the page headers back from the file */
+static void index_feed_page(FFStream *feed, int64_t pos, const uint8_t *page)
+{
+    int n = pos / feed->feed_page_size;
+
+    if (n >= feed->nb_page_pts) {
+        int i, nb = FFMAX(2 * feed->nb_page_pts, n + 1);
+        int64_t *page_pts = av_realloc(feed->page_pts, nb * sizeof(int64_t));
+
+        if (!page_pts)
+            return;
+        for(i = feed->nb_page_pts; i < nb; i++)
+            page_pts[i] = AV_NOPTS_VALUE;
+        feed->page_pts = page_pts;
+        feed->nb_page_pts = nb;
+    }
+    feed->page_pts[n] = AV_RB64(page + 4);
+}
+
+static int http_receive_data(HTTPContext *c)
+{
+    FFStream *feed = c->stream;
 
     if (c->buffer_end > c->buffer_ptr) {
         int len;
@@ -2385,11 +3286,11 @@ static int http_receive_data(HTTPContext *c)
         else {
             c->buffer_ptr += len;
             c->data_count += len;
-            update_datarate(&c->datarate, c->data_count);
+            update_datarate(&c->datarate, c->data_count, c->worker->cur_time);
         }
     }
 
-    if (c->buffer_ptr - c->buffer >= 2 && c->data_count > FFM_PACKET_SIZE) {
+    if (c->buffer_ptr - c->buffer >= 2 && c->data_count > feed->feed_page_size) {
         if (c->buffer[0] != 'f' ||
             c->buffer[1] != 'm') {
             http_log("Feed stream has become desynchronized -- disconnecting\n");
@@ -2398,37 +3299,34 @@ static int http_receive_data(HTTPContext *c)
     }
 
     if (c->buffer_ptr >= c->buffer_end) {
-        FFStream *feed = c->stream;
         /* a packet has been received : write it in the store, except
            if header */
-        if (c->data_count > FFM_PACKET_SIZE) {
+        if (c->data_count > feed->feed_page_size) {
 
             //            printf("writing pos=0x%"PRIx64" size=0x%"PRIx64"\n", feed->feed_write_index, feed->feed_size);
-            /* XXX: use llseek or url_seek */
-            lseek(c->feed_fd, feed->feed_write_index, SEEK_SET);
-            if (write(c->feed_fd, c->buffer, FFM_PACKET_SIZE) < 0) {
+            if (pwrite(c->feed_fd, c->buffer, feed->feed_page_size,
+                       feed->feed_write_index) < 0) {
                 http_log("Error writing to feed file: %s\n", strerror(errno));
                 goto fail;
             }
 
-            feed->feed_write_index += FFM_PACKET_SIZE;
+            LOCK_STREAM(feed);
+            index_feed_page(feed, feed->feed_write_index, c->buffer);
+            feed->feed_write_index += feed->feed_page_size;
             /* update file size */
             if (feed->feed_write_index > c->stream->feed_size)
                 feed->feed_size = feed->feed_write_index;
 
             /* handle wrap around if max file size reached */
             if (c->stream->feed_max_size && feed->feed_write_index >= c->stream->feed_max_size)
-                feed->feed_write_index = FFM_PACKET_SIZE;
+                feed->feed_write_index = feed->feed_page_size;
+            UNLOCK_STREAM(feed);
 
             /* write index */
             ffm_write_write_index(c->feed_fd, feed->feed_write_index);
 
             /* wake up any waiting connections */
-            for(c1 = first_http_ctx; c1 != NULL; c1 = c1->next) {
-                if (c1->state == HTTPSTATE_WAIT_FEED &&
-                    c1->stream->feed == c->stream->feed)
-                    c1->state = HTTPSTATE_SEND_DATA;
-            }
+            wake_up_feed_readers(c, HTTPSTATE_SEND_DATA);
         } else {
             /* We have a header in our hands that contains useful data */
             AVFormatContext s;
@@ -2437,6 +3335,12 @@ static int http_receive_data(HTTPContext *c)
 
             memset(&s, 0, sizeof(s));
 
+            if (AV_RB32(c->buffer + 4) != feed->feed_page_size) {
+                http_log("Feed pages of %d bytes instead of %d -- disconnecting\n",
+                         AV_RB32(c->buffer + 4), feed->feed_page_size);
+                goto fail;
+            }
+
             url_open_buf(&s.pb, c->buffer, c->buffer_end - c->buffer, URL_RDONLY);
             s.pb->is_streamed = 1;
 
@@ -2459,12 +3363,14 @@ static int http_receive_data(HTTPContext *c)
 
             /* Now we have the actual streams */
             if (s.nb_streams != feed->nb_streams) {
+                fmt_in->read_close(&s);
                 av_freep(&s.priv_data);
                 goto fail;
             }
             for (i = 0; i < s.nb_streams; i++)
                 memcpy(feed->streams[i]->codec,
                        s.streams[i]->codec, sizeof(AVCodecContext));
+            fmt_in->read_close(&s);
             av_freep(&s.priv_data);
         }
         c->buffer_ptr = c->buffer;
@@ -2472,14 +3378,12 @@ static int http_receive_data(HTTPContext *c)
 
     return 0;
  fail:
+    LOCK_STREAM(c->stream);
     c->stream->feed_opened = 0;
+    UNLOCK_STREAM(c->stream);
     close(c->feed_fd);
     /* wake up any waiting connections to stop waiting for feed */
-    for(c1 = first_http_ctx; c1 != NULL; c1 = c1->next) {
-        if (c1->state == HTTPSTATE_WAIT_FEED &&
-            c1->stream->feed == c->stream->feed)
-            c1->state = HTTPSTATE_SEND_DATA_TRAILER;
-    }
+    wake_up_feed_readers(c, HTTPSTATE_SEND_DATA_TRAILER);
     return -1;
 }
 
@@ -2646,8 +3550,12 @@ static int prepare_sdp_description(FFStream *stream, uint8_t **pbuffer,
 {
     AVFormatContext *avc;
     AVStream avs[MAX_STREAMS];
+    AVStream *avs_ptr[MAX_STREAMS];
+    char ipaddr[INET_ADDRSTRLEN];
     int i;
 
+    if (stream->nb_streams > MAX_STREAMS)
+        return -1;
     avc =  av_alloc_format_context();
     if (avc == NULL) {
         return -1;
@@ -2657,10 +3565,12 @@ static int prepare_sdp_description(FFStream *stream, uint8_t **pbuffer,
     } else {
         av_strlcpy(avc->title, "No Title", sizeof(avc->title));
     }
+    avc->streams = avs_ptr;
     avc->nb_streams = stream->nb_streams;
     if (stream->is_multicast) {
+        inet_ntop(AF_INET, &stream->multicast_ip, ipaddr, sizeof(ipaddr));
         snprintf(avc->filename, 1024, "rtp://%s:%d?multicast=1?ttl=%d",
-                 inet_ntoa(stream->multicast_ip),
+                 ipaddr,
                  stream->multicast_port, stream->multicast_ttl);
     }
 
@@ -2735,7 +3645,8 @@ static HTTPContext *find_rtp_session(const char *session_id)
     if (session_id[0] == '\0')
         return NULL;
 
-    for(c = first_http_ctx; c != NULL; c = c->next) {
+    /* the RTP sessions are all served by the first worker */
+    for(c = workers->first_http_ctx; c != NULL; c = c->next) {
         if (!strcmp(c->session_id, session_id))
             return c;
     }
@@ -2805,7 +3716,7 @@ static void rtsp_cmd_setup(HTTPContext *c, const char *url,
     /* generate session id if needed */
     if (h->session_id[0] == '\0')
         snprintf(h->session_id, sizeof(h->session_id), "%08x%08x",
-                 av_random(&random_state), av_random(&random_state));
+                 av_random(&c->worker->random_state), av_random(&c->worker->random_state));
 
     /* find rtp session, and create it if none found */
     rtp_c = find_rtp_session(h->session_id);
@@ -2820,8 +3731,8 @@ static void rtsp_cmd_setup(HTTPContext *c, const char *url,
             }
         }
 
-        rtp_c = rtp_new_connection(&c->from_addr, stream, h->session_id,
-                                   th->protocol);
+        rtp_c = rtp_new_connection(c->worker, &c->from_addr, stream,
+                                   h->session_id, th->protocol);
         if (!rtp_c) {
             rtsp_reply_error(c, RTSP_STATUS_BANDWIDTH);
             return;
@@ -3013,7 +3924,8 @@ static void rtsp_cmd_teardown(HTTPContext *c, const char *url, RTSPHeader *h)
 /********************************************************************/
 /* RTP handling */
 
-static HTTPContext *rtp_new_connection(struct sockaddr_in *from_addr,
+static HTTPContext *rtp_new_connection(HTTPWorker *w,
+                                       struct sockaddr_in *from_addr,
                                        FFStream *stream, const char *session_id,
                                        enum RTSPProtocol rtp_protocol)
 {
@@ -3022,7 +3934,7 @@ static HTTPContext *rtp_new_connection(struct sockaddr_in *from_addr,
 
     /* XXX: should output a warning page when coming
        close to the connection limit */
-    if (nb_connections >= nb_max_connections)
+    if (total_connections() >= nb_max_connections)
         goto fail;
 
     /* add a new connection */
@@ -3031,13 +3943,12 @@ static HTTPContext *rtp_new_connection(struct sockaddr_in *from_addr,
         goto fail;
 
     c->fd = -1;
-    c->poll_entry = NULL;
+    c->worker = w;
     c->from_addr = *from_addr;
     c->buffer_size = IOBUFFER_INIT_SIZE;
     c->buffer = av_malloc(c->buffer_size);
     if (!c->buffer)
         goto fail;
-    nb_connections++;
     c->stream = stream;
     av_strlcpy(c->session_id, session_id, sizeof(c->session_id));
     c->state = HTTPSTATE_READY;
@@ -3062,10 +3973,12 @@ static HTTPContext *rtp_new_connection(struct sockaddr_in *from_addr,
     av_strlcpy(c->protocol, "RTP/", sizeof(c->protocol));
     av_strlcat(c->protocol, proto_str, sizeof(c->protocol));
 
-    current_bandwidth += stream->bandwidth;
-
-    c->next = first_http_ctx;
-    first_http_ctx = c;
+    LOCK_WORKER(w);
+    w->current_bandwidth += stream->bandwidth;
+    c->next = w->first_http_ctx;
+    w->first_http_ctx = c;
+    w->nb_connections++;
+    UNLOCK_WORKER(w);
     return c;
 
  fail:
@@ -3085,7 +3998,7 @@ static int rtp_new_av_stream(HTTPContext *c,
 {
     AVFormatContext *ctx;
     AVStream *st;
-    char *ipaddr;
+    char ipaddr[INET_ADDRSTRLEN];
     URLContext *h = NULL;
     uint8_t *dummy_buf;
     char buf2[32];
@@ -3097,6 +4010,9 @@ static int rtp_new_av_stream(HTTPContext *c,
         return -1;
     ctx->oformat = guess_format("rtp", NULL, NULL);
 
+    ctx->streams = av_mallocz(sizeof(*ctx->streams));
+    if (!ctx->streams)
+        goto fail;
     st = av_mallocz(sizeof(AVStream));
     if (!st)
         goto fail;
@@ -3114,7 +4030,7 @@ static int rtp_new_av_stream(HTTPContext *c,
     st->priv_data = NULL;
 
     /* build destination RTP address */
-    ipaddr = inet_ntoa(dest_addr->sin_addr);
+    inet_ntop(AF_INET, &dest_addr->sin_addr, ipaddr, sizeof(ipaddr));
 
     switch(c->rtp_protocol) {
     case RTSP_PROTOCOL_RTP_UDP:
@@ -3164,6 +4080,7 @@ static int rtp_new_av_stream(HTTPContext *c,
     fail:
         if (h)
             url_close(h);
+        av_free(ctx->streams);
         av_free(ctx);
         return -1;
     }
@@ -3181,6 +4098,9 @@ static AVStream *add_av_stream1(FFStream *stream, AVCodecContext *codec)
 {
     AVStream *fst;
 
+    /* the tables of FFStream and HTTPContext are sized by MAX_STREAMS */
+    if (stream->nb_streams >= MAX_STREAMS)
+        return NULL;
     fst = av_mallocz(sizeof(AVStream));
     if (!fst)
         return NULL;
@@ -3335,6 +4255,12 @@ static void build_file_streams(void)
                     av_close_input_file(infile);
                     goto fail;
                 }
+                if (infile->nb_streams > MAX_STREAMS) {
+                    http_log("'%s' has %d streams, at most %d can be served\n",
+                             stream->feed_filename, infile->nb_streams, MAX_STREAMS);
+                    av_close_input_file(infile);
+                    goto fail;
+                }
                 extract_mpeg4_header(infile);
 
                 for(i=0;i<infile->nb_streams;i++)
@@ -3358,8 +4284,14 @@ static void build_feed_streams(void)
         if (feed) {
             if (!stream->is_feed) {
                 /* we handle a stream coming from a feed */
-                for(i=0;i<stream->nb_streams;i++)
+                for(i=0;i<stream->nb_streams;i++) {
                     stream->feed_streams[i] = add_av_stream(feed, stream->streams[i]);
+                    if (stream->feed_streams[i] < 0) {
+                        fprintf(stderr, "Feed '%s' cannot hold more than %d streams\n",
+                                feed->filename, MAX_STREAMS);
+                        exit(1);
+                    }
+                }
             }
         }
     }
@@ -3377,6 +4309,7 @@ static void build_feed_streams(void)
 
     /* create feed files if needed */
     for(feed = first_feed; feed != NULL; feed = feed->next_feed) {
+        int64_t pos;
         int fd;
 
         if (url_exist(feed->feed_filename)) {
@@ -3384,7 +4317,7 @@ static void build_feed_streams(void)
             AVFormatContext *s;
             int matches = 0;
 
-            if (av_open_input_file(&s, feed->feed_filename, NULL, FFM_PACKET_SIZE, NULL) >= 0) {
+            if (av_open_input_file(&s, feed->feed_filename, NULL, feed->feed_page_size, NULL) >= 0) {
                 /* Now see if it matches */
                 if (s->nb_streams == feed->nb_streams) {
                     matches = 1;
@@ -3438,6 +4371,12 @@ static void build_feed_streams(void)
                     printf("Deleting feed file '%s' as stream counts differ (%d != %d)\n",
                         feed->feed_filename, s->nb_streams, feed->nb_streams);
 
+                if (matches && s->packet_size != feed->feed_page_size) {
+                    printf("Deleting feed file '%s' as page sizes differ (%d != %d)\n",
+                        feed->feed_filename, s->packet_size, feed->feed_page_size);
+                    matches = 0;
+                }
+
                 av_close_input_file(s);
             } else
                 printf("Deleting feed file '%s' as it appears to be corrupt\n",
@@ -3468,12 +4407,9 @@ static void build_feed_streams(void)
                 exit(1);
             }
             s->oformat = feed->fmt;
+            s->packet_size = feed->feed_page_size;
             s->nb_streams = feed->nb_streams;
-            for(i=0;i<s->nb_streams;i++) {
-                AVStream *st;
-                st = feed->streams[i];
-                s->streams[i] = st;
-            }
+            s->streams = feed->streams;
             av_set_parameters(s, NULL);
             if (av_write_header(s) < 0) {
                 fprintf(stderr, "Container doesn't supports the required parameters\n");
@@ -3497,6 +4433,17 @@ static void build_feed_streams(void)
         if (feed->feed_max_size && feed->feed_max_size < feed->feed_size)
             feed->feed_max_size = feed->feed_size;
 
+        /* index the pages stored by the previous runs */
+        for(pos = feed->feed_page_size; pos < feed->feed_size;
+            pos += feed->feed_page_size) {
+            uint8_t header[12];
+
+            if (pread(fd, header, sizeof(header), pos) != sizeof(header))
+                break;
+            if (header[0] == 'f' && header[1] == 'm')
+                index_feed_page(feed, pos, header);
+        }
+
         close(fd);
     }
 }
@@ -3623,6 +4570,8 @@ static void add_codec(FFStream *stream, AVCodecContext *av)
         abort();
     }
 
+    if (stream->nb_streams >= MAX_STREAMS)
+        return;
     st = av_mallocz(sizeof(AVStream));
     if (!st)
         return;
@@ -3763,6 +4712,22 @@ static int parse_ffconfig(const char *filename)
             } else {
                 nb_max_connections = val;
             }
+        } else if (!strcasecmp(cmd, "Threads")) {
+            get_arg(arg, sizeof(arg), &p);
+            val = atoi(arg);
+            if (val < 1 || val > MAX_WORKERS) {
+                fprintf(stderr, "%s:%d: Invalid Threads: %s\n",
+                        filename, line_num, arg);
+                errors++;
+            } else {
+#ifdef HAVE_PTHREADS
+                nb_workers = val;
+#else
+                if (val > 1)
+                    fprintf(stderr, "%s:%d: Threads ignored, ffserver was built without pthreads\n",
+                            filename, line_num);
+#endif
+            }
         } else if (!strcasecmp(cmd, "MaxBandwidth")) {
             get_arg(arg, sizeof(arg), &p);
             val = atoi(arg);
@@ -3799,6 +4764,7 @@ static int parse_ffconfig(const char *filename)
                 snprintf(feed->feed_filename, sizeof(feed->feed_filename),
                          "/tmp/%s.ffm", feed->filename);
                 feed->feed_max_size = 5 * 1024 * 1024;
+                feed->feed_page_size = FFM_PACKET_SIZE;
                 feed->is_feed = 1;
                 feed->feed = feed; /* self feeding :-) */
             }
@@ -3866,6 +4832,22 @@ static int parse_ffconfig(const char *filename)
                 }
                 feed->feed_max_size = (int64_t)fsize;
             }
+        } else if (!strcasecmp(cmd, "FilePageSize")) {
+            if (feed) {
+                char *p1;
+
+                get_arg(arg, sizeof(arg), &p);
+                val = strtol(arg, &p1, 10);
+                if (toupper(*p1) == 'K')
+                    val *= 1024;
+                if (val < FFM_PACKET_SIZE || val > FFM_MAX_PACKET_SIZE ||
+                    val % FFM_PACKET_SIZE) {
+                    fprintf(stderr, "%s:%d: Invalid FilePageSize: %s\n",
+                            filename, line_num, arg);
+                    errors++;
+                } else
+                    feed->feed_page_size = val;
+            }
         } else if (!strcasecmp(cmd, "</Feed>")) {
             if (!feed) {
                 fprintf(stderr, "%s:%d: No corresponding <Feed> for </Feed>\n",
@@ -4387,8 +5369,6 @@ int main(int argc, char **argv)
 
     putenv("http_proxy");               /* Kill the http_proxy */
 
-    av_init_random(av_gettime() + (getpid() << 16), &random_state);
-
     /* address on which the server will handle HTTP connections */
     my_http_addr.sin_family = AF_INET;
     my_http_addr.sin_port = htons (8080);
@@ -4401,6 +5381,7 @@ int main(int argc, char **argv)
 
     nb_max_connections = 5;
     max_bandwidth = 1000;
+    nb_workers = 1;
     first_stream = NULL;
     logfilename[0] = '\0';
 
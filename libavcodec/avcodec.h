@@ -30,8 +30,8 @@
 #include "libavutil/avutil.h"
 
 #define LIBAVCODEC_VERSION_MAJOR 51
-#define LIBAVCODEC_VERSION_MINOR 57
-#define LIBAVCODEC_VERSION_MICRO  2
+#define LIBAVCODEC_VERSION_MINOR 58
+#define LIBAVCODEC_VERSION_MICRO  3
 
 #define LIBAVCODEC_VERSION_INT  AV_VERSION_INT(LIBAVCODEC_VERSION_MAJOR, \
                                                LIBAVCODEC_VERSION_MINOR, \
@@ -2208,6 +2208,17 @@ typedef struct AVCodecContext {
      * - decoding: Set by user.
      */
     float drc_scale;
+
+    /**
+     * Memory held by the context, the pictures allocated by
+     * avcodec_default_get_buffer(). Above the hard limit get_buffer()
+     * fails, the soft limit is unused. avcodec_open() clears the usage
+     * and the parent, which the user may then set to charge another
+     * account as well, such as the one of the AVFormatContext.
+     * - encoding: unused
+     * - decoding: limits and parent set by user, usage set by libavcodec
+     */
+    AVMemAccount mem;
 } AVCodecContext;
 
 /**
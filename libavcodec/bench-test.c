@@ -0,0 +1,999 @@
+/*
+ * Microbenchmarks of the DSP functions, FFT/MDCT and entropy decoders
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file bench-test.c
+ * Times every DSPContext function pointer for each CPU variant which
+ * dsputil_init() can be restricted to, each FFT and MDCT size, and the
+ * CABAC, CAVLC, exp-Golomb and range decoders on fixed pseudo random
+ * inputs. A progress table goes to stderr, the results as JSON to stdout.
+ *
+ * A benchmark is run in samples of a few calls, each sample starting from
+ * the same inputs; the median and the minimum time per call over the
+ * samples are reported, in AV_READ_TIME() ticks (TSC cycles on x86) or
+ * else in nanoseconds.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "avcodec.h"
+#include "dsputil.h"
+#include "bitstream.h"
+#include "golomb.h"
+#include "h264data.h"
+/* cabac.h and rangecoder.h both define refill() */
+#define refill rac_refill
+#include "rangecoder.h"
+#undef refill
+#include "cabac.h"
+
+#undef exit
+#undef printf
+#undef fprintf
+
+#define STRIDE   64
+#define HEIGHT   64
+#define OFFSET   (16 * STRIDE + 16)      ///< of the blocks in the pictures
+#define FLOATS   1024
+#define SYMBOLS  4096                    ///< decoded per entropy decoder sample
+#define MAX_FFT_BITS  12
+#define MAX_MDCT_BITS 13
+
+static int nb_runs = 101;
+static const char *filter;
+
+/* inputs, restored from the *_ref copies before each sample */
+static uint8_t *pix[3], *pix_ref[3];
+static DCTELEM *block, *block_ref;
+static float *fl[4], *fl_ref[4], *fbias;
+static int16_t *s16;
+static int32_t *s32;
+static IDWTELEM *dwt[6], *dwt_ref[6];
+static int16_t basis[3][64];
+
+static int nb_results;
+
+#ifdef AV_READ_TIME
+static const char unit[] = "cycles";
+#else
+static const char unit[] = "ns";
+#endif
+
+static uint64_t bench_time(void)
+{
+#ifdef AV_READ_TIME
+    return AV_READ_TIME();
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+static unsigned int seed = 1;
+
+static int rnd(void)
+{
+    seed = seed * 1664525 + 1013904223;
+    return seed >> 16;
+}
+
+static void *alloc_random(int size)
+{
+    uint8_t *p = av_malloc(size);
+    int i;
+
+    for(i = 0; i < size; i++)
+        p[i] = rnd();
+    return p;
+}
+
+static void *dup_buf(const void *src, int size)
+{
+    void *p = av_malloc(size);
+    memcpy(p, src, size);
+    return p;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Time run(opaque, calls) over nb_runs samples, reset(opaque) restoring
+ * the inputs before each, and report the time per call.
+ */
+static void bench(const char *group, const char *name, const char *cpu,
+                  void (*run)(void *opaque, int calls),
+                  void (*reset)(void *opaque), void *opaque, int calls)
+{
+    uint64_t *t = av_malloc(nb_runs * sizeof(*t));
+    uint64_t t0;
+    int i;
+
+    for(i = -2; i < nb_runs; i++) {
+        if (reset)
+            reset(opaque);
+        t0 = bench_time();
+        run(opaque, calls);
+        if (i >= 0)
+            t[i] = bench_time() - t0;
+        emms_c();
+    }
+    qsort(t, nb_runs, sizeof(*t), cmp_u64);
+
+    fprintf(stderr, "%-10s %-36s %-9s %10.1f %s\n", group, name, cpu,
+            (double)t[nb_runs / 2] / calls, unit);
+    printf("%s\n    { \"group\": \"%s\", \"name\": \"%s\", \"cpu\": \"%s\", "
+           "\"median\": %.1f, \"min\": %.1f }", nb_results++ ? "," : "",
+           group, name, cpu,
+           (double)t[nb_runs / 2] / calls, (double)t[0] / calls);
+    av_free(t);
+}
+
+static int selected(const char *name)
+{
+    return !filter || strstr(name, filter);
+}
+
+/* DSPContext */
+
+enum {
+    K_GET_PIXELS, K_DIFF_PIXELS, K_PUT_CLAMPED, K_ADD_PIXELS, K_BLOCK_SUM,
+    K_GMC1, K_GMC, K_CLEAR_BLOCKS, K_PIX_SUM, K_CMP, K_CMP5, K_SSD8,
+    K_PIXELS, K_PIXELS_L2, K_TPEL, K_QPEL, K_MSPEL, K_CHROMA, K_WEIGHT,
+    K_BIWEIGHT, K_CAVS_FILTER, K_IDCT_ADD, K_BYTES, K_BYTES3, K_MEDIAN,
+    K_PAETH, K_BSWAP, K_H264_LF, K_H264_LF_INTRA, K_H264_STRENGTH, K_LF_Q,
+    K_LF, K_VORBIS, K_FLAC, K_FMUL, K_FMUL3, K_FMUL_ADD, K_FLOAT_INT16,
+    K_BLOCK, K_H264_DCT, K_IDCT_PUT, K_TRY_BASIS, K_ADD_BASIS, K_DRAW_EDGES,
+    K_COMPOSE97V, K_COMPOSE97H, K_PREFETCH, K_SHRINK, K_X8_SPATIAL,
+    K_X8_SETUP,
+};
+
+typedef struct DSPFunc {
+    const char *name;
+    int offset;                 ///< of the pointers in DSPContext
+    int count;                  ///< number of pointers
+    int cols;                   ///< pointers per row of a 2 dimensional table
+    int size;                   ///< block size of the first row, halved by each row
+    int kind;
+} DSPFunc;
+
+#define F(kind, field, size, cols) \
+    { #field, offsetof(DSPContext, field), \
+      sizeof(((DSPContext *)0)->field) / sizeof(void (*)(void)), cols, size, kind }
+
+/* sad/sse/... [5] are indexed 16x16, 8x8, 4x4 and 16x16 intra;
+   dct_sad, dct264_sad, dct_max, quant_psnr, bit, rd and nsse need an
+   encoder context, me_*cmp, mb_cmp, ildct_cmp and frame_skip_cmp are set
+   by the encoder, inner_add_yblock needs a snow slice buffer */
+static const DSPFunc dsp_funcs[] = {
+    F(K_GET_PIXELS,     get_pixels,                  8,  1),
+    F(K_DIFF_PIXELS,    diff_pixels,                 8,  1),
+    F(K_PUT_CLAMPED,    put_pixels_clamped,          8,  1),
+    F(K_PUT_CLAMPED,    put_signed_pixels_clamped,   8,  1),
+    F(K_PUT_CLAMPED,    add_pixels_clamped,          8,  1),
+    F(K_ADD_PIXELS,     add_pixels8,                 8,  1),
+    F(K_ADD_PIXELS,     add_pixels4,                 4,  1),
+    F(K_BLOCK_SUM,      sum_abs_dctelem,             8,  1),
+    F(K_GMC1,           gmc1,                        8,  1),
+    F(K_GMC,            gmc,                         8,  1),
+    F(K_CLEAR_BLOCKS,   clear_blocks,                8,  1),
+    F(K_PIX_SUM,        pix_sum,                    16,  1),
+    F(K_PIX_SUM,        pix_norm1,                  16,  1),
+    F(K_CMP5,           sad,                        16,  1),
+    F(K_CMP5,           sse,                        16,  1),
+    F(K_CMP5,           hadamard8_diff,             16,  1),
+    F(K_CMP5,           vsad,                       16,  1),
+    F(K_CMP5,           vsse,                       16,  1),
+    F(K_CMP5,           w53,                        16,  1),
+    F(K_CMP5,           w97,                        16,  1),
+    F(K_SSD8,           ssd_int8_vs_int16,          64,  1),
+    F(K_PIXELS,         put_pixels_tab,             16,  4),
+    F(K_PIXELS,         avg_pixels_tab,             16,  4),
+    F(K_PIXELS,         put_no_rnd_pixels_tab,      16,  4),
+    F(K_PIXELS,         avg_no_rnd_pixels_tab,      16,  4),
+    F(K_PIXELS_L2,      put_no_rnd_pixels_l2,       16,  1),
+    F(K_TPEL,           put_tpel_pixels_tab,        16, 11),
+    F(K_TPEL,           avg_tpel_pixels_tab,        16, 11),
+    F(K_QPEL,           put_qpel_pixels_tab,        16, 16),
+    F(K_QPEL,           avg_qpel_pixels_tab,        16, 16),
+    F(K_QPEL,           put_no_rnd_qpel_pixels_tab, 16, 16),
+    F(K_QPEL,           avg_no_rnd_qpel_pixels_tab, 16, 16),
+    F(K_QPEL,           put_mspel_pixels_tab,        8,  8),
+    F(K_CHROMA,         put_h264_chroma_pixels_tab,  8,  1),
+    F(K_CHROMA,         put_no_rnd_h264_chroma_pixels_tab, 8, 1),
+    F(K_CHROMA,         avg_h264_chroma_pixels_tab,  8,  1),
+    F(K_QPEL,           put_h264_qpel_pixels_tab,   16, 16),
+    F(K_QPEL,           avg_h264_qpel_pixels_tab,   16, 16),
+    F(K_QPEL,           put_2tap_qpel_pixels_tab,   16, 16),
+    F(K_QPEL,           avg_2tap_qpel_pixels_tab,   16, 16),
+    F(K_WEIGHT,         weight_h264_pixels_tab,     16, 10),
+    F(K_BIWEIGHT,       biweight_h264_pixels_tab,   16, 10),
+    F(K_QPEL,           put_cavs_qpel_pixels_tab,   16, 16),
+    F(K_QPEL,           avg_cavs_qpel_pixels_tab,   16, 16),
+    F(K_CAVS_FILTER,    cavs_filter_lv,              8,  1),
+    F(K_CAVS_FILTER,    cavs_filter_lh,              8,  1),
+    F(K_CAVS_FILTER,    cavs_filter_cv,              8,  1),
+    F(K_CAVS_FILTER,    cavs_filter_ch,              8,  1),
+    F(K_IDCT_ADD,       cavs_idct8_add,              8,  1),
+    F(K_CMP,            pix_abs,                    16,  4),
+    F(K_BYTES,          add_bytes,                  32,  1),
+    F(K_BYTES3,         add_bytes_l2,               32,  1),
+    F(K_BYTES3,         diff_bytes,                 32,  1),
+    F(K_MEDIAN,         sub_hfyu_median_prediction, 32,  1),
+    F(K_PAETH,          add_png_paeth_prediction,   32,  1),
+    F(K_BSWAP,          bswap_buf,                  16,  1),
+    F(K_H264_LF,        h264_v_loop_filter_luma,    16,  1),
+    F(K_H264_LF,        h264_h_loop_filter_luma,    16,  1),
+    F(K_H264_LF,        h264_v_loop_filter_chroma,   8,  1),
+    F(K_H264_LF,        h264_h_loop_filter_chroma,   8,  1),
+    F(K_H264_LF_INTRA,  h264_v_loop_filter_chroma_intra, 8, 1),
+    F(K_H264_LF_INTRA,  h264_h_loop_filter_chroma_intra, 8, 1),
+    F(K_H264_STRENGTH,  h264_loop_filter_strength,  16,  1),
+    F(K_LF_Q,           h263_v_loop_filter,          8,  1),
+    F(K_LF_Q,           h263_h_loop_filter,          8,  1),
+    F(K_LF,             h261_loop_filter,            8,  1),
+    F(K_LF_Q,           x8_v_loop_filter,            8,  1),
+    F(K_LF_Q,           x8_h_loop_filter,            8,  1),
+    F(K_VORBIS,         vorbis_inverse_coupling,   256,  1),
+    F(K_FLAC,           flac_compute_autocorr,    1024,  1),
+    F(K_FMUL,           vector_fmul,               256,  1),
+    F(K_FMUL3,          vector_fmul_reverse,       256,  1),
+    F(K_FMUL_ADD,       vector_fmul_add_add,       256,  1),
+    F(K_FLOAT_INT16,    float_to_int16,            256,  1),
+    F(K_BLOCK,          fdct,                        8,  1),
+    F(K_BLOCK,          fdct248,                     8,  1),
+    F(K_BLOCK,          idct,                        8,  1),
+    F(K_IDCT_PUT,       idct_put,                    8,  1),
+    F(K_IDCT_PUT,       idct_add,                    8,  1),
+    F(K_TRY_BASIS,      try_8x8basis,                8,  1),
+    F(K_ADD_BASIS,      add_8x8basis,                8,  1),
+    F(K_DRAW_EDGES,     draw_edges,                 32,  1),
+    F(K_IDCT_ADD,       h264_idct_add,               4,  1),
+    F(K_IDCT_ADD,       h264_idct8_add,              8,  1),
+    F(K_IDCT_ADD,       h264_idct_dc_add,            4,  1),
+    F(K_IDCT_ADD,       h264_idct8_dc_add,           8,  1),
+    F(K_H264_DCT,       h264_dct,                    4,  1),
+    F(K_COMPOSE97V,     vertical_compose97i,        64,  1),
+    F(K_COMPOSE97H,     horizontal_compose97i,      64,  1),
+    F(K_PREFETCH,       prefetch,                    8,  1),
+    F(K_SHRINK,         shrink,                     32,  1),
+    F(K_BLOCK,          vc1_inv_trans_8x8,           8,  1),
+    F(K_IDCT_PUT,       vc1_inv_trans_8x4,           8,  1),
+    F(K_IDCT_PUT,       vc1_inv_trans_4x8,           8,  1),
+    F(K_IDCT_PUT,       vc1_inv_trans_4x4,           4,  1),
+    F(K_LF,             vc1_v_overlap,               8,  1),
+    F(K_LF,             vc1_h_overlap,               8,  1),
+    F(K_MSPEL,          put_vc1_mspel_pixels_tab,    8, 16),
+    F(K_X8_SPATIAL,     x8_spatial_compensation,     8, 12),
+    F(K_X8_SETUP,       x8_setup_spatial_compensation, 8, 1),
+};
+
+typedef struct DSPBench {
+    int kind;
+    void (*fn)(void);
+    int index;                  ///< of the pointer in its table
+    int size;                   ///< block size
+} DSPBench;
+
+static void dsp_reset(void *opaque)
+{
+    int i;
+
+    for(i = 0; i < 3; i++)
+        memcpy(pix[i], pix_ref[i], STRIDE * HEIGHT);
+    memcpy(block, block_ref, 6 * 64 * sizeof(DCTELEM));
+    for(i = 0; i < 4; i++)
+        memcpy(fl[i], fl_ref[i], FLOATS * sizeof(float));
+    for(i = 0; i < 6; i++)
+        memcpy(dwt[i], dwt_ref[i], 2 * STRIDE * sizeof(IDWTELEM));
+}
+
+static int dummy;
+
+static void dsp_run(void *opaque, int calls)
+{
+    DSPBench *b = opaque;
+    uint8_t *dst  = pix[0] + OFFSET;
+    uint8_t *src  = pix[1] + OFFSET;
+    uint8_t *src2 = pix[2] + OFFSET;
+    int size = b->size, sum = 0, i;
+
+    switch(b->kind) {
+    case K_GET_PIXELS:
+        for(i = 0; i < calls; i++)
+            ((void (*)(DCTELEM *, const uint8_t *, int))b->fn)(block, src, STRIDE);
+        break;
+    case K_DIFF_PIXELS:
+        for(i = 0; i < calls; i++)
+            ((void (*)(DCTELEM *, const uint8_t *, const uint8_t *, int))b->fn)(block, src, src2, STRIDE);
+        break;
+    case K_PUT_CLAMPED:
+        for(i = 0; i < calls; i++)
+            ((void (*)(const DCTELEM *, uint8_t *, int))b->fn)(block, dst, STRIDE);
+        break;
+    case K_ADD_PIXELS:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, DCTELEM *, int))b->fn)(dst, block, STRIDE);
+        break;
+    case K_BLOCK_SUM:
+        for(i = 0; i < calls; i++)
+            sum += ((int (*)(DCTELEM *))b->fn)(block);
+        break;
+    case K_GMC1:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, uint8_t *, int, int, int, int, int))b->fn)(dst, src, STRIDE, size, 5, 7, 8);
+        break;
+    case K_GMC:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, uint8_t *, int, int, int, int, int, int, int, int, int, int, int, int))b->fn)
+                (dst, src, STRIDE, size, 3 << 16, 5 << 16, 17 << 16, 1 << 16, -(1 << 16), 15 << 16,
+                 4, 1 << 7, 32, 32);
+        break;
+    case K_CLEAR_BLOCKS:
+        for(i = 0; i < calls; i++)
+            ((void (*)(DCTELEM *))b->fn)(block);
+        break;
+    case K_PIX_SUM:
+        for(i = 0; i < calls; i++)
+            sum += ((int (*)(uint8_t *, int))b->fn)(src, STRIDE);
+        break;
+    case K_CMP5:
+        size = b->index == 1 ? 8 : b->index == 2 ? 4 : 16;
+    case K_CMP:
+        for(i = 0; i < calls; i++)
+            sum += ((me_cmp_func)b->fn)(NULL, dst, src, STRIDE, size);
+        break;
+    case K_SSD8:
+        for(i = 0; i < calls; i++)
+            sum += ((int (*)(const int8_t *, const int16_t *, int))b->fn)((int8_t *)src, s16, size);
+        break;
+    case K_PIXELS:
+        for(i = 0; i < calls; i++)
+            ((op_pixels_func)b->fn)(dst, src, STRIDE, size);
+        break;
+    case K_PIXELS_L2:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, const uint8_t *, const uint8_t *, int, int))b->fn)(dst, src, src2, STRIDE, size);
+        break;
+    case K_TPEL:
+        for(i = 0; i < calls; i++)
+            ((tpel_mc_func)b->fn)(dst, src, STRIDE, size, size);
+        break;
+    case K_QPEL:
+        for(i = 0; i < calls; i++)
+            ((qpel_mc_func)b->fn)(dst, src, STRIDE);
+        break;
+    case K_MSPEL:
+        for(i = 0; i < calls; i++)
+            ((op_pixels_func)b->fn)(dst, src, STRIDE, 1);
+        break;
+    case K_CHROMA:
+        for(i = 0; i < calls; i++)
+            ((h264_chroma_mc_func)b->fn)(dst, src, STRIDE, size, 3, 5);
+        break;
+    case K_WEIGHT:
+        for(i = 0; i < calls; i++)
+            ((h264_weight_func)b->fn)(dst, STRIDE, 5, 40, 3);
+        break;
+    case K_BIWEIGHT:
+        for(i = 0; i < calls; i++)
+            ((h264_biweight_func)b->fn)(dst, src, STRIDE, 5, 30, 34, 0);
+        break;
+    case K_CAVS_FILTER:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, int, int, int, int, int, int))b->fn)(dst, STRIDE, 20, 10, 2, 1, 1);
+        break;
+    case K_IDCT_ADD:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, DCTELEM *, int))b->fn)(dst, block, STRIDE);
+        break;
+    case K_BYTES:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, uint8_t *, int))b->fn)(dst, src, size);
+        break;
+    case K_BYTES3:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, uint8_t *, uint8_t *, int))b->fn)(dst, src, src2, size);
+        break;
+    case K_MEDIAN: {
+        int left = 0, left_top = 0;
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, uint8_t *, uint8_t *, int, int *, int *))b->fn)
+                (dst, src, src2, size, &left, &left_top);
+        break;
+    }
+    case K_PAETH:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, uint8_t *, uint8_t *, int, int))b->fn)(dst, src, src2, size, 3);
+        break;
+    case K_BSWAP:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint32_t *, const uint32_t *, int))b->fn)((uint32_t *)dst, (uint32_t *)src, size);
+        break;
+    case K_H264_LF: {
+        int8_t tc0[4] = { 1, 2, 1, 2 };
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, int, int, int, int8_t *))b->fn)(dst, STRIDE, 20, 10, tc0);
+        break;
+    }
+    case K_H264_LF_INTRA:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, int, int, int))b->fn)(dst, STRIDE, 20, 10);
+        break;
+    case K_H264_STRENGTH: {
+        DECLARE_ALIGNED_8(int16_t, bS[2][4][4]);
+        uint8_t nnz[40];
+        int8_t ref[2][40];
+        int16_t mv[2][40][2];
+        memcpy(nnz, src, sizeof(nnz));
+        memcpy(ref, src2, sizeof(ref));
+        memcpy(mv, s16, sizeof(mv));
+        for(i = 0; i < 40; i++)
+            nnz[i] &= 1, ref[0][i] &= 3, ref[1][i] &= 3;
+        for(i = 0; i < calls; i++)
+            ((void (*)(int16_t [2][4][4], uint8_t [40], int8_t [2][40], int16_t [2][40][2], int, int, int, int, int))b->fn)
+                (bS, nnz, ref, mv, 1, 4, 1, 0, 0);
+        break;
+    }
+    case K_LF_Q:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, int, int))b->fn)(dst, STRIDE, 8);
+        break;
+    case K_LF:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, int))b->fn)(dst, STRIDE);
+        break;
+    case K_VORBIS:
+        for(i = 0; i < calls; i++)
+            ((void (*)(float *, float *, int))b->fn)(fl[0], fl[1], size);
+        break;
+    case K_FLAC: {
+        double autoc[9];
+        for(i = 0; i < calls; i++)
+            ((void (*)(const int32_t *, int, int, double *))b->fn)(s32, size, 8, autoc);
+        break;
+    }
+    case K_FMUL:
+        for(i = 0; i < calls; i++)
+            ((void (*)(float *, const float *, int))b->fn)(fl[0], fl[1], size);
+        break;
+    case K_FMUL3:
+        for(i = 0; i < calls; i++)
+            ((void (*)(float *, const float *, const float *, int))b->fn)(fl[0], fl[1], fl[2], size);
+        break;
+    case K_FMUL_ADD:
+        for(i = 0; i < calls; i++)
+            ((void (*)(float *, const float *, const float *, const float *, int, int, int))b->fn)
+                (fl[0], fl[1], fl[2], fl[3], 0, size, 1);
+        break;
+    case K_FLOAT_INT16:
+        for(i = 0; i < calls; i++)
+            ((void (*)(int16_t *, const float *, int))b->fn)(s16, fbias, size);
+        break;
+    case K_BLOCK:
+        for(i = 0; i < calls; i++)
+            ((void (*)(DCTELEM *))b->fn)(block);
+        break;
+    case K_H264_DCT:
+        for(i = 0; i < calls; i++)
+            ((void (*)(DCTELEM [4][4]))b->fn)((DCTELEM (*)[4])block);
+        break;
+    case K_IDCT_PUT:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, int, DCTELEM *))b->fn)(dst, STRIDE, block);
+        break;
+    case K_TRY_BASIS:
+        for(i = 0; i < calls; i++)
+            sum += ((int (*)(int16_t *, int16_t *, int16_t *, int))b->fn)(basis[0], basis[1], basis[2], 1 << 8);
+        break;
+    case K_ADD_BASIS:
+        for(i = 0; i < calls; i++)
+            ((void (*)(int16_t *, int16_t *, int))b->fn)(basis[0], basis[2], 1 << 8);
+        break;
+    case K_DRAW_EDGES:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, int, int, int, int))b->fn)(dst, STRIDE, size, size, 16);
+        break;
+    case K_COMPOSE97V:
+        for(i = 0; i < calls; i++)
+            ((void (*)(IDWTELEM *, IDWTELEM *, IDWTELEM *, IDWTELEM *, IDWTELEM *, IDWTELEM *, int))b->fn)
+                (dwt[0], dwt[1], dwt[2], dwt[3], dwt[4], dwt[5], size);
+        break;
+    case K_COMPOSE97H:
+        for(i = 0; i < calls; i++)
+            ((void (*)(IDWTELEM *, int))b->fn)(dwt[0], size);
+        break;
+    case K_PREFETCH:
+        for(i = 0; i < calls; i++)
+            ((void (*)(void *, int, int))b->fn)(src, STRIDE, size);
+        break;
+    case K_SHRINK:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, int, const uint8_t *, int, int, int))b->fn)(dst, STRIDE, src, STRIDE, size, size);
+        break;
+    case K_X8_SPATIAL:
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, uint8_t *, int))b->fn)(src2, dst, STRIDE);
+        break;
+    case K_X8_SETUP: {
+        int range, psum;
+        for(i = 0; i < calls; i++)
+            ((void (*)(uint8_t *, uint8_t *, int, int *, int *, int))b->fn)(src, src2, STRIDE, &range, &psum, 0);
+        break;
+    }
+    }
+    dummy += sum;
+}
+
+/* the variants dsputil_init() can be restricted to with dsp_mask, other
+   architectures than x86 ignore dsp_mask */
+static const struct {
+    const char *name;
+    int flags;
+} cpus[] = {
+#ifdef HAVE_MMX
+    { "c",        0 },
+    { "mmx",      FF_MM_MMX },
+    { "mmx2",     FF_MM_MMX | FF_MM_MMXEXT },
+    { "3dnow",    FF_MM_MMX | FF_MM_3DNOW },
+    { "3dnowext", FF_MM_MMX | FF_MM_MMXEXT | FF_MM_3DNOW | FF_MM_3DNOWEXT },
+    { "sse",      FF_MM_MMX | FF_MM_MMXEXT | FF_MM_SSE },
+    { "sse2",     FF_MM_MMX | FF_MM_MMXEXT | FF_MM_SSE | FF_MM_SSE2 },
+    { "sse3",     FF_MM_MMX | FF_MM_MMXEXT | FF_MM_SSE | FF_MM_SSE2 | FF_MM_SSE3 },
+    { "ssse3",    FF_MM_MMX | FF_MM_MMXEXT | FF_MM_SSE | FF_MM_SSE2 | FF_MM_SSE3 | FF_MM_SSSE3 },
+#else
+    { "default",  0 },
+#endif
+};
+
+#define NB_CPUS (sizeof(cpus) / sizeof(cpus[0]))
+
+static void bench_dsp(void)
+{
+    AVCodecContext *avctx = avcodec_alloc_context();
+    DSPContext *dsp = av_mallocz(NB_CPUS * sizeof(DSPContext));
+    int nb_cpus = 0, cpu_flags = 0, c, u, f, k;
+
+#ifdef HAVE_MMX
+    cpu_flags = mm_support();
+#endif
+    for(c = 0; c < NB_CPUS; c++) {
+        if ((cpus[c].flags & cpu_flags) != cpus[c].flags)
+            continue;
+        avctx->dsp_mask = 0xffff & ~cpus[c].flags;
+        dsputil_init(&dsp[c], avctx);
+        nb_cpus = c + 1;
+    }
+
+    for(f = 0; f < sizeof(dsp_funcs) / sizeof(dsp_funcs[0]); f++) {
+        const DSPFunc *d = &dsp_funcs[f];
+
+        for(k = 0; k < d->count; k++) {
+            DSPBench b;
+            char name[64];
+
+            if (d->count == 1)
+                snprintf(name, sizeof(name), "%s", d->name);
+            else if (d->cols == 1 || d->cols == d->count)
+                snprintf(name, sizeof(name), "%s[%d]", d->name, k);
+            else
+                snprintf(name, sizeof(name), "%s[%d][%d]", d->name, k / d->cols, k % d->cols);
+            if (!selected(name))
+                continue;
+
+            b.kind  = d->kind;
+            b.index = k;
+            b.size  = d->cols == d->count ? d->size : d->size >> (k / d->cols);
+            for(c = 0; c < nb_cpus; c++) {
+                if ((cpus[c].flags & cpu_flags) != cpus[c].flags)
+                    continue;
+                b.fn = ((void (**)(void))((uint8_t *)&dsp[c] + d->offset))[k];
+                if (!b.fn)
+                    continue;
+                /* the same code was timed for an earlier variant */
+                for(u = 0; u < c; u++)
+                    if ((cpus[u].flags & cpu_flags) == cpus[u].flags &&
+                        ((void (**)(void))((uint8_t *)&dsp[u] + d->offset))[k] == b.fn)
+                        break;
+                if (u < c)
+                    continue;
+                bench("dsputil", name, cpus[c].name, dsp_run, dsp_reset, &b, 16);
+            }
+        }
+    }
+    av_free(dsp);
+    av_free(avctx);
+}
+
+/* FFT and MDCT */
+
+typedef struct TransformBench {
+    FFTContext *fft;
+    MDCTContext *mdct;
+    int inverse;
+    int n;
+    FFTSample *in, *out, *tmp;
+} TransformBench;
+
+static void transform_reset(void *opaque)
+{
+    TransformBench *t = opaque;
+    int i;
+
+    for(i = 0; i < t->n; i++)
+        t->in[i] = fl_ref[0][i % FLOATS] - 1;
+}
+
+static void fft_run(void *opaque, int calls)
+{
+    TransformBench *t = opaque;
+    int i;
+
+    for(i = 0; i < calls; i++)
+        ff_fft_calc(t->fft, (FFTComplex *)t->in);
+}
+
+static void mdct_run(void *opaque, int calls)
+{
+    TransformBench *t = opaque;
+    int i;
+
+    for(i = 0; i < calls; i++) {
+        if (t->inverse)
+            t->mdct->fft.imdct_calc(t->mdct, t->out, t->in, t->tmp);
+        else
+            ff_mdct_calc(t->mdct, t->out, t->in, t->tmp);
+    }
+}
+
+/**
+ * Switch an initialized FFT back to the C code, ff_fft_init() drops the
+ * twiddle factors of the C code when it picks SIMD code.
+ */
+static void fft_set_c(FFTContext *s)
+{
+    int i, n = 1 << s->nbits;
+
+    s->fft_calc   = ff_fft_calc_c;
+    s->imdct_calc = ff_imdct_calc;
+    if (s->exptab)
+        return;
+    s->exptab = av_malloc(n / 2 * sizeof(FFTComplex));
+    for(i = 0; i < n / 2; i++) {
+        double alpha = 2 * M_PI * i / n;
+        s->exptab[i].re = cos(alpha);
+        s->exptab[i].im = sin(alpha) * (s->inverse ? 1 : -1);
+    }
+}
+
+static void bench_transforms(void)
+{
+    TransformBench t;
+    FFTContext fft;
+    MDCTContext mdct;
+    char name[32];
+    int nbits, inverse, simd;
+
+    t.in  = av_malloc(2 * sizeof(FFTSample) << MAX_MDCT_BITS);
+    t.out = av_malloc(2 * sizeof(FFTSample) << MAX_MDCT_BITS);
+    t.tmp = av_malloc(2 * sizeof(FFTSample) << MAX_MDCT_BITS);
+    t.fft  = &fft;
+    t.mdct = &mdct;
+
+    for(nbits = 4; nbits <= MAX_FFT_BITS; nbits++) {
+        for(inverse = 0; inverse < 2; inverse++) {
+            snprintf(name, sizeof(name), "%s_%d", inverse ? "ifft" : "fft", 1 << nbits);
+            if (!selected(name))
+                continue;
+            t.n = 2 << nbits;
+            ff_fft_init(&fft, nbits, inverse);
+            simd = fft.fft_calc != ff_fft_calc_c;
+            if (simd)
+                bench("fft", name, "simd", fft_run, transform_reset, &t, 4);
+            fft_set_c(&fft);
+            bench("fft", name, "c", fft_run, transform_reset, &t, 4);
+            ff_fft_end(&fft);
+        }
+    }
+
+    for(nbits = 6; nbits <= MAX_MDCT_BITS; nbits++) {
+        for(inverse = 0; inverse < 2; inverse++) {
+            snprintf(name, sizeof(name), "%s_%d", inverse ? "imdct" : "mdct", 1 << nbits);
+            if (!selected(name))
+                continue;
+            t.n = 1 << nbits;
+            t.inverse = inverse;
+            ff_mdct_init(&mdct, nbits, inverse);
+            simd = inverse ? mdct.fft.imdct_calc != ff_imdct_calc :
+                             mdct.fft.fft_calc   != ff_fft_calc_c;
+            if (simd)
+                bench("fft", name, "simd", mdct_run, transform_reset, &t, 4);
+            fft_set_c(&mdct.fft);
+            bench("fft", name, "c", mdct_run, transform_reset, &t, 4);
+            ff_mdct_end(&mdct);
+        }
+    }
+    av_free(t.in);
+    av_free(t.out);
+    av_free(t.tmp);
+}
+
+/* entropy decoders, each sample decodes the same SYMBOLS symbols */
+
+typedef struct CoderBench {
+    uint8_t *buf;
+    int size;
+    uint8_t state[16];
+    CABACContext cabac;
+    RangeCoder rac;
+    GetBitContext gb;
+    VLC vlc;
+} CoderBench;
+
+static void cabac_reset(void *opaque)
+{
+    CoderBench *c = opaque;
+
+    memset(c->state, 0, sizeof(c->state));
+    ff_init_cabac_decoder(&c->cabac, c->buf, c->size);
+}
+
+static void cabac_run(void *opaque, int calls)
+{
+    CoderBench *c = opaque;
+    int i, sum = 0;
+
+    for(i = 0; i < calls; i++)
+        sum += get_cabac(&c->cabac, &c->state[i & 7]);
+    dummy += sum;
+}
+
+static void cabac_bypass_run(void *opaque, int calls)
+{
+    CoderBench *c = opaque;
+    int i, sum = 0;
+
+    for(i = 0; i < calls; i++)
+        sum += get_cabac_bypass(&c->cabac);
+    dummy += sum;
+}
+
+static void rac_reset(void *opaque)
+{
+    CoderBench *c = opaque;
+
+    memset(c->state, 128, sizeof(c->state));
+    ff_init_range_decoder(&c->rac, c->buf, c->size);
+    ff_build_rac_states(&c->rac, 0.05 * (1LL << 32), 128 + 64 + 32 + 16);
+}
+
+static void rac_run(void *opaque, int calls)
+{
+    CoderBench *c = opaque;
+    int i, sum = 0;
+
+    for(i = 0; i < calls; i++)
+        sum += get_rac(&c->rac, &c->state[i & 7]);
+    dummy += sum;
+}
+
+static void gb_reset(void *opaque)
+{
+    CoderBench *c = opaque;
+
+    init_get_bits(&c->gb, c->buf, 8 * c->size);
+}
+
+static void ue_run(void *opaque, int calls)
+{
+    CoderBench *c = opaque;
+    int i, sum = 0;
+
+    for(i = 0; i < calls; i++)
+        sum += get_ue_golomb(&c->gb);
+    dummy += sum;
+}
+
+static void se_run(void *opaque, int calls)
+{
+    CoderBench *c = opaque;
+    int i, sum = 0;
+
+    for(i = 0; i < calls; i++)
+        sum += get_se_golomb(&c->gb);
+    dummy += sum;
+}
+
+#define COEFF_TOKEN_VLC_BITS 8
+
+static void coeff_token_run(void *opaque, int calls)
+{
+    CoderBench *c = opaque;
+    int i, sum = 0;
+
+    for(i = 0; i < calls; i++)
+        sum += get_vlc2(&c->gb, c->vlc.table, COEFF_TOKEN_VLC_BITS, 2);
+    dummy += sum;
+}
+
+/** @return a symbol, small ones being more likely */
+static int rnd_symbol(int max)
+{
+    int v = rnd();
+    return (v & 0xff) % (1 + (max >> ((v >> 8) & 7)));
+}
+
+static void bench_coders(void)
+{
+    CoderBench c;
+    CABACContext enc;
+    RangeCoder renc;
+    PutBitContext pb;
+    int i, v, bufsize = 8 * SYMBOLS + 64;
+
+    memset(&c, 0, sizeof(c));
+    c.buf = av_mallocz(bufsize + FF_INPUT_BUFFER_PADDING_SIZE);
+
+    /* CABAC bins, 1 in 8 being a 1, then bypass bins */
+    if (selected("get_cabac")) {
+        ff_init_cabac_encoder(&enc, c.buf, bufsize);
+        ff_init_cabac_states(&enc);
+        for(i = 0; i < SYMBOLS; i++)
+            put_cabac(&enc, &c.state[i & 7], !(rnd() & 7));
+        for(i = 0; i < SYMBOLS; i++)
+            put_cabac_bypass(&enc, rnd() & 1);
+        c.size = put_cabac_terminate(&enc, 1);
+        bench("entropy", "get_cabac", "c", cabac_run, cabac_reset, &c, SYMBOLS);
+        bench("entropy", "get_cabac_bypass", "c", cabac_bypass_run, cabac_reset, &c, SYMBOLS);
+    }
+
+    if (selected("get_rac")) {
+        memset(c.state, 128, sizeof(c.state));
+        ff_init_range_encoder(&renc, c.buf, bufsize);
+        ff_build_rac_states(&renc, 0.05 * (1LL << 32), 128 + 64 + 32 + 16);
+        for(i = 0; i < SYMBOLS; i++)
+            put_rac(&renc, &c.state[i & 7], !(rnd() & 7));
+        c.size = ff_rac_terminate(&renc);
+        bench("entropy", "get_rac", "c", rac_run, rac_reset, &c, SYMBOLS);
+    }
+
+    c.size = bufsize;
+    if (selected("get_ue_golomb")) {
+        init_put_bits(&pb, c.buf, bufsize);
+        for(i = 0; i < SYMBOLS; i++)
+            set_ue_golomb(&pb, rnd_symbol(255));
+        flush_put_bits(&pb);
+        bench("entropy", "get_ue_golomb", "c", ue_run, gb_reset, &c, SYMBOLS);
+    }
+
+    if (selected("get_se_golomb")) {
+        init_put_bits(&pb, c.buf, bufsize);
+        for(i = 0; i < SYMBOLS; i++)
+            set_se_golomb(&pb, rnd_symbol(255) - 128);
+        flush_put_bits(&pb);
+        bench("entropy", "get_se_golomb", "c", se_run, gb_reset, &c, SYMBOLS);
+    }
+
+    /* H.264 CAVLC coeff_token codes for 0 <= nC < 2 */
+    if (selected("get_vlc2_coeff_token")) {
+        init_vlc(&c.vlc, COEFF_TOKEN_VLC_BITS, 4 * 17,
+                 &coeff_token_len [0][0], 1, 1,
+                 &coeff_token_bits[0][0], 1, 1, 0);
+        init_put_bits(&pb, c.buf, bufsize);
+        for(i = 0; i < SYMBOLS; i++) {
+            do {
+                v = rnd_symbol(4 * 17 - 1);
+            } while (!coeff_token_len[0][v]);
+            put_bits(&pb, coeff_token_len[0][v], coeff_token_bits[0][v]);
+        }
+        flush_put_bits(&pb);
+        bench("entropy", "get_vlc2_coeff_token", "c", coeff_token_run, gb_reset, &c, SYMBOLS);
+        free_vlc(&c.vlc);
+    }
+    av_free(c.buf);
+}
+
+static void help(void)
+{
+    printf("bench-test [-h] [-f filter] [-r runs]\n"
+           "time the DSP functions, FFT/MDCT and entropy decoders\n"
+           "-f filter  only time the functions with filter in their name\n"
+           "-r runs    samples taken of each function, %d by default\n",
+           nb_runs);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int c, i;
+
+    for(;;) {
+        c = getopt(argc, argv, "hf:r:");
+        if (c == -1)
+            break;
+        switch(c) {
+        case 'f':
+            filter = optarg;
+            break;
+        case 'r':
+            nb_runs = FFMAX(atoi(optarg), 1);
+            break;
+        default:
+            help();
+        }
+    }
+
+    avcodec_init();
+
+    for(i = 0; i < 3; i++) {
+        pix_ref[i] = alloc_random(STRIDE * HEIGHT);
+        pix[i]     = dup_buf(pix_ref[i], STRIDE * HEIGHT);
+    }
+    block_ref = av_malloc(6 * 64 * sizeof(DCTELEM));
+    for(i = 0; i < 6 * 64; i++)
+        block_ref[i] = (rnd() & 127) - 64;
+    block = dup_buf(block_ref, 6 * 64 * sizeof(DCTELEM));
+    fbias = av_malloc(FLOATS * sizeof(float));
+    for(i = 0; i < 4; i++) {
+        int j;
+        fl_ref[i] = av_malloc(FLOATS * sizeof(float));
+        for(j = 0; j < FLOATS; j++)
+            fl_ref[i][j] = 0.5 + (rnd() & 0xffff) / 65536.0;
+        fl[i] = dup_buf(fl_ref[i], FLOATS * sizeof(float));
+    }
+    for(i = 0; i < FLOATS; i++)
+        fbias[i] = 384.5 + fl_ref[0][i] - 0.5;
+    s16 = av_malloc(FLOATS * sizeof(int16_t));
+    for(i = 0; i < FLOATS; i++)
+        s16[i] = (rnd() & 255) - 128;
+    s32 = av_malloc(FLOATS * sizeof(int32_t));
+    for(i = 0; i < FLOATS; i++)
+        s32[i] = (rnd() & 0xffff) - 0x8000;
+    for(i = 0; i < 6; i++) {
+        int j;
+        dwt_ref[i] = av_malloc(2 * STRIDE * sizeof(IDWTELEM));
+        for(j = 0; j < 2 * STRIDE; j++)
+            dwt_ref[i][j] = (rnd() & 1023) - 512;
+        dwt[i] = dup_buf(dwt_ref[i], 2 * STRIDE * sizeof(IDWTELEM));
+    }
+    for(i = 0; i < 64; i++) {
+        basis[0][i] = (rnd() & 255) - 128;
+        basis[1][i] = (rnd() & 15) + 1;
+        basis[2][i] = (rnd() & 1023) - 512;
+    }
+
+    printf("{\n  \"unit\": \"%s\",\n  \"results\": [", unit);
+    bench_dsp();
+    bench_transforms();
+    bench_coders();
+    printf("\n  ]\n}\n");
+
+    return 0;
+}
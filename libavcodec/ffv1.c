@@ -966,6 +966,10 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, const
     if(!f->plane[0].state && !f->plane[0].vlc_state)
         return -1;
 
+    /* the previous picture is kept until now, the caller may still use it */
+    if(p->data[0])
+        avctx->release_buffer(avctx, p);
+
     p->reference= 0;
     if(avctx->get_buffer(avctx, p) < 0){
         av_log(avctx, AV_LOG_ERROR, "get_buffer() failed\n");
@@ -1001,8 +1005,6 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, const
 
     *picture= *p;
 
-    avctx->release_buffer(avctx, p); //FIXME
-
     *data_size = sizeof(AVFrame);
 
     if(f->ac){
@@ -1015,6 +1017,15 @@ static int decode_frame(AVCodecContext *avctx, void *data, int *data_size, const
     return bytes_read;
 }
 
+static av_cold int decode_end(AVCodecContext *avctx){
+    FFV1Context *f = avctx->priv_data;
+
+    if(f->picture.data[0])
+        avctx->release_buffer(avctx, &f->picture);
+
+    return common_end(avctx);
+}
+
 AVCodec ffv1_decoder = {
     "ffv1",
     CODEC_TYPE_VIDEO,
@@ -1022,7 +1033,7 @@ AVCodec ffv1_decoder = {
     sizeof(FFV1Context),
     decode_init,
     NULL,
-    common_end,
+    decode_end,
     decode_frame,
     CODEC_CAP_DR1 /*| CODEC_CAP_DRAW_HORIZ_BAND*/,
     NULL,
@@ -31,6 +31,7 @@
 #include "h263_parser.h"
 #include "mpeg4video_parser.h"
 #include "msmpeg4.h"
+#include "libavutil/trace.h"
 
 //#define DEBUG
 //#define PRINT_FRAME_TIME
@@ -148,7 +149,7 @@ static int get_consumed_bytes(MpegEncContext *s, int buf_size){
     }
 }
 
-static int decode_slice(MpegEncContext *s){
+static int decode_slice_mbs(MpegEncContext *s){
     const int part_mask= s->partitioned_frame ? (AC_END|AC_ERROR) : 0x7F;
     const int mb_size= 16>>s->avctx->lowres;
     s->last_resync_gb= s->gb;
@@ -320,6 +321,15 @@ static int decode_slice(MpegEncContext *s){
     return -1;
 }
 
+static int decode_slice(MpegEncContext *s){
+    int ret;
+
+    AV_TRACE_BEGIN("decode_slice");
+    ret= decode_slice_mbs(s);
+    AV_TRACE_END("decode_slice");
+    return ret;
+}
+
 int ff_h263_decode_frame(AVCodecContext *avctx,
                              void *data, int *data_size,
                              const uint8_t *buf, int buf_size)
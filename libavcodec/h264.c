@@ -35,6 +35,7 @@
 #include "rectangle.h"
 
 #include "cabac.h"
+#include "libavutil/trace.h"
 #ifdef ARCH_X86
 #include "i386/h264_i386.h"
 #endif
@@ -6802,7 +6803,7 @@ static void filter_mb( H264Context *h, int mb_x, int mb_y, uint8_t *img_y, uint8
     }
 }
 
-static int decode_slice(struct AVCodecContext *avctx, H264Context *h){
+static int decode_slice_mbs(struct AVCodecContext *avctx, H264Context *h){
     MpegEncContext * const s = &h->s;
     const int part_mask= s->partitioned_frame ? (AC_END|AC_ERROR) : 0x7F;
 
@@ -7094,6 +7095,15 @@ static int decode_mb_parallelized(struct AVCodecContext *avctx, H264Context *h)
 
 
 
+static int decode_slice(struct AVCodecContext *avctx, H264Context *h){
+    int ret;
+
+    AV_TRACE_BEGIN("decode_slice");
+    ret= decode_slice_mbs(avctx, h);
+    AV_TRACE_END("decode_slice");
+    return ret;
+}
+
 static int decode_slice2(struct AVCodecContext *avctx, H264Context *h){
     MpegEncContext * const s = &h->s;
     const int part_mask= s->partitioned_frame ? (AC_END|AC_ERROR) : 0x7F;
@@ -7642,9 +7652,11 @@ static void execute_decode_slices(H264Context *h, int context_count){
     int i;
 
     if(context_count == 1) {
-	if(avctx->thread_count > 1 && h->pps.cabac && !FIELD_OR_MBAFF_PICTURE) // multithread path does not like interlaced picture
+	if(avctx->thread_count > 1 && h->pps.cabac && !FIELD_OR_MBAFF_PICTURE){ // multithread path does not like interlaced picture
+	    AV_TRACE_BEGIN("decode_slice");
 	    decode_slice2(avctx, h);
-	else
+	    AV_TRACE_END("decode_slice");
+	}else
 	    decode_slice(avctx, h);
     } else {
         for(i = 1; i < context_count; i++) {
@@ -34,6 +34,7 @@
 #include "mpeg12data.h"
 #include "mpeg12decdata.h"
 #include "bytestream.h"
+#include "libavutil/trace.h"
 
 //#undef NDEBUG
 //#include <assert.h>
@@ -1888,7 +1889,9 @@ static int slice_decode_thread(AVCodecContext *c, void *arg){
         uint32_t start_code;
         int ret;
 
+        AV_TRACE_BEGIN("decode_slice");
         ret= mpeg_decode_slice((Mpeg1Context*)s, mb_y, &buf, s->gb.buffer_end - buf);
+        AV_TRACE_END("decode_slice");
         emms_c();
 //av_log(c, AV_LOG_DEBUG, "ret:%d resync:%d/%d mb:%d/%d ts:%d/%d ec:%d\n",
 //ret, s->resync_mb_x, s->resync_mb_y, s->mb_x, s->mb_y, s->start_mb_y, s->end_mb_y, s->error_count);
@@ -2409,7 +2412,9 @@ static int decode_chunks(AVCodecContext *avctx,
                     }
                     buf_ptr += 2; //FIXME add minimum num of bytes per slice
                 }else{
+                    AV_TRACE_BEGIN("decode_slice");
                     ret = mpeg_decode_slice(s, mb_y, &buf_ptr, input_size);
+                    AV_TRACE_END("decode_slice");
                     emms_c();
 
                     if(ret < 0){
@@ -27,6 +27,7 @@
 
 #include "libavutil/integer.h"
 #include "libavutil/crc.h"
+#include "libavutil/trace.h"
 #include "avcodec.h"
 #include "dsputil.h"
 #include "opt.h"
@@ -104,6 +105,7 @@ typedef struct InternalBuffer{
     int linesize[4];
     int width, height;
     enum PixelFormat pix_fmt;
+    int mem;                    ///< bytes charged to AVCodecContext.mem
 }InternalBuffer;
 
 #define INTERNAL_BUFFER_SIZE 32
@@ -214,6 +216,8 @@ int avcodec_default_get_buffer(AVCodecContext *s, AVFrame *pic){
             av_freep(&buf->base[i]);
             buf->data[i]= NULL;
         }
+        av_mem_account_release(&s->mem, buf->mem);
+        buf->mem= 0;
     }
 
     if(buf->base[0]){
@@ -250,6 +254,17 @@ int avcodec_default_get_buffer(AVCodecContext *s, AVFrame *pic){
         memset(buf->base, 0, sizeof(buf->base));
         memset(buf->data, 0, sizeof(buf->data));
 
+        /* a failed allocation may have left a charge behind */
+        av_mem_account_release(&s->mem, buf->mem);
+        buf->mem= 0;
+        for(i=0; i<4 && size[i]; i++)
+            buf->mem+= size[i]+16;
+        if(av_mem_account_charge(&s->mem, buf->mem) < 0){
+            av_log(s, AV_LOG_ERROR, "memory limit exceeded, cannot allocate picture\n");
+            buf->mem= 0;
+            return -1;
+        }
+
         for(i=0; i<4 && size[i]; i++){
             const int h_shift= i==0 ? 0 : h_chroma_shift;
             const int v_shift= i==0 ? 0 : v_chroma_shift;
@@ -711,6 +726,7 @@ static const AVOption options[]={
 {"request_channels", "set desired number of audio channels", OFFSET(request_channels), FF_OPT_TYPE_INT, DEFAULT, 0, INT_MAX, A|D},
 {"drc_scale", "percentage of dynamic range compression to apply", OFFSET(drc_scale), FF_OPT_TYPE_FLOAT, 1.0, 0.0, 1.0, A|D},
 {"reservoir", "use bit reservoir", 0, FF_OPT_TYPE_CONST, CODEC_FLAG2_BIT_RESERVOIR, INT_MIN, INT_MAX, A|E, "flags2"},
+{"picmemlimit", "bytes of decoded pictures above which no more are allocated, 0 means unlimited", OFFSET(mem.hard_limit), FF_OPT_TYPE_INT64, DEFAULT, 0, INT64_MAX, V|D},
 {NULL},
 };
 
@@ -800,6 +816,9 @@ int attribute_align_arg avcodec_open(AVCodecContext *avctx, AVCodec *codec)
     if(avctx->codec || !codec)
         goto end;
 
+    /* the context may be a copy of one which was in use */
+    av_mem_account_reset(&avctx->mem, NULL);
+
     if (codec->priv_data_size > 0) {
         avctx->priv_data = av_mallocz(codec->priv_data_size);
         if (!avctx->priv_data) {
@@ -846,7 +865,10 @@ int attribute_align_arg avcodec_encode_audio(AVCodecContext *avctx, uint8_t *buf
         return -1;
     }
     if((avctx->codec->capabilities & CODEC_CAP_DELAY) || samples){
-        int ret = avctx->codec->encode(avctx, buf, buf_size, (void *)samples);
+        int ret;
+        AV_TRACE_BEGIN("encode");
+        ret = avctx->codec->encode(avctx, buf, buf_size, (void *)samples);
+        AV_TRACE_END("encode");
         avctx->frame_number++;
         return ret;
     }else
@@ -863,7 +885,10 @@ int attribute_align_arg avcodec_encode_video(AVCodecContext *avctx, uint8_t *buf
     if(avcodec_check_dimensions(avctx,avctx->width,avctx->height))
         return -1;
     if((avctx->codec->capabilities & CODEC_CAP_DELAY) || pict){
-        int ret = avctx->codec->encode(avctx, buf, buf_size, (void *)pict);
+        int ret;
+        AV_TRACE_BEGIN("encode");
+        ret = avctx->codec->encode(avctx, buf, buf_size, (void *)pict);
+        AV_TRACE_END("encode");
         avctx->frame_number++;
         emms_c(); //needed to avoid an emms_c() call before every return;
 
@@ -876,7 +901,9 @@ int avcodec_encode_subtitle(AVCodecContext *avctx, uint8_t *buf, int buf_size,
                             const AVSubtitle *sub)
 {
     int ret;
+    AV_TRACE_BEGIN("encode");
     ret = avctx->codec->encode(avctx, buf, buf_size, (void *)sub);
+    AV_TRACE_END("encode");
     avctx->frame_number++;
     return ret;
 }
@@ -891,8 +918,10 @@ int attribute_align_arg avcodec_decode_video(AVCodecContext *avctx, AVFrame *pic
     if((avctx->coded_width||avctx->coded_height) && avcodec_check_dimensions(avctx,avctx->coded_width,avctx->coded_height))
         return -1;
     if((avctx->codec->capabilities & CODEC_CAP_DELAY) || buf_size){
+        AV_TRACE_BEGIN("decode");
         ret = avctx->codec->decode(avctx, picture, got_picture_ptr,
                                 buf, buf_size);
+        AV_TRACE_END("decode");
 
         emms_c(); //needed to avoid an emms_c() call before every return;
 
@@ -922,8 +951,10 @@ int attribute_align_arg avcodec_decode_audio2(AVCodecContext *avctx, int16_t *sa
             return -1;
         }
 
+        AV_TRACE_BEGIN("decode");
         ret = avctx->codec->decode(avctx, samples, frame_size_ptr,
                                 buf, buf_size);
+        AV_TRACE_END("decode");
         avctx->frame_number++;
     }else{
         ret= 0;
@@ -948,8 +979,10 @@ int avcodec_decode_subtitle(AVCodecContext *avctx, AVSubtitle *sub,
     int ret;
 
     *got_sub_ptr = 0;
+    AV_TRACE_BEGIN("decode");
     ret = avctx->codec->decode(avctx, sub, got_sub_ptr,
                                buf, buf_size);
+    AV_TRACE_END("decode");
     if (*got_sub_ptr)
         avctx->frame_number++;
     return ret;
@@ -1230,6 +1263,7 @@ void avcodec_default_free_buffers(AVCodecContext *s){
             av_freep(&buf->base[j]);
             buf->data[j]= NULL;
         }
+        av_mem_account_release(&s->mem, buf->mem);
     }
     av_freep(&s->internal_buffer);
 
@@ -34,6 +34,16 @@ void avfilter_register_all(void)
         return;
     initialized = 1;
 
-//    REGISTER_FILTER (CROP,crop,vf);
+    REGISTER_FILTER (CROP,crop,vf);
+    REGISTER_FILTER (DRAWTEXT,drawtext,vf);
+    REGISTER_FILTER (FISH,fish,vf);
+    REGISTER_FILTER (FORMAT,format,vf);
+    REGISTER_FILTER (FPS,fps,vf);
+    REGISTER_FILTER (NULL,null,vf);
+    REGISTER_FILTER (OVERLAY,overlay,vf);
+    REGISTER_FILTER (PAD,pad,vf);
+    REGISTER_FILTER (SCALE,scale,vf);
+    REGISTER_FILTER (SPLIT,split,vf);
+    REGISTER_FILTER (WATERMARK,watermark,vf);
 
 }
@@ -0,0 +1,92 @@
+/*
+ * decoding into filter pictures
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavcodec/imgconvert.h"
+#include "avfilter.h"
+
+int avfilter_codec_get_buffer(AVCodecContext *avctx, AVFrame *frame)
+{
+    AVFilterLink *link = avctx->opaque;
+    AVFilterPicRef *ref;
+    int w = avctx->width, h = avctx->height, perms = AV_PERM_WRITE, i;
+
+    avcodec_align_dimensions(avctx, &w, &h);
+
+    /* filter pictures have no edges and are only guaranteed to hold the
+     * link size rounded up to 16 */
+    if(!link || !(avctx->flags & CODEC_FLAG_EMU_EDGE) ||
+       avctx->pix_fmt != link->format ||
+       avctx->width != link->w || avctx->height != link->h ||
+       w > ((link->w + 15) & ~15) || h > ((link->h + 15) & ~15))
+        return avcodec_default_get_buffer(avctx, frame);
+
+    if(frame->buffer_hints & FF_BUFFER_HINTS_PRESERVE)
+        perms |= AV_PERM_PRESERVE;
+    if(frame->buffer_hints & FF_BUFFER_HINTS_REUSABLE)
+        perms |= AV_PERM_REUSE2;
+
+    ref = avfilter_get_video_buffer(link, perms);
+    if(ref->linesize[0] < ff_get_plane_bytewidth(avctx->pix_fmt, w, 0)) {
+        avfilter_unref_pic(ref);
+        return avcodec_default_get_buffer(avctx, frame);
+    }
+
+    for(i = 0; i < 4; i ++) {
+        frame->base[i]     =
+        frame->data[i]     = ref->data[i];
+        frame->linesize[i] = ref->linesize[i];
+    }
+    frame->opaque = ref;
+    frame->type   = FF_BUFFER_TYPE_USER;
+    /* the contents of a pooled picture are unrelated to earlier frames */
+    frame->age    = 256*256*256*64;
+
+    return 0;
+}
+
+void avfilter_codec_release_buffer(AVCodecContext *avctx, AVFrame *frame)
+{
+    int i;
+
+    if(frame->type != FF_BUFFER_TYPE_USER) {
+        avcodec_default_release_buffer(avctx, frame);
+        return;
+    }
+
+    avfilter_unref_pic(frame->opaque);
+    frame->opaque = NULL;
+    for(i = 0; i < 4; i ++)
+        frame->data[i] = NULL;
+}
+
+AVFilterPicRef *avfilter_codec_ref_frame(AVFrame *frame, int pmask)
+{
+    AVFilterPicRef *ref;
+
+    if(frame->type != FF_BUFFER_TYPE_USER || !frame->opaque)
+        return NULL;
+
+    ref = avfilter_ref_pic(frame->opaque, pmask);
+    /* the decoder may still predict other frames from it */
+    if(frame->reference)
+        ref->perms &= ~AV_PERM_WRITE;
+
+    return ref;
+}
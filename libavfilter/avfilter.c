@@ -20,6 +20,7 @@
  */
 
 #include "libavcodec/imgconvert.h"
+#include "libavutil/trace.h"
 #include "avfilter.h"
 
 /** list of registered filters */
@@ -231,7 +232,9 @@ void avfilter_end_frame(AVFilterLink *link)
     if(!(end_frame = link_dpad(link).end_frame))
         end_frame = avfilter_default_end_frame;
 
+    AV_TRACE_BEGIN("filter");
     end_frame(link);
+    AV_TRACE_END("filter");
 
     /* unreference the source picture if we're feeding the destination filter
      * a copied version dues to permission issues */
@@ -242,41 +245,65 @@ void avfilter_end_frame(AVFilterLink *link)
 
 }
 
-void avfilter_draw_slice(AVFilterLink *link, int y, int h)
+typedef struct {
+    AVFilterLink *link;
+    int y, h;
+} SliceCopy;
+
+static int copy_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
 {
-    uint8_t *src[4], *dst[4];
+    SliceCopy *s = arg;
+    AVFilterLink *link = s->link;
+    uint8_t *src, *dst;
     int i, j, hsub, vsub;
 
-    /* copy the slice if needed for permission reasons */
-    if(link->srcpic) {
-        avcodec_get_chroma_sub_sample(link->format, &hsub, &vsub);
-
-        for(i = 0; i < 4; i ++) {
-            if(link->srcpic->data[i]) {
-                src[i] = link->srcpic-> data[i] +
-                    (y >> (i==0 ? 0 : vsub)) * link->srcpic-> linesize[i];
-                dst[i] = link->cur_pic->data[i] +
-                    (y >> (i==0 ? 0 : vsub)) * link->cur_pic->linesize[i];
-            } else
-                src[i] = dst[i] = NULL;
-        }
+    avcodec_get_chroma_sub_sample(link->format, &hsub, &vsub);
 
-        for(i = 0; i < 4; i ++) {
-            int planew =
-                ff_get_plane_bytewidth(link->format, link->cur_pic->w, i);
+    /* every job copies a band of rows from each plane */
+    for(i = 0; i < 4; i ++) {
+        int planew =
+            ff_get_plane_bytewidth(link->format, link->cur_pic->w, i);
+        int y0 = s->y >> (i==0 ? 0 : vsub);
+        int h  = s->h >> (i==0 ? 0 : vsub);
+        int j0 = h *  jobnr      / nb_jobs;
+        int j1 = h * (jobnr + 1) / nb_jobs;
 
-            if(!src[i]) continue;
+        if(!link->srcpic->data[i]) continue;
 
-            for(j = 0; j < h >> (i==0 ? 0 : vsub); j ++) {
-                memcpy(dst[i], src[i], planew);
-                src[i] += link->srcpic ->linesize[i];
-                dst[i] += link->cur_pic->linesize[i];
-            }
+        /* the palette goes with the first slice */
+        if(planew < 0) {
+            if(!s->y && !jobnr)
+                memcpy(link->cur_pic->data[i], link->srcpic->data[i], 256 * 4);
+            continue;
+        }
+
+        src = link->srcpic-> data[i] + (y0 + j0) * link->srcpic-> linesize[i];
+        dst = link->cur_pic->data[i] + (y0 + j0) * link->cur_pic->linesize[i];
+        for(j = j0; j < j1; j ++) {
+            memcpy(dst, src, planew);
+            src += link->srcpic ->linesize[i];
+            dst += link->cur_pic->linesize[i];
         }
     }
 
-    if(link_dpad(link).draw_slice)
+    return 0;
+}
+
+void avfilter_draw_slice(AVFilterLink *link, int y, int h)
+{
+    /* copy the slice if needed for permission reasons */
+    if(link->srcpic) {
+        AVFilterContext *dst = link->dst;
+        SliceCopy s = { link, y, h };
+
+        dst->execute(dst, copy_slice, &s, NULL, FFMAX(FFMIN(dst->thread_count, h >> 4), 1));
+    }
+
+    if(link_dpad(link).draw_slice) {
+        AV_TRACE_BEGIN("filter");
         link_dpad(link).draw_slice(link, y, h);
+        AV_TRACE_END("filter");
+    }
 }
 
 AVFilter *avfilter_get_by_name(const char *name)
@@ -352,6 +379,10 @@ AVFilterContext *avfilter_open(AVFilter *filter, const char *inst_name)
     memcpy(ret->output_pads, filter->outputs, sizeof(AVFilterPad)*ret->output_count);
     ret->outputs      = av_mallocz(sizeof(AVFilterLink*) * ret->output_count);
 
+    ret->execute      = avfilter_default_execute;
+    ret->thread_count = 1;
+    ret->thread_opaque = NULL;
+
     return ret;
 }
 
@@ -363,13 +394,17 @@ void avfilter_destroy(AVFilterContext *filter)
         filter->filter->uninit(filter);
 
     for(i = 0; i < filter->input_count; i ++) {
-        if(filter->inputs[i])
+        if(filter->inputs[i]) {
             filter->inputs[i]->src->outputs[filter->inputs[i]->srcpad] = NULL;
+            avfilter_default_free_buffer_pool(filter->inputs[i]);
+        }
         av_freep(&filter->inputs[i]);
     }
     for(i = 0; i < filter->output_count; i ++) {
-        if(filter->outputs[i])
+        if(filter->outputs[i]) {
             filter->outputs[i]->dst->inputs[filter->outputs[i]->dstpad] = NULL;
+            avfilter_default_free_buffer_pool(filter->outputs[i]);
+        }
         av_freep(&filter->outputs[i]);
     }
 
@@ -23,7 +23,7 @@
 #define FFMPEG_AVFILTER_H
 
 #define LIBAVFILTER_VERSION_MAJOR  0
-#define LIBAVFILTER_VERSION_MINOR  0
+#define LIBAVFILTER_VERSION_MINOR  3
 #define LIBAVFILTER_VERSION_MICRO  0
 
 #define LIBAVFILTER_VERSION_INT AV_VERSION_INT(LIBAVFILTER_VERSION_MAJOR, \
@@ -40,6 +40,7 @@
 typedef struct AVFilterContext AVFilterContext;
 typedef struct AVFilterLink    AVFilterLink;
 typedef struct AVFilterPad     AVFilterPad;
+typedef struct AVFilterPool    AVFilterPool;
 
 /* TODO: look for other flags which may be useful in this structure (interlace
  * flags, etc)
@@ -281,7 +282,9 @@ struct AVFilterPad
 
     /**
      * Callback function to get a buffer.  If NULL, the filter system will
-     * handle buffer requests.
+     * handle buffer requests.  The picture must have room for the link size
+     * rounded up to a multiple of 16 in both directions.  Returning NULL
+     * also leaves the request to the filter system.
      *
      * Input video pads only.
      */
@@ -318,7 +321,9 @@ struct AVFilterPad
     /**
      * Frame request callback.  A call to this should result in at least one
      * frame being output over the given link.  This should return zero on
-     * success, and another value on error.
+     * success, and another value on error.  AVERROR(EAGAIN) means that no
+     * frame is available yet, e.g. from a source fed by the application, and
+     * that the request may be repeated later; filters pass it on as is.
      *
      * Output video pads only.
      */
@@ -341,6 +346,16 @@ struct AVFilterPad
     int (*config_props)(AVFilterLink *link);
 };
 
+/** start_frame() handler for filters which pass the picture on unchanged */
+void avfilter_null_start_frame(AVFilterLink *link, AVFilterPicRef *picref);
+/**
+ * get_video_buffer() handler for filters which pass the picture on
+ * unchanged, hands out buffers of the next filter
+ */
+AVFilterPicRef *avfilter_null_get_video_buffer(AVFilterLink *link, int perms);
+/** draw_slice() handler for filters which pass the picture on unchanged */
+void avfilter_null_draw_slice(AVFilterLink *link, int y, int h);
+
 /** Default handler for start_frame() for video inputs */
 void avfilter_default_start_frame(AVFilterLink *link, AVFilterPicRef *picref);
 /** Default handler for end_frame() for video inputs */
@@ -352,6 +367,8 @@ int avfilter_default_config_input_link (AVFilterLink *link);
 /** Default handler for get_video_buffer() for video inputs */
 AVFilterPicRef *avfilter_default_get_video_buffer(AVFilterLink *link,
                                                   int perms);
+/** Free the unused pictures of a link, called when the link is destroyed */
+void avfilter_default_free_buffer_pool(AVFilterLink *link);
 /**
  * A helper for query_formats() which sets all links to the same list of
  * formats. If there are no links hooked to this filter, the list of formats is
@@ -399,6 +416,21 @@ typedef struct
     const AVFilterPad *outputs; ///< NULL terminated list of outputs. NULL if none
 } AVFilter;
 
+/**
+ * A job run by AVFilterContext.execute().
+ * @param ctx    the filter the job is run for
+ * @param arg    the argument given to execute()
+ * @param jobnr  index of this job, 0 <= jobnr < nb_jobs
+ * @param nb_jobs total number of jobs
+ * @return       zero on success
+ */
+typedef int (avfilter_action_func)(AVFilterContext *ctx, void *arg,
+                                   int jobnr, int nb_jobs);
+
+/** Default handler for execute(), runs all jobs in the calling thread */
+int avfilter_default_execute(AVFilterContext *ctx, avfilter_action_func *func,
+                             void *arg, int *ret, int nb_jobs);
+
 /** An instance of a filter */
 struct AVFilterContext
 {
@@ -417,6 +449,17 @@ struct AVFilterContext
     AVFilterLink **outputs;         ///< array of pointers to output links
 
     void *priv;                     ///< private data for use by the filter
+
+    /**
+     * Run func nb_jobs times, possibly in parallel.  Filters use this to
+     * split the work on a slice among the threads of the filter graph.
+     * Returns once all jobs have finished.  If ret is not NULL, the return
+     * value of each job is stored in it.
+     */
+    int (*execute)(AVFilterContext *ctx, avfilter_action_func *func,
+                   void *arg, int *ret, int nb_jobs);
+    int thread_count;               ///< number of threads execute() may use
+    void *thread_opaque;            ///< thread pool of the graph, used by execute()
 };
 
 /**
@@ -464,6 +507,9 @@ struct AVFilterLink
 
     AVFilterPicRef *cur_pic;
     AVFilterPicRef *outpic;
+
+    /** unused pictures kept for avfilter_default_get_video_buffer() */
+    AVFilterPool *pool;
 };
 
 /**
@@ -532,6 +578,28 @@ void avfilter_end_frame(AVFilterLink *link);
  */
 void avfilter_draw_slice(AVFilterLink *link, int y, int h);
 
+/**
+ * AVCodecContext.get_buffer() which makes a video decoder render directly
+ * into pictures requested from the filter link in AVCodecContext.opaque,
+ * instead of into its own buffers which would then be copied into the
+ * filter chain.  If the decoder does not use CODEC_FLAG_EMU_EDGE or does not
+ * output the size and colorspace of the link, avcodec_default_get_buffer()
+ * is used instead.
+ */
+int avfilter_codec_get_buffer(AVCodecContext *avctx, AVFrame *frame);
+
+/** AVCodecContext.release_buffer() to go with avfilter_codec_get_buffer() */
+void avfilter_codec_release_buffer(AVCodecContext *avctx, AVFrame *frame);
+
+/**
+ * Get a reference to the filter picture a decoded frame was rendered into
+ * by avfilter_codec_get_buffer(), to send it over the link without copying.
+ * Write permission is withheld while the decoder still references the frame.
+ * @param pmask a bitmask containing the allowable permissions
+ * @return      the reference, NULL if the frame is not in a filter picture
+ */
+AVFilterPicRef *avfilter_codec_ref_frame(AVFrame *frame, int pmask);
+
 /** Initialize the filter system.  Registers all builtin filters */
 void avfilter_register_all(void);
 
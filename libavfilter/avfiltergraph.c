@@ -31,6 +31,40 @@ void avfilter_destroy_graph(AVFilterGraph *graph)
     for(; graph->filter_count > 0; graph->filter_count --)
         avfilter_destroy(graph->filters[graph->filter_count - 1]);
     av_freep(&graph->filters);
+    avfilter_graph_thread_init(graph, 1);
+}
+
+static void set_threads(AVFilterGraph *graph, AVFilterContext *filter)
+{
+    if(graph->thread_opaque) {
+        filter->execute       = graph->execute;
+        filter->thread_count  = graph->thread_count;
+        filter->thread_opaque = graph->thread_opaque;
+    } else {
+        filter->execute       = avfilter_default_execute;
+        filter->thread_count  = 1;
+        filter->thread_opaque = NULL;
+    }
+}
+
+int avfilter_graph_thread_init(AVFilterGraph *graph, int thread_count)
+{
+    int i, ret = 0;
+
+#ifdef HAVE_PTHREADS
+    if(graph->thread_opaque)
+        ff_avfilter_thread_free(graph);
+    if(thread_count > 1)
+        ret = ff_avfilter_thread_init(graph, thread_count);
+#else
+    if(thread_count > 1)
+        ret = -1;
+#endif
+
+    for(i = 0; i < graph->filter_count; i ++)
+        set_threads(graph, graph->filters[i]);
+
+    return ret;
 }
 
 int avfilter_graph_add_filter(AVFilterGraph *graph, AVFilterContext *filter)
@@ -42,6 +76,7 @@ int avfilter_graph_add_filter(AVFilterGraph *graph, AVFilterContext *filter)
         return -1;
 
     graph->filters[graph->filter_count - 1] = filter;
+    set_threads(graph, filter);
 
     return 0;
 }
@@ -110,30 +145,87 @@ static int query_formats(AVFilterGraph *graph)
     return 0;
 }
 
-static void pick_format(AVFilterLink *link)
+/**
+ * Pick a format for a link whose format lists have been merged.
+ * @param format the format to pick, or -1 for the first one of the list
+ * @return       1 if a format was picked, 0 if format is not in the list
+ */
+static int pick_format(AVFilterLink *link, int format)
 {
-    if(!link || !link->in_formats)
-        return;
+    AVFilterFormats *fmts = link->in_formats;
+    int i = 0;
 
-    link->in_formats->format_count = 1;
-    link->format = link->in_formats->formats[0];
+    if(format >= 0)
+        for(i = 0; i < fmts->format_count && fmts->formats[i] != format; i ++);
+    if(i == fmts->format_count)
+        return 0;
+
+    /* the list may be shared with other links, which have to pick the same */
+    fmts->formats[0]   = fmts->formats[i];
+    fmts->format_count = 1;
+    link->format = fmts->formats[0];
 
     avfilter_formats_unref(&link->in_formats);
     avfilter_formats_unref(&link->out_formats);
+    return 1;
 }
 
-static void pick_formats(AVFilterGraph *graph)
+/**
+ * Try to give link the format already picked for another link of filter, so
+ * that the filter need not convert between them.
+ */
+static int pick_neighbour_format(AVFilterContext *filter, AVFilterLink *link)
 {
-    int i, j;
-
-    for(i = 0; i < graph->filter_count; i ++) {
-        AVFilterContext *filter = graph->filters[i];
+    int i;
 
-        for(j = 0; j < filter->input_count; j ++)
-            pick_format(filter->inputs[j]);
-        for(j = 0; j < filter->output_count; j ++)
-            pick_format(filter->outputs[j]);
+    for(i = 0; i < filter->input_count; i ++) {
+        AVFilterLink *l = filter->inputs[i];
+        if(l && l != link && !l->in_formats && l->format >= 0 &&
+           pick_format(link, l->format))
+            return 1;
+    }
+    for(i = 0; i < filter->output_count; i ++) {
+        AVFilterLink *l = filter->outputs[i];
+        if(l && l != link && !l->in_formats && l->format >= 0 &&
+           pick_format(link, l->format))
+            return 1;
     }
+    return 0;
+}
+
+static void pick_formats(AVFilterGraph *graph)
+{
+    AVFilterLink *first;
+    int i, j, changed;
+
+    do {
+        /* propagate the formats which are already decided, either because
+         * only one is possible or because a neighbouring link has it */
+        do {
+            changed = 0;
+            first   = NULL;
+            for(i = 0; i < graph->filter_count; i ++) {
+                AVFilterContext *filter = graph->filters[i];
+
+                for(j = 0; j < filter->input_count; j ++) {
+                    AVFilterLink *link = filter->inputs[j];
+
+                    if(!link || !link->in_formats)
+                        continue;
+                    if(link->in_formats->format_count == 1)
+                        changed |= pick_format(link, -1);
+                    else if(pick_neighbour_format(link->src, link) ||
+                            pick_neighbour_format(link->dst, link))
+                        changed = 1;
+                    else if(!first)
+                        first = link;
+                }
+            }
+        } while(changed);
+
+        if(first && first->in_formats)
+            pick_format(first, -1);
+    } while(first);
 }
 
 int avfilter_graph_config_formats(AVFilterGraph *graph)
@@ -143,7 +235,9 @@ int avfilter_graph_config_formats(AVFilterGraph *graph)
         return -1;
 
     /* Once everything is merged, it's possible that we'll still have
-     * multiple valid colorspace choices. We pick the first one. */
+     * multiple valid colorspace choices. We pick the first one, preferring
+     * the colorspace of a neighbouring link so filters can avoid converting
+     * between their inputs and outputs. */
     pick_formats(graph);
 
     return 0;
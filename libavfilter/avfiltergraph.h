@@ -27,6 +27,12 @@
 typedef struct AVFilterGraph {
     unsigned filter_count;
     AVFilterContext **filters;
+
+    int thread_count;           ///< number of threads in the pool, 0 or 1 if there is none
+    void *thread_opaque;        ///< thread pool shared by the filters of the graph
+    /** execute() handed to the filters of the graph, NULL for the default */
+    int (*execute)(AVFilterContext *ctx, avfilter_action_func *func,
+                   void *arg, int *ret, int nb_jobs);
 } AVFilterGraph;
 
 /**
@@ -46,9 +52,20 @@ int avfilter_graph_add_filter(AVFilterGraph *graphctx, AVFilterContext *filter);
  */
 int avfilter_graph_config_formats(AVFilterGraph *graphctx);
 
+/**
+ * Start a pool of threads on which the filters of the graph run their slice
+ * jobs.  This applies to filters already in the graph as well as to those
+ * added later.  A thread_count of 1 or less stops a pool started earlier.
+ * @return zero on success
+ */
+int avfilter_graph_thread_init(AVFilterGraph *graph, int thread_count);
+
 /**
  * Free a graph and destroy its links.
  */
 void avfilter_destroy_graph(AVFilterGraph *graph);
 
+int  ff_avfilter_thread_init(AVFilterGraph *graph, int thread_count);
+void ff_avfilter_thread_free(AVFilterGraph *graph);
+
 #endif  /* FFMPEG_AVFILTERGRAPH_H */
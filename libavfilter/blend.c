@@ -0,0 +1,212 @@
+/*
+ * alpha blending helpers for the drawing filters
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "blend.h"
+
+/* t is at most 255 * 255 + 128, then (t + (t >> 8)) >> 8 is t / 255 rounded
+ * to nearest and everything fits in 16 bits unsigned */
+static void blend_row_c(uint8_t *dst, const uint8_t *src, const uint8_t *alpha, int w)
+{
+    int i;
+
+    for(i = 0; i < w; i ++) {
+        unsigned t = dst[i] * (255 - alpha[i]) + src[i] * alpha[i] + 128;
+        dst[i] = (t + (t >> 8)) >> 8;
+    }
+}
+
+static void blend_color_row_c(uint8_t *dst, int color, const uint8_t *alpha, int w)
+{
+    int i;
+
+    for(i = 0; i < w; i ++) {
+        unsigned t = dst[i] * (255 - alpha[i]) + color * alpha[i] + 128;
+        dst[i] = (t + (t >> 8)) >> 8;
+    }
+}
+
+static void add_row_c(uint8_t *dst, const int16_t *delta, int w)
+{
+    int i;
+
+    for(i = 0; i < w; i ++)
+        dst[i] = av_clip_uint8(dst[i] + delta[i]);
+}
+
+void ff_blend_dsp_init(BlendDSPContext *c)
+{
+    c->blend_row       = blend_row_c;
+    c->blend_color_row = blend_color_row_c;
+    c->add_row         = add_row_c;
+
+#ifdef HAVE_MMX
+    ff_blend_dsp_init_mmx(c);
+#endif
+}
+
+void ff_blend_subsample_alpha(uint8_t *dst, int dst_linesize,
+                              const uint8_t *src, int src_linesize,
+                              int w, int h, int hsub, int vsub)
+{
+    int x, y, i, j;
+
+    for(y = 0; y < h; y += 1 << vsub) {
+        int rows = FFMIN(1 << vsub, h - y);
+        for(x = 0; x < w; x += 1 << hsub) {
+            int cols = FFMIN(1 << hsub, w - x);
+            int sum  = 0;
+            for(j = 0; j < rows; j ++)
+                for(i = 0; i < cols; i ++)
+                    sum += src[(y + j) * src_linesize + x + i];
+            dst[x >> hsub] = (sum + (rows * cols >> 1)) / (rows * cols);
+        }
+        dst += dst_linesize;
+    }
+}
+
+void ff_blend_batch_add(BlendBatch *batch, AVFilterPicRef *picref)
+{
+    if(batch->count == MAX_BATCH) {
+        /* only when an input sends several pictures for one request */
+        avfilter_unref_pic(picref);
+        return;
+    }
+    batch->pic[batch->count ++] = picref;
+}
+
+int ff_blend_batch_request(AVFilterLink *link, BlendBatch *batch,
+                           avfilter_action_func *func, int nb_jobs)
+{
+    AVFilterContext *ctx = link->src;
+    AVFilterPicRef *pic;
+    int ret;
+
+    if(!batch->done) {
+        while(!batch->eof && batch->count < batch->size) {
+            ret = avfilter_request_frame(ctx->inputs[0]);
+            /* the pictures held so far wait for the next call */
+            if(ret == AVERROR(EAGAIN))
+                return ret;
+            if(ret)
+                batch->eof = 1;
+        }
+        if(!batch->count)
+            return -1;
+
+        ctx->execute(ctx, func, batch, NULL, FFMAX(nb_jobs, 1));
+        batch->done = batch->count;
+    }
+
+    pic = batch->pic[0];
+    batch->done --;
+    batch->count --;
+    memmove(batch->pic, batch->pic + 1, batch->count * sizeof(*batch->pic));
+
+    avfilter_start_frame(link, pic);
+    avfilter_draw_slice(link, 0, pic->h);
+    avfilter_end_frame(link);
+
+    return 0;
+}
+
+void ff_blend_batch_free(BlendBatch *batch)
+{
+    while(batch->count)
+        avfilter_unref_pic(batch->pic[-- batch->count]);
+    batch->done = 0;
+}
+
+#ifdef TEST
+#undef printf
+#include <stdio.h>
+
+#define MAX_WIDTH 80
+#define ROUNDS    20000
+
+static unsigned int rnd(unsigned int *seed)
+{
+    *seed = *seed * 1664525 + 1013904223;
+    return *seed >> 8;
+}
+
+/* mostly random alpha, with runs of fully transparent and opaque samples */
+static int rnd_alpha(unsigned int *seed)
+{
+    int a = rnd(seed) & 511;
+    return a < 256 ? a : a < 384 ? 0 : 255;
+}
+
+/**
+ * Run the C and the optimized row functions on the same random rows, at
+ * every width up to MAX_WIDTH and at unaligned addresses, and compare.
+ */
+int main(void)
+{
+    BlendDSPContext c, opt;
+    uint8_t src[MAX_WIDTH + 8], alpha[MAX_WIDTH + 8];
+    uint8_t dst_c[MAX_WIDTH + 8], dst_opt[MAX_WIDTH + 8];
+    int16_t delta[MAX_WIDTH + 8];
+    unsigned int seed = 1;
+    int i, j, errors = 0;
+
+    c.blend_row       = blend_row_c;
+    c.blend_color_row = blend_color_row_c;
+    c.add_row         = add_row_c;
+    ff_blend_dsp_init(&opt);
+
+    for(i = 0; i < ROUNDS; i ++) {
+        int w     = rnd(&seed) % (MAX_WIDTH + 1);
+        int off   = rnd(&seed) & 7;
+        int color = rnd(&seed) & 255;
+
+        for(j = 0; j < MAX_WIDTH + 8; j ++) {
+            src[j]   = rnd(&seed);
+            alpha[j] = rnd_alpha(&seed);
+            dst_c[j] = dst_opt[j] = rnd(&seed);
+            delta[j] = rnd(&seed) % 511 - 255;
+        }
+
+        switch(i % 3) {
+        case 0:
+            c  .blend_row(dst_c   + off, src + off, alpha + off, w);
+            opt.blend_row(dst_opt + off, src + off, alpha + off, w);
+            break;
+        case 1:
+            c  .blend_color_row(dst_c   + off, color, alpha + off, w);
+            opt.blend_color_row(dst_opt + off, color, alpha + off, w);
+            break;
+        case 2:
+            c  .add_row(dst_c   + off, delta + off, w);
+            opt.add_row(dst_opt + off, delta + off, w);
+            break;
+        }
+
+        if(memcmp(dst_c, dst_opt, sizeof(dst_c))) {
+            static const char *names[] = { "blend_row", "blend_color_row", "add_row" };
+            printf("%s differs from C for width %d at offset %d\n",
+                   names[i % 3], w, off);
+            errors ++;
+        }
+    }
+
+    printf("%d rows compared, %d mismatches\n", ROUNDS, errors);
+    return !!errors;
+}
+#endif /* TEST */
@@ -0,0 +1,86 @@
+/*
+ * alpha blending helpers for the drawing filters
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FFMPEG_BLEND_H
+#define FFMPEG_BLEND_H
+
+#include <stdint.h>
+#include "avfilter.h"
+
+/**
+ * Row functions shared by the filters which draw onto planar pictures.
+ * The optimized versions give exactly the same results as the C ones.
+ */
+typedef struct BlendDSPContext {
+    /**
+     * dst[i] = (dst[i] * (255 - alpha[i]) + src[i] * alpha[i]) / 255,
+     * rounded to nearest.
+     */
+    void (*blend_row)(uint8_t *dst, const uint8_t *src, const uint8_t *alpha, int w);
+    /** Same as blend_row() with all of src[] set to color. */
+    void (*blend_color_row)(uint8_t *dst, int color, const uint8_t *alpha, int w);
+    /** dst[i] = av_clip_uint8(dst[i] + delta[i]), delta in [-255, 255]. */
+    void (*add_row)(uint8_t *dst, const int16_t *delta, int w);
+} BlendDSPContext;
+
+void ff_blend_dsp_init(BlendDSPContext *c);
+void ff_blend_dsp_init_mmx(BlendDSPContext *c);
+
+/**
+ * Build the alpha mask of a chroma plane from that of the luma plane, each
+ * chroma sample gets the rounded average of the luma samples it covers.
+ */
+void ff_blend_subsample_alpha(uint8_t *dst, int dst_linesize,
+                              const uint8_t *src, int src_linesize,
+                              int w, int h, int hsub, int vsub);
+
+#define MAX_BATCH 16            ///< maximum number of pictures drawn at once
+
+/**
+ * Pictures held back by a filter so that they are drawn onto together:
+ * each job of the drawing function goes over the same rows of all the
+ * pictures of the batch, while the rows of the overlaid image it reads are
+ * still in the cache.
+ */
+typedef struct BlendBatch {
+    AVFilterPicRef *pic[MAX_BATCH];
+    int size;                   ///< number of pictures drawn at once
+    int count;                  ///< number of pictures held
+    int done;                   ///< pictures at the start of pic[] already drawn onto
+    int eof;                    ///< no more input pictures
+} BlendBatch;
+
+/** Hold a picture received by the input of the filter. */
+void ff_blend_batch_add(BlendBatch *batch, AVFilterPicRef *picref);
+
+/**
+ * request_frame() of filters using a batch.  Input pictures are read until
+ * the batch is full or the input ends, then func is run on them with the
+ * batch as argument, split into nb_jobs jobs, and the pictures are sent on
+ * one per call.
+ * @return zero on success, AVERROR(EAGAIN) if the input has no picture
+ *         available yet, another negative value at the end
+ */
+int ff_blend_batch_request(AVFilterLink *link, BlendBatch *batch,
+                           avfilter_action_func *func, int nb_jobs);
+
+void ff_blend_batch_free(BlendBatch *batch);
+
+#endif  /* FFMPEG_BLEND_H */
@@ -22,45 +22,134 @@
 #include "libavcodec/imgconvert.h"
 #include "avfilter.h"
 
-/* TODO: buffer pool.  see comment for avfilter_default_get_video_buffer() */
-void avfilter_default_free_video_buffer(AVFilterPic *pic)
+#define POOL_SIZE 8              ///< unused pictures kept by a link
+
+/**
+ * Pictures allocated for a link and no longer referenced are kept here and
+ * handed out again by avfilter_default_get_video_buffer().  A picture has
+ * no references left when it comes back, so whatever permissions the new
+ * request asks for can be granted.  Pools are not thread safe, pictures
+ * must be released by the thread driving the filter graph.
+ */
+struct AVFilterPool
+{
+    AVFilterPic *pic[POOL_SIZE];    ///< unused pictures
+    int count;                      ///< number of unused pictures
+    int refcount;                   ///< pictures allocated from the pool, plus one for the link
+    int orphan;                     ///< the link is gone
+    int w, h, format;               ///< properties of the pooled pictures
+};
+
+static void free_pool_pic(AVFilterPool *pool, AVFilterPic *pic)
 {
     av_free(pic->data[0]);
     av_free(pic);
+
+    if(!--pool->refcount)
+        av_free(pool);
+}
+
+static void flush_pool(AVFilterPool *pool)
+{
+    while(pool->count)
+        free_pool_pic(pool, pool->pic[--pool->count]);
+}
+
+/** AVFilterPic.free() for pictures allocated from a link pool */
+static void pool_release_video_buffer(AVFilterPic *pic)
+{
+    AVFilterPool *pool = pic->priv;
+
+    /* the link may be gone already, then its pool only waits for its
+     * pictures to come back before going away */
+    if(!pool->orphan && pool->count < POOL_SIZE) {
+        pic->refcount = 0;
+        pool->pic[pool->count++] = pic;
+    } else
+        free_pool_pic(pool, pic);
+}
+
+void avfilter_default_free_buffer_pool(AVFilterLink *link)
+{
+    AVFilterPool *pool = link->pool;
+
+    if(!pool)
+        return;
+
+    link->pool   = NULL;
+    pool->orphan = 1;
+    flush_pool(pool);
+    if(!--pool->refcount)
+        av_free(pool);
 }
 
 #define ALIGN(a) do{ \
                      (a) = ((a) + 15) & (~15); \
                  } while(0);
 
-/* TODO: set the buffer's priv member to a context structure for the whole
- * filter chain.  This will allow for a buffer pool instead of the constant
- * alloc & free cycle currently implemented. */
+#define PAD16(a) (((a) + 15) & ~15)
+
+/**
+ * The planes are allocated for a size rounded up to a multiple of 16 in
+ * both directions, so that decoders can render into the picture directly,
+ * see avfilter_codec_get_buffer().
+ */
 AVFilterPicRef *avfilter_default_get_video_buffer(AVFilterLink *link, int perms)
 {
-    AVFilterPic *pic = av_mallocz(sizeof(AVFilterPic));
-    AVFilterPicRef *ref = av_mallocz(sizeof(AVFilterPicRef));
+    AVFilterPool *pool = link->pool;
+    AVFilterPicRef *ref;
+    AVFilterPic *pic = NULL;
     int i, tempsize;
     char *buf;
 
-    ref->pic   = pic;
+    if(!pool) {
+        if(!(pool = av_mallocz(sizeof(AVFilterPool))))
+            return NULL;
+        pool->refcount = 1;
+        link->pool = pool;
+    }
+    if(pool->w != link->w || pool->h != link->h || pool->format != link->format) {
+        flush_pool(pool);
+        pool->w      = link->w;
+        pool->h      = link->h;
+        pool->format = link->format;
+    }
+
+    if(!(ref = av_mallocz(sizeof(AVFilterPicRef))))
+        return NULL;
     ref->w     = link->w;
     ref->h     = link->h;
 
     /* make sure the buffer gets read permission or it's useless for output */
     ref->perms = perms | AV_PERM_READ;
 
-    pic->refcount = 1;
-    pic->format   = link->format;
-    pic->free     = avfilter_default_free_video_buffer;
-    ff_fill_linesize((AVPicture *)pic, pic->format, ref->w);
+    if(pool->count) {
+        pic = pool->pic[--pool->count];
+    } else {
+        if(!(pic = av_mallocz(sizeof(AVFilterPic)))) {
+            av_free(ref);
+            return NULL;
+        }
+        pic->format = link->format;
+        pic->free   = pool_release_video_buffer;
+        pic->priv   = pool;
+        ff_fill_linesize((AVPicture *)pic, pic->format, PAD16(ref->w));
 
-    for (i=0; i<4;i++)
-        ALIGN(pic->linesize[i]);
+        for (i=0; i<4;i++)
+            ALIGN(pic->linesize[i]);
 
-    tempsize = ff_fill_pointer((AVPicture *)pic, NULL, pic->format, ref->h);
-    buf = av_malloc(tempsize);
-    ff_fill_pointer((AVPicture *)pic, buf, pic->format, ref->h);
+        tempsize = ff_fill_pointer((AVPicture *)pic, NULL, pic->format,
+                                   PAD16(ref->h));
+        if(!(buf = av_malloc(tempsize))) {
+            av_free(pic);
+            av_free(ref);
+            return NULL;
+        }
+        ff_fill_pointer((AVPicture *)pic, buf, pic->format, PAD16(ref->h));
+        pool->refcount ++;
+    }
+    pic->refcount = 1;
+    ref->pic      = pic;
 
     memcpy(ref->data,     pic->data,     sizeof(pic->data));
     memcpy(ref->linesize, pic->linesize, sizeof(pic->linesize));
@@ -101,6 +190,34 @@ void avfilter_default_end_frame(AVFilterLink *link)
     }
 }
 
+void avfilter_null_start_frame(AVFilterLink *link, AVFilterPicRef *picref)
+{
+    avfilter_start_frame(link->dst->outputs[0], avfilter_ref_pic(picref, ~0));
+}
+
+AVFilterPicRef *avfilter_null_get_video_buffer(AVFilterLink *link, int perms)
+{
+    return avfilter_get_video_buffer(link->dst->outputs[0], perms);
+}
+
+void avfilter_null_draw_slice(AVFilterLink *link, int y, int h)
+{
+    avfilter_draw_slice(link->dst->outputs[0], y, h);
+}
+
+int avfilter_default_execute(AVFilterContext *ctx, avfilter_action_func *func,
+                             void *arg, int *ret, int nb_jobs)
+{
+    int i;
+
+    for(i = 0; i < nb_jobs; i ++) {
+        int r = func(ctx, arg, i, nb_jobs);
+        if(ret)
+            ret[i] = r;
+    }
+    return 0;
+}
+
 /**
  * default config_link() implementation for output video links to simplify
  * the implementation of one input one output video filters */
@@ -0,0 +1,178 @@
+/*
+ * MMX optimized alpha blending
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/x86_cpu.h"
+#include "libavcodec/dsputil.h"
+#include "libavfilter/blend.h"
+
+DECLARE_ASM_CONST(8, uint64_t, ff_pw_255_blend) = 0x00FF00FF00FF00FFULL;
+DECLARE_ASM_CONST(8, uint64_t, ff_pw_128_blend) = 0x0080008000800080ULL;
+
+#define LOAD_CONSTANTS \
+        "pxor %%mm7, %%mm7              \n\t"\
+        "movq "MANGLE(ff_pw_255_blend)", %%mm6 \n\t"\
+        "movq "MANGLE(ff_pw_128_blend)", %%mm5 \n\t"
+
+/* mm0 and mm1 hold the low and high words of the sums t, store
+ * (t + 128 + ((t + 128) >> 8)) >> 8 packed to bytes at (%1, %0) */
+#define DIVIDE_255_STORE \
+        "paddw %%mm5, %%mm0             \n\t"\
+        "paddw %%mm5, %%mm1             \n\t"\
+        "movq %%mm0, %%mm2              \n\t"\
+        "movq %%mm1, %%mm3              \n\t"\
+        "psrlw $8, %%mm2                \n\t"\
+        "psrlw $8, %%mm3                \n\t"\
+        "paddw %%mm2, %%mm0             \n\t"\
+        "paddw %%mm3, %%mm1             \n\t"\
+        "psrlw $8, %%mm0                \n\t"\
+        "psrlw $8, %%mm1                \n\t"\
+        "packuswb %%mm1, %%mm0          \n\t"\
+        "movq %%mm0, (%1, %0)           \n\t"
+
+static void blend_row_mmx(uint8_t *dst, const uint8_t *src, const uint8_t *alpha, int w)
+{
+    x86_reg i = -(w & ~7);
+
+    if(i) {
+        asm volatile(
+            LOAD_CONSTANTS
+            ASMALIGN(4)
+            "1:                             \n\t"
+            "movq (%1, %0), %%mm0           \n\t"
+            "movq (%3, %0), %%mm2           \n\t"
+            "movq %%mm0, %%mm1              \n\t"
+            "movq %%mm2, %%mm3              \n\t"
+            "punpcklbw %%mm7, %%mm0         \n\t"
+            "punpckhbw %%mm7, %%mm1         \n\t"
+            "punpcklbw %%mm7, %%mm2         \n\t"
+            "punpckhbw %%mm7, %%mm3         \n\t"
+            "movq %%mm6, %%mm4              \n\t"
+            "psubw %%mm2, %%mm4             \n\t"
+            "pmullw %%mm4, %%mm0            \n\t"
+            "movq (%2, %0), %%mm4           \n\t"
+            "punpcklbw %%mm7, %%mm4         \n\t"
+            "pmullw %%mm2, %%mm4            \n\t"
+            "paddw %%mm4, %%mm0             \n\t"
+            "movq %%mm6, %%mm2              \n\t"
+            "psubw %%mm3, %%mm2             \n\t"
+            "pmullw %%mm2, %%mm1            \n\t"
+            "movq (%2, %0), %%mm2           \n\t"
+            "punpckhbw %%mm7, %%mm2         \n\t"
+            "pmullw %%mm3, %%mm2            \n\t"
+            "paddw %%mm2, %%mm1             \n\t"
+            DIVIDE_255_STORE
+            "add $8, %0                     \n\t"
+            " js 1b                         \n\t"
+            "emms                           \n\t"
+            : "+r" (i)
+            : "r" (dst + (w & ~7)), "r" (src + (w & ~7)), "r" (alpha + (w & ~7))
+            : "memory"
+        );
+    }
+
+    for(i = w & ~7; i < w; i ++) {
+        unsigned t = dst[i] * (255 - alpha[i]) + src[i] * alpha[i] + 128;
+        dst[i] = (t + (t >> 8)) >> 8;
+    }
+}
+
+static void blend_color_row_mmx(uint8_t *dst, int color, const uint8_t *alpha, int w)
+{
+    DECLARE_ALIGNED(8, uint64_t, colorw) = color * 0x0001000100010001ULL;
+    x86_reg i = -(w & ~7);
+
+    if(i) {
+        asm volatile(
+            LOAD_CONSTANTS
+            ASMALIGN(4)
+            "1:                             \n\t"
+            "movq (%1, %0), %%mm0           \n\t"
+            "movq (%3, %0), %%mm2           \n\t"
+            "movq %%mm0, %%mm1              \n\t"
+            "movq %%mm2, %%mm3              \n\t"
+            "punpcklbw %%mm7, %%mm0         \n\t"
+            "punpckhbw %%mm7, %%mm1         \n\t"
+            "punpcklbw %%mm7, %%mm2         \n\t"
+            "punpckhbw %%mm7, %%mm3         \n\t"
+            "movq %%mm6, %%mm4              \n\t"
+            "psubw %%mm2, %%mm4             \n\t"
+            "pmullw %%mm4, %%mm0            \n\t"
+            "pmullw %2, %%mm2               \n\t"
+            "paddw %%mm2, %%mm0             \n\t"
+            "movq %%mm6, %%mm4              \n\t"
+            "psubw %%mm3, %%mm4             \n\t"
+            "pmullw %%mm4, %%mm1            \n\t"
+            "pmullw %2, %%mm3               \n\t"
+            "paddw %%mm3, %%mm1             \n\t"
+            DIVIDE_255_STORE
+            "add $8, %0                     \n\t"
+            " js 1b                         \n\t"
+            "emms                           \n\t"
+            : "+r" (i)
+            : "r" (dst + (w & ~7)), "m" (colorw), "r" (alpha + (w & ~7))
+            : "memory"
+        );
+    }
+
+    for(i = w & ~7; i < w; i ++) {
+        unsigned t = dst[i] * (255 - alpha[i]) + color * alpha[i] + 128;
+        dst[i] = (t + (t >> 8)) >> 8;
+    }
+}
+
+static void add_row_mmx(uint8_t *dst, const int16_t *delta, int w)
+{
+    x86_reg i = -(w & ~7);
+
+    if(i) {
+        asm volatile(
+            "pxor %%mm7, %%mm7              \n\t"
+            ASMALIGN(4)
+            "1:                             \n\t"
+            "movq (%1, %0), %%mm0           \n\t"
+            "movq %%mm0, %%mm1              \n\t"
+            "punpcklbw %%mm7, %%mm0         \n\t"
+            "punpckhbw %%mm7, %%mm1         \n\t"
+            "paddw (%2, %0, 2), %%mm0       \n\t"
+            "paddw 8(%2, %0, 2), %%mm1      \n\t"
+            "packuswb %%mm1, %%mm0          \n\t"
+            "movq %%mm0, (%1, %0)           \n\t"
+            "add $8, %0                     \n\t"
+            " js 1b                         \n\t"
+            "emms                           \n\t"
+            : "+r" (i)
+            : "r" (dst + (w & ~7)), "r" (delta + (w & ~7))
+            : "memory"
+        );
+    }
+
+    for(i = w & ~7; i < w; i ++)
+        dst[i] = av_clip_uint8(dst[i] + delta[i]);
+}
+
+void ff_blend_dsp_init_mmx(BlendDSPContext *c)
+{
+    if(!(mm_support() & MM_MMX))
+        return;
+
+    c->blend_row       = blend_row_mmx;
+    c->blend_color_row = blend_color_row_mmx;
+    c->add_row         = add_row_mmx;
+}
@@ -0,0 +1,91 @@
+/*
+ * parsing of filter arguments
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/avutil.h"
+#include "libavcodec/colorspace.h"
+#include "parseutils.h"
+
+int ff_parse_key_values(void *log_ctx, const char *args,
+                        const char * const *keys, char **values)
+{
+    char *buf, *p;
+    int i;
+
+    if(!args)
+        return 0;
+
+    while(*args) {
+        size_t len = strcspn(args, "=:");
+
+        for(i = 0; keys[i]; i ++)
+            if(strlen(keys[i]) == len && !strncmp(args, keys[i], len))
+                break;
+        if(!keys[i]) {
+            av_log(log_ctx, AV_LOG_ERROR, "unknown option '%.*s'\n", (int)len, args);
+            return -1;
+        }
+        args += len;
+
+        p = buf = av_malloc(strlen(args) + 2);
+        if(*args == '=') {
+            for(args ++; *args && *args != ':'; args ++) {
+                if(*args == '\\' && args[1])
+                    args ++;
+                *p ++ = *args;
+            }
+        } else
+            *p ++ = '1';
+        *p = 0;
+
+        av_free(values[i]);
+        values[i] = buf;
+
+        if(*args == ':')
+            args ++;
+    }
+
+    return 0;
+}
+
+int ff_parse_color(void *log_ctx, uint8_t yuv[3], const char *arg)
+{
+    unsigned int rgb, r, g, b;
+    char *tail;
+
+    if(*arg == '#')
+        arg ++;
+    rgb = strtoul(arg, &tail, 16);
+    if(tail - arg != 6 || *tail) {
+        av_log(log_ctx, AV_LOG_ERROR, "invalid color '%s', expected RRGGBB\n", arg);
+        return -1;
+    }
+
+    r = rgb >> 16;
+    g = (rgb >> 8) & 0xff;
+    b = rgb & 0xff;
+    yuv[0] = RGB_TO_Y_CCIR(r, g, b);
+    yuv[1] = RGB_TO_U_CCIR(r, g, b, 0);
+    yuv[2] = RGB_TO_V_CCIR(r, g, b, 0);
+
+    return 0;
+}
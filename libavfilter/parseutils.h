@@ -0,0 +1,45 @@
+/*
+ * parsing of filter arguments
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FFMPEG_PARSEUTILS_H
+#define FFMPEG_PARSEUTILS_H
+
+#include <stdint.h>
+
+/**
+ * Split arguments of the form "key=value:key=value".  A ':' or '\' inside a
+ * value is escaped with a '\'.  A key given without a value gets "1".
+ * @param log_ctx context used for logging errors
+ * @param args    the arguments, may be NULL
+ * @param keys    NULL terminated list of the accepted keys
+ * @param values  one entry per key, set to a copy of the value of the key if
+ *                it is given; the copies must be freed with av_free()
+ * @return zero on success, -1 on an unknown key
+ */
+int ff_parse_key_values(void *log_ctx, const char *args,
+                        const char * const *keys, char **values);
+
+/**
+ * Parse a color given as "RRGGBB" or "#RRGGBB" into its Y, Cb and Cr.
+ * @return zero on success, -1 if arg is not a color
+ */
+int ff_parse_color(void *log_ctx, uint8_t yuv[3], const char *arg);
+
+#endif  /* FFMPEG_PARSEUTILS_H */
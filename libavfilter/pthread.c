@@ -0,0 +1,172 @@
+/*
+ * filter graph thread pool
+ * Copyright (c) 2004 Roman Shaposhnik
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file pthread.c
+ * One pool of worker threads per filter graph.  The filters of the graph
+ * run their slice jobs on it through AVFilterContext.execute().  A graph is
+ * driven from a single thread, so at most one execute() is in flight per
+ * pool.  The job handling follows libavcodec/pthread.c.
+ */
+
+#include <pthread.h>
+
+#include "avfilter.h"
+#include "avfiltergraph.h"
+
+typedef struct ThreadContext {
+    pthread_t *workers;
+    int thread_count;
+    AVFilterContext *ctx;
+    avfilter_action_func *func;
+    void *arg;
+    int *rets;
+    int job_count;
+
+    pthread_cond_t last_job_cond;
+    pthread_cond_t current_job_cond;
+    pthread_mutex_t current_job_lock;
+    int current_job;
+    int done;
+} ThreadContext;
+
+static void* attribute_align_arg worker(void *v)
+{
+    ThreadContext *c = v;
+    int our_job = c->job_count;
+    int thread_count = c->thread_count;
+    int self_id;
+
+    pthread_mutex_lock(&c->current_job_lock);
+    self_id = c->current_job++;
+    for (;;){
+        while (our_job >= c->job_count) {
+            if (c->current_job == thread_count + c->job_count)
+                pthread_cond_signal(&c->last_job_cond);
+
+            pthread_cond_wait(&c->current_job_cond, &c->current_job_lock);
+            our_job = self_id;
+
+            if (c->done) {
+                pthread_mutex_unlock(&c->current_job_lock);
+                return NULL;
+            }
+        }
+        pthread_mutex_unlock(&c->current_job_lock);
+
+        if (c->rets)
+            c->rets[our_job] = c->func(c->ctx, c->arg, our_job, c->job_count);
+        else
+            c->func(c->ctx, c->arg, our_job, c->job_count);
+
+        pthread_mutex_lock(&c->current_job_lock);
+        our_job = c->current_job++;
+    }
+}
+
+static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
+                          void *arg, int *ret, int nb_jobs)
+{
+    ThreadContext *c = ctx->thread_opaque;
+
+    if (nb_jobs <= 0)
+        return 0;
+    if (nb_jobs == 1)
+        return avfilter_default_execute(ctx, func, arg, ret, nb_jobs);
+
+    pthread_mutex_lock(&c->current_job_lock);
+
+    c->current_job = c->thread_count;
+    c->job_count = nb_jobs;
+    c->ctx = ctx;
+    c->func = func;
+    c->arg = arg;
+    c->rets = ret;
+    pthread_cond_broadcast(&c->current_job_cond);
+
+    pthread_cond_wait(&c->last_job_cond, &c->current_job_lock);
+    pthread_mutex_unlock(&c->current_job_lock);
+
+    return 0;
+}
+
+void ff_avfilter_thread_free(AVFilterGraph *graph)
+{
+    ThreadContext *c = graph->thread_opaque;
+    int i;
+
+    pthread_mutex_lock(&c->current_job_lock);
+    c->done = 1;
+    pthread_cond_broadcast(&c->current_job_cond);
+    pthread_mutex_unlock(&c->current_job_lock);
+
+    for (i=0; i<c->thread_count; i++)
+         pthread_join(c->workers[i], NULL);
+
+    pthread_mutex_destroy(&c->current_job_lock);
+    pthread_cond_destroy(&c->current_job_cond);
+    pthread_cond_destroy(&c->last_job_cond);
+    av_free(c->workers);
+    av_freep(&graph->thread_opaque);
+    graph->thread_count = 1;
+    graph->execute = avfilter_default_execute;
+}
+
+int ff_avfilter_thread_init(AVFilterGraph *graph, int thread_count)
+{
+    int i;
+    ThreadContext *c;
+
+    c = av_mallocz(sizeof(ThreadContext));
+    if (!c)
+        return -1;
+
+    c->workers = av_mallocz(sizeof(pthread_t)*thread_count);
+    if (!c->workers) {
+        av_free(c);
+        return -1;
+    }
+
+    graph->thread_opaque = c;
+    c->thread_count = thread_count;
+    c->current_job = 0;
+    c->job_count = 0;
+    c->done = 0;
+    pthread_cond_init(&c->current_job_cond, NULL);
+    pthread_cond_init(&c->last_job_cond, NULL);
+    pthread_mutex_init(&c->current_job_lock, NULL);
+    pthread_mutex_lock(&c->current_job_lock);
+    for (i=0; i<thread_count; i++) {
+        if(pthread_create(&c->workers[i], NULL, worker, c)) {
+           c->thread_count = i;
+           pthread_mutex_unlock(&c->current_job_lock);
+           ff_avfilter_thread_free(graph);
+           return -1;
+        }
+    }
+
+    pthread_cond_wait(&c->last_job_cond, &c->current_job_lock);
+    pthread_mutex_unlock(&c->current_job_lock);
+
+    graph->thread_count = thread_count;
+    graph->execute = thread_execute;
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * video crop filter
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file vf_crop.c
+ * Crop the input to the rectangle given as "x:y:w:h".  A width or height of
+ * zero keeps everything right of or below the origin.  No picture data is
+ * copied, the output is a reference to the input with moved plane pointers.
+ */
+
+#include "libavcodec/imgconvert.h"
+#include "avfilter.h"
+
+typedef struct
+{
+    int x, y, w, h;             ///< cropped rectangle
+    int hsub, vsub;             ///< chroma subsampling
+} CropContext;
+
+static av_cold int init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    CropContext *crop = ctx->priv;
+
+    if(args)
+        sscanf(args, "%d:%d:%d:%d", &crop->x, &crop->y, &crop->w, &crop->h);
+
+    if(crop->x < 0 || crop->y < 0 || crop->w < 0 || crop->h < 0) {
+        av_log(ctx, AV_LOG_ERROR, "invalid crop rectangle '%s'\n", args);
+        return -1;
+    }
+    return 0;
+}
+
+static int config_input(AVFilterLink *link)
+{
+    CropContext *crop = link->dst->priv;
+
+    avcodec_get_chroma_sub_sample(link->format, &crop->hsub, &crop->vsub);
+
+    /* the chroma planes can only be cropped at whole chroma samples */
+    crop->x &= ~((1 << crop->hsub) - 1);
+    crop->y &= ~((1 << crop->vsub) - 1);
+
+    if(crop->x >= link->w || crop->y >= link->h) {
+        av_log(link->dst, AV_LOG_ERROR, "crop origin %dx%d outside of the %dx%d picture\n",
+               crop->x, crop->y, link->w, link->h);
+        return -1;
+    }
+    if(!crop->w || crop->x + crop->w > link->w)
+        crop->w = link->w - crop->x;
+    if(!crop->h || crop->y + crop->h > link->h)
+        crop->h = link->h - crop->y;
+
+    return 0;
+}
+
+static int config_output(AVFilterLink *link)
+{
+    CropContext *crop = link->src->priv;
+
+    link->w = crop->w;
+    link->h = crop->h;
+
+    return 0;
+}
+
+static void start_frame(AVFilterLink *link, AVFilterPicRef *picref)
+{
+    CropContext *crop = link->dst->priv;
+    AVFilterPicRef *ref = avfilter_ref_pic(picref, ~0);
+    int i;
+
+    ref->w = crop->w;
+    ref->h = crop->h;
+
+    for(i = 0; i < 4; i ++) {
+        int vsub = i == 1 || i == 2 ? crop->vsub : 0;
+        int x    = ff_get_plane_bytewidth(link->format, crop->x, i);
+
+        /* palette and empty planes are not moved */
+        if(!ref->data[i] || x < 0)
+            continue;
+        ref->data[i] += (crop->y >> vsub) * ref->linesize[i] + x;
+    }
+
+    avfilter_start_frame(link->dst->outputs[0], ref);
+}
+
+static void draw_slice(AVFilterLink *link, int y, int h)
+{
+    CropContext *crop = link->dst->priv;
+    int top    = FFMAX(y,     crop->y);
+    int bottom = FFMIN(y + h, crop->y + crop->h);
+
+    if(bottom > top)
+        avfilter_draw_slice(link->dst->outputs[0], top - crop->y, bottom - top);
+}
+
+AVFilter avfilter_vf_crop =
+{
+    .name      = "crop",
+
+    .priv_size = sizeof(CropContext),
+
+    .init      = init,
+
+    .inputs    = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .start_frame     = start_frame,
+                                    .draw_slice      = draw_slice,
+                                    .config_props    = config_input, },
+                                  { .name = NULL}},
+
+    .outputs   = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .config_props    = config_output, },
+                                  { .name = NULL}},
+};
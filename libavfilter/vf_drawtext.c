@@ -0,0 +1,512 @@
+/*
+ * text drawing filter
+ * Copyright (c) Gustavo Sverzut Barbieri <gsbarbieri@yahoo.com.br>
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file vf_drawtext.c
+ * Draw text with FreeType, a port of vhook/drawtext.c.  The arguments are
+ * "key=value" pairs separated by ':':
+ *   fontfile  font file name, mandatory
+ *   text      text to draw, passed to strftime()
+ *   textfile  file holding the text, read again for every batch of pictures,
+ *             text is used if it cannot be read
+ *   x, y      position of the text, 0:0 by default
+ *   fontsize  font size in pixels, 16 by default
+ *   fontcolor text color as RRGGBB, ffffff by default
+ *   boxcolor  color of the box and outline, 000000 by default
+ *   box       draw a box behind the text
+ *   outline   outline the glyphs
+ *   batch     number of pictures drawn onto at once, 1 by default
+ *
+ * The text is rendered into alpha masks for each plane only when it
+ * changes, and the masks are blended onto the pictures in their own
+ * format, so nothing is converted to RGB.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "libavutil/avstring.h"
+#include "avfilter.h"
+#include "blend.h"
+#include "parseutils.h"
+
+/* the text is stamped with the wall clock time, as with the vhook */
+#undef time
+
+#define MAXSIZE_TEXT 1024
+
+typedef struct {
+    uint8_t *bitmap;            ///< coverage of the glyph, 0 to 255
+    int w, h;                   ///< size of the bitmap
+    int left, top;              ///< position of the bitmap from the pen
+    int advance;                ///< horizontal advance of the pen
+    unsigned index;             ///< glyph index in the face, for kerning
+} Glyph;
+
+typedef struct {
+    char *text;                 ///< text given as argument
+    char *textfile;             ///< file holding the text, or NULL
+    int x, y;                   ///< position of the text
+    uint8_t fgcolor[3];         ///< Y, U and V of the text
+    uint8_t bgcolor[3];         ///< Y, U and V of the box and outline
+    int box;                    ///< draw a box behind the text
+    int outline;                ///< outline the glyphs
+    int hsub, vsub;             ///< chroma subsampling
+
+    FT_Library library;
+    FT_Face face;
+    Glyph glyphs[256];
+    int text_height;            ///< distance between two lines
+    int baseline;               ///< distance from the top of a line to its baseline
+    int use_kerning;
+
+    char shown[MAXSIZE_TEXT];   ///< text the masks were made for
+    int mask_x, mask_y;         ///< position of the masks in the picture
+    int mask_w, mask_h;         ///< size of the masks, 0 if there is nothing to draw
+    uint8_t *fg_mask[3];        ///< alpha of the text for each plane
+    uint8_t *bg_mask[3];        ///< alpha of the box and outline for each plane, or NULL
+    int mask_linesize[3];
+
+    BlendDSPContext dsp;
+    BlendBatch batch;
+} DrawTextContext;
+
+static const char * const keys[] = {
+    "fontfile", "text", "textfile", "x", "y", "fontsize",
+    "fontcolor", "boxcolor", "box", "outline", "batch", NULL
+};
+
+enum { FONTFILE, TEXT, TEXTFILE, X, Y, FONTSIZE,
+       FONTCOLOR, BOXCOLOR, BOX, OUTLINE, BATCH, NB_KEYS };
+
+static int load_glyphs(AVFilterContext *ctx, const char *fontfile, int size)
+{
+    DrawTextContext *dt = ctx->priv;
+    int y_max = -32000, y_min = 32000;
+    int c, x, y, err;
+
+    if((err = FT_Init_FreeType(&dt->library))) {
+        av_log(ctx, AV_LOG_ERROR, "could not load FreeType (error %d)\n", err);
+        return -1;
+    }
+    if((err = FT_New_Face(dt->library, fontfile, 0, &dt->face))) {
+        av_log(ctx, AV_LOG_ERROR, "could not load face '%s' (error %d)\n", fontfile, err);
+        return -1;
+    }
+    if((err = FT_Set_Pixel_Sizes(dt->face, 0, size))) {
+        av_log(ctx, AV_LOG_ERROR, "could not set font size to %d (error %d)\n", size, err);
+        return -1;
+    }
+    dt->use_kerning = FT_HAS_KERNING(dt->face);
+
+    for(c = 0; c < 256; c ++) {
+        FT_GlyphSlot slot = dt->face->glyph;
+        FT_Bitmap *bm     = &slot->bitmap;
+        Glyph *g          = &dt->glyphs[c];
+
+        if(FT_Load_Char(dt->face, c, FT_LOAD_RENDER))
+            continue;
+
+        g->w       = bm->width;
+        g->h       = bm->rows;
+        g->left    = slot->bitmap_left;
+        g->top     = slot->bitmap_top;
+        g->advance = slot->advance.x >> 6;
+        g->index   = FT_Get_Char_Index(dt->face, c);
+        g->bitmap  = av_malloc(FFMAX(g->w * g->h, 1));
+
+        for(y = 0; y < g->h; y ++)
+            for(x = 0; x < g->w; x ++) {
+                const uint8_t *row = bm->buffer + y * bm->pitch;
+                if(bm->pixel_mode == FT_PIXEL_MODE_MONO)
+                    g->bitmap[y * g->w + x] = row[x >> 3] & (0x80 >> (x & 7)) ? 255 : 0;
+                else
+                    g->bitmap[y * g->w + x] = row[x];
+            }
+
+        if(g->h) {
+            y_max = FFMAX(y_max, g->top);
+            y_min = FFMIN(y_min, g->top - g->h);
+        }
+    }
+
+    dt->text_height = FFMAX(y_max - y_min, 1);
+    dt->baseline    = y_max;
+    return 0;
+}
+
+static av_cold int init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    DrawTextContext *dt = ctx->priv;
+    char *values[NB_KEYS] = { NULL };
+    int ret = -1, i;
+
+    if(ff_parse_key_values(ctx, args, keys, values))
+        goto end;
+
+    if(!values[FONTFILE]) {
+        av_log(ctx, AV_LOG_ERROR, "no font file given\n");
+        goto end;
+    }
+    if(!values[TEXT] && !values[TEXTFILE]) {
+        av_log(ctx, AV_LOG_ERROR, "no text given\n");
+        goto end;
+    }
+
+    dt->text     = values[TEXT] ? values[TEXT] : av_strdup("");
+    dt->textfile = values[TEXTFILE];
+    values[TEXT] = values[TEXTFILE] = NULL;
+
+    dt->x          = values[X]       ? atoi(values[X]) : 0;
+    dt->y          = values[Y]       ? atoi(values[Y]) : 0;
+    dt->box        = values[BOX]     ? atoi(values[BOX])     : 0;
+    dt->outline    = values[OUTLINE] ? atoi(values[OUTLINE]) : 0;
+    dt->batch.size = values[BATCH]   ? atoi(values[BATCH])   : 1;
+
+    if(dt->x < 0 || dt->y < 0) {
+        av_log(ctx, AV_LOG_ERROR, "invalid position %d:%d\n", dt->x, dt->y);
+        goto end;
+    }
+    if(dt->batch.size < 1 || dt->batch.size > MAX_BATCH) {
+        av_log(ctx, AV_LOG_ERROR, "batch size must be between 1 and %d\n", MAX_BATCH);
+        goto end;
+    }
+    if(ff_parse_color(ctx, dt->fgcolor, values[FONTCOLOR] ? values[FONTCOLOR] : "ffffff") ||
+       ff_parse_color(ctx, dt->bgcolor, values[BOXCOLOR]  ? values[BOXCOLOR]  : "000000"))
+        goto end;
+
+    if(load_glyphs(ctx, values[FONTFILE], values[FONTSIZE] ? atoi(values[FONTSIZE]) : 16))
+        goto end;
+
+    ff_blend_dsp_init(&dt->dsp);
+    ret = 0;
+
+end:
+    for(i = 0; i < NB_KEYS; i ++)
+        av_free(values[i]);
+    return ret;
+}
+
+static void free_masks(DrawTextContext *dt)
+{
+    int i;
+
+    for(i = 0; i < 3; i ++) {
+        av_freep(&dt->fg_mask[i]);
+        av_freep(&dt->bg_mask[i]);
+    }
+    dt->mask_w = dt->mask_h = 0;
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    DrawTextContext *dt = ctx->priv;
+    int c;
+
+    ff_blend_batch_free(&dt->batch);
+    free_masks(dt);
+    for(c = 0; c < 256; c ++)
+        av_free(dt->glyphs[c].bitmap);
+    if(dt->face)
+        FT_Done_Face(dt->face);
+    if(dt->library)
+        FT_Done_FreeType(dt->library);
+    av_free(dt->text);
+    av_free(dt->textfile);
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+    avfilter_set_common_formats(ctx,
+        avfilter_make_format_list(6, PIX_FMT_YUV420P, PIX_FMT_YUV422P,
+                                     PIX_FMT_YUV444P, PIX_FMT_YUV411P,
+                                     PIX_FMT_YUV410P, PIX_FMT_GRAY8));
+    return 0;
+}
+
+static int config_input(AVFilterLink *link)
+{
+    DrawTextContext *dt = link->dst->priv;
+
+    avcodec_get_chroma_sub_sample(link->format, &dt->hsub, &dt->vsub);
+    /* the masks are laid out for the picture size */
+    dt->shown[0] = 0;
+    free_masks(dt);
+
+    return 0;
+}
+
+/**
+ * Lay out text at x:y in a picture of width w, wrapping lines which do
+ * not fit.  Sets the pen position of each character and returns the
+ * bottom of the last line.
+ */
+static int layout_text(DrawTextContext *dt, const uint8_t *text, int len,
+                       int w, int *pos_x, int *pos_y, int *right)
+{
+    int x = dt->x, y = dt->y, i;
+
+    *right = x;
+    for(i = 0; i < len; i ++) {
+        const Glyph *g = &dt->glyphs[text[i]];
+
+        if(dt->use_kerning && i && g->index) {
+            FT_Vector delta;
+            FT_Get_Kerning(dt->face, dt->glyphs[text[i-1]].index, g->index,
+                           ft_kerning_default, &delta);
+            x += delta.x >> 6;
+        }
+        if(text[i] == '\n' || (x + g->advance >= w && x > dt->x)) {
+            y += dt->text_height;
+            x  = dt->x;
+        }
+        pos_x[i] = x;
+        pos_y[i] = y + dt->baseline;
+        if(text[i] != '\n')
+            x += g->advance;
+        *right = FFMAX(*right, x);
+    }
+
+    return y + dt->text_height;
+}
+
+/** Render the text into the masks, for pictures of size w x h. */
+static void make_masks(DrawTextContext *dt, const uint8_t *text, int w, int h)
+{
+    int pos_x[MAXSIZE_TEXT], pos_y[MAXSIZE_TEXT];
+    int len = strlen(text);
+    int x0, y0, x1, y1, right, bottom;
+    int align_x = (1 << dt->hsub) - 1, align_y = (1 << dt->vsub) - 1;
+    int margin = dt->outline;
+    uint8_t *fg, *bg = NULL;
+    int i, x, y;
+
+    free_masks(dt);
+
+    bottom = layout_text(dt, text, len, w, pos_x, pos_y, &right);
+
+    /* the masks cover the box or the glyphs and their outline */
+    x0 = y0 = INT_MAX;
+    x1 = y1 = INT_MIN;
+    if(dt->box) {
+        x0 = dt->x;  x1 = right;
+        y0 = dt->y;  y1 = bottom;
+    }
+    for(i = 0; i < len; i ++) {
+        const Glyph *g = &dt->glyphs[text[i]];
+        if(!g->w || !g->h || text[i] == '\n')
+            continue;
+        x0 = FFMIN(x0, pos_x[i] + g->left - margin);
+        y0 = FFMIN(y0, pos_y[i] - g->top - margin);
+        x1 = FFMAX(x1, pos_x[i] + g->left + g->w + margin);
+        y1 = FFMAX(y1, pos_y[i] - g->top + g->h + margin);
+    }
+    x0 = FFMAX(x0, 0) & ~align_x;
+    y0 = FFMAX(y0, 0) & ~align_y;
+    x1 = FFMIN(x1, w);
+    y1 = FFMIN(y1, h);
+    if(x1 <= x0 || y1 <= y0)
+        return;
+
+    dt->mask_x = x0;
+    dt->mask_y = y0;
+    dt->mask_w = x1 - x0;
+    dt->mask_h = y1 - y0;
+    fg = av_mallocz(dt->mask_w * dt->mask_h);
+    if(dt->box || dt->outline)
+        bg = av_mallocz(dt->mask_w * dt->mask_h);
+
+    for(i = 0; i < len; i ++) {
+        const Glyph *g = &dt->glyphs[text[i]];
+        int gx = pos_x[i] + g->left - x0;
+        int gy = pos_y[i] - g->top  - y0;
+
+        if(text[i] == '\n')
+            continue;
+        for(y = FFMAX(0, -gy); y < g->h && gy + y < dt->mask_h; y ++)
+            for(x = FFMAX(0, -gx); x < g->w && gx + x < dt->mask_w; x ++) {
+                uint8_t *d = fg + (gy + y) * dt->mask_w + gx + x;
+                *d = FFMAX(*d, g->bitmap[y * g->w + x]);
+            }
+    }
+
+    if(dt->box) {
+        for(y = dt->y - y0; y < FFMIN(bottom, y1) - y0; y ++)
+            memset(bg + y * dt->mask_w + dt->x - x0, 255,
+                   FFMIN(right, x1) - dt->x);
+    } else if(bg) {
+        /* the outline is the text grown by one pixel in each direction */
+        for(y = 0; y < dt->mask_h; y ++)
+            for(x = 0; x < dt->mask_w; x ++) {
+                int a = 0, dx, dy;
+                for(dy = FFMAX(y - 1, 0); dy <= FFMIN(y + 1, dt->mask_h - 1); dy ++)
+                    for(dx = FFMAX(x - 1, 0); dx <= FFMIN(x + 1, dt->mask_w - 1); dx ++)
+                        a = FFMAX(a, fg[dy * dt->mask_w + dx]);
+                bg[y * dt->mask_w + x] = a;
+            }
+    }
+
+    dt->fg_mask[0] = fg;
+    dt->bg_mask[0] = bg;
+    dt->mask_linesize[0] = dt->mask_w;
+    for(i = 1; i < 3; i ++) {
+        int cw = -((-dt->mask_w) >> dt->hsub);
+        int ch = -((-dt->mask_h) >> dt->vsub);
+
+        dt->mask_linesize[i] = cw;
+        dt->fg_mask[i] = av_malloc(cw * ch);
+        ff_blend_subsample_alpha(dt->fg_mask[i], cw, fg, dt->mask_w,
+                                 dt->mask_w, dt->mask_h, dt->hsub, dt->vsub);
+        if(bg) {
+            dt->bg_mask[i] = av_malloc(cw * ch);
+            ff_blend_subsample_alpha(dt->bg_mask[i], cw, bg, dt->mask_w,
+                                     dt->mask_w, dt->mask_h, dt->hsub, dt->vsub);
+        }
+    }
+}
+
+static void update_text(AVFilterContext *ctx)
+{
+    DrawTextContext *dt = ctx->priv;
+    AVFilterLink *link  = ctx->inputs[0];
+    char tbuf[MAXSIZE_TEXT], buf[MAXSIZE_TEXT];
+    const char *text = dt->text;
+    time_t now = time(0);
+
+    if(dt->textfile) {
+        FILE *f = fopen(dt->textfile, "r");
+        if(f) {
+            size_t len = fread(tbuf, 1, sizeof(tbuf) - 1, f);
+            tbuf[len] = 0;
+            text = tbuf;
+            fclose(f);
+        } else
+            av_log(ctx, AV_LOG_WARNING, "could not read '%s', using the text argument\n",
+                   dt->textfile);
+    }
+
+    buf[0] = 0;
+    strftime(buf, sizeof(buf), text, localtime(&now));
+
+    if(!strcmp(buf, dt->shown))
+        return;
+    av_strlcpy(dt->shown, buf, sizeof(dt->shown));
+    make_masks(dt, buf, link->w, link->h);
+}
+
+static void start_frame(AVFilterLink *link, AVFilterPicRef *picref)
+{
+    DrawTextContext *dt = link->dst->priv;
+
+    ff_blend_batch_add(&dt->batch, picref);
+}
+
+static void end_frame(AVFilterLink *link)
+{
+    /* the picture is kept in the batch, not released here */
+    link->cur_pic = NULL;
+}
+
+static int draw_rows(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    DrawTextContext *dt = ctx->priv;
+    BlendBatch *batch   = arg;
+    int align = (1 << dt->vsub) - 1;
+    int y0 = dt->mask_h *  jobnr      / nb_jobs & ~align;
+    int y1 = dt->mask_h * (jobnr + 1) / nb_jobs & ~align;
+    int i, n, y;
+
+    if(jobnr == nb_jobs - 1)
+        y1 = dt->mask_h;
+
+    for(i = 0; i < 3; i ++) {
+        int hsub = i ? dt->hsub : 0;
+        int vsub = i ? dt->vsub : 0;
+        int w    = -((-dt->mask_w) >> hsub);
+
+        for(y = y0 >> vsub; y < -((-y1) >> vsub); y ++) {
+            const uint8_t *fg = dt->fg_mask[i] + y * dt->mask_linesize[i];
+            const uint8_t *bg = NULL;
+
+            if(dt->bg_mask[i])
+                bg = dt->bg_mask[i] + y * dt->mask_linesize[i];
+
+            /* the same rows of all the pictures while the masks are cached */
+            for(n = 0; n < batch->count; n ++) {
+                AVFilterPicRef *pic = batch->pic[n];
+                uint8_t *dst;
+
+                if(!pic->data[i])
+                    continue;
+                dst = pic->data[i] + ((dt->mask_y >> vsub) + y) * pic->linesize[i] +
+                                      (dt->mask_x >> hsub);
+                if(bg)
+                    dt->dsp.blend_color_row(dst, dt->bgcolor[i], bg, w);
+                dt->dsp.blend_color_row(dst, dt->fgcolor[i], fg, w);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int request_frame(AVFilterLink *link)
+{
+    AVFilterContext *ctx = link->src;
+    DrawTextContext *dt  = ctx->priv;
+
+    if(!dt->batch.done)
+        update_text(ctx);
+
+    return ff_blend_batch_request(link, &dt->batch, draw_rows,
+        dt->mask_h ? FFMIN(ctx->thread_count, dt->mask_h >> dt->vsub) : 0);
+}
+
+AVFilter avfilter_vf_drawtext =
+{
+    .name      = "drawtext",
+
+    .priv_size = sizeof(DrawTextContext),
+
+    .init      = init,
+    .uninit    = uninit,
+
+    .query_formats = query_formats,
+
+    .inputs    = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .get_video_buffer= avfilter_null_get_video_buffer,
+                                    .start_frame     = start_frame,
+                                    .end_frame       = end_frame,
+                                    .config_props    = config_input,
+                                    .min_perms       = AV_PERM_READ | AV_PERM_WRITE,
+                                    .rej_perms       = AV_PERM_REUSE | AV_PERM_REUSE2, },
+                                  { .name = NULL}},
+
+    .outputs   = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .request_frame   = request_frame, },
+                                  { .name = NULL}},
+};
@@ -0,0 +1,327 @@
+/*
+ * fish detector filter
+ * Copyright (c) 2002 Philip Gladstone
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file vf_fish.c
+ * Detect when a goldfish passes in front of the camera, a port of
+ * vhook/fish.c.  A picture shows a fish when enough of its pixels fall
+ * within an HSV range.  The arguments are "key=value" pairs separated
+ * by ':':
+ *   hue        range of H values that are fish, as "min-max", 0 to 360
+ *   saturation range of S values that are fish, 0 to 255
+ *   value      range of V values that are fish, 0 to 255
+ *   threshold  part of the pixels which must be fish, 0 to 1, 0.1 by default
+ *   inset      percentage of the width and height left out at the edges
+ *   interval   minimum time in seconds between two checks, 1 by default,
+ *              and between two fish once one is found
+ *   zap        paint the pixels which are not fish black in checked pictures
+ *   select     only pass on the pictures with a fish
+ *
+ * Fish are logged.  With select the filter replaces the snapshots of the
+ * vhook: sending its output to the image2 muxer saves one image per fish.
+ */
+
+#include "libavcodec/dsputil.h"
+#include "libavcodec/colorspace.h"
+#include "avfilter.h"
+#include "parseutils.h"
+
+typedef struct {
+    int h;                      ///< 0 .. 360
+    int s;                      ///< 0 .. 255
+    int v;                      ///< 0 .. 255
+} HSV;
+
+typedef struct {
+    HSV dark, bright;           ///< range of the fish colors
+    int threshold;              ///< fish pixels needed, in thousandths
+    int inset;                  ///< percentage left out at the edges
+    int64_t interval;           ///< minimum time between checks, AV_TIME_BASE units
+    int zap;
+    int select;
+    int hsub, vsub;             ///< chroma subsampling
+
+    int64_t next_pts;           ///< the next picture checked is not earlier
+    int sent;                   ///< a picture was sent on since the last request
+} FishContext;
+
+static const char * const keys[] = {
+    "hue", "saturation", "value", "threshold", "inset", "interval",
+    "zap", "select", NULL
+};
+
+enum { HUE, SATURATION, VALUE, THRESHOLD, INSET, INTERVAL, ZAP, SELECT, NB_KEYS };
+
+static void parse_range(const char *arg, int *first, int *second, int maxval)
+{
+    if(arg)
+        sscanf(arg, "%d-%d", first, second);
+    *first  = av_clip(*first,  0, maxval);
+    *second = av_clip(*second, 0, maxval);
+}
+
+static av_cold int init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    FishContext *fish = ctx->priv;
+    char *values[NB_KEYS] = { NULL };
+    double threshold = 0.1, interval = 1;
+    int ret = -1, i;
+
+    if(ff_parse_key_values(ctx, args, keys, values))
+        goto end;
+
+    fish->bright = (HSV){ 360, 255, 255 };
+    parse_range(values[HUE],        &fish->dark.h, &fish->bright.h, 360);
+    parse_range(values[SATURATION], &fish->dark.s, &fish->bright.s, 255);
+    parse_range(values[VALUE],      &fish->dark.v, &fish->bright.v, 255);
+
+    if(values[THRESHOLD])
+        threshold = atof(values[THRESHOLD]);
+    if(values[INTERVAL])
+        interval  = atof(values[INTERVAL]);
+    fish->inset    = values[INSET]  ? atoi(values[INSET])  : 0;
+    fish->zap      = values[ZAP]    ? atoi(values[ZAP])    : 0;
+    fish->select   = values[SELECT] ? atoi(values[SELECT]) : 0;
+
+    if(threshold < 0 || threshold > 1) {
+        av_log(ctx, AV_LOG_ERROR, "invalid threshold %f, the range is 0-1\n", threshold);
+        goto end;
+    }
+    if(fish->inset < 0 || fish->inset >= 100 || interval < 0) {
+        av_log(ctx, AV_LOG_ERROR, "invalid inset or interval\n");
+        goto end;
+    }
+    fish->threshold = threshold * 1000;
+    fish->interval  = interval * AV_TIME_BASE;
+    fish->next_pts  = INT64_MIN;
+    ret = 0;
+
+end:
+    for(i = 0; i < NB_KEYS; i ++)
+        av_free(values[i]);
+    return ret;
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+    avfilter_set_common_formats(ctx,
+        avfilter_make_format_list(5, PIX_FMT_YUV420P, PIX_FMT_YUV422P,
+                                     PIX_FMT_YUV444P, PIX_FMT_YUV411P,
+                                     PIX_FMT_YUV410P));
+    return 0;
+}
+
+static int config_input(AVFilterLink *link)
+{
+    FishContext *fish = link->dst->priv;
+
+    avcodec_get_chroma_sub_sample(link->format, &fish->hsub, &fish->vsub);
+    return 0;
+}
+
+static void get_hsv(HSV *hsv, int r, int g, int b)
+{
+    int i, v, x, f;
+
+    x = (r < g) ? r : g;
+    if (b < x)
+        x = b;
+    v = (r > g) ? r : g;
+    if (b > v)
+        v = b;
+
+    if (v == x) {
+        hsv->h = 0;
+        hsv->s = 0;
+        hsv->v = v;
+        return;
+    }
+
+    if (r == v) {
+        f = g - b;
+        i = 0;
+    } else if (g == v) {
+        f = b - r;
+        i = 2 * 60;
+    } else {
+        f = r - g;
+        i = 4 * 60;
+    }
+
+    hsv->h = i + (60 * f) / (v - x);
+    if (hsv->h < 0)
+        hsv->h += 360;
+
+    hsv->s = (255 * (v - x)) / v;
+    hsv->v = v;
+}
+
+/**
+ * Count the fish pixels in a band of chroma rows of the picture, each
+ * chroma sample is taken with the top left luma sample it covers.
+ */
+static int count_rows(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    FishContext *fish   = ctx->priv;
+    AVFilterPicRef *pic = arg;
+    uint8_t *cm = ff_cropTbl + MAX_NEG_CROP;
+    int cw = -((-pic->w) >> fish->hsub);
+    int ch = -((-pic->h) >> fish->vsub);
+    int x0  = fish->inset * cw / 200, x1 = cw - x0;
+    int top = fish->inset * ch / 200, rows = ch - 2 * top;
+    int y0  = top + rows *  jobnr      / nb_jobs;
+    int y1  = top + rows * (jobnr + 1) / nb_jobs;
+    int inrange = 0, cx, cy, i, j;
+
+    for(cy = y0; cy < y1; cy ++) {
+        uint8_t *luma = pic->data[0] + (cy << fish->vsub) * pic->linesize[0];
+        uint8_t *u    = pic->data[1] +  cy * pic->linesize[1];
+        uint8_t *v    = pic->data[2] +  cy * pic->linesize[2];
+
+        for(cx = x0; cx < x1; cx ++) {
+            int y, cb, cr, r_add, g_add, b_add;
+            unsigned r, g, b;
+            HSV hsv;
+
+            YUV_TO_RGB1_CCIR(u[cx], v[cx]);
+            YUV_TO_RGB2_CCIR(r, g, b, luma[cx << fish->hsub]);
+            get_hsv(&hsv, r, g, b);
+
+            if(hsv.h >= fish->dark.h && hsv.h <= fish->bright.h &&
+               hsv.s >= fish->dark.s && hsv.s <= fish->bright.s &&
+               hsv.v >= fish->dark.v && hsv.v <= fish->bright.v)
+                inrange ++;
+            else if(fish->zap) {
+                for(j = 0; j < 1 << fish->vsub && (cy << fish->vsub) + j < pic->h; j ++)
+                    for(i = 0; i < 1 << fish->hsub && (cx << fish->hsub) + i < pic->w; i ++)
+                        luma[j * pic->linesize[0] + (cx << fish->hsub) + i] = 16;
+                u[cx] = 128;
+                v[cx] = 128;
+            }
+        }
+    }
+
+    return inrange;
+}
+
+/** @return 1 if the picture shows a fish */
+static int detect(AVFilterContext *ctx, AVFilterPicRef *pic)
+{
+    FishContext *fish = ctx->priv;
+    int cw = -((-pic->w) >> fish->hsub);
+    int ch = -((-pic->h) >> fish->vsub);
+    int cols    = cw - 2 * (fish->inset * cw / 200);
+    int rows    = ch - 2 * (fish->inset * ch / 200);
+    int pixcnt  = cols * rows;
+    int nb_jobs = av_clip(rows, 1, ctx->thread_count);
+    int *ret, inrange = 0, i;
+
+    if(pixcnt <= 0)
+        return 0;
+
+    ret = av_malloc(nb_jobs * sizeof(*ret));
+    ctx->execute(ctx, count_rows, pic, ret, nb_jobs);
+    for(i = 0; i < nb_jobs; i ++)
+        inrange += ret[i];
+    av_free(ret);
+
+    av_log(ctx, AV_LOG_DEBUG, "inrange=%d of %d = %d threshold\n",
+           inrange, pixcnt, (int)(1000LL * inrange / pixcnt));
+
+    return 1000LL * inrange / pixcnt >= fish->threshold;
+}
+
+static void start_frame(AVFilterLink *link, AVFilterPicRef *picref)
+{
+    /* the picture is checked once it is complete */
+    link->cur_pic = picref;
+}
+
+static void draw_slice(AVFilterLink *link, int y, int h)
+{
+}
+
+static void end_frame(AVFilterLink *link)
+{
+    AVFilterContext *ctx = link->dst;
+    FishContext *fish    = ctx->priv;
+    AVFilterPicRef *pic  = link->cur_pic;
+    int found = 0;
+
+    link->cur_pic = NULL;
+
+    if(pic->pts >= fish->next_pts) {
+        fish->next_pts = pic->pts + AV_TIME_BASE;
+        if((found = detect(ctx, pic))) {
+            av_log(ctx, AV_LOG_INFO, "fish at %0.3f\n", pic->pts / (double)AV_TIME_BASE);
+            fish->next_pts = pic->pts + fish->interval;
+        }
+    }
+
+    if(fish->select && !found) {
+        avfilter_unref_pic(pic);
+        return;
+    }
+
+    fish->sent = 1;
+    avfilter_start_frame(ctx->outputs[0], pic);
+    avfilter_draw_slice(ctx->outputs[0], 0, pic->h);
+    avfilter_end_frame(ctx->outputs[0]);
+}
+
+static int request_frame(AVFilterLink *link)
+{
+    FishContext *fish = link->src->priv;
+    int ret;
+
+    /* with select, read on until a picture with a fish shows up */
+    for(fish->sent = 0; !fish->sent; )
+        if((ret = avfilter_request_frame(link->src->inputs[0])))
+            return ret;
+
+    return 0;
+}
+
+AVFilter avfilter_vf_fish =
+{
+    .name      = "fish",
+
+    .priv_size = sizeof(FishContext),
+
+    .init      = init,
+
+    .query_formats = query_formats,
+
+    .inputs    = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .get_video_buffer= avfilter_null_get_video_buffer,
+                                    .start_frame     = start_frame,
+                                    .draw_slice      = draw_slice,
+                                    .end_frame       = end_frame,
+                                    .config_props    = config_input,
+                                    .min_perms       = AV_PERM_READ | AV_PERM_WRITE, },
+                                  { .name = NULL}},
+
+    .outputs   = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .request_frame   = request_frame, },
+                                  { .name = NULL}},
+};
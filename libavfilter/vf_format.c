@@ -0,0 +1,99 @@
+/*
+ * video format filter
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file vf_format.c
+ * Restrict the colorspaces negotiated on a link to those listed in the
+ * arguments, e.g. "yuv420p:rgb24".  Pictures pass through unchanged.
+ */
+
+#include "libavutil/avstring.h"
+#include "avfilter.h"
+
+typedef struct
+{
+    int formats[PIX_FMT_NB];    ///< accepted colorspaces
+    int format_count;
+} FormatContext;
+
+static av_cold int init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    FormatContext *format = ctx->priv;
+    const char *cur = args;
+    char name[32];
+    int i, len;
+
+    while(cur && *cur && format->format_count < PIX_FMT_NB) {
+        len = strcspn(cur, ":");
+        av_strlcpy(name, cur, FFMIN(len + 1, sizeof(name)));
+        cur += len + (cur[len] == ':');
+        if(!*name)
+            continue;
+
+        i = avcodec_get_pix_fmt(name);
+        if(i == PIX_FMT_NB) {
+            av_log(ctx, AV_LOG_ERROR, "unknown pixel format '%s'\n", name);
+            return -1;
+        }
+        format->formats[format->format_count++] = i;
+    }
+
+    if(!format->format_count) {
+        av_log(ctx, AV_LOG_ERROR, "no pixel format given\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+    FormatContext *format = ctx->priv;
+    AVFilterFormats *formats = av_mallocz(sizeof(AVFilterFormats));
+
+    formats->formats      = av_malloc(sizeof(*formats->formats) * format->format_count);
+    formats->format_count = format->format_count;
+    memcpy(formats->formats, format->formats,
+           sizeof(*formats->formats) * format->format_count);
+
+    avfilter_set_common_formats(ctx, formats);
+    return 0;
+}
+
+AVFilter avfilter_vf_format =
+{
+    .name      = "format",
+
+    .init      = init,
+
+    .query_formats = query_formats,
+
+    .priv_size = sizeof(FormatContext),
+
+    .inputs    = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .get_video_buffer= avfilter_null_get_video_buffer,
+                                    .start_frame     = avfilter_null_start_frame,
+                                    .draw_slice      = avfilter_null_draw_slice, },
+                                  { .name = NULL}},
+
+    .outputs   = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO, },
+                                  { .name = NULL}},
+};
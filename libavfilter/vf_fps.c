@@ -0,0 +1,162 @@
+/*
+ * video frame rate filter
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file vf_fps.c
+ * Output pictures at a constant frame rate given as "num/den" or as a plain
+ * number, 25 by default.  Each output picture is a reference to the latest
+ * input picture not later than it, so pictures are dropped or repeated
+ * without being copied.
+ */
+
+#include "avfilter.h"
+
+typedef struct
+{
+    AVRational rate;            ///< output frame rate
+    int64_t frame;              ///< index of the next output picture
+    int64_t start;              ///< timestamp of the first input picture
+    AVFilterPicRef *prev;       ///< input picture before cur
+    AVFilterPicRef *cur;        ///< latest input picture
+    int eof;                    ///< no more input pictures
+} FPSContext;
+
+static av_cold int init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    FPSContext *fps = ctx->priv;
+
+    fps->rate = (AVRational){25, 1};
+    if(args)
+        sscanf(args, "%d/%d", &fps->rate.num, &fps->rate.den);
+
+    if(fps->rate.num <= 0 || fps->rate.den <= 0) {
+        av_log(ctx, AV_LOG_ERROR, "invalid frame rate '%s'\n", args);
+        return -1;
+    }
+    fps->start = AV_NOPTS_VALUE;
+    return 0;
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    FPSContext *fps = ctx->priv;
+
+    if(fps->prev)
+        avfilter_unref_pic(fps->prev);
+    if(fps->cur)
+        avfilter_unref_pic(fps->cur);
+}
+
+static void start_frame(AVFilterLink *link, AVFilterPicRef *picref)
+{
+    FPSContext *fps = link->dst->priv;
+
+    if(fps->prev)
+        avfilter_unref_pic(fps->prev);
+    fps->prev = fps->cur;
+    fps->cur  = picref;
+    if(fps->start == AV_NOPTS_VALUE)
+        fps->start = picref->pts;
+}
+
+static void end_frame(AVFilterLink *link)
+{
+    /* the picture is kept in the context, not released here */
+    link->cur_pic = NULL;
+}
+
+/** timestamp of the next output picture */
+static int64_t next_pts(FPSContext *fps)
+{
+    return fps->start + av_rescale(fps->frame, (int64_t)AV_TIME_BASE * fps->rate.den,
+                                   fps->rate.num);
+}
+
+static int request_frame(AVFilterLink *link)
+{
+    FPSContext *fps = link->src->priv;
+    AVFilterPicRef *pic;
+    int64_t pts;
+    int ret;
+
+    /* the first input picture sets the time of the first output picture */
+    if(!fps->cur && (ret = avfilter_request_frame(link->src->inputs[0])))
+        return ret;
+
+    pts = next_pts(fps);
+
+    /* read ahead until a picture later than the output time shows up */
+    while(!fps->eof && fps->cur->pts <= pts) {
+        ret = avfilter_request_frame(link->src->inputs[0]);
+        if(ret == AVERROR(EAGAIN))
+            return ret;
+        if(ret)
+            fps->eof = 1;
+    }
+
+    if(fps->cur->pts <= pts)
+        pic = fps->eof && fps->cur->pts < pts ? NULL : fps->cur;
+    else
+        pic = fps->prev;
+    if(!pic)
+        return -1;
+
+    pic = avfilter_ref_pic(pic, ~AV_PERM_WRITE);
+    pic->pts = pts;
+    fps->frame ++;
+
+    avfilter_start_frame(link, pic);
+    avfilter_draw_slice(link, 0, pic->h);
+    avfilter_end_frame(link);
+
+    return 0;
+}
+
+static int poll_frame(AVFilterLink *link)
+{
+    FPSContext *fps = link->src->priv;
+
+    /* a picture can be repeated without asking for more input */
+    if(fps->cur && fps->cur->pts > next_pts(fps))
+        return 1;
+    return avfilter_poll_frame(link->src->inputs[0]);
+}
+
+AVFilter avfilter_vf_fps =
+{
+    .name      = "fps",
+
+    .priv_size = sizeof(FPSContext),
+
+    .init      = init,
+    .uninit    = uninit,
+
+    .inputs    = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .start_frame     = start_frame,
+                                    .end_frame       = end_frame, },
+                                  { .name = NULL}},
+
+    .outputs   = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .request_frame   = request_frame,
+                                    .poll_frame      = poll_frame, },
+                                  { .name = NULL}},
+};
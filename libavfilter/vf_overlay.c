@@ -0,0 +1,211 @@
+/*
+ * video overlay filter
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file vf_overlay.c
+ * Draw the pictures of the second input at "x:y" onto those of the first.
+ * Each main picture gets the latest overlay picture not later than it.  The
+ * overlay is drawn in place into the main picture, which is then passed on,
+ * and its rows are split among the threads of the graph.  The main pictures
+ * are requested from the next filter, so they can be rendered straight into
+ * its buffers.
+ */
+
+#include "avfilter.h"
+
+typedef struct
+{
+    int x, y;                   ///< position of the overlay
+    int hsub, vsub;             ///< chroma subsampling
+    AVFilterPicRef *main;       ///< main picture being overlaid
+    AVFilterPicRef *prev;       ///< overlay picture before cur
+    AVFilterPicRef *cur;        ///< latest overlay picture
+    int overlay_eof;            ///< no more overlay pictures
+} OverlayContext;
+
+static av_cold int init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    OverlayContext *over = ctx->priv;
+
+    if(args)
+        sscanf(args, "%d:%d", &over->x, &over->y);
+
+    if(over->x < 0 || over->y < 0) {
+        av_log(ctx, AV_LOG_ERROR, "invalid position '%s'\n", args);
+        return -1;
+    }
+    return 0;
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    OverlayContext *over = ctx->priv;
+
+    if(over->main)
+        avfilter_unref_pic(over->main);
+    if(over->prev)
+        avfilter_unref_pic(over->prev);
+    if(over->cur)
+        avfilter_unref_pic(over->cur);
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+    avfilter_set_common_formats(ctx,
+        avfilter_make_format_list(6, PIX_FMT_YUV420P, PIX_FMT_YUV422P,
+                                     PIX_FMT_YUV444P, PIX_FMT_YUV411P,
+                                     PIX_FMT_YUV410P, PIX_FMT_GRAY8));
+    return 0;
+}
+
+static int config_input_main(AVFilterLink *link)
+{
+    OverlayContext *over = link->dst->priv;
+
+    avcodec_get_chroma_sub_sample(link->format, &over->hsub, &over->vsub);
+
+    /* the overlay has to start on a whole chroma sample */
+    over->x &= ~((1 << over->hsub) - 1);
+    over->y &= ~((1 << over->vsub) - 1);
+
+    return 0;
+}
+
+static void start_frame_main(AVFilterLink *link, AVFilterPicRef *picref)
+{
+    OverlayContext *over = link->dst->priv;
+
+    if(over->main)
+        avfilter_unref_pic(over->main);
+    over->main = picref;
+}
+
+static void start_frame_overlay(AVFilterLink *link, AVFilterPicRef *picref)
+{
+    OverlayContext *over = link->dst->priv;
+
+    if(over->prev)
+        avfilter_unref_pic(over->prev);
+    over->prev = over->cur;
+    over->cur  = picref;
+}
+
+static void end_frame(AVFilterLink *link)
+{
+    /* the picture is kept in the context, not released here */
+    link->cur_pic = NULL;
+}
+
+static int blend_rows(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    OverlayContext *over = ctx->priv;
+    AVFilterPicRef *src  = arg;
+    AVFilterPicRef *dst  = over->main;
+    int align = 1 << over->vsub;
+    int w  = FFMIN(src->w, dst->w - over->x);
+    int h  = FFMIN(src->h, dst->h - over->y);
+    int y0 = h *  jobnr      / nb_jobs & ~(align - 1);
+    int y1 = h * (jobnr + 1) / nb_jobs & ~(align - 1);
+    int i, y;
+
+    if(jobnr == nb_jobs - 1)
+        y1 = h;
+
+    for(i = 0; i < 3 && dst->data[i]; i ++) {
+        int hsub = i ? over->hsub : 0;
+        int vsub = i ? over->vsub : 0;
+        uint8_t *d = dst->data[i] + (over->y >> vsub) * dst->linesize[i] +
+                                    (over->x >> hsub);
+
+        for(y = y0 >> vsub; y < -((-y1) >> vsub); y ++)
+            memcpy(d + y * dst->linesize[i], src->data[i] + y * src->linesize[i],
+                   -((-w) >> hsub));
+    }
+
+    return 0;
+}
+
+static int request_frame(AVFilterLink *link)
+{
+    AVFilterContext *ctx = link->src;
+    OverlayContext *over = ctx->priv;
+    AVFilterPicRef *pic;
+    int nb_jobs, ret;
+
+    if((ret = avfilter_request_frame(ctx->inputs[0])))
+        return ret;
+    if(!over->main)
+        return -1;
+
+    /* read overlay pictures ahead until one later than the main picture,
+     * an overlay which has none ready yet leaves the current one shown */
+    while(!over->overlay_eof && (!over->cur || over->cur->pts <= over->main->pts)) {
+        ret = avfilter_request_frame(ctx->inputs[1]);
+        if(ret == AVERROR(EAGAIN))
+            break;
+        if(ret)
+            over->overlay_eof = 1;
+    }
+
+    pic = over->cur && over->cur->pts <= over->main->pts ? over->cur : over->prev;
+    if(pic && over->x < over->main->w && over->y < over->main->h) {
+        nb_jobs = FFMIN(ctx->thread_count, FFMIN(pic->h, over->main->h - over->y) >> over->vsub);
+        ctx->execute(ctx, blend_rows, pic, NULL, FFMAX(nb_jobs, 1));
+    }
+
+    pic = over->main;
+    over->main = NULL;
+    avfilter_start_frame(link, pic);
+    avfilter_draw_slice(link, 0, pic->h);
+    avfilter_end_frame(link);
+
+    return 0;
+}
+
+AVFilter avfilter_vf_overlay =
+{
+    .name      = "overlay",
+
+    .priv_size = sizeof(OverlayContext),
+
+    .init      = init,
+    .uninit    = uninit,
+
+    .query_formats = query_formats,
+
+    .inputs    = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .get_video_buffer= avfilter_null_get_video_buffer,
+                                    .start_frame     = start_frame_main,
+                                    .end_frame       = end_frame,
+                                    .config_props    = config_input_main,
+                                    .min_perms       = AV_PERM_READ | AV_PERM_WRITE,
+                                    .rej_perms       = AV_PERM_REUSE | AV_PERM_REUSE2, },
+                                  { .name            = "overlay",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .start_frame     = start_frame_overlay,
+                                    .end_frame       = end_frame, },
+                                  { .name = NULL}},
+
+    .outputs   = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .request_frame   = request_frame, },
+                                  { .name = NULL}},
+};
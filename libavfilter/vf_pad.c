@@ -0,0 +1,295 @@
+/*
+ * video pad filter
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file vf_pad.c
+ * Place the input at "x:y" on a "w:h" picture filled with a color given as
+ * a hexadecimal RRGGBB value after the size and position, black by default.
+ * The rows of each slice are split among the threads of the graph.
+ *
+ * Buffers requested for the input are carved out of a padded picture of the
+ * next filter, so that the previous filter or a decoder renders straight
+ * into place and only the borders are left to draw.
+ */
+
+#include "avfilter.h"
+
+#define DR_PICS 16              ///< padded pictures handed out for direct rendering
+
+typedef struct
+{
+    int w, h;                   ///< size of the padded picture
+    int x, y;                   ///< position of the input in the padded picture
+    int color[3];               ///< Y, U and V of the padding
+    int hsub, vsub;             ///< chroma subsampling
+    int passthrough;            ///< nothing to pad, pictures are passed on by reference
+    int direct;                 ///< input buffers can be carved out of padded pictures
+    int in_place;               ///< the current picture was rendered into the padded one
+    AVFilterPicRef *dr[DR_PICS]; ///< padded pictures whose inside was handed out
+    int dr_next;                ///< next entry of dr to use
+} PadContext;
+
+typedef struct
+{
+    AVFilterPicRef *in, *out;
+    int y, h;                   ///< output rows to draw
+    int in_place;               ///< only draw the borders
+} PadSlice;
+
+static av_cold int init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    PadContext *pad = ctx->priv;
+    unsigned int rgb = 0;
+    int r, g, b;
+
+    if(args)
+        sscanf(args, "%d:%d:%d:%d:%x", &pad->w, &pad->h, &pad->x, &pad->y, &rgb);
+
+    if(pad->w < 0 || pad->h < 0 || pad->x < 0 || pad->y < 0) {
+        av_log(ctx, AV_LOG_ERROR, "invalid padding '%s'\n", args);
+        return -1;
+    }
+
+    r = (rgb >> 16) & 0xff;
+    g = (rgb >>  8) & 0xff;
+    b =  rgb        & 0xff;
+    pad->color[0] =  16 + (( 66 * r + 129 * g +  25 * b + 128) >> 8);
+    pad->color[1] = 128 + ((-38 * r -  74 * g + 112 * b + 128) >> 8);
+    pad->color[2] = 128 + ((112 * r -  94 * g -  18 * b + 128) >> 8);
+
+    return 0;
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    PadContext *pad = ctx->priv;
+    int i;
+
+    for(i = 0; i < DR_PICS; i ++)
+        if(pad->dr[i])
+            avfilter_unref_pic(pad->dr[i]);
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+    avfilter_set_common_formats(ctx,
+        avfilter_make_format_list(6, PIX_FMT_YUV420P, PIX_FMT_YUV422P,
+                                     PIX_FMT_YUV444P, PIX_FMT_YUV411P,
+                                     PIX_FMT_YUV410P, PIX_FMT_GRAY8));
+    return 0;
+}
+
+static int config_input(AVFilterLink *link)
+{
+    PadContext *pad = link->dst->priv;
+
+    avcodec_get_chroma_sub_sample(link->format, &pad->hsub, &pad->vsub);
+
+    if(!pad->w)
+        pad->w = link->w;
+    if(!pad->h)
+        pad->h = link->h;
+
+    /* the input has to start on a whole chroma sample */
+    pad->x &= ~((1 << pad->hsub) - 1);
+    pad->y &= ~((1 << pad->vsub) - 1);
+
+    if(pad->x + link->w > pad->w || pad->y + link->h > pad->h) {
+        av_log(link->dst, AV_LOG_ERROR, "%dx%d input at %dx%d does not fit in %dx%d\n",
+               link->w, link->h, pad->x, pad->y, pad->w, pad->h);
+        return -1;
+    }
+    pad->passthrough = pad->w == link->w && pad->h == link->h;
+
+    /* buffers need room for the size rounded up to 16, which the input
+     * only has inside the padded picture when it needs no rounding */
+    pad->direct = !(link->w & 15) && !(link->h & 15);
+
+    return 0;
+}
+
+static int config_output(AVFilterLink *link)
+{
+    PadContext *pad = link->src->priv;
+
+    link->w = pad->w;
+    link->h = pad->h;
+
+    return 0;
+}
+
+/** move the origin of ref from the padded picture to the input inside, or back */
+static void shift_ref(PadContext *pad, AVFilterPicRef *ref, int dir)
+{
+    int i;
+
+    for(i = 0; i < 3 && ref->data[i]; i ++) {
+        int hsub = i ? pad->hsub : 0;
+        int vsub = i ? pad->vsub : 0;
+
+        ref->data[i] += dir * ((pad->y >> vsub) * ref->linesize[i] + (pad->x >> hsub));
+    }
+}
+
+static AVFilterPicRef *get_video_buffer(AVFilterLink *link, int perms)
+{
+    PadContext *pad = link->dst->priv;
+    AVFilterPicRef *picref;
+
+    if(pad->passthrough)
+        return avfilter_null_get_video_buffer(link, perms);
+    if(!pad->direct)
+        return NULL;
+
+    picref = avfilter_get_video_buffer(link->dst->outputs[0], perms);
+
+    /* keep the padded picture to recognize it in start_frame() */
+    if(pad->dr[pad->dr_next])
+        avfilter_unref_pic(pad->dr[pad->dr_next]);
+    pad->dr[pad->dr_next] = avfilter_ref_pic(picref, ~0);
+    pad->dr_next = (pad->dr_next + 1) % DR_PICS;
+
+    shift_ref(pad, picref, 1);
+    picref->w = link->w;
+    picref->h = link->h;
+
+    return picref;
+}
+
+static void start_frame(AVFilterLink *link, AVFilterPicRef *picref)
+{
+    PadContext *pad   = link->dst->priv;
+    AVFilterLink *out = link->dst->outputs[0];
+    int i;
+
+    if(pad->passthrough) {
+        avfilter_start_frame(out, avfilter_ref_pic(picref, ~0));
+        return;
+    }
+
+    for(i = 0; i < DR_PICS; i ++)
+        if(pad->dr[i] && pad->dr[i]->pic == picref->pic)
+            break;
+
+    pad->in_place = 0;
+    if(i < DR_PICS) {
+        shift_ref(pad, pad->dr[i], 1);
+        pad->in_place = pad->dr[i]->data[0] == picref->data[0];
+        shift_ref(pad, pad->dr[i], -1);
+    }
+
+    if(pad->in_place) {
+        out->outpic = pad->dr[i];
+        pad->dr[i]  = NULL;
+    } else
+        out->outpic = avfilter_get_video_buffer(out, AV_PERM_WRITE);
+    out->outpic->pts          = picref->pts;
+    out->outpic->pixel_aspect = picref->pixel_aspect;
+    avfilter_start_frame(out, avfilter_ref_pic(out->outpic, ~0));
+}
+
+static int draw_rows(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    PadContext *pad = ctx->priv;
+    PadSlice *s     = arg;
+    int align = 1 << pad->vsub;
+    int y0 = s->y + (s->h *  jobnr      / nb_jobs & ~(align - 1));
+    int y1 = s->y + (s->h * (jobnr + 1) / nb_jobs & ~(align - 1));
+    int i, y;
+
+    if(jobnr == nb_jobs - 1)
+        y1 = s->y + s->h;
+
+    for(i = 0; i < 3 && s->out->data[i]; i ++) {
+        int hsub  = i ? pad->hsub : 0;
+        int vsub  = i ? pad->vsub : 0;
+        int x     = pad->x >> hsub;
+        int w     = -((-s->in->w) >> hsub);
+        int outw  = -((-pad->w)   >> hsub);
+        int top   = pad->y >> vsub;
+        int bottom = top - ((-s->in->h) >> vsub);
+
+        for(y = y0 >> vsub; y < -((-y1) >> vsub); y ++) {
+            uint8_t *dst = s->out->data[i] + y * s->out->linesize[i];
+
+            if(y < top || y >= bottom) {
+                memset(dst, pad->color[i], outw);
+                continue;
+            }
+            memset(dst, pad->color[i], x);
+            if(!s->in_place)
+                memcpy(dst + x, s->in->data[i] + (y - top) * s->in->linesize[i], w);
+            memset(dst + x + w, pad->color[i], outw - x - w);
+        }
+    }
+
+    return 0;
+}
+
+static void draw_slice(AVFilterLink *link, int y, int h)
+{
+    PadContext *pad   = link->dst->priv;
+    AVFilterLink *out = link->dst->outputs[0];
+    PadSlice s;
+    int nb_jobs;
+
+    if(pad->passthrough) {
+        avfilter_draw_slice(out, y, h);
+        return;
+    }
+
+    /* the borders above and below the input go with its first and last slice */
+    s.in       = link->cur_pic;
+    s.out      = out->outpic;
+    s.in_place = pad->in_place;
+    s.y   = y ? pad->y + y : 0;
+    s.h   = (y + h == link->h ? pad->h : pad->y + y + h) - s.y;
+
+    nb_jobs = FFMIN(link->dst->thread_count, s.h >> pad->vsub);
+    link->dst->execute(link->dst, draw_rows, &s, NULL, FFMAX(nb_jobs, 1));
+
+    avfilter_draw_slice(out, s.y, s.h);
+}
+
+AVFilter avfilter_vf_pad =
+{
+    .name      = "pad",
+
+    .priv_size = sizeof(PadContext),
+
+    .init      = init,
+    .uninit    = uninit,
+
+    .query_formats = query_formats,
+
+    .inputs    = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .get_video_buffer= get_video_buffer,
+                                    .start_frame     = start_frame,
+                                    .draw_slice      = draw_slice,
+                                    .config_props    = config_input,
+                                    .min_perms       = AV_PERM_READ, },
+                                  { .name = NULL}},
+
+    .outputs   = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .config_props    = config_output, },
+                                  { .name = NULL}},
+};
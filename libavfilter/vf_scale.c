@@ -0,0 +1,191 @@
+/*
+ * video scale filter
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file vf_scale.c
+ * Scale the input to "w:h" and convert it to the colorspace negotiated for
+ * the output.  A zero size keeps the input size, -1 keeps the aspect ratio
+ * of the input.  If neither size nor colorspace change, pictures are passed
+ * on by reference.
+ */
+
+#include "avfilter.h"
+#include "libswscale/swscale.h"
+
+typedef struct
+{
+    struct SwsContext *sws;     ///< software scaler context, NULL when passing through
+    int w, h;                   ///< requested output size
+} ScaleContext;
+
+static av_cold int init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    ScaleContext *scale = ctx->priv;
+
+    if(args)
+        sscanf(args, "%d:%d", &scale->w, &scale->h);
+
+    if(scale->w < -1 || scale->h < -1 || (scale->w == -1 && scale->h == -1)) {
+        av_log(ctx, AV_LOG_ERROR, "invalid size '%s'\n", args);
+        return -1;
+    }
+    return 0;
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    ScaleContext *scale = ctx->priv;
+
+    if(scale->sws)
+        sws_freeContext(scale->sws);
+    scale->sws = NULL;
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+    /* the graph picks the same colorspace on both sides when it can */
+    if(ctx->inputs[0])
+        avfilter_formats_ref(avfilter_all_colorspaces(),
+                             &ctx->inputs[0]->out_formats);
+    if(ctx->outputs[0])
+        avfilter_formats_ref(avfilter_all_colorspaces(),
+                             &ctx->outputs[0]->in_formats);
+
+    return 0;
+}
+
+static int config_output(AVFilterLink *link)
+{
+    ScaleContext *scale = link->src->priv;
+    AVFilterLink *in    = link->src->inputs[0];
+    int w = scale->w, h = scale->h;
+
+    if(!w)
+        w = in->w;
+    if(!h)
+        h = in->h;
+    if(w == -1)
+        w = av_rescale(h, in->w, in->h);
+    if(h == -1)
+        h = av_rescale(w, in->h, in->w);
+
+    link->w = w;
+    link->h = h;
+
+    if(scale->sws)
+        sws_freeContext(scale->sws);
+    scale->sws = NULL;
+
+    if(in->w == w && in->h == h && in->format == link->format)
+        return 0;
+
+    scale->sws = sws_getContext(in->w, in->h, in->format, w, h, link->format,
+                                SWS_BICUBIC, NULL, NULL, NULL);
+    if(!scale->sws) {
+        av_log(link->src, AV_LOG_ERROR, "cannot scale %dx%d to %dx%d\n",
+               in->w, in->h, w, h);
+        return -1;
+    }
+    return 0;
+}
+
+static AVFilterPicRef *get_video_buffer(AVFilterLink *link, int perms)
+{
+    ScaleContext *scale = link->dst->priv;
+
+    /* when passing through, the next filter can supply the picture */
+    if(!scale->sws)
+        return avfilter_null_get_video_buffer(link, perms);
+    return NULL;
+}
+
+static void start_frame(AVFilterLink *link, AVFilterPicRef *picref)
+{
+    ScaleContext *scale = link->dst->priv;
+    AVFilterLink *out   = link->dst->outputs[0];
+    AVFilterPicRef *outpicref;
+
+    if(!scale->sws) {
+        avfilter_start_frame(out, avfilter_ref_pic(picref, ~0));
+        return;
+    }
+
+    out->outpic = avfilter_get_video_buffer(out, AV_PERM_WRITE);
+    out->outpic->pts = picref->pts;
+    out->outpic->pixel_aspect = picref->pixel_aspect;
+    if(picref->pixel_aspect.num)
+        av_reduce(&out->outpic->pixel_aspect.num, &out->outpic->pixel_aspect.den,
+                  (int64_t)picref->pixel_aspect.num * out->h * link->w,
+                  (int64_t)picref->pixel_aspect.den * out->w * link->h, INT_MAX);
+
+    outpicref = avfilter_ref_pic(out->outpic, ~0);
+    avfilter_start_frame(out, outpicref);
+}
+
+static void draw_slice(AVFilterLink *link, int y, int h)
+{
+    ScaleContext *scale = link->dst->priv;
+
+    if(!scale->sws)
+        avfilter_draw_slice(link->dst->outputs[0], y, h);
+}
+
+static void end_frame(AVFilterLink *link)
+{
+    ScaleContext *scale = link->dst->priv;
+    AVFilterLink *out   = link->dst->outputs[0];
+    AVFilterPicRef *in  = link->cur_pic;
+
+    /* the scaler is fed the whole picture at once, not every sws_scale()
+     * implementation accepts slices */
+    if(scale->sws) {
+        sws_scale(scale->sws, in->data, in->linesize, 0, link->h,
+                  out->outpic->data, out->outpic->linesize);
+        avfilter_draw_slice(out, 0, out->h);
+    }
+
+    avfilter_default_end_frame(link);
+}
+
+AVFilter avfilter_vf_scale =
+{
+    .name      = "scale",
+
+    .init      = init,
+    .uninit    = uninit,
+
+    .query_formats = query_formats,
+
+    .priv_size = sizeof(ScaleContext),
+
+    .inputs    = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .get_video_buffer= get_video_buffer,
+                                    .start_frame     = start_frame,
+                                    .draw_slice      = draw_slice,
+                                    .end_frame       = end_frame,
+                                    .min_perms       = AV_PERM_READ, },
+                                  { .name = NULL}},
+
+    .outputs   = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .config_props    = config_output, },
+                                  { .name = NULL}},
+};
@@ -0,0 +1,137 @@
+/*
+ * split video filter
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file vf_split.c
+ * Send every input picture to two outputs, e.g. both inputs of overlay.
+ * Each output gets a read-only reference to the picture, queued until that
+ * output requests it, so one output may read ahead of the other.
+ */
+
+#include "libavutil/fifo.h"
+#include "avfilter.h"
+
+typedef struct
+{
+    AVFifoBuffer queue[2];      ///< pictures not yet requested by each output
+} SplitContext;
+
+static av_cold int init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    SplitContext *split = ctx->priv;
+
+    if(av_fifo_init(&split->queue[0], 4 * sizeof(AVFilterPicRef *)) < 0 ||
+       av_fifo_init(&split->queue[1], 4 * sizeof(AVFilterPicRef *)) < 0)
+        return AVERROR(ENOMEM);
+    return 0;
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    SplitContext *split = ctx->priv;
+    AVFilterPicRef *pic;
+    int i;
+
+    for(i = 0; i < 2; i ++) {
+        while(av_fifo_size(&split->queue[i]) > 0) {
+            av_fifo_read(&split->queue[i], (uint8_t *)&pic, sizeof(pic));
+            avfilter_unref_pic(pic);
+        }
+        av_fifo_free(&split->queue[i]);
+    }
+}
+
+static void start_frame(AVFilterLink *link, AVFilterPicRef *picref)
+{
+    /* the picture stays in link->cur_pic until end_frame() queues it */
+}
+
+static void end_frame(AVFilterLink *link)
+{
+    SplitContext *split = link->dst->priv;
+    AVFilterPicRef *pic;
+    int i;
+
+    for(i = 0; i < 2; i ++) {
+        AVFifoBuffer *queue = &split->queue[i];
+
+        pic = avfilter_ref_pic(link->cur_pic, ~AV_PERM_WRITE);
+        av_fifo_realloc(queue, av_fifo_size(queue) + sizeof(pic));
+        av_fifo_generic_write(queue, &pic, sizeof(pic), NULL);
+    }
+    avfilter_unref_pic(link->cur_pic);
+    link->cur_pic = NULL;
+}
+
+static int request_frame(AVFilterLink *link)
+{
+    AVFilterContext *ctx = link->src;
+    SplitContext *split = ctx->priv;
+    AVFifoBuffer *queue = &split->queue[link == ctx->outputs[1]];
+    AVFilterPicRef *pic;
+    int ret;
+
+    while(!av_fifo_size(queue))
+        if((ret = avfilter_request_frame(ctx->inputs[0])))
+            return ret;
+
+    av_fifo_read(queue, (uint8_t *)&pic, sizeof(pic));
+    avfilter_start_frame(link, pic);
+    avfilter_draw_slice(link, 0, pic->h);
+    avfilter_end_frame(link);
+
+    return 0;
+}
+
+static int poll_frame(AVFilterLink *link)
+{
+    AVFilterContext *ctx = link->src;
+    SplitContext *split = ctx->priv;
+
+    if(av_fifo_size(&split->queue[link == ctx->outputs[1]]))
+        return 1;
+    return avfilter_poll_frame(ctx->inputs[0]);
+}
+
+AVFilter avfilter_vf_split =
+{
+    .name      = "split",
+
+    .priv_size = sizeof(SplitContext),
+
+    .init      = init,
+    .uninit    = uninit,
+
+    .inputs    = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .start_frame     = start_frame,
+                                    .end_frame       = end_frame, },
+                                  { .name = NULL}},
+
+    .outputs   = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .request_frame   = request_frame,
+                                    .poll_frame      = poll_frame, },
+                                  { .name            = "copy",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .request_frame   = request_frame,
+                                    .poll_frame      = poll_frame, },
+                                  { .name = NULL}},
+};
@@ -0,0 +1,457 @@
+/*
+ * watermarking filter
+ * Copyright (c) 2005 Marcus Engene myfirstname(at)mylastname.se
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file vf_watermark.c
+ * Stamp an image or a video onto the pictures, a port of vhook/watermark.c.
+ * The mark is stretched to the size of the pictures.  The arguments are
+ * "key=value" pairs separated by ':':
+ *   file      image or video used as mark, mandatory; a video mark moves on
+ *             by one frame for every batch of pictures and its last frame
+ *             stays once it ends
+ *   mode      0: the mark minus the threshold is added to the pictures, so
+ *                that a mark at the threshold changes nothing
+ *             1: the mark replaces the pictures where one of its components
+ *                is above the threshold
+ *             2: the mark is blended using its alpha channel
+ *   threshold RRGGBB, 808080 by default
+ *   batch     number of pictures marked at once, 1 by default
+ *
+ * The mark is converted once per mark frame to the format of the pictures,
+ * either as signed differences for mode 0 or as planes with an alpha mask,
+ * and only the span of each row it covers is touched.  In mode 0 the
+ * components are added in YUV rather than RGB, so the result is clipped
+ * slightly differently than with the vhook.
+ */
+
+#include "libavformat/avformat.h"
+#include "libavcodec/colorspace.h"
+#include "libswscale/swscale.h"
+#include "avfilter.h"
+#include "blend.h"
+#include "parseutils.h"
+
+typedef struct {
+    int x, w;                   ///< part of a row where the mark is not transparent
+} Span;
+
+typedef struct {
+    int mode;
+    int thr_rgb[3];             ///< threshold as R, G and B
+    int thr_yuv[3];             ///< threshold as Y, U and V
+    int hsub, vsub;             ///< chroma subsampling
+
+    AVFormatContext *fmt_ctx;   ///< mark file
+    AVCodecContext *dec_ctx;
+    int stream_index;
+    AVFrame *frame;             ///< last decoded mark frame
+    int mark_eof;               ///< no more mark frames, the last one stays
+    int next_mark;              ///< the next batch moves on to the next mark frame
+    struct SwsContext *sws;     ///< converts the mark to RGB32
+    uint8_t *rgb;               ///< mark as RGB32 at its own size
+    int rgb_w, rgb_h;
+
+    uint8_t *mark[3];           ///< planes of the mark, modes 1 and 2
+    uint8_t *alpha[3];          ///< alpha of the mark, modes 1 and 2
+    int16_t *delta[3];          ///< mark minus threshold, mode 0
+    Span *span[3];              ///< part of each row to touch
+    int plane_w[3], plane_h[3];
+
+    BlendDSPContext dsp;
+    BlendBatch batch;
+} WatermarkContext;
+
+static const char * const keys[] = { "file", "mode", "threshold", "batch", NULL };
+
+enum { FILE_, MODE, THRESHOLD, BATCH, NB_KEYS };
+
+static int open_mark(AVFilterContext *ctx, const char *filename)
+{
+    WatermarkContext *wm = ctx->priv;
+    AVCodec *codec;
+    int i;
+
+    av_register_all();
+
+    if(av_open_input_file(&wm->fmt_ctx, filename, NULL, 0, NULL)) {
+        av_log(ctx, AV_LOG_ERROR, "could not open '%s'\n", filename);
+        return -1;
+    }
+    if(av_find_stream_info(wm->fmt_ctx) < 0) {
+        av_log(ctx, AV_LOG_ERROR, "could not find the stream info of '%s'\n", filename);
+        return -1;
+    }
+
+    wm->stream_index = -1;
+    for(i = 0; i < wm->fmt_ctx->nb_streams; i ++)
+        if(wm->fmt_ctx->streams[i]->codec->codec_type == CODEC_TYPE_VIDEO) {
+            wm->stream_index = i;
+            break;
+        }
+    if(wm->stream_index < 0) {
+        av_log(ctx, AV_LOG_ERROR, "no video stream in '%s'\n", filename);
+        return -1;
+    }
+
+    wm->dec_ctx = wm->fmt_ctx->streams[i]->codec;
+    if(!(codec = avcodec_find_decoder(wm->dec_ctx->codec_id)) ||
+       avcodec_open(wm->dec_ctx, codec) < 0) {
+        av_log(ctx, AV_LOG_ERROR, "could not open the decoder of '%s'\n", filename);
+        wm->dec_ctx = NULL;
+        return -1;
+    }
+    wm->frame = avcodec_alloc_frame();
+
+    return 0;
+}
+
+/**
+ * Decode the next frame of the mark and convert it to RGB32.
+ * @return 1 if there is a new frame, 0 at the end of the mark
+ */
+static int read_mark(AVFilterContext *ctx)
+{
+    WatermarkContext *wm = ctx->priv;
+    AVCodecContext *dec  = wm->dec_ctx;
+    AVPacket pkt;
+    int got_frame = 0;
+
+    while(!got_frame) {
+        if(av_read_frame(wm->fmt_ctx, &pkt) < 0)
+            return 0;
+        if(pkt.stream_index == wm->stream_index)
+            avcodec_decode_video(dec, wm->frame, &got_frame, pkt.data, pkt.size);
+        av_free_packet(&pkt);
+    }
+
+    if(!wm->rgb || wm->rgb_w != dec->width || wm->rgb_h != dec->height) {
+        av_free(wm->rgb);
+        wm->rgb   = av_malloc(dec->width * dec->height * 4);
+        wm->rgb_w = dec->width;
+        wm->rgb_h = dec->height;
+    }
+    wm->sws = sws_getCachedContext(wm->sws, dec->width, dec->height, dec->pix_fmt,
+                                   dec->width, dec->height, PIX_FMT_RGB32,
+                                   SWS_BICUBIC, NULL, NULL, NULL);
+    if(!wm->sws) {
+        av_log(ctx, AV_LOG_ERROR, "cannot convert the mark to RGB\n");
+        return 0;
+    }
+    {
+        uint8_t *data[4] = { wm->rgb };
+        int linesize[4]  = { wm->rgb_w * 4 };
+        sws_scale(wm->sws, wm->frame->data, wm->frame->linesize, 0, dec->height,
+                  data, linesize);
+    }
+
+    return 1;
+}
+
+static av_cold int init(AVFilterContext *ctx, const char *args, void *opaque)
+{
+    WatermarkContext *wm = ctx->priv;
+    char *values[NB_KEYS] = { NULL };
+    unsigned int thr = 0x808080;
+    int ret = -1, i;
+
+    if(ff_parse_key_values(ctx, args, keys, values))
+        goto end;
+
+    if(!values[FILE_]) {
+        av_log(ctx, AV_LOG_ERROR, "no mark file given\n");
+        goto end;
+    }
+
+    wm->mode       = values[MODE]  ? atoi(values[MODE])  : 0;
+    wm->batch.size = values[BATCH] ? atoi(values[BATCH]) : 1;
+
+    if(wm->mode < 0 || wm->mode > 2) {
+        av_log(ctx, AV_LOG_ERROR, "invalid mode %d\n", wm->mode);
+        goto end;
+    }
+    if(wm->batch.size < 1 || wm->batch.size > MAX_BATCH) {
+        av_log(ctx, AV_LOG_ERROR, "batch size must be between 1 and %d\n", MAX_BATCH);
+        goto end;
+    }
+    if(values[THRESHOLD] && sscanf(values[THRESHOLD], "%x", &thr) != 1) {
+        av_log(ctx, AV_LOG_ERROR, "invalid threshold '%s', expected RRGGBB\n",
+               values[THRESHOLD]);
+        goto end;
+    }
+    wm->thr_rgb[0] = (thr >> 16) & 0xff;
+    wm->thr_rgb[1] = (thr >>  8) & 0xff;
+    wm->thr_rgb[2] =  thr        & 0xff;
+    wm->thr_yuv[0] = RGB_TO_Y_CCIR(wm->thr_rgb[0], wm->thr_rgb[1], wm->thr_rgb[2]);
+    wm->thr_yuv[1] = RGB_TO_U_CCIR(wm->thr_rgb[0], wm->thr_rgb[1], wm->thr_rgb[2], 0);
+    wm->thr_yuv[2] = RGB_TO_V_CCIR(wm->thr_rgb[0], wm->thr_rgb[1], wm->thr_rgb[2], 0);
+
+    if(open_mark(ctx, values[FILE_]))
+        goto end;
+    if(!read_mark(ctx)) {
+        av_log(ctx, AV_LOG_ERROR, "no picture in '%s'\n", values[FILE_]);
+        goto end;
+    }
+
+    ff_blend_dsp_init(&wm->dsp);
+    ret = 0;
+
+end:
+    for(i = 0; i < NB_KEYS; i ++)
+        av_free(values[i]);
+    return ret;
+}
+
+static void free_planes(WatermarkContext *wm)
+{
+    int i;
+
+    for(i = 0; i < 3; i ++) {
+        av_freep(&wm->mark[i]);
+        av_freep(&wm->alpha[i]);
+        av_freep(&wm->delta[i]);
+        av_freep(&wm->span[i]);
+    }
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    WatermarkContext *wm = ctx->priv;
+
+    ff_blend_batch_free(&wm->batch);
+    free_planes(wm);
+    if(wm->sws)
+        sws_freeContext(wm->sws);
+    av_freep(&wm->rgb);
+    av_freep(&wm->frame);
+    if(wm->dec_ctx)
+        avcodec_close(wm->dec_ctx);
+    if(wm->fmt_ctx)
+        av_close_input_file(wm->fmt_ctx);
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+    avfilter_set_common_formats(ctx,
+        avfilter_make_format_list(6, PIX_FMT_YUV420P, PIX_FMT_YUV422P,
+                                     PIX_FMT_YUV444P, PIX_FMT_YUV411P,
+                                     PIX_FMT_YUV410P, PIX_FMT_GRAY8));
+    return 0;
+}
+
+/** Convert the RGB32 mark to the planes, stretched to the link size. */
+static void make_planes(WatermarkContext *wm, AVFilterLink *link)
+{
+    int p, x, y, i, j;
+
+    for(p = 0; p < 3 && wm->span[p]; p ++) {
+        int hsub = p ? wm->hsub : 0;
+        int vsub = p ? wm->vsub : 0;
+
+        for(y = 0; y < wm->plane_h[p]; y ++) {
+            int first = wm->plane_w[p], last = 0;
+
+            for(x = 0; x < wm->plane_w[p]; x ++) {
+                int y0 = y << vsub, y1 = FFMIN((y + 1) << vsub, link->h);
+                int x0 = x << hsub, x1 = FFMIN((x + 1) << hsub, link->w);
+                int r = 0, g = 0, b = 0, sum_a = 0, n = 0, a;
+                int value;
+
+                /* weight the colors of the mark by its alpha, so that
+                 * transparent pixels do not bleed into the chroma */
+                for(j = y0; j < y1; j ++)
+                    for(i = x0; i < x1; i ++) {
+                        const uint32_t *row = (const uint32_t *)wm->rgb +
+                                              (j * wm->rgb_h / link->h) * wm->rgb_w;
+                        uint32_t pix = row[i * wm->rgb_w / link->w];
+                        int pr = (pix >> 16) & 0xff, pg = (pix >> 8) & 0xff, pb = pix & 0xff;
+
+                        if(wm->mode == 0)
+                            a = 1;
+                        else if(wm->mode == 1)
+                            a = pr > wm->thr_rgb[0] || pg > wm->thr_rgb[1] ||
+                                pb > wm->thr_rgb[2] ? 255 : 0;
+                        else
+                            a = pix >> 24;
+                        r += pr * a;
+                        g += pg * a;
+                        b += pb * a;
+                        sum_a += a;
+                        n ++;
+                    }
+
+                if(sum_a) {
+                    r = (r + (sum_a >> 1)) / sum_a;
+                    g = (g + (sum_a >> 1)) / sum_a;
+                    b = (b + (sum_a >> 1)) / sum_a;
+                }
+                switch(p) {
+                case 0:  value = RGB_TO_Y_CCIR(r, g, b);    break;
+                case 1:  value = RGB_TO_U_CCIR(r, g, b, 0); break;
+                default: value = RGB_TO_V_CCIR(r, g, b, 0); break;
+                }
+
+                if(wm->mode == 0) {
+                    value -= wm->thr_yuv[p];
+                    wm->delta[p][y * wm->plane_w[p] + x] = value;
+                } else {
+                    a = (sum_a + (n >> 1)) / n;
+                    wm->mark [p][y * wm->plane_w[p] + x] = value;
+                    wm->alpha[p][y * wm->plane_w[p] + x] = a;
+                    value = a;
+                }
+                if(value) {
+                    first = FFMIN(first, x);
+                    last  = x + 1;
+                }
+            }
+
+            wm->span[p][y].x = first;
+            wm->span[p][y].w = FFMAX(last - first, 0);
+        }
+    }
+}
+
+static int config_input(AVFilterLink *link)
+{
+    WatermarkContext *wm = link->dst->priv;
+    int p, planes = link->format == PIX_FMT_GRAY8 ? 1 : 3;
+
+    avcodec_get_chroma_sub_sample(link->format, &wm->hsub, &wm->vsub);
+
+    free_planes(wm);
+    for(p = 0; p < planes; p ++) {
+        int w = wm->plane_w[p] = p ? -((-link->w) >> wm->hsub) : link->w;
+        int h = wm->plane_h[p] = p ? -((-link->h) >> wm->vsub) : link->h;
+
+        if(wm->mode == 0)
+            wm->delta[p] = av_malloc(w * h * sizeof(*wm->delta[p]));
+        else {
+            wm->mark[p]  = av_malloc(w * h);
+            wm->alpha[p] = av_malloc(w * h);
+        }
+        wm->span[p] = av_malloc(h * sizeof(*wm->span[p]));
+    }
+    make_planes(wm, link);
+
+    return 0;
+}
+
+static void start_frame(AVFilterLink *link, AVFilterPicRef *picref)
+{
+    WatermarkContext *wm = link->dst->priv;
+
+    ff_blend_batch_add(&wm->batch, picref);
+}
+
+static void end_frame(AVFilterLink *link)
+{
+    /* the picture is kept in the batch, not released here */
+    link->cur_pic = NULL;
+}
+
+static int draw_rows(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    WatermarkContext *wm = ctx->priv;
+    BlendBatch *batch    = arg;
+    int h     = wm->plane_h[0];
+    int align = (1 << wm->vsub) - 1;
+    int y0 = h *  jobnr      / nb_jobs & ~align;
+    int y1 = h * (jobnr + 1) / nb_jobs & ~align;
+    int p, n, y;
+
+    if(jobnr == nb_jobs - 1)
+        y1 = h;
+
+    for(p = 0; p < 3 && wm->span[p]; p ++) {
+        int vsub = p ? wm->vsub : 0;
+
+        for(y = y0 >> vsub; y < -((-y1) >> vsub); y ++) {
+            const Span *span = &wm->span[p][y];
+            int offset = y * wm->plane_w[p] + span->x;
+
+            if(!span->w)
+                continue;
+
+            /* the same rows of all the pictures while the mark is cached */
+            for(n = 0; n < batch->count; n ++) {
+                AVFilterPicRef *pic = batch->pic[n];
+                uint8_t *dst = pic->data[p] + y * pic->linesize[p] + span->x;
+
+                if(wm->mode == 0)
+                    wm->dsp.add_row(dst, wm->delta[p] + offset, span->w);
+                else
+                    wm->dsp.blend_row(dst, wm->mark[p] + offset,
+                                      wm->alpha[p] + offset, span->w);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int request_frame(AVFilterLink *link)
+{
+    AVFilterContext *ctx = link->src;
+    WatermarkContext *wm = ctx->priv;
+    int ret;
+
+    /* the first frame of the mark was read by init() */
+    if(wm->next_mark && !wm->mark_eof) {
+        if(read_mark(ctx))
+            make_planes(wm, ctx->inputs[0]);
+        else
+            wm->mark_eof = 1;
+    }
+    wm->next_mark = 0;
+
+    ret = ff_blend_batch_request(link, &wm->batch, draw_rows,
+                                 FFMIN(ctx->thread_count, wm->plane_h[0] >> wm->vsub));
+    if(!ret && !wm->batch.done)
+        wm->next_mark = 1;
+    return ret;
+}
+
+AVFilter avfilter_vf_watermark =
+{
+    .name      = "watermark",
+
+    .priv_size = sizeof(WatermarkContext),
+
+    .init      = init,
+    .uninit    = uninit,
+
+    .query_formats = query_formats,
+
+    .inputs    = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .get_video_buffer= avfilter_null_get_video_buffer,
+                                    .start_frame     = start_frame,
+                                    .end_frame       = end_frame,
+                                    .config_props    = config_input,
+                                    .min_perms       = AV_PERM_READ | AV_PERM_WRITE,
+                                    .rej_perms       = AV_PERM_REUSE | AV_PERM_REUSE2, },
+                                  { .name = NULL}},
+
+    .outputs   = (AVFilterPad[]) {{ .name            = "default",
+                                    .type            = CODEC_TYPE_VIDEO,
+                                    .request_frame   = request_frame, },
+                                  { .name = NULL}},
+};
@@ -82,6 +82,8 @@ void av_register_all(void)
     REGISTER_MUXDEMUX (FLV, flv);
     REGISTER_DEMUXER  (FOURXM, fourxm);
     REGISTER_MUXER    (FRAMECRC, framecrc);
+    REGISTER_MUXER    (FRAMEHASH, framehash);
+    REGISTER_MUXER    (FRAMEMD5, framemd5);
     REGISTER_MUXDEMUX (GIF, gif);
     REGISTER_DEMUXER  (GSM, gsm);
     REGISTER_MUXDEMUX (GXF, gxf);
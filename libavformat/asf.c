@@ -25,6 +25,7 @@
 #include "riff.h"
 #include "asf.h"
 #include "asfcrypt.h"
+#include "pktpool.h"
 
 extern void ff_mms_set_stream_selection(URLContext *h, AVFormatContext *format);
 
@@ -845,8 +846,9 @@ static int asf_read_packet(AVFormatContext *s, AVPacket *pkt)
                     av_log(s, AV_LOG_ERROR, "pkt.size != ds_packet_size * ds_span (%d %d %d)\n", asf_st->pkt.size, asf_st->ds_packet_size, asf_st->ds_span);
               }else{
                 /* packet descrambling */
-                uint8_t *newdata = av_malloc(asf_st->pkt.size);
-                if (newdata) {
+                AVPacket newpkt;
+                if (av_new_packet(&newpkt, asf_st->pkt.size) >= 0) {
+                    uint8_t *newdata = newpkt.data;
                     int offset = 0;
                     while (offset < asf_st->pkt.size) {
                         int off = offset / asf_st->ds_chunk_size;
@@ -862,16 +864,16 @@ static int asf_read_packet(AVFormatContext *s, AVPacket *pkt)
                                asf_st->ds_chunk_size);
                         offset += asf_st->ds_chunk_size;
                     }
-                    av_free(asf_st->pkt.data);
-                    asf_st->pkt.data = newdata;
+                    av_destruct_packet(&asf_st->pkt);
+                    asf_st->pkt.data = newpkt.data;
+                    asf_st->pkt.size = newpkt.size;
+                    asf_st->pkt.priv = newpkt.priv;
                 }
               }
             }
             asf_st->frag_offset = 0;
-            *pkt= asf_st->pkt;
-            //printf("packet %d %d\n", asf_st->pkt.size, asf->packet_frag_size);
-            asf_st->pkt.size = 0;
-            asf_st->pkt.data = 0;
+            ff_packet_move(pkt, &asf_st->pkt);
+            //printf("packet %d %d\n", pkt->size, asf->packet_frag_size);
             break; // packet completed
         }
     }
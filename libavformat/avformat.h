@@ -22,7 +22,7 @@
 #define FFMPEG_AVFORMAT_H
 
 #define LIBAVFORMAT_VERSION_MAJOR 52
-#define LIBAVFORMAT_VERSION_MINOR 14
+#define LIBAVFORMAT_VERSION_MINOR 18
 #define LIBAVFORMAT_VERSION_MICRO  0
 
 #define LIBAVFORMAT_VERSION_INT AV_VERSION_INT(LIBAVFORMAT_VERSION_MAJOR, \
@@ -67,6 +67,14 @@ typedef struct AVPacket {
     int   flags;
     int   duration;                         ///< presentation duration in time_base units (0 if not available)
     void  (*destruct)(struct AVPacket *);
+    /**
+     * Private data of the destructor. For packets with destruct set to
+     * av_destruct_packet() or av_destruct_packet_nofree() this is either
+     * NULL or the reference counted buffer data points into, and is
+     * managed by libavformat. Anyone replacing data must reset it, and
+     * a packet whose payload was moved to another one must have its
+     * destruct reset, as av_destruct_packet() releases any buffer set here.
+     */
     void  *priv;
     int64_t pos;                            ///< byte position in stream, -1 if unknown
 } AVPacket;
@@ -95,6 +103,17 @@ void av_init_packet(AVPacket *pkt);
  */
 int av_new_packet(AVPacket *pkt, int size);
 
+/**
+ * Increase the size of a packet, keeping its payload. The added bytes are
+ * left uninitialized, the padding after them is zeroed.
+ * If the payload is not owned by the packet it is copied.
+ *
+ * @param pkt packet
+ * @param grow_by number of bytes to add to the payload size
+ * @return 0 if OK. AVERROR_xxx otherwise.
+ */
+int av_grow_packet(AVPacket *pkt, int grow_by);
+
 /**
  * Allocate and read the payload of a packet and initialize its fields to default values.
  *
@@ -106,7 +125,9 @@ int av_get_packet(ByteIOContext *s, AVPacket *pkt, int size);
 
 /**
  * @warning This is a hack - the packet memory allocation stuff is broken. The
- * packet is allocated if it was not really allocated
+ * packet is allocated if it was not really allocated.
+ * Packets returned by av_read_frame() which point into a buffer of
+ * libavformat share that buffer instead of copying it.
  */
 int av_dup_packet(AVPacket *pkt);
 
@@ -391,6 +412,17 @@ typedef struct AVStream {
     char *filename; /**< source filename of the stream */
 
     int disposition; /**< AV_DISPOSITION_* bitfield */
+
+    /**
+     * Number of packets of this stream queued by the muxing interleaver.
+     */
+    int nb_interleaved_packets;
+
+    /**
+     * Packets of this stream queued by av_interleave_packet_per_dts(),
+     * in dts order.
+     */
+    struct AVInterleaveEntry *interleave_head, *interleave_tail;
 } AVStream;
 
 #define AV_PROGRAM_RUNNING 1
@@ -414,6 +446,11 @@ typedef struct AVProgram {
 #define AVFMTCTX_NOHEADER      0x0001 /**< signal that no header is present
                                          (streams are added dynamically) */
 
+/**
+ * Historical limit on the number of streams in an AVFormatContext.
+ * libavformat itself no longer has a limit, AVFormatContext.streams grows
+ * as needed. Only kept for applications which size their own tables with it.
+ */
 #ifdef _XBOX
 /* dvd's can have maximally 41 streams */
 #define MAX_STREAMS 42
@@ -443,7 +480,7 @@ typedef struct AVFormatContext {
     void *priv_data;
     ByteIOContext *pb;
     unsigned int nb_streams;
-    AVStream *streams[MAX_STREAMS];
+    AVStream **streams; /**< grown by av_new_stream(), freed with the context */
     char filename[1024]; /**< input or output filename */
     /* stream info */
     int64_t timestamp;
@@ -554,6 +591,52 @@ typedef struct AVFormatContext {
 
     unsigned int nb_chapters;
     AVChapter **chapters;
+
+    /**
+     * Maximum dts difference, in AV_TIME_BASE units, between the packets
+     * queued by av_interleave_packet_per_dts() before it outputs packets
+     * although some streams have none queued. This bounds the memory
+     * used when a sparse stream (e.g. subtitles) stalls.
+     * 0 means no limit.
+     * muxing: set by user
+     */
+    int64_t max_interleave_delta;
+
+    /**
+     * Hash functions of the framehash muxer: adler32, crc32, md5 or sha1,
+     * or a comma separated list of them in stream order.
+     * muxing: set by user
+     */
+    const char *hash;
+    /**
+     * File written by the framehash or framemd5 muxer which the output is
+     * compared to, muxing fails at the first difference.
+     * muxing: set by user
+     */
+    const char *hash_ref;
+    /**
+     * Number of threads of the framehash and framemd5 muxers, 0 hashes in
+     * the calling thread.
+     * muxing: set by user
+     */
+    int hash_threads;
+
+    /**
+     * Memory held by the context: the packets queued by
+     * av_find_stream_info(), av_read_frame() and the interleaver, the
+     * pictures decoded by av_find_stream_info() and those of the decoders
+     * the user linked to it, see AVCodecContext.mem.
+     * Above the soft limit fewer packets are probed and the interleaver
+     * outputs packets without waiting for all streams, above the hard
+     * limit these functions fail with AVERROR(ENOMEM).
+     * limits: set by user, usage: set by libavformat
+     */
+    AVMemAccount mem;
+
+    /* av_interleave_packet_per_dts() state, do not modify directly */
+    AVStream **interleave_heap; /**< streams with queued packets, min-heap on their first dts */
+    int nb_interleave_heap;
+    int64_t interleave_seq;
 } AVFormatContext;
 
 typedef struct AVPacketList {
@@ -699,6 +782,36 @@ AVFormatContext *av_alloc_format_context(void);
  */
 int av_find_stream_info(AVFormatContext *ic);
 
+/**
+ * Store the stream parameters of an input in a sidecar file.
+ * Meant to be called after av_find_stream_info(), the file stores the
+ * codec parameters, extradata, time bases, start times, durations and a
+ * summary of the index together with the size and modification time of
+ * the input.
+ *
+ * @param ic media file handle
+ * @param filename sidecar file name
+ * @return 0 if OK. AVERROR_xxx otherwise.
+ */
+int av_probe_cache_write(AVFormatContext *ic, const char *filename);
+
+/**
+ * Load stream parameters written by av_probe_cache_write() instead of
+ * probing them with av_find_stream_info().
+ * The sidecar is rejected, and ic is left untouched, if the input file
+ * changed size or modification time since it was written, if it was written
+ * for another demuxer or if the streams created by the demuxer header do
+ * not match the stored ones. The caller should then fall back to
+ * av_find_stream_info().
+ * For demuxers without header (AVFMTCTX_NOHEADER), the stored streams
+ * which the header did not create are added to ic.
+ *
+ * @param ic media file handle, as returned by av_open_input_file()
+ * @param filename sidecar file name
+ * @return 0 if the parameters were loaded. AVERROR_xxx otherwise.
+ */
+int av_probe_cache_read(AVFormatContext *ic, const char *filename);
+
 /**
  * Read a transport packet from a media file.
  *
@@ -984,10 +1097,18 @@ int64_t parse_date(const char *datestr, int duration);
 int64_t av_gettime(void);
 
 /* ffm specific for ffserver */
-#define FFM_PACKET_SIZE 4096
+#define FFM_PACKET_SIZE 4096            ///< default and minimum page size
+#define FFM_MAX_PACKET_SIZE (1 << 20)
 offset_t ffm_read_write_index(int fd);
 void ffm_write_write_index(int fd, offset_t pos);
 void ffm_set_write_index(AVFormatContext *s, offset_t pos, offset_t file_size);
+/**
+ * Lets ffm seek with the pts of the pages of the file kept in memory,
+ * page_pts[n] being the pts of the page at n * page size or AV_NOPTS_VALUE
+ * when unknown. The pages not in the table are read from the file.
+ * The table must not change during a seek, NULL stops using it.
+ */
+void ffm_set_page_index(AVFormatContext *s, const int64_t *page_pts, int nb_pages);
 
 /**
  * Attempts to find a specific tag in a URL.
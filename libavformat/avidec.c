@@ -625,6 +625,7 @@ static int avi_read_packet(AVFormatContext *s, AVPacket *pkt)
     int n, d[8], size;
     offset_t i, sync;
     void* dstr;
+    void* priv;
 
     if (ENABLE_DV_DEMUXER && avi->dv_demux) {
         size = dv_get_packet(avi->dv_demux, pkt);
@@ -700,17 +701,17 @@ resync:
 
         if(ast->has_pal && pkt->data && pkt->size<(unsigned)INT_MAX/2){
             ast->has_pal=0;
-            pkt->size += 4*256;
-            pkt->data = av_realloc(pkt->data, pkt->size + FF_INPUT_BUFFER_PADDING_SIZE);
-            if(pkt->data)
+            if(av_grow_packet(pkt, 4*256) >= 0)
                 memcpy(pkt->data + pkt->size - 4*256, ast->pal, 4*256);
         }
 
         if (ENABLE_DV_DEMUXER && avi->dv_demux) {
             dstr = pkt->destruct;
+            priv = pkt->priv;
             size = dv_produce_packet(avi->dv_demux, pkt,
                                     pkt->data, pkt->size);
             pkt->destruct = dstr;
+            pkt->priv = priv;
             pkt->flags |= PKT_FLAG_KEY;
         } else {
             /* XXX: how to handle B frames in avi ? */
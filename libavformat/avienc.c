@@ -41,14 +41,20 @@ typedef struct AVIIndex {
     AVIIentry** cluster;
 } AVIIndex;
 
+typedef struct {
+    offset_t frames_hdr_strm;
+    int audio_strm_length;
+    int packet_count;
+
+    AVIIndex index;
+} AVIStream;
+
 typedef struct {
     offset_t riff_start, movi_list, odml_list;
-    offset_t frames_hdr_all, frames_hdr_strm[MAX_STREAMS];
-    int audio_strm_length[MAX_STREAMS];
+    offset_t frames_hdr_all;
     int riff_id;
-    int packet_count[MAX_STREAMS];
 
-    AVIIndex indexes[MAX_STREAMS];
+    AVIStream *streams; ///< one entry per AVFormatContext stream
 } AVIContext;
 
 static inline AVIIentry* avi_get_ientry(AVIIndex* idx, int ent_id)
@@ -58,15 +64,16 @@ static inline AVIIentry* avi_get_ientry(AVIIndex* idx, int ent_id)
     return &idx->cluster[cl][id];
 }
 
-static offset_t avi_start_new_riff(AVIContext *avi, ByteIOContext *pb,
+static offset_t avi_start_new_riff(AVFormatContext *s, ByteIOContext *pb,
                                    const char* riff_tag, const char* list_tag)
 {
+    AVIContext *avi = s->priv_data;
     offset_t loff;
     int i;
 
     avi->riff_id++;
-    for (i=0; i<MAX_STREAMS; i++)
-         avi->indexes[i].entry = 0;
+    for (i=0; i<s->nb_streams; i++)
+         avi->streams[i].index.entry = 0;
 
     avi->riff_start = start_tag(pb, "RIFF");
     put_tag(pb, riff_tag);
@@ -113,17 +120,17 @@ static int avi_write_counters(AVFormatContext* s, int riff_id)
 
     file_size = url_ftell(pb);
     for(n = 0; n < s->nb_streams; n++) {
-        assert(avi->frames_hdr_strm[n]);
+        assert(avi->streams[n].frames_hdr_strm);
         stream = s->streams[n]->codec;
-        url_fseek(pb, avi->frames_hdr_strm[n], SEEK_SET);
+        url_fseek(pb, avi->streams[n].frames_hdr_strm, SEEK_SET);
         ff_parse_specific_params(stream, &au_byterate, &au_ssize, &au_scale);
         if(au_ssize == 0) {
-            put_le32(pb, avi->packet_count[n]);
+            put_le32(pb, avi->streams[n].packet_count);
         } else {
-            put_le32(pb, avi->audio_strm_length[n] / au_ssize);
+            put_le32(pb, avi->streams[n].audio_strm_length / au_ssize);
         }
         if(stream->codec_type == CODEC_TYPE_VIDEO)
-            nb_frames = FFMAX(nb_frames, avi->packet_count[n]);
+            nb_frames = FFMAX(nb_frames, avi->streams[n].packet_count);
     }
     if(riff_id == 1) {
         assert(avi->frames_hdr_all);
@@ -143,9 +150,13 @@ static int avi_write_header(AVFormatContext *s)
     AVCodecContext *stream, *video_enc;
     offset_t list1, list2, strh, strf;
 
+    avi->streams = av_mallocz(s->nb_streams * sizeof(*avi->streams));
+    if (!avi->streams)
+        return AVERROR(ENOMEM);
+
     /* header list */
     avi->riff_id = 0;
-    list1 = avi_start_new_riff(avi, pb, "AVI ", "hdrl");
+    list1 = avi_start_new_riff(s, pb, "AVI ", "hdrl");
 
     /* avi header */
     put_tag(pb, "avih");
@@ -221,7 +232,7 @@ static int avi_write_header(AVFormatContext *s)
         av_set_pts_info(s->streams[i], 64, au_scale, au_byterate);
 
         put_le32(pb, 0); /* start */
-        avi->frames_hdr_strm[i] = url_ftell(pb); /* remember this offset to fill later */
+        avi->streams[i].frames_hdr_strm = url_ftell(pb); /* remember this offset to fill later */
         if (url_is_streamed(pb))
             put_le32(pb, AVI_MAX_RIFF_SIZE); /* FIXME: this may be broken, but who cares */
         else
@@ -268,8 +279,8 @@ static int avi_write_header(AVFormatContext *s)
              * like to get away without making AVI an OpenDML one
              * for compatibility reasons.
              */
-            avi->indexes[i].entry = avi->indexes[i].ents_allocated = 0;
-            avi->indexes[i].indx_start = start_tag(pb, "JUNK");
+            avi->streams[i].index.entry = avi->streams[i].index.ents_allocated = 0;
+            avi->streams[i].index.indx_start = start_tag(pb, "JUNK");
             put_le16(pb, 4);        /* wLongsPerEntry */
             put_byte(pb, 0);        /* bIndexSubType (0 == frame index) */
             put_byte(pb, 0);        /* bIndexType (0 == AVI_INDEX_OF_INDEXES) */
@@ -280,7 +291,7 @@ static int avi_write_header(AVFormatContext *s)
             put_le32(pb, 0);           Must be 0.    */
             for (j=0; j < AVI_MASTER_INDEX_SIZE * 2; j++)
                  put_le64(pb, 0);
-            end_tag(pb, avi->indexes[i].indx_start);
+            end_tag(pb, avi->streams[i].index.indx_start);
         }
 
         if(   stream->codec_type == CODEC_TYPE_VIDEO
@@ -384,19 +395,19 @@ static int avi_write_ix(AVFormatContext *s)
          /* Writing AVI OpenDML leaf index chunk */
          ix = url_ftell(pb);
          put_tag(pb, &ix_tag[0]);     /* ix?? */
-         put_le32(pb, avi->indexes[i].entry * 8 + 24);
+         put_le32(pb, avi->streams[i].index.entry * 8 + 24);
                                       /* chunk size */
          put_le16(pb, 2);             /* wLongsPerEntry */
          put_byte(pb, 0);             /* bIndexSubType (0 == frame index) */
          put_byte(pb, 1);             /* bIndexType (1 == AVI_INDEX_OF_CHUNKS) */
-         put_le32(pb, avi->indexes[i].entry);
+         put_le32(pb, avi->streams[i].index.entry);
                                       /* nEntriesInUse */
          put_tag(pb, &tag[0]);        /* dwChunkId */
          put_le64(pb, avi->movi_list);/* qwBaseOffset */
          put_le32(pb, 0);             /* dwReserved_3 (must be 0) */
 
-         for (j=0; j<avi->indexes[i].entry; j++) {
-             AVIIentry* ie = avi_get_ientry(&avi->indexes[i], j);
+         for (j=0; j<avi->streams[i].index.entry; j++) {
+             AVIIentry* ie = avi_get_ientry(&avi->streams[i].index, j);
              put_le32(pb, ie->pos + 8);
              put_le32(pb, ((uint32_t)ie->len & ~0x80000000) |
                           (ie->flags & 0x10 ? 0 : 0x80000000));
@@ -405,14 +416,14 @@ static int avi_write_ix(AVFormatContext *s)
          pos = url_ftell(pb);
 
          /* Updating one entry in the AVI OpenDML master index */
-         url_fseek(pb, avi->indexes[i].indx_start - 8, SEEK_SET);
+         url_fseek(pb, avi->streams[i].index.indx_start - 8, SEEK_SET);
          put_tag(pb, "indx");                 /* enabling this entry */
          url_fskip(pb, 8);
          put_le32(pb, avi->riff_id);          /* nEntriesInUse */
          url_fskip(pb, 16*avi->riff_id);
          put_le64(pb, ix);                    /* qwOffset */
          put_le32(pb, pos - ix);              /* dwSize */
-         put_le32(pb, avi->indexes[i].entry); /* dwDuration */
+         put_le32(pb, avi->streams[i].index.entry); /* dwDuration */
 
          url_fseek(pb, pos, SEEK_SET);
     }
@@ -429,18 +440,21 @@ static int avi_write_idx1(AVFormatContext *s)
 
     if (!url_is_streamed(pb)) {
         AVIIentry* ie = 0, *tie;
-        int entry[MAX_STREAMS];
+        int *entry;
         int empty, stream_id = -1;
 
+        entry = av_mallocz(s->nb_streams * sizeof(*entry));
+        if (!entry)
+            return AVERROR(ENOMEM);
+
         idx_chunk = start_tag(pb, "idx1");
-        memset(&entry[0], 0, sizeof(entry));
         do {
             empty = 1;
             for (i=0; i<s->nb_streams; i++) {
-                 if (avi->indexes[i].entry <= entry[i])
+                 if (avi->streams[i].index.entry <= entry[i])
                      continue;
 
-                 tie = avi_get_ientry(&avi->indexes[i], entry[i]);
+                 tie = avi_get_ientry(&avi->streams[i].index, entry[i]);
                  if (empty || tie->pos < ie->pos) {
                      ie = tie;
                      stream_id = i;
@@ -458,6 +472,7 @@ static int avi_write_idx1(AVFormatContext *s)
             }
         } while (!empty);
         end_tag(pb, idx_chunk);
+        av_free(entry);
 
         avi_write_counters(s, avi->riff_id);
     }
@@ -474,8 +489,8 @@ static int avi_write_packet(AVFormatContext *s, AVPacket *pkt)
     AVCodecContext *enc= s->streams[stream_index]->codec;
     int size= pkt->size;
 
-//    av_log(s, AV_LOG_DEBUG, "%"PRId64" %d %d\n", pkt->dts, avi->packet_count[stream_index], stream_index);
-    while(enc->block_align==0 && pkt->dts != AV_NOPTS_VALUE && pkt->dts > avi->packet_count[stream_index]){
+//    av_log(s, AV_LOG_DEBUG, "%"PRId64" %d %d\n", pkt->dts, avi->streams[stream_index].packet_count, stream_index);
+    while(enc->block_align==0 && pkt->dts != AV_NOPTS_VALUE && pkt->dts > avi->streams[stream_index].packet_count){
         AVPacket empty_packet;
 
         av_init_packet(&empty_packet);
@@ -483,9 +498,9 @@ static int avi_write_packet(AVFormatContext *s, AVPacket *pkt)
         empty_packet.data= NULL;
         empty_packet.stream_index= stream_index;
         avi_write_packet(s, &empty_packet);
-//        av_log(s, AV_LOG_DEBUG, "dup %"PRId64" %d\n", pkt->dts, avi->packet_count[stream_index]);
+//        av_log(s, AV_LOG_DEBUG, "dup %"PRId64" %d\n", pkt->dts, avi->streams[stream_index].packet_count);
     }
-    avi->packet_count[stream_index]++;
+    avi->streams[stream_index].packet_count++;
 
     // Make sure to put an OpenDML chunk when the file size exceeds the limits
     if (!url_is_streamed(pb) &&
@@ -498,18 +513,18 @@ static int avi_write_packet(AVFormatContext *s, AVPacket *pkt)
             avi_write_idx1(s);
 
         end_tag(pb, avi->riff_start);
-        avi->movi_list = avi_start_new_riff(avi, pb, "AVIX", "movi");
+        avi->movi_list = avi_start_new_riff(s, pb, "AVIX", "movi");
     }
 
     avi_stream2fourcc(&tag[0], stream_index, enc->codec_type);
     if(pkt->flags&PKT_FLAG_KEY)
         flags = 0x10;
     if (enc->codec_type == CODEC_TYPE_AUDIO) {
-       avi->audio_strm_length[stream_index] += size;
+       avi->streams[stream_index].audio_strm_length += size;
     }
 
     if (!url_is_streamed(s->pb)) {
-        AVIIndex* idx = &avi->indexes[stream_index];
+        AVIIndex* idx = &avi->streams[stream_index].index;
         int cl = idx->entry / AVI_INDEX_CLUSTER_SIZE;
         int id = idx->entry % AVI_INDEX_CLUSTER_SIZE;
         if (idx->ents_allocated <= idx->entry) {
@@ -564,11 +579,11 @@ static int avi_write_trailer(AVFormatContext *s)
             for (n=nb_frames=0;n<s->nb_streams;n++) {
                 AVCodecContext *stream = s->streams[n]->codec;
                 if (stream->codec_type == CODEC_TYPE_VIDEO) {
-                    if (nb_frames < avi->packet_count[n])
-                        nb_frames = avi->packet_count[n];
+                    if (nb_frames < avi->streams[n].packet_count)
+                        nb_frames = avi->streams[n].packet_count;
                 } else {
                     if (stream->codec_id == CODEC_ID_MP2 || stream->codec_id == CODEC_ID_MP3) {
-                        nb_frames += avi->packet_count[n];
+                        nb_frames += avi->streams[n].packet_count;
                     }
                 }
             }
@@ -580,13 +595,14 @@ static int avi_write_trailer(AVFormatContext *s)
     }
     put_flush_packet(pb);
 
-    for (i=0; i<MAX_STREAMS; i++) {
-         for (j=0; j<avi->indexes[i].ents_allocated/AVI_INDEX_CLUSTER_SIZE; j++)
-              av_free(avi->indexes[i].cluster[j]);
-         av_free(avi->indexes[i].cluster);
-         avi->indexes[i].cluster = NULL;
-         avi->indexes[i].ents_allocated = avi->indexes[i].entry = 0;
+    for (i=0; i<s->nb_streams; i++) {
+         for (j=0; j<avi->streams[i].index.ents_allocated/AVI_INDEX_CLUSTER_SIZE; j++)
+              av_free(avi->streams[i].index.cluster[j]);
+         av_free(avi->streams[i].index.cluster);
+         avi->streams[i].index.cluster = NULL;
+         avi->streams[i].index.ents_allocated = avi->streams[i].index.entry = 0;
     }
+    av_freep(&avi->streams);
 
     return res;
 }
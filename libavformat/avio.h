@@ -365,5 +365,7 @@ void init_checksum(ByteIOContext *s, unsigned long (*update_checksum)(unsigned l
 int udp_set_remote_url(URLContext *h, const char *uri);
 int udp_get_local_port(URLContext *h);
 int udp_get_file_handle(URLContext *h);
+void udp_get_receive_stats(URLContext *h, unsigned int *overruns,
+                           unsigned int *dropped, unsigned int *kernel_dropped);
 
 #endif /* FFMPEG_AVIO_H */
@@ -20,6 +20,7 @@
  */
 
 #include "libavutil/crc.h"
+#include "libavutil/trace.h"
 #include "avformat.h"
 #include "avio.h"
 #include <stdarg.h>
@@ -79,7 +80,10 @@ static void flush_buffer(ByteIOContext *s)
 {
     if (s->buf_ptr > s->buffer) {
         if (s->write_packet && !s->error){
-            int ret= s->write_packet(s->opaque, s->buffer, s->buf_ptr - s->buffer);
+            int ret;
+            AV_TRACE_BEGIN("io_wait");
+            ret= s->write_packet(s->opaque, s->buffer, s->buf_ptr - s->buffer);
+            AV_TRACE_END("io_wait");
             if(ret < 0){
                 s->error = ret;
             }
@@ -303,8 +307,11 @@ static void fill_buffer(ByteIOContext *s)
         s->checksum_ptr= s->buffer;
     }
 
-    if(s->read_packet)
+    if(s->read_packet){
+        AV_TRACE_BEGIN("io_wait");
         len = s->read_packet(s->opaque, s->buffer, s->buffer_size);
+        AV_TRACE_END("io_wait");
+    }
     if (len <= 0) {
         /* do not modify buffer if EOF reached so that a seek back can
            be done without rereading data */
@@ -374,8 +381,11 @@ int get_buffer(ByteIOContext *s, unsigned char *buf, int size)
             len = size;
         if (len == 0) {
             if(size > s->buffer_size && !s->update_checksum){
-                if(s->read_packet)
+                if(s->read_packet){
+                    AV_TRACE_BEGIN("io_wait");
                     len = s->read_packet(s->opaque, buf, size);
+                    AV_TRACE_END("io_wait");
+                }
                 if (len <= 0) {
                     /* do not modify buffer if EOF reached so that a seek back can
                     be done without rereading data */
@@ -44,6 +44,8 @@ enum {
 typedef struct FFMContext {
     /* only reading mode */
     offset_t write_index, file_size;
+    const int64_t *page_pts; ///< pts of the pages of the file, see ffm_set_page_index()
+    int nb_pages;
     int read_state;
     uint8_t header[FRAME_HEADER_SIZE];
 
@@ -54,7 +56,7 @@ typedef struct FFMContext {
     int frame_offset;
     int64_t pts;
     uint8_t *packet_ptr, *packet_end;
-    uint8_t packet[FFM_PACKET_SIZE];
+    uint8_t *packet;         ///< packet_size bytes
 } FFMContext;
 
 #endif /* FFMPEG_FFM_H */
@@ -50,6 +50,13 @@ void ffm_set_write_index(AVFormatContext *s, offset_t pos, offset_t file_size)
     ffm->write_index = pos;
     ffm->file_size = file_size;
 }
+
+void ffm_set_page_index(AVFormatContext *s, const int64_t *page_pts, int nb_pages)
+{
+    FFMContext *ffm = s->priv_data;
+    ffm->page_pts = page_pts;
+    ffm->nb_pages = page_pts ? nb_pages : 0;
+}
 #endif // CONFIG_FFSERVER
 
 static int ffm_is_avail_data(AVFormatContext *s, int size)
@@ -68,7 +75,7 @@ static int ffm_is_avail_data(AVFormatContext *s, int size)
     } else if (pos < ffm->write_index) {
         avail_size = ffm->write_index - pos;
     } else {
-        avail_size = (ffm->file_size - pos) + (ffm->write_index - FFM_PACKET_SIZE);
+        avail_size = (ffm->file_size - pos) + (ffm->write_index - ffm->packet_size);
     }
     avail_size = (avail_size / ffm->packet_size) * (ffm->packet_size - FFM_HEADER_SIZE) + len;
     if (size <= avail_size)
@@ -140,17 +147,24 @@ static int ffm_read_data(AVFormatContext *s,
 
 //#define DEBUG_SEEK
 
-/* pos is between 0 and file_size - FFM_PACKET_SIZE. It is translated
+/* pos is between 0 and file_size - packet_size. It is translated
    by the write position inside this function */
-static void ffm_seek1(AVFormatContext *s, offset_t pos1)
+static offset_t ffm_file_pos(FFMContext *ffm, offset_t pos1)
 {
-    FFMContext *ffm = s->priv_data;
-    ByteIOContext *pb = s->pb;
     offset_t pos;
 
     pos = pos1 + ffm->write_index;
     if (pos >= ffm->file_size)
-        pos -= (ffm->file_size - FFM_PACKET_SIZE);
+        pos -= (ffm->file_size - ffm->packet_size);
+    return pos;
+}
+
+static void ffm_seek1(AVFormatContext *s, offset_t pos1)
+{
+    FFMContext *ffm = s->priv_data;
+    ByteIOContext *pb = s->pb;
+    offset_t pos = ffm_file_pos(ffm, pos1);
+
 #ifdef DEBUG_SEEK
     av_log(s, AV_LOG_DEBUG, "seek to %"PRIx64" -> %"PRIx64"\n", pos1, pos);
 #endif
@@ -159,9 +173,15 @@ static void ffm_seek1(AVFormatContext *s, offset_t pos1)
 
 static int64_t get_pts(AVFormatContext *s, offset_t pos)
 {
+    FFMContext *ffm = s->priv_data;
     ByteIOContext *pb = s->pb;
+    offset_t page = ffm_file_pos(ffm, pos) / ffm->packet_size;
     int64_t pts;
 
+    /* the page headers known in memory need no read */
+    if (page < ffm->nb_pages && ffm->page_pts[page] != AV_NOPTS_VALUE)
+        return ffm->page_pts[page];
+
     ffm_seek1(s, pos);
     url_fskip(pb, 4);
     pts = get_be64(pb);
@@ -183,7 +203,7 @@ static void adjust_write_index(AVFormatContext *s)
 
 
     pos_min = 0;
-    pos_max = ffm->file_size - 2 * FFM_PACKET_SIZE;
+    pos_max = ffm->file_size - 2 * ffm->packet_size;
 
     pts_start = get_pts(s, pos_min);
 
@@ -192,7 +212,7 @@ static void adjust_write_index(AVFormatContext *s)
     if (pts - 100000 > pts_start)
         goto end;
 
-    ffm->write_index = FFM_PACKET_SIZE;
+    ffm->write_index = ffm->packet_size;
 
     pts_start = get_pts(s, pos_min);
 
@@ -203,7 +223,7 @@ static void adjust_write_index(AVFormatContext *s)
             offset_t newpos;
             int64_t newpts;
 
-            newpos = ((pos_max + pos_min) / (2 * FFM_PACKET_SIZE)) * FFM_PACKET_SIZE;
+            newpos = ((pos_max + pos_min) / (2 * ffm->packet_size)) * ffm->packet_size;
 
             if (newpos == pos_min)
                 break;
@@ -243,8 +263,12 @@ static int ffm_read_header(AVFormatContext *s, AVFormatParameters *ap)
     if (tag != MKTAG('F', 'F', 'M', '1'))
         goto fail;
     ffm->packet_size = get_be32(pb);
-    if (ffm->packet_size != FFM_PACKET_SIZE)
+    if (ffm->packet_size < FFM_PACKET_SIZE || ffm->packet_size > FFM_MAX_PACKET_SIZE)
+        goto fail;
+    ffm->packet = av_malloc(ffm->packet_size);
+    if (!ffm->packet)
         goto fail;
+    s->packet_size = ffm->packet_size;
     ffm->write_index = get_be64(pb);
     /* get also filesize */
     if (!url_is_streamed(pb)) {
@@ -349,6 +373,7 @@ static int ffm_read_header(AVFormatContext *s, AVFormatParameters *ap)
             av_free(st);
         }
     }
+    av_freep(&ffm->packet);
     return -1;
 }
 
@@ -427,14 +452,14 @@ static int ffm_seek(AVFormatContext *s, int stream_index, int64_t wanted_pts, in
     /* find the position using linear interpolation (better than
        dichotomy in typical cases) */
     pos_min = 0;
-    pos_max = ffm->file_size - 2 * FFM_PACKET_SIZE;
+    pos_max = ffm->file_size - 2 * ffm->packet_size;
     while (pos_min <= pos_max) {
         pts_min = get_pts(s, pos_min);
         pts_max = get_pts(s, pos_max);
         /* linear interpolation */
         pos1 = (double)(pos_max - pos_min) * (double)(wanted_pts - pts_min) /
             (double)(pts_max - pts_min);
-        pos = (((int64_t)pos1) / FFM_PACKET_SIZE) * FFM_PACKET_SIZE;
+        pos = (((int64_t)pos1) / ffm->packet_size) * ffm->packet_size;
         if (pos <= pos_min)
             pos = pos_min;
         else if (pos >= pos_max)
@@ -444,21 +469,32 @@ static int ffm_seek(AVFormatContext *s, int stream_index, int64_t wanted_pts, in
         if (pts == wanted_pts) {
             goto found;
         } else if (pts > wanted_pts) {
-            pos_max = pos - FFM_PACKET_SIZE;
+            pos_max = pos - ffm->packet_size;
         } else {
-            pos_min = pos + FFM_PACKET_SIZE;
+            pos_min = pos + ffm->packet_size;
         }
     }
     pos = (flags & AVSEEK_FLAG_BACKWARD) ? pos_min : pos_max;
     if (pos > 0)
-        pos -= FFM_PACKET_SIZE;
+        pos -= ffm->packet_size;
+    /* a feed without any data packet yet leaves pos_max negative */
+    if (pos < 0)
+        pos = 0;
  found:
     ffm_seek1(s, pos);
+
+    /* the position is at a packet boundary, not at a frame */
+    ffm->read_state = READ_HEADER;
+    ffm->packet_ptr = ffm->packet;
+    ffm->packet_end = ffm->packet;
+    ffm->first_packet = 1;
+
     return 0;
 }
 
 static int ffm_read_close(AVFormatContext *s)
 {
+    FFMContext *ffm = s->priv_data;
     AVStream *st;
     int i;
 
@@ -466,6 +502,7 @@ static int ffm_read_close(AVFormatContext *s)
         st = s->streams[i];
         av_freep(&st->priv_data);
     }
+    av_freep(&ffm->packet);
     return 0;
 }
 
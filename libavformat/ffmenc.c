@@ -97,7 +97,15 @@ static int ffm_write_header(AVFormatContext *s)
     AVCodecContext *codec;
     int bit_rate, i;
 
-    ffm->packet_size = FFM_PACKET_SIZE;
+    /* ffserver gives the page size of its feed file */
+    ffm->packet_size = s->packet_size ? s->packet_size : FFM_PACKET_SIZE;
+    if (ffm->packet_size < FFM_PACKET_SIZE || ffm->packet_size > FFM_MAX_PACKET_SIZE) {
+        av_log(s, AV_LOG_ERROR, "invalid page size %d\n", ffm->packet_size);
+        return -1;
+    }
+    ffm->packet = av_malloc(ffm->packet_size);
+    if (!ffm->packet)
+        return AVERROR(ENOMEM);
 
     /* header */
     put_le32(pb, MKTAG('F', 'F', 'M', '1'));
@@ -203,6 +211,7 @@ static int ffm_write_header(AVFormatContext *s)
         st = s->streams[i];
         av_freep(&st->priv_data);
     }
+    av_freep(&ffm->packet);
     return -1;
 }
 
@@ -248,6 +257,7 @@ static int ffm_write_trailer(AVFormatContext *s)
         put_flush_packet(pb);
     }
 
+    av_freep(&ffm->packet);
     return 0;
 }
 
@@ -0,0 +1,417 @@
+/*
+ * frame hash testing muxers
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file framehashenc.c
+ * Writes one line per packet with its stream, dts, size and hash:
+ *
+ *   #hash 0 md5
+ *   0, 0, 152064, 2e3a...
+ *
+ * The hash function of each stream is set with the "hash" option, as a
+ * comma separated list in stream order whose last entry applies to the
+ * remaining streams. With the "hashthreads" option the packets are hashed
+ * by that many threads, and with "hashref" each line is compared to the
+ * same line of a reference file and muxing fails at the first difference.
+ */
+
+#include "libavutil/adler32.h"
+#include "libavutil/crc.h"
+#include "libavutil/md5.h"
+#include "libavutil/sha1.h"
+#include "libavutil/threadfifo.h"
+#include "avformat.h"
+#include "pktpool.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+enum HashType {
+    HASH_ADLER32,
+    HASH_CRC32,
+    HASH_MD5,
+    HASH_SHA1,
+};
+
+static const char *hash_names[] = { "adler32", "crc32", "md5", "sha1" };
+
+#define MAX_HASH_SIZE 20
+#define MAX_LINE_SIZE 128
+
+typedef struct HashJob {
+    AVPacket pkt;
+    enum HashType type;
+    const AVCRC *crc_table;
+    char line[MAX_LINE_SIZE];   ///< without the line feed
+    int done;
+} HashJob;
+
+typedef struct FrameHashContext {
+    enum HashType *types;       ///< hash function of each stream
+    ByteIOContext *ref;         ///< reference file or NULL
+    int line_number;            ///< of the reference file
+    int nb_threads;
+    HashJob *jobs;              ///< ring of the packets being hashed
+    int nb_jobs;
+    unsigned int head, tail;    ///< jobs written out and queued
+#ifdef HAVE_PTHREADS
+    AVMPMCFifo *queue;          ///< indices of the jobs to hash
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;        ///< signals a job done
+#endif
+} FrameHashContext;
+
+static void hash_packet(HashJob *job)
+{
+    AVPacket *pkt = &job->pkt;
+    uint8_t hash[MAX_HASH_SIZE];
+    int i, n, size = 0;
+    uint32_t v;
+    struct AVSHA1 *sha1;
+
+    switch (job->type) {
+    case HASH_ADLER32:
+    case HASH_CRC32:
+        if (job->type == HASH_ADLER32)
+            v = av_adler32_update(1, pkt->data, pkt->size);
+        else
+            v = av_crc(job->crc_table, UINT32_MAX, pkt->data, pkt->size) ^ UINT32_MAX;
+        for (i = 0; i < 4; i++)
+            hash[i] = v >> (24 - 8*i);
+        size = 4;
+        break;
+    case HASH_MD5:
+        av_md5_sum(hash, pkt->data, pkt->size);
+        size = 16;
+        break;
+    case HASH_SHA1:
+        if (!(sha1 = av_malloc(av_sha1_size)))
+            break;
+        av_sha1_init(sha1);
+        av_sha1_update(sha1, pkt->data, pkt->size);
+        av_sha1_final(sha1, hash);
+        av_free(sha1);
+        size = 20;
+        break;
+    }
+
+    n = snprintf(job->line, MAX_LINE_SIZE, "%d, %"PRId64", %d, ",
+                 pkt->stream_index, pkt->dts, pkt->size);
+    for (i = 0; i < size; i++)
+        n += snprintf(job->line + n, MAX_LINE_SIZE - n, "%02x", hash[i]);
+    av_free_packet(pkt);
+    pkt->destruct = NULL;
+}
+
+#ifdef HAVE_PTHREADS
+static void *hash_thread(void *arg)
+{
+    FrameHashContext *fh = arg;
+    int index;
+
+    while (av_mpmc_fifo_read(fh->queue, &index, AV_THREAD_FIFO_BLOCK) > 0) {
+        hash_packet(&fh->jobs[index]);
+        pthread_mutex_lock(&fh->mutex);
+        fh->jobs[index].done = 1;
+        pthread_cond_broadcast(&fh->cond);
+        pthread_mutex_unlock(&fh->mutex);
+    }
+    return NULL;
+}
+#endif
+
+/**
+ * Reads the next line of the reference file which is neither empty nor
+ * a comment.
+ * @return 0 if there is none
+ */
+static int read_ref_line(FrameHashContext *fh, char *buf)
+{
+    do {
+        if (!url_fgets(fh->ref, buf, MAX_LINE_SIZE))
+            return 0;
+        fh->line_number++;
+    } while (!buf[0] || buf[0] == '#');
+    return 1;
+}
+
+/**
+ * Writes the line of a hashed packet and compares it to the reference.
+ */
+static int write_line(AVFormatContext *s, const char *line)
+{
+    FrameHashContext *fh = s->priv_data;
+    char ref[MAX_LINE_SIZE];
+
+    put_buffer(s->pb, line, strlen(line));
+    put_byte(s->pb, '\n');
+    if (fh->ref) {
+        if (!read_ref_line(fh, ref)) {
+            av_log(s, AV_LOG_ERROR, "reference ends before %s\n", line);
+            return AVERROR_INVALIDDATA;
+        }
+        if (strcmp(ref, line)) {
+            av_log(s, AV_LOG_ERROR, "mismatch with line %d of the reference:\n%s\n%s\n",
+                   fh->line_number, ref, line);
+            return AVERROR_INVALIDDATA;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Writes out the hashed jobs in order, waiting for them until at most
+ * max_pending are left.
+ */
+static int flush_jobs(AVFormatContext *s, int max_pending)
+{
+    FrameHashContext *fh = s->priv_data;
+    int ret = 0;
+
+    while (fh->head != fh->tail) {
+        HashJob *job = &fh->jobs[fh->head % fh->nb_jobs];
+        int done;
+#ifdef HAVE_PTHREADS
+        if (fh->nb_threads) {
+            pthread_mutex_lock(&fh->mutex);
+            while (!job->done && fh->tail - fh->head > max_pending)
+                pthread_cond_wait(&fh->cond, &fh->mutex);
+            done = job->done;
+            pthread_mutex_unlock(&fh->mutex);
+        } else
+#endif
+            done = job->done;
+        if (!done)
+            break;
+        job->done = 0;
+        fh->head++;
+        if (!ret)
+            ret = write_line(s, job->line);
+    }
+    put_flush_packet(s->pb);
+    return ret;
+}
+
+static int parse_hashes(AVFormatContext *s, const char *list)
+{
+    FrameHashContext *fh = s->priv_data;
+    int i, j;
+
+    fh->types = av_malloc(s->nb_streams * sizeof(*fh->types));
+    if (!fh->types)
+        return AVERROR(ENOMEM);
+    for (i = 0; i < s->nb_streams; i++) {
+        for (j = 0; j < sizeof(hash_names) / sizeof(hash_names[0]); j++) {
+            int len = strlen(hash_names[j]);
+            if (!strncmp(list, hash_names[j], len) && (!list[len] || list[len] == ','))
+                break;
+        }
+        if (j == sizeof(hash_names) / sizeof(hash_names[0])) {
+            av_log(s, AV_LOG_ERROR, "unknown hash function '%s', "
+                   "expected adler32, crc32, md5 or sha1\n", list);
+            return AVERROR(EINVAL);
+        }
+        fh->types[i] = j;
+        if (strchr(list, ','))
+            list = strchr(list, ',') + 1;
+    }
+    return 0;
+}
+
+static int framehash_close(AVFormatContext *s);
+
+static int write_header(AVFormatContext *s, const char *list)
+{
+    FrameHashContext *fh = s->priv_data;
+    char buf[64];
+    int i, ret;
+
+    if ((ret = parse_hashes(s, list)) < 0)
+        return ret;
+    for (i = 0; i < s->nb_streams; i++) {
+        snprintf(buf, sizeof(buf), "#hash %d %s\n", i, hash_names[fh->types[i]]);
+        put_buffer(s->pb, buf, strlen(buf));
+    }
+    put_flush_packet(s->pb);
+
+    if (s->hash_ref && *s->hash_ref &&
+        (ret = url_fopen(&fh->ref, s->hash_ref, URL_RDONLY)) < 0) {
+        av_log(s, AV_LOG_ERROR, "cannot open reference %s\n", s->hash_ref);
+        return ret;
+    }
+
+    fh->nb_jobs = 1;
+#ifdef HAVE_PTHREADS
+    if (s->hash_threads > 0) {
+        fh->nb_jobs = 4 * s->hash_threads;
+        fh->queue   = av_mpmc_fifo_alloc(fh->nb_jobs, sizeof(int));
+        fh->threads = av_mallocz(s->hash_threads * sizeof(*fh->threads));
+        if (!fh->queue || !fh->threads)
+            return AVERROR(ENOMEM);
+        pthread_mutex_init(&fh->mutex, NULL);
+        pthread_cond_init(&fh->cond, NULL);
+        for (i = 0; i < s->hash_threads; i++) {
+            if (pthread_create(&fh->threads[i], NULL, hash_thread, fh))
+                break;
+            fh->nb_threads++;
+        }
+        if (!fh->nb_threads) {
+            pthread_mutex_destroy(&fh->mutex);
+            pthread_cond_destroy(&fh->cond);
+            fh->nb_jobs = 1;
+        }
+    }
+#endif
+    fh->jobs = av_mallocz(fh->nb_jobs * sizeof(*fh->jobs));
+    if (!fh->jobs)
+        return AVERROR(ENOMEM);
+    return 0;
+}
+
+static int framehash_write_header(AVFormatContext *s)
+{
+    int ret = write_header(s, s->hash && *s->hash ? s->hash : "crc32");
+    if (ret < 0)
+        framehash_close(s);
+    return ret;
+}
+
+static int framemd5_write_header(AVFormatContext *s)
+{
+    int ret = write_header(s, "md5");
+    if (ret < 0)
+        framehash_close(s);
+    return ret;
+}
+
+static int framehash_write_packet(AVFormatContext *s, AVPacket *pkt)
+{
+    FrameHashContext *fh = s->priv_data;
+    HashJob *job;
+    int ret, index;
+
+    if ((ret = flush_jobs(s, fh->nb_jobs - 1)) < 0)
+        return ret;
+
+    index = fh->tail % fh->nb_jobs;
+    job = &fh->jobs[index];
+    job->type = fh->types[pkt->stream_index];
+    job->crc_table = av_crc_get_table(AV_CRC_32_IEEE_LE);
+    job->pkt  = *pkt;
+    if (fh->nb_threads) {
+        /* the packet is released after this call, keep its payload */
+        if (pkt->priv && (pkt->destruct == av_destruct_packet ||
+                          pkt->destruct == av_destruct_packet_nofree)) {
+            ff_packet_ref_payload(&job->pkt);
+            job->pkt.destruct = av_destruct_packet;
+        } else {
+            job->pkt.destruct = NULL;
+            if ((ret = av_dup_packet(&job->pkt)) < 0)
+                return ret;
+        }
+    } else
+        job->pkt.destruct = NULL;
+    fh->tail++;
+
+#ifdef HAVE_PTHREADS
+    if (fh->nb_threads) {
+        av_mpmc_fifo_write(fh->queue, &index, AV_THREAD_FIFO_BLOCK);
+        return flush_jobs(s, INT_MAX);
+    }
+#endif
+    hash_packet(job);
+    job->done = 1;
+    return flush_jobs(s, 0);
+}
+
+static int framehash_close(AVFormatContext *s)
+{
+    FrameHashContext *fh = s->priv_data;
+    int i;
+
+#ifdef HAVE_PTHREADS
+    /* the threads hash what remains queued before they exit */
+    if (fh->nb_threads) {
+        av_mpmc_fifo_close(fh->queue);
+        for (i = 0; i < fh->nb_threads; i++)
+            pthread_join(fh->threads[i], NULL);
+        pthread_mutex_destroy(&fh->mutex);
+        pthread_cond_destroy(&fh->cond);
+        fh->nb_threads = 0;
+    }
+    av_freep(&fh->threads);
+    av_mpmc_fifo_free(&fh->queue);
+#endif
+    for (i = 0; i < fh->nb_jobs && fh->jobs; i++)
+        av_free_packet(&fh->jobs[i].pkt);
+    av_freep(&fh->jobs);
+    av_freep(&fh->types);
+    if (fh->ref)
+        url_fclose(fh->ref);
+    fh->ref = NULL;
+    return 0;
+}
+
+static int framehash_write_trailer(AVFormatContext *s)
+{
+    FrameHashContext *fh = s->priv_data;
+    char ref[MAX_LINE_SIZE];
+    int ret;
+
+    ret = flush_jobs(s, 0);
+    if (!ret && fh->ref && read_ref_line(fh, ref)) {
+        av_log(s, AV_LOG_ERROR, "output ends before line %d of the reference:\n%s\n",
+               fh->line_number, ref);
+        ret = AVERROR_INVALIDDATA;
+    }
+    framehash_close(s);
+    return ret;
+}
+
+#ifdef CONFIG_FRAMEHASH_MUXER
+AVOutputFormat framehash_muxer = {
+    "framehash",
+    NULL_IF_CONFIG_SMALL("frame hash testing format"),
+    NULL,
+    "",
+    sizeof(FrameHashContext),
+    CODEC_ID_PCM_S16LE,
+    CODEC_ID_RAWVIDEO,
+    framehash_write_header,
+    framehash_write_packet,
+    framehash_write_trailer,
+};
+#endif
+
+#ifdef CONFIG_FRAMEMD5_MUXER
+AVOutputFormat framemd5_muxer = {
+    "framemd5",
+    NULL_IF_CONFIG_SMALL("frame MD5 testing format"),
+    NULL,
+    "",
+    sizeof(FrameHashContext),
+    CODEC_ID_PCM_S16LE,
+    CODEC_ID_RAWVIDEO,
+    framemd5_write_header,
+    framehash_write_packet,
+    framehash_write_trailer,
+};
+#endif
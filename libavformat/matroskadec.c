@@ -32,6 +32,7 @@
 /* For codec_get_id(). */
 #include "riff.h"
 #include "matroska.h"
+#include "pktpool.h"
 #include "libavcodec/mpeg4audio.h"
 #include "libavutil/intfloat_readwrite.h"
 #include "libavutil/lzo.h"
@@ -183,7 +184,7 @@ typedef struct MatroskaDemuxContext {
      * for ( = that are available to the calling program). */
     int num_tracks;
     int num_streams;
-    MatroskaTrack *tracks[MAX_STREAMS];
+    MatroskaTrack **tracks;
 
     /* cache for ID peeking */
     uint32_t peek_id;
@@ -211,6 +212,10 @@ typedef struct MatroskaDemuxContext {
 
 #define ARRAY_SIZE(x)  (sizeof(x)/sizeof(*x))
 
+/* set on queued packets whose payload is still LZO compressed, they are
+ * only decompressed when delivered */
+#define MATROSKA_PKT_FLAG_LZO 0x40000000
+
 /*
  * The first few functions handle EBML file parsing. The rest
  * is the document interpretation. Matroska really just is a
@@ -841,6 +846,41 @@ matroska_find_track_by_num (MatroskaDemuxContext *matroska,
 }
 
 
+/*
+ * Decompress the LZO compressed payload of a packet into a pooled buffer.
+ * Returns 0 on success or -1 on failure.
+ */
+
+static int
+matroska_decompress_lzo (AVPacket *pkt)
+{
+    AVPacket out;
+    int result, size = pkt->size, room, ilen, olen;
+
+    do {
+        size *= 3;
+        if (av_new_packet(&out, size + LZO_OUTPUT_PADDING) < 0)
+            return -1;
+        /* use all of the pooled buffer, it is usually much larger */
+        room = FFMAX(ff_packet_payload_room(&out) - LZO_OUTPUT_PADDING, size);
+        ilen = pkt->size;
+        olen = room;
+        result = lzo1x_decode(out.data, &olen, pkt->data, &ilen);
+        if (result)
+            av_free_packet(&out);
+    } while (result == LZO_OUTPUT_FULL && size < 10000000);
+    if (result)
+        return -1;
+
+    av_free_packet(pkt);
+    pkt->data     = out.data;
+    pkt->size     = room - olen;
+    pkt->priv     = out.priv;
+    pkt->destruct = out.destruct;
+    memset(pkt->data + pkt->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    return 0;
+}
+
 /*
  * Put one packet in an application-supplied AVPacket struct.
  * Returns 0 on success or -1 on failure.
@@ -850,7 +890,7 @@ static int
 matroska_deliver_packet (MatroskaDemuxContext *matroska,
                          AVPacket             *pkt)
 {
-    if (matroska->num_packets > 0) {
+    while (matroska->num_packets > 0) {
         memcpy(pkt, matroska->packets[0], sizeof(AVPacket));
         av_free(matroska->packets[0]);
         if (matroska->num_packets > 1) {
@@ -863,6 +903,13 @@ matroska_deliver_packet (MatroskaDemuxContext *matroska,
             av_freep(&matroska->packets);
         }
         matroska->num_packets--;
+        if (pkt->flags & MATROSKA_PKT_FLAG_LZO) {
+            pkt->flags &= ~MATROSKA_PKT_FLAG_LZO;
+            if (matroska_decompress_lzo(pkt) < 0) {
+                av_free_packet(pkt);
+                continue;
+            }
+        }
         return 0;
     }
 
@@ -1626,8 +1673,8 @@ matroska_add_stream (MatroskaDemuxContext *matroska)
         }
     }
 
-    if (track->type && matroska->num_tracks < ARRAY_SIZE(matroska->tracks)) {
-        matroska->tracks[matroska->num_tracks++] = track;
+    if (track->type) {
+        dynarray_add(&matroska->tracks, &matroska->num_tracks, track);
     } else {
         av_free(track);
     }
@@ -2910,14 +2957,16 @@ matroska_parse_block(MatroskaDemuxContext *matroska, uint8_t *data, int size,
                 s = do_decompress(data,&d,lace_size[n]);
                 if(s > 0) {
                     pkt = av_mallocz(sizeof(AVPacket));
-                    if (av_new_packet(pkt, 0) < 0) {
+                    if (!pkt) {
+                        av_free(d);
                         res = AVERROR(ENOMEM);
                         n = laces-1;
                     break;
                     }
-    
+                    av_init_packet(pkt);
                     pkt->data = d;
                     pkt->size = s;
+                    pkt->destruct = av_destruct_packet;
 
                     if (n == 0)
                         pkt->flags = is_keyframe;
@@ -2937,7 +2986,7 @@ matroska_parse_block(MatroskaDemuxContext *matroska, uint8_t *data, int size,
 #endif
 
             } else {
-                int result, offset = 0, ilen, olen, pkt_size = lace_size[n];
+                int result, offset = 0, lzo = 0, pkt_size = lace_size[n];
                 uint8_t *pkt_data = data;
 
                 if (matroska->tracks[track]->encoding_scope & 1) {
@@ -2946,19 +2995,8 @@ matroska_parse_block(MatroskaDemuxContext *matroska, uint8_t *data, int size,
                         offset = matroska->tracks[track]->encoding_settings_len;
                         break;
                     case MATROSKA_TRACK_ENCODING_COMP_LZO:
-                        pkt_data = NULL;
-                        do {
-                            ilen = lace_size[n];
-                            olen = pkt_size *= 3;
-                            pkt_data = av_realloc(pkt_data,
-                                                  pkt_size+LZO_OUTPUT_PADDING);
-                            result = lzo1x_decode(pkt_data, &olen, data, &ilen);
-                        } while (result==LZO_OUTPUT_FULL && pkt_size<10000000);
-                        if (result) {
-                            av_free(pkt_data);
-                            continue;
-                        }
-                        pkt_size -= olen;
+                        /* queued as is, see matroska_deliver_packet() */
+                        lzo = MATROSKA_PKT_FLAG_LZO;
                         break;
 #ifdef CONFIG_ZLIB
                     case MATROSKA_TRACK_ENCODING_COMP_ZLIB: {
@@ -3014,6 +3052,8 @@ matroska_parse_block(MatroskaDemuxContext *matroska, uint8_t *data, int size,
                 pkt = av_mallocz(sizeof(AVPacket));
                 /* XXX: prevent data copy... */
                 if (av_new_packet(pkt, pkt_size+offset) < 0) {
+                    if (pkt_data != data)
+                        av_free(pkt_data);
                     av_free(pkt);
                     res = AVERROR(ENOMEM);
                     n = laces-1;
@@ -3022,9 +3062,12 @@ matroska_parse_block(MatroskaDemuxContext *matroska, uint8_t *data, int size,
                 if (offset)
                     memcpy (pkt->data, matroska->tracks[track]->encoding_settings, offset);
                 memcpy (pkt->data+offset, pkt_data, pkt_size);
+                if (pkt_data != data)
+                    av_free(pkt_data);
 
+                pkt->flags = lzo;
                 if (n == 0)
-                    pkt->flags = is_keyframe;
+                    pkt->flags |= is_keyframe;
                 pkt->stream_index = stream_index;
 
                 if (matroska->tracks[track]->flags & MATROSKA_TRACK_MSCOMP)
@@ -3094,7 +3137,7 @@ matroska_parse_blockgroup (MatroskaDemuxContext *matroska,
                  * the lace is a key frame. */
                 is_keyframe = 0;
                 if (last_num_packets != matroska->num_packets)
-                    matroska->packets[last_num_packets]->flags = 0;
+                    matroska->packets[last_num_packets]->flags &= ~PKT_FLAG_KEY;
                 if ((res = ebml_read_sint(matroska, &id, &num)) < 0)
                     break;
                 if (num > 0)
@@ -3294,6 +3337,7 @@ matroska_read_close (AVFormatContext *s)
 
         av_free(track);
     }
+    av_freep(&matroska->tracks);
 
     return 0;
 }
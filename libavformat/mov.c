@@ -1797,9 +1797,11 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
     av_get_packet(sc->pb, pkt, sample->size);
 #ifdef CONFIG_DV_DEMUXER
     if (mov->dv_demux && sc->dv_audio_container) {
+        void *priv = pkt->priv;
         dv_produce_packet(mov->dv_demux, pkt, pkt->data, pkt->size);
-        av_free(pkt->data);
-        pkt->size = 0;
+        pkt->priv = priv;
+        pkt->destruct = av_destruct_packet;
+        av_free_packet(pkt);
         if (dv_get_packet(mov->dv_demux, pkt) < 0)
             return -1;
     }
@@ -1905,6 +1907,7 @@ static int mov_read_close(AVFormatContext *s)
             av_freep(&mov->dv_fctx->streams[i]->codec);
             av_freep(&mov->dv_fctx->streams[i]);
         }
+        av_freep(&mov->dv_fctx->streams);
         av_freep(&mov->dv_fctx);
         av_freep(&mov->dv_demux);
     }
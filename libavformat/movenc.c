@@ -77,7 +77,7 @@ typedef struct MOVContext {
     offset_t mdat_pos;
     uint64_t mdat_size;
     long    timescale;
-    MOVTrack tracks[MAX_STREAMS];
+    MOVTrack *tracks;
 } MOVContext;
 
 //FIXME support 64 bit variant with wide placeholders
@@ -1496,6 +1496,10 @@ static int mov_write_header(AVFormatContext *s)
         }
     }
 
+    mov->tracks = av_mallocz(s->nb_streams * sizeof(*mov->tracks));
+    if (!mov->tracks)
+        return AVERROR(ENOMEM);
+
     for(i=0; i<s->nb_streams; i++){
         AVStream *st= s->streams[i];
         MOVTrack *track= &mov->tracks[i];
@@ -1657,6 +1661,7 @@ static int mov_write_trailer(AVFormatContext *s)
         if(mov->tracks[i].vosLen) av_free(mov->tracks[i].vosData);
 
     }
+    av_freep(&mov->tracks);
 
     put_flush_packet(pb);
 
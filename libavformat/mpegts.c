@@ -120,6 +120,14 @@ struct MpegTSContext {
 
     /** filters for various streams specified by PMT + for the PAT and PMT */
     MpegTSFilter *pids[NB_PID_MAX];
+
+    /** discard_pid() result for each pid, plus one, 0 if not known yet */
+    uint8_t discard_map[NB_PID_MAX];
+    /** false if discard_map has to be cleared before it is used */
+    int discard_map_valid;
+    /** AVProgram.discard of each program when discard_map was filled */
+    enum AVDiscard *prg_discard;
+    int nb_prg_discard;
 };
 
 /* TS stream handling */
@@ -160,12 +168,14 @@ static void clear_program(MpegTSContext *ts, unsigned int programid)
     for(i=0; i<ts->nb_prg; i++)
         if(ts->prg[i].id == programid)
             ts->prg[i].nb_pids = 0;
+    ts->discard_map_valid = 0;
 }
 
 static void clear_programs(MpegTSContext *ts)
 {
     av_freep(&ts->prg);
     ts->nb_prg=0;
+    ts->discard_map_valid = 0;
 }
 
 static void add_pat_entry(MpegTSContext *ts, unsigned int programid)
@@ -179,6 +189,7 @@ static void add_pat_entry(MpegTSContext *ts, unsigned int programid)
     p->id = programid;
     p->nb_pids = 0;
     ts->nb_prg++;
+    ts->discard_map_valid = 0;
 }
 
 static void add_pid_to_pmt(MpegTSContext *ts, unsigned int programid, unsigned int pid)
@@ -197,6 +208,7 @@ static void add_pid_to_pmt(MpegTSContext *ts, unsigned int programid, unsigned i
     if(p->nb_pids >= MAX_PIDS_PER_PROGRAM)
         return;
     p->pids[p->nb_pids++] = pid;
+    ts->discard_map_valid = 0;
 }
 
 /**
@@ -232,6 +244,52 @@ static int discard_pid(MpegTSContext *ts, unsigned int pid)
     return !used && discarded;
 }
 
+/**
+ * discard_pid() with the result cached per pid, the cache is dropped when
+ * the program tables or the program discard settings change.
+ */
+static inline int discard_pid_cached(MpegTSContext *ts, unsigned int pid)
+{
+    if (!ts->discard_map_valid) {
+        memset(ts->discard_map, 0, sizeof(ts->discard_map));
+        ts->discard_map_valid = 1;
+    }
+    if (!ts->discard_map[pid])
+        ts->discard_map[pid] = 1 + discard_pid(ts, pid);
+    return ts->discard_map[pid] - 1;
+}
+
+/**
+ * Invalidate the discard_pid() cache if the user changed the discard
+ * setting of a program since it was filled.
+ */
+static void check_program_discard(MpegTSContext *ts)
+{
+    AVFormatContext *s = ts->stream;
+    int i;
+
+    if (s->nb_programs > ts->nb_prg_discard) {
+        enum AVDiscard *tmp = av_realloc(ts->prg_discard,
+                                         s->nb_programs * sizeof(*tmp));
+        if (!tmp) {
+            ts->discard_map_valid = 0;
+            return;
+        }
+        ts->prg_discard = tmp;
+        for (i = ts->nb_prg_discard; i < s->nb_programs; i++)
+            ts->prg_discard[i] = s->programs[i]->discard;
+        ts->discard_map_valid = 0;
+    }
+    ts->nb_prg_discard = s->nb_programs;
+
+    for (i = 0; i < s->nb_programs; i++) {
+        if (ts->prg_discard[i] != s->programs[i]->discard) {
+            ts->prg_discard[i] = s->programs[i]->discard;
+            ts->discard_map_valid = 0;
+        }
+    }
+}
+
 /**
  *  Assembles PES packets out of TS packets, and then calls the "section_cb"
  *  function when they are complete.
@@ -345,23 +403,22 @@ static void mpegts_close_filter(MpegTSContext *ts, MpegTSFilter *filter)
 
 static int analyze(const uint8_t *buf, int size, int packet_size, int *index){
     int stat[packet_size];
-    int i;
-    int x=0;
+    const uint8_t *p = buf, *end = buf + size;
+    int x;
     int best_score=0;
 
     memset(stat, 0, packet_size*sizeof(int));
 
-    for(x=i=0; i<size; i++){
-        if(buf[i] == 0x47){
-            stat[x]++;
-            if(stat[x] > best_score){
-                best_score= stat[x];
-                if(index) *index= x;
-            }
+    /* memchr() skips the bytes between sync bytes much faster than a
+       byte loop, most libcs vectorize it */
+    while ((p = memchr(p, 0x47, end - p))) {
+        x = (p - buf) % packet_size;
+        stat[x]++;
+        if(stat[x] > best_score){
+            best_score= stat[x];
+            if(index) *index= x;
         }
-
-        x++;
-        if(x == packet_size) x= 0;
+        p++;
     }
 
     return best_score;
@@ -961,7 +1018,7 @@ static void mpegts_push_data(MpegTSFilter *filter,
 static AVStream* new_pes_av_stream(PESContext *pes, uint32_t code)
 {
     AVStream *st;
-    int codec_type, codec_id;
+    int codec_type, codec_id, i;
 
     switch(pes->stream_type){
     case STREAM_TYPE_AUDIO_MPEG1:
@@ -1020,6 +1077,15 @@ static AVStream* new_pes_av_stream(PESContext *pes, uint32_t code)
         }
         break;
     }
+    /* the stream may have been created already from a probe cache */
+    for (i = 0; i < pes->stream->nb_streams; i++) {
+        st = pes->stream->streams[i];
+        if (st->id == pes->pid && !st->priv_data) {
+            st->priv_data = pes;
+            pes->st = st;
+            return st;
+        }
+    }
     st = av_new_stream(pes->stream, pes->pid);
     if (st) {
         av_set_pts_info(st, 33, 1, 90000);
@@ -1064,7 +1130,7 @@ static void handle_packet(MpegTSContext *ts, const uint8_t *packet)
     const uint8_t *p, *p_end;
 
     pid = AV_RB16(packet + 1) & 0x1fff;
-    if(pid && discard_pid(ts, pid))
+    if(pid && discard_pid_cached(ts, pid))
         return;
     is_start = packet[1] & 0x40;
     tss = ts->pids[pid];
@@ -1075,6 +1141,17 @@ static void handle_packet(MpegTSContext *ts, const uint8_t *packet)
     if (!tss)
         return;
 
+    if (tss->type == MPEGTS_PES) {
+        PESContext *pes = tss->u.pes_filter.opaque;
+        /* the packet would be dropped anyway, do not even look at the
+           payload, and resume at the next PES start once wanted again */
+        if (pes->st && pes->st->discard >= AVDISCARD_ALL) {
+            pes->state = MPEGTS_SKIP;
+            tss->last_cc = -1;
+            return;
+        }
+    }
+
     /* continuity check (currently not used) */
     cc = (packet[3] & 0xf);
     cc_ok = (tss->last_cc < 0) || ((((tss->last_cc + 1) & 0x0f) == cc));
@@ -1133,16 +1210,31 @@ static void handle_packet(MpegTSContext *ts, const uint8_t *packet)
    get_packet_size() ?) */
 static int mpegts_resync(ByteIOContext *pb)
 {
-    int c, i;
-
-    for(i = 0;i < MAX_RESYNC_SIZE; i++) {
-        c = url_fgetc(pb);
-        if (c < 0)
-            return -1;
-        if (c == 0x47) {
-            url_fseek(pb, -1, SEEK_CUR);
+    uint8_t *p;
+    int c, i, len;
+
+    for(i = 0; i < MAX_RESYNC_SIZE; ) {
+        len = FFMIN(pb->buf_end - pb->buf_ptr, MAX_RESYNC_SIZE - i);
+        if (len <= 0) {
+            /* nothing buffered, refill */
+            c = url_fgetc(pb);
+            if (c < 0)
+                return -1;
+            if (c == 0x47) {
+                url_fseek(pb, -1, SEEK_CUR);
+                return 0;
+            }
+            i++;
+            continue;
+        }
+        /* search the buffered data at once */
+        p = memchr(pb->buf_ptr, 0x47, len);
+        if (p) {
+            pb->buf_ptr = p;
             return 0;
         }
+        pb->buf_ptr += len;
+        i += len;
     }
     /* no sync found */
     return -1;
@@ -1175,13 +1267,35 @@ static int read_packet(ByteIOContext *pb, uint8_t *buf, int raw_packet_size)
     return 0;
 }
 
+/**
+ * Get the next packet. If it is entirely in the I/O buffer it is used in
+ * place, so that a buffer fill is demuxed without any copy, otherwise it
+ * is read into buf.
+ * @return -1 if error or EOF, 0 if OK
+ */
+static int get_packet(ByteIOContext *pb, uint8_t *buf, int raw_packet_size,
+                      const uint8_t **packet)
+{
+    if (pb->buf_end - pb->buf_ptr >= raw_packet_size &&
+        pb->buf_ptr[0] == 0x47 && !pb->update_checksum) {
+        *packet = pb->buf_ptr;
+        pb->buf_ptr += raw_packet_size;
+        return 0;
+    }
+    *packet = buf;
+    return read_packet(pb, buf, raw_packet_size);
+}
+
 static int handle_packets(MpegTSContext *ts, int nb_packets)
 {
     AVFormatContext *s = ts->stream;
     ByteIOContext *pb = s->pb;
-    uint8_t packet[TS_PACKET_SIZE];
+    uint8_t buf[TS_PACKET_SIZE];
+    const uint8_t *packet;
     int packet_num, ret;
 
+    check_program_discard(ts);
+
     ts->stop_parse = 0;
     packet_num = 0;
     for(;;) {
@@ -1190,7 +1304,7 @@ static int handle_packets(MpegTSContext *ts, int nb_packets)
         packet_num++;
         if (nb_packets != 0 && packet_num >= nb_packets)
             break;
-        ret = read_packet(pb, packet, ts->raw_packet_size);
+        ret = get_packet(pb, buf, ts->raw_packet_size, &packet);
         if (ret != 0)
             return ret;
         handle_packet(ts, packet);
@@ -1457,6 +1571,7 @@ static int mpegts_read_close(AVFormatContext *s)
     int i;
 
     clear_programs(ts);
+    av_freep(&ts->prg_discard);
 
     for(i=0;i<NB_PID_MAX;i++)
         if (ts->pids[i]) mpegts_close_filter(ts, ts->pids[i]);
@@ -1535,14 +1650,18 @@ int mpegts_parse_packet(MpegTSContext *ts, AVPacket *pkt,
     len1 = len;
     ts->pkt = pkt;
     ts->stop_parse = 0;
+    check_program_discard(ts);
     for(;;) {
         if (ts->stop_parse>0)
             break;
         if (len < TS_PACKET_SIZE)
             return -1;
         if (buf[0] != 0x47) {
-            buf++;
-            len--;
+            const uint8_t *p = memchr(buf, 0x47, len);
+            if (!p)
+                p = buf + len;
+            len -= p - buf;
+            buf = p;
         } else {
             handle_packet(ts, buf);
             buf += TS_PACKET_SIZE;
@@ -1558,6 +1677,8 @@ void mpegts_parse_close(MpegTSContext *ts)
 
     for(i=0;i<NB_PID_MAX;i++)
         av_free(ts->pids[i]);
+    av_free(ts->prg);
+    av_free(ts->prg_discard);
     av_free(ts);
 }
 
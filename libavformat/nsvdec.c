@@ -20,6 +20,7 @@
  */
 #include "avformat.h"
 #include "riff.h"
+#include "pktpool.h"
 
 //#define DEBUG
 //#define DEBUG_DUMP_INDEX // XXX dumbdriving-271.nsv breaks with it commented!!
@@ -677,8 +678,7 @@ static int nsv_read_packet(AVFormatContext *s, AVPacket *pkt)
         if (nsv->ahead[i].data) {
                 PRINT(("%s: using cached packet[%d]\n", __FUNCTION__, i));
             /* avoid the cost of new_packet + memcpy(->data) */
-            memcpy(pkt, &nsv->ahead[i], sizeof(AVPacket));
-            nsv->ahead[i].data = NULL; /* we ate that one */
+            ff_packet_move(pkt, &nsv->ahead[i]); /* we ate that one */
             return pkt->size;
         }
     }
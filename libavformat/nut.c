@@ -56,17 +56,28 @@ int ff_nut_sp_pts_cmp(syncpoint_t *a, syncpoint_t *b){
 }
 
 void ff_nut_add_sp(NUTContext *nut, int64_t pos, int64_t back_ptr, int64_t ts){
-    syncpoint_t *sp= av_mallocz(sizeof(syncpoint_t));
-    struct AVTreeNode *node= av_mallocz(av_tree_node_size);
+    syncpoint_t *sp, dummy= {.pos= pos};
+    struct AVTreeNode *node;
+
+    if(av_tree_find(nut->syncpoints, &dummy, (void *) ff_nut_sp_pos_cmp, NULL))
+        return;
+    if(!nut->sp_arena && !(nut->sp_arena= av_arena_alloc(65536)))
+        return;
+    sp  = av_arena_malloc(nut->sp_arena, sizeof(syncpoint_t));
+    node= av_arena_malloc(nut->sp_arena, av_tree_node_size);
+    if(!sp || !node)
+        return;
+    memset(node, 0, av_tree_node_size);
 
     sp->pos= pos;
     sp->back_ptr= back_ptr;
     sp->ts= ts;
     av_tree_insert(&nut->syncpoints, sp, ff_nut_sp_pos_cmp, &node);
-    if(node){
-        av_free(sp);
-        av_free(node);
-    }
+}
+
+void ff_nut_free_sp(NUTContext *nut){
+    nut->syncpoints= NULL;
+    av_arena_free(&nut->sp_arena);
 }
 
 const Dispositions ff_nut_dispositions[] = {
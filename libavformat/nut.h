@@ -95,6 +95,7 @@ typedef struct {
     int header_count;
     AVRational *time_base;
     struct AVTreeNode *syncpoints;
+    AVArena *sp_arena;           ///< holds the syncpoints and their tree nodes
 } NUTContext;
 
 extern const AVCodecTag ff_nut_subtitle_tags[];
@@ -109,6 +110,7 @@ int64_t ff_lsb2full(StreamContext *stream, int64_t lsb);
 int ff_nut_sp_pos_cmp(syncpoint_t *a, syncpoint_t *b);
 int ff_nut_sp_pts_cmp(syncpoint_t *a, syncpoint_t *b);
 void ff_nut_add_sp(NUTContext *nut, int64_t pos, int64_t back_ptr, int64_t ts);
+void ff_nut_free_sp(NUTContext *nut);
 
 extern const Dispositions ff_nut_dispositions[];
 
@@ -191,7 +191,7 @@ static int decode_main_header(NUTContext *nut){
     end += url_ftell(bc);
 
     GET_V(tmp              , tmp >=2 && tmp <= 3)
-    GET_V(stream_count     , tmp > 0 && tmp <=MAX_STREAMS)
+    GET_V(stream_count     , tmp > 0 && tmp < INT_MAX / sizeof(StreamContext))
 
     nut->max_distance = ff_get_v(bc);
     if(nut->max_distance > 65536){
@@ -282,8 +282,11 @@ static int decode_main_header(NUTContext *nut){
     }
 
     nut->stream = av_mallocz(sizeof(StreamContext)*stream_count);
+    if (!nut->stream)
+        return AVERROR(ENOMEM);
     for(i=0; i<stream_count; i++){
-        av_new_stream(s, i);
+        if (!av_new_stream(s, i))
+            return AVERROR(ENOMEM);
     }
 
     return 0;
@@ -901,6 +904,7 @@ static int nut_read_close(AVFormatContext *s)
 
     av_freep(&nut->time_base);
     av_freep(&nut->stream);
+    ff_nut_free_sp(nut);
 
     return 0;
 }
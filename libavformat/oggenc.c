@@ -206,8 +206,8 @@ int ogg_interleave_per_granule(AVFormatContext *s, AVPacket *out, AVPacket *pkt,
 {
     AVPacketList *pktl, **next_point, *this_pktl;
     int stream_count = 0;
-    int streams[MAX_STREAMS] = {0};
     int interleaved = 0;
+    int i;
 
     if (pkt) {
         AVStream *st = s->streams[pkt->stream_index];
@@ -232,17 +232,15 @@ int ogg_interleave_per_granule(AVFormatContext *s, AVPacket *out, AVPacket *pkt,
         }
         this_pktl->next= *next_point;
         *next_point= this_pktl;
+        st->nb_interleaved_packets++;
     }
 
-    pktl = s->packet_buffer;
-    while (pktl) {
-        if (streams[pktl->pkt.stream_index] == 0)
+    for (i = 0; i < s->nb_streams; i++) {
+        if (s->streams[i]->nb_interleaved_packets)
             stream_count++;
-        streams[pktl->pkt.stream_index]++;
         // need to buffer at least one packet to set eos flag
-        if (streams[pktl->pkt.stream_index] == 2)
+        if (s->streams[i]->nb_interleaved_packets >= 2)
             interleaved++;
-        pktl = pktl->next;
     }
 
     if ((s->nb_streams == stream_count && interleaved == stream_count) ||
@@ -250,10 +248,11 @@ int ogg_interleave_per_granule(AVFormatContext *s, AVPacket *out, AVPacket *pkt,
         pktl= s->packet_buffer;
         *out= pktl->pkt;
         s->packet_buffer = pktl->next;
-        if (flush && streams[out->stream_index] == 1) {
+        if (flush && s->streams[out->stream_index]->nb_interleaved_packets == 1) {
             OGGStreamContext *ogg = s->streams[out->stream_index]->priv_data;
             ogg->eos = 1;
         }
+        s->streams[out->stream_index]->nb_interleaved_packets--;
         av_freep(&pktl);
         return 1;
     } else {
@@ -0,0 +1,208 @@
+/*
+ * Reference counted packet payloads
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file pktpool.c
+ * Packet payloads allocated by av_new_packet() are preceded by a
+ * PacketBuffer header which pkt->priv points to. The header holds a
+ * reference count, so packets whose data lies within such a buffer can be
+ * duplicated by taking a reference instead of copying the payload. Freed
+ * buffers are kept in per size class free lists and reused.
+ *
+ * Both need atomic operations, without them payloads are plain av_malloc()
+ * blocks and pkt->priv stays NULL.
+ */
+
+#include "avformat.h"
+#include "pktpool.h"
+#include "libavutil/atomic.h"
+
+#ifdef HAVE_ATOMICS
+
+#define POOL_MIN_SHIFT  8       ///< size of the smallest class is 256 bytes
+#define POOL_CLASSES   12       ///< size of the largest class is 512 kB
+#define POOL_CLASS_MEM (256<<10) ///< memory kept in the free list of a class
+#define POOL_MIN_FREE   4       ///< buffers kept at least in the free list of a class
+
+typedef struct PacketBuffer {
+    volatile int refcount;
+    int size_class;             ///< -1 if the buffer is too large to be pooled
+    int size;                   ///< allocated payload size, including padding
+    struct PacketBuffer *next;  ///< next buffer in the free list
+} PacketBuffer;
+
+/* keep the payload as aligned as av_malloc() would */
+#define HEADER_SIZE ((sizeof(PacketBuffer) + 15) & ~15)
+
+static PacketBuffer *free_list[POOL_CLASSES];
+static int nb_free[POOL_CLASSES];
+static volatile int pool_lock;
+
+static void lock_pool(void)
+{
+    while (ff_atomic_int_cas(&pool_lock, 0, 1))
+        ff_atomic_yield();
+}
+
+static void unlock_pool(void)
+{
+    ff_atomic_barrier();
+    pool_lock = 0;
+}
+
+static inline uint8_t *buffer_data(PacketBuffer *buf)
+{
+    return (uint8_t *)buf + HEADER_SIZE;
+}
+
+static int size_class(int size)
+{
+    int c = 0;
+
+    while ((1 << (POOL_MIN_SHIFT + c)) < size) {
+        if (++c == POOL_CLASSES)
+            return -1;
+    }
+    return c;
+}
+
+int ff_packet_alloc_payload(AVPacket *pkt, int size)
+{
+    PacketBuffer *buf = NULL;
+    int c;
+
+    if ((unsigned)size > INT_MAX - HEADER_SIZE)
+        return AVERROR(ENOMEM);
+
+    c = size_class(size);
+    if (c >= 0) {
+        lock_pool();
+        buf = free_list[c];
+        if (buf) {
+            free_list[c] = buf->next;
+            nb_free[c]--;
+        }
+        unlock_pool();
+        if (!buf) {
+            buf = av_malloc(HEADER_SIZE + (1 << (POOL_MIN_SHIFT + c)));
+            if (!buf)
+                return AVERROR(ENOMEM);
+            buf->size = 1 << (POOL_MIN_SHIFT + c);
+        }
+    } else {
+        buf = av_malloc(HEADER_SIZE + size);
+        if (!buf)
+            return AVERROR(ENOMEM);
+        buf->size = size;
+    }
+    buf->refcount   = 1;
+    buf->size_class = c;
+    buf->next       = NULL;
+
+    pkt->data = buffer_data(buf);
+    pkt->priv = buf;
+    return 0;
+}
+
+void ff_packet_unref_payload(AVPacket *pkt)
+{
+    PacketBuffer *buf = pkt->priv;
+    int c = buf->size_class;
+
+    if (ff_atomic_int_add_and_fetch(&buf->refcount, -1))
+        return;
+
+    if (c >= 0) {
+        lock_pool();
+        if (nb_free[c] < FFMAX(POOL_MIN_FREE, POOL_CLASS_MEM >> (POOL_MIN_SHIFT + c))) {
+            buf->next = free_list[c];
+            free_list[c] = buf;
+            nb_free[c]++;
+            buf = NULL;
+        }
+        unlock_pool();
+    }
+    av_free(buf);
+}
+
+void ff_packet_ref_payload(AVPacket *pkt)
+{
+    PacketBuffer *buf = pkt->priv;
+
+    ff_atomic_int_add_and_fetch(&buf->refcount, 1);
+}
+
+int ff_packet_payload_room(AVPacket *pkt)
+{
+    PacketBuffer *buf = pkt->priv;
+
+    if (buf->refcount != 1)
+        return 0;
+    return buf->size - (pkt->data - buffer_data(buf));
+}
+
+void ff_packet_set_parent(AVPacket *pkt, const AVPacket *parent)
+{
+    PacketBuffer *buf = parent->priv;
+
+    pkt->priv = NULL;
+    if (buf && parent->destruct == av_destruct_packet &&
+        pkt->data >= buffer_data(buf) &&
+        pkt->data + pkt->size <= buffer_data(buf) + buf->size)
+        pkt->priv = buf;
+}
+
+#else
+
+int ff_packet_alloc_payload(AVPacket *pkt, int size)
+{
+    pkt->data = av_malloc(size);
+    pkt->priv = NULL;
+    return pkt->data ? 0 : AVERROR(ENOMEM);
+}
+
+void ff_packet_unref_payload(AVPacket *pkt)
+{
+}
+
+void ff_packet_ref_payload(AVPacket *pkt)
+{
+}
+
+int ff_packet_payload_room(AVPacket *pkt)
+{
+    return 0;
+}
+
+void ff_packet_set_parent(AVPacket *pkt, const AVPacket *parent)
+{
+    pkt->priv = NULL;
+}
+
+#endif /* HAVE_ATOMICS */
+
+void ff_packet_move(AVPacket *dst, AVPacket *src)
+{
+    *dst = *src;
+    src->data     = NULL;
+    src->size     = 0;
+    src->priv     = NULL;
+    src->destruct = NULL;
+}
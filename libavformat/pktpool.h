@@ -0,0 +1,44 @@
+/*
+ * Reference counted packet payloads
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FFMPEG_PKTPOOL_H
+#define FFMPEG_PKTPOOL_H
+
+#include "avformat.h"
+
+/**
+ * Allocate size bytes of payload and set pkt->data and pkt->priv.
+ * The payload is released by av_destruct_packet().
+ */
+int ff_packet_alloc_payload(AVPacket *pkt, int size);
+void ff_packet_unref_payload(AVPacket *pkt);
+void ff_packet_ref_payload(AVPacket *pkt);
+/** @return number of bytes available from pkt->data if the buffer is not shared, 0 otherwise */
+int ff_packet_payload_room(AVPacket *pkt);
+/** Set pkt->priv to the buffer of parent if pkt->data lies within it. */
+void ff_packet_set_parent(AVPacket *pkt, const AVPacket *parent);
+
+/**
+ * Move a packet and the ownership of its payload from src to dst.
+ * src is left without payload and without destructor.
+ */
+void ff_packet_move(AVPacket *dst, AVPacket *src);
+
+#endif /* FFMPEG_PKTPOOL_H */
@@ -0,0 +1,362 @@
+/*
+ * stream parameter cache, lets av_find_stream_info() be skipped on reopen
+ * Copyright (c) 2008 The FFmpeg Project
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file probecache.c
+ * Serializes the stream parameters found by av_find_stream_info() into a
+ * small sidecar file so that later opens of the same input can skip the
+ * probing (and the duration estimation seek to the end of the file).
+ *
+ * Layout, all numbers big endian except the checksum:
+ *   "FFPC" version(32) file_size(64) mtime(64) format_name(strz)
+ *   start_time(64) duration(64) bit_rate(32) nb_streams(32)
+ *   per stream: see write_stream()
+ *   crc32 over everything before it, stored like the NUT checksums
+ */
+
+#include <sys/stat.h>
+#include "avformat.h"
+#include "libavutil/avstring.h"
+
+#define PROBE_CACHE_VERSION 1
+#define PROBE_CACHE_MAX_EXTRADATA (1<<24)
+
+typedef struct CachedIndexEntry {
+    int64_t pos;
+    int64_t timestamp;
+    int flags;
+    int size;
+    int min_distance;
+} CachedIndexEntry;
+
+typedef struct CachedStream {
+    int id;
+    enum CodecType codec_type;
+    enum CodecID codec_id;
+    unsigned int codec_tag;
+    AVRational time_base;
+    AVRational codec_time_base;
+    AVRational r_frame_rate;
+    AVRational sample_aspect_ratio;
+    int width, height;
+    enum PixelFormat pix_fmt;
+    int sample_rate, channels, bits_per_sample;
+    int bit_rate;
+    int has_b_frames;
+    enum AVStreamParseType need_parsing;
+    int64_t start_time;
+    int64_t duration;
+    int64_t nb_frames;
+    uint8_t *extradata;
+    int extradata_size;
+    CachedIndexEntry *index;
+    int nb_index_entries;
+} CachedStream;
+
+/**
+ * Gets size and modification time of the file behind the context.
+ * Inputs which are not local files only get their size validated.
+ */
+static void get_file_stamp(AVFormatContext *ic, int64_t *size, int64_t *mtime)
+{
+    const char *path = ic->filename;
+    struct stat st;
+
+    *size  = ic->pb && !url_is_streamed(ic->pb) ? url_fsize(ic->pb) : -1;
+    *mtime = 0;
+    av_strstart(path, "file:", &path);
+    if (!stat(path, &st)) {
+        *size  = st.st_size;
+        *mtime = st.st_mtime;
+    }
+}
+
+static void put_rational(ByteIOContext *pb, AVRational q)
+{
+    put_be32(pb, q.num);
+    put_be32(pb, q.den);
+}
+
+static AVRational get_rational(ByteIOContext *pb)
+{
+    AVRational q;
+    q.num = get_be32(pb);
+    q.den = get_be32(pb);
+    return q;
+}
+
+static void write_stream(AVFormatContext *ic, ByteIOContext *pb, AVStream *st)
+{
+    AVCodecContext *c = st->codec;
+    unsigned int max_entries = ic->max_index_size / sizeof(AVIndexEntry);
+    int i, nb_entries = FFMIN((unsigned)st->nb_index_entries, max_entries);
+
+    put_be32(pb, st->id);
+    put_be32(pb, c->codec_type);
+    put_be32(pb, c->codec_id);
+    put_be32(pb, c->codec_tag);
+    put_rational(pb, st->time_base);
+    put_rational(pb, c->time_base);
+    put_rational(pb, st->r_frame_rate);
+    put_rational(pb, c->sample_aspect_ratio);
+    put_be32(pb, c->width);
+    put_be32(pb, c->height);
+    put_be32(pb, c->pix_fmt);
+    put_be32(pb, c->sample_rate);
+    put_be32(pb, c->channels);
+    put_be32(pb, c->bits_per_sample);
+    put_be32(pb, c->bit_rate);
+    put_be32(pb, c->has_b_frames);
+    put_be32(pb, st->need_parsing);
+    put_be64(pb, st->start_time);
+    put_be64(pb, st->duration);
+    put_be64(pb, st->nb_frames);
+
+    put_be32(pb, c->extradata_size);
+    if (c->extradata_size > 0)
+        put_buffer(pb, c->extradata, c->extradata_size);
+
+    /* keyframe summary of the index, thinned the same way ff_reduce_index()
+       does so the sidecar stays small */
+    put_be32(pb, nb_entries);
+    for (i = 0; i < nb_entries; i++) {
+        AVIndexEntry *ie = &st->index_entries[(int64_t)i * st->nb_index_entries / nb_entries];
+        put_be64(pb, ie->pos);
+        put_be64(pb, ie->timestamp);
+        put_be32(pb, ie->flags);
+        put_be32(pb, ie->size);
+        put_be32(pb, ie->min_distance);
+    }
+}
+
+int av_probe_cache_write(AVFormatContext *ic, const char *filename)
+{
+    ByteIOContext *pb;
+    int64_t file_size, mtime;
+    int i, ret;
+
+    if (!ic->iformat)
+        return AVERROR(EINVAL);
+
+    if ((ret = url_fopen(&pb, filename, URL_WRONLY)) < 0)
+        return ret;
+
+    get_file_stamp(ic, &file_size, &mtime);
+
+    init_checksum(pb, ff_crc04C11DB7_update, 0);
+    put_tag(pb, "FFPC");
+    put_be32(pb, PROBE_CACHE_VERSION);
+    put_be64(pb, file_size);
+    put_be64(pb, mtime);
+    put_strz(pb, ic->iformat->name);
+    put_be64(pb, ic->start_time);
+    put_be64(pb, ic->duration);
+    put_be32(pb, ic->bit_rate);
+    put_be32(pb, ic->nb_streams);
+    for (i = 0; i < ic->nb_streams; i++)
+        write_stream(ic, pb, ic->streams[i]);
+    put_le32(pb, get_checksum(pb));
+    put_flush_packet(pb);
+
+    ret = url_ferror(pb);
+    url_fclose(pb);
+    return ret;
+}
+
+static int read_stream(ByteIOContext *pb, CachedStream *cs)
+{
+    int i;
+
+    cs->id              = get_be32(pb);
+    cs->codec_type      = get_be32(pb);
+    cs->codec_id        = get_be32(pb);
+    cs->codec_tag       = get_be32(pb);
+    cs->time_base       = get_rational(pb);
+    cs->codec_time_base = get_rational(pb);
+    cs->r_frame_rate    = get_rational(pb);
+    cs->sample_aspect_ratio = get_rational(pb);
+    cs->width           = get_be32(pb);
+    cs->height          = get_be32(pb);
+    cs->pix_fmt         = get_be32(pb);
+    cs->sample_rate     = get_be32(pb);
+    cs->channels        = get_be32(pb);
+    cs->bits_per_sample = get_be32(pb);
+    cs->bit_rate        = get_be32(pb);
+    cs->has_b_frames    = get_be32(pb);
+    cs->need_parsing    = get_be32(pb);
+    cs->start_time      = get_be64(pb);
+    cs->duration        = get_be64(pb);
+    cs->nb_frames       = get_be64(pb);
+
+    cs->extradata_size = get_be32(pb);
+    if ((unsigned)cs->extradata_size > PROBE_CACHE_MAX_EXTRADATA)
+        return AVERROR_INVALIDDATA;
+    if (cs->extradata_size) {
+        cs->extradata = av_mallocz(cs->extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!cs->extradata)
+            return AVERROR(ENOMEM);
+        if (get_buffer(pb, cs->extradata, cs->extradata_size) != cs->extradata_size)
+            return AVERROR(EIO);
+    }
+
+    cs->nb_index_entries = get_be32(pb);
+    if ((unsigned)cs->nb_index_entries >= UINT_MAX / sizeof(CachedIndexEntry))
+        return AVERROR_INVALIDDATA;
+    if (cs->nb_index_entries) {
+        cs->index = av_malloc(cs->nb_index_entries * sizeof(CachedIndexEntry));
+        if (!cs->index)
+            return AVERROR(ENOMEM);
+    }
+    for (i = 0; i < cs->nb_index_entries; i++) {
+        CachedIndexEntry *ie = &cs->index[i];
+        ie->pos          = get_be64(pb);
+        ie->timestamp    = get_be64(pb);
+        ie->flags        = get_be32(pb);
+        ie->size         = get_be32(pb);
+        ie->min_distance = get_be32(pb);
+    }
+    return url_feof(pb) ? AVERROR(EIO) : 0;
+}
+
+static void apply_stream(AVFormatContext *ic, AVStream *st, CachedStream *cs)
+{
+    AVCodecContext *c = st->codec;
+    int i;
+
+    c->codec_id        = cs->codec_id;
+    c->codec_tag       = cs->codec_tag;
+    c->time_base       = cs->codec_time_base;
+    c->sample_aspect_ratio = cs->sample_aspect_ratio;
+    c->width           = cs->width;
+    c->height          = cs->height;
+    c->pix_fmt         = cs->pix_fmt;
+    c->sample_rate     = cs->sample_rate;
+    c->channels        = cs->channels;
+    c->bits_per_sample = cs->bits_per_sample;
+    c->bit_rate        = cs->bit_rate;
+    c->has_b_frames    = cs->has_b_frames;
+    st->time_base      = cs->time_base;
+    st->r_frame_rate   = cs->r_frame_rate;
+    st->need_parsing   = cs->need_parsing;
+    st->start_time     = cs->start_time;
+    st->duration       = cs->duration;
+    st->nb_frames      = cs->nb_frames;
+
+    if (cs->extradata) {
+        av_free(c->extradata);
+        c->extradata      = cs->extradata;
+        c->extradata_size = cs->extradata_size;
+        cs->extradata     = NULL;
+    }
+
+    /* demuxers which build their index in read_header() know better */
+    if (!st->nb_index_entries)
+        for (i = 0; i < cs->nb_index_entries; i++)
+            av_add_index_entry(st, cs->index[i].pos, cs->index[i].timestamp,
+                               cs->index[i].size, cs->index[i].min_distance,
+                               cs->index[i].flags);
+}
+
+int av_probe_cache_read(AVFormatContext *ic, const char *filename)
+{
+    ByteIOContext *pb;
+    CachedStream *streams = NULL;
+    int64_t file_size, mtime, start_time, duration;
+    char format_name[64];
+    int i, ret, nb_streams = 0, bit_rate;
+
+    if (!ic->iformat)
+        return AVERROR(EINVAL);
+
+    if ((ret = url_fopen(&pb, filename, URL_RDONLY)) < 0)
+        return ret;
+
+    get_file_stamp(ic, &file_size, &mtime);
+
+    ret = AVERROR_INVALIDDATA;
+    init_checksum(pb, ff_crc04C11DB7_update, 0);
+    if (get_le32(pb) != MKTAG('F', 'F', 'P', 'C') ||
+        get_be32(pb) != PROBE_CACHE_VERSION)
+        goto fail;
+    if (get_be64(pb) != file_size || get_be64(pb) != mtime) {
+        av_log(ic, AV_LOG_DEBUG, "probe cache %s is stale\n", filename);
+        goto fail;
+    }
+    get_strz(pb, format_name, sizeof(format_name));
+    if (strcmp(format_name, ic->iformat->name))
+        goto fail;
+    start_time = get_be64(pb);
+    duration   = get_be64(pb);
+    bit_rate   = get_be32(pb);
+    nb_streams = get_be32(pb);
+    /* demuxers without header create their streams while probing, the
+     * cache may add those which the first packets would have revealed */
+    if (nb_streams < ic->nb_streams || nb_streams > MAX_STREAMS ||
+        (nb_streams > ic->nb_streams && !(ic->ctx_flags & AVFMTCTX_NOHEADER)))
+        goto fail;
+
+    streams = av_mallocz(nb_streams * sizeof(*streams));
+    if (nb_streams && !streams) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    for (i = 0; i < nb_streams; i++) {
+        if ((ret = read_stream(pb, &streams[i])) < 0)
+            goto fail;
+        if (i < ic->nb_streams && streams[i].id != ic->streams[i]->id) {
+            ret = AVERROR_INVALIDDATA;
+            goto fail;
+        }
+    }
+    get_le32(pb);
+    if (get_checksum(pb)) {
+        av_log(ic, AV_LOG_ERROR, "probe cache %s checksum mismatch\n", filename);
+        ret = AVERROR_INVALIDDATA;
+        goto fail;
+    }
+
+    /* everything validated, only now touch the context */
+    for (i = ic->nb_streams; i < nb_streams; i++) {
+        AVStream *st = av_new_stream(ic, streams[i].id);
+        if (!st) {
+            ret = AVERROR(ENOMEM);
+            goto fail;
+        }
+        st->codec->codec_type = streams[i].codec_type;
+    }
+    for (i = 0; i < nb_streams; i++)
+        apply_stream(ic, ic->streams[i], &streams[i]);
+    ic->start_time = start_time;
+    ic->duration   = duration;
+    ic->bit_rate   = bit_rate;
+    if (file_size > 0)
+        ic->file_size = file_size;
+    ret = 0;
+
+fail:
+    for (i = 0; streams && i < nb_streams; i++) {
+        av_free(streams[i].extradata);
+        av_free(streams[i].index);
+    }
+    av_free(streams);
+    url_fclose(pb);
+    return ret;
+}
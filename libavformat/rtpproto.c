@@ -111,6 +111,8 @@ static void build_udp_url(char *buf, int buf_size,
  * option: 'ttl=n'       : set the ttl value (for multicast only)
  *         'localport=n' : set the local port to n
  *         'pkt_size=n'  : set max packet size
+ *         'bitrate=n'   : pace the RTP output at n bits per second
+ *         'burst_bits=n' : send up to n bits of RTP output ahead of time
  *
  */
 
@@ -118,6 +120,7 @@ static int rtp_open(URLContext *h, const char *uri, int flags)
 {
     RTPContext *s;
     int port, is_output, ttl, local_port, max_packet_size;
+    int64_t bitrate, burst_bits;
     char hostname[256];
     char buf[1024];
     char path[1024];
@@ -136,6 +139,7 @@ static int rtp_open(URLContext *h, const char *uri, int flags)
     ttl = -1;
     local_port = -1;
     max_packet_size = -1;
+    bitrate = burst_bits = 0;
 
     p = strchr(uri, '?');
     if (p) {
@@ -148,10 +152,20 @@ static int rtp_open(URLContext *h, const char *uri, int flags)
         if (find_info_tag(buf, sizeof(buf), "pkt_size", p)) {
             max_packet_size = strtol(buf, NULL, 10);
         }
+        if (find_info_tag(buf, sizeof(buf), "bitrate", p)) {
+            bitrate = strtoll(buf, NULL, 10);
+        }
+        if (find_info_tag(buf, sizeof(buf), "burst_bits", p)) {
+            burst_bits = strtoll(buf, NULL, 10);
+        }
     }
 
     build_udp_url(buf, sizeof(buf),
                   hostname, port, local_port, ttl, max_packet_size);
+    /* only the media is paced, RTCP reports go out as they come */
+    if (bitrate > 0)
+        url_add_option(buf, sizeof(buf), "bitrate=%"PRId64"&burst_bits=%"PRId64,
+                       bitrate, burst_bits);
     if (url_open(&s->rtp_hd, buf, flags) < 0)
         goto fail;
     local_port = udp_get_local_port(s->rtp_hd);
@@ -260,14 +274,6 @@ static int rtp_write(URLContext *h, uint8_t *buf, int size)
     }
 
     ret = url_write(hd, buf, size);
-#if 0
-    {
-        struct timespec ts;
-        ts.tv_sec = 0;
-        ts.tv_nsec = 10 * 1000000;
-        nanosleep(&ts, NULL);
-    }
-#endif
     return ret;
 }
 
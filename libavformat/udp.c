@@ -24,10 +24,16 @@
  * UDP protocol
  */
 
+#define _GNU_SOURCE /* for recvmmsg() and sendmmsg() */
 #include "avformat.h"
 #include <unistd.h>
+#include <time.h>
 #include "network.h"
 #include "os_support.h"
+#if defined(HAVE_PTHREADS) && !defined(HAVE_WINSOCK2_H)
+#define UDP_THREADS
+#include <pthread.h>
+#endif
 
 #ifndef IPV6_ADD_MEMBERSHIP
 #define IPV6_ADD_MEMBERSHIP IPV6_JOIN_GROUP
@@ -52,10 +58,81 @@ typedef struct {
     struct sockaddr_storage dest_addr;
 #endif
     int dest_addr_len;
+#ifdef UDP_THREADS
+    /* ring of the datagrams received by the thread, if fifo_size is set,
+       or queued for the thread to send, if bitrate is set */
+    uint8_t *ring;              ///< nb_slots + 1 slots, the last one to drop datagrams
+    int *ring_len;              ///< size of the datagram in each slot
+    int slot_size, nb_slots;
+    unsigned int head, tail;    ///< datagrams put in and taken out of the ring
+    int overrun;                ///< the ring is full
+    unsigned int overruns, dropped, kernel_dropped;
+    int64_t bitrate;            ///< output rate in bits per second
+    int64_t burst_bits;         ///< output sent ahead of its time at most
+    int stop, thread_done;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
 } UDPContext;
 
 #define UDP_TX_BUF_SIZE 32768
 #define UDP_MAX_PKT_SIZE 65536
+#define UDP_RECV_BATCH 32       ///< datagrams received by one system call
+#define UDP_SEND_BATCH 32       ///< datagrams sent by one system call
+#define UDP_SEND_SLOTS 256      ///< default size of the output ring
+#define UDP_SEND_LATE 100000    ///< output late by more is not caught up, in microseconds
+
+#ifdef UDP_THREADS
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+typedef struct mmsghdr UDPMsgHdr;
+#else
+typedef struct UDPMsgHdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+} UDPMsgHdr;
+#endif
+
+#ifdef HAVE_RECVMMSG
+#define udp_recvmmsg recvmmsg
+#else
+#ifndef MSG_WAITFORONE
+#define MSG_WAITFORONE 0
+#endif
+
+/* wait for the first datagram only */
+static int udp_recvmmsg(int fd, UDPMsgHdr *msgs, unsigned int n, int flags,
+                        struct timespec *timeout)
+{
+    int i, len;
+
+    for(i = 0; i < n; i++) {
+        len = recvmsg(fd, &msgs[i].msg_hdr, i ? MSG_DONTWAIT : 0);
+        if (len < 0)
+            break;
+        msgs[i].msg_len = len;
+    }
+    return i ? i : -1;
+}
+#endif
+
+#ifdef HAVE_SENDMMSG
+#define udp_sendmmsg sendmmsg
+#else
+static int udp_sendmmsg(int fd, UDPMsgHdr *msgs, unsigned int n, int flags)
+{
+    int i, len;
+
+    for(i = 0; i < n; i++) {
+        len = sendmsg(fd, &msgs[i].msg_hdr, flags);
+        if (len < 0)
+            break;
+        msgs[i].msg_len = len;
+    }
+    return i ? i : -1;
+}
+#endif
+#endif /* UDP_THREADS */
 
 static int udp_set_multicast_ttl(int sockfd, int mcastTTL, struct sockaddr *addr) {
 #ifdef IP_MULTICAST_TTL
@@ -281,6 +358,11 @@ static int udp_port(struct sockaddr_in *addr, int len)
  *         'localport=n' : set the local port
  *         'pkt_size=n'  : set max packet size
  *         'reuse=1'     : enable reusing the socket
+ *         'buffer_size=n' : set the size of the socket receive buffer
+ *         'fifo_size=n' : receive in a thread into a ring of n bytes,
+ *                         or queue n bytes of paced output
+ *         'bitrate=n'   : send in a thread at n bits per second
+ *         'burst_bits=n' : send up to n bits ahead of time, in batches
  *
  * @param s1 media file context
  * @param uri of the remote server
@@ -326,12 +408,296 @@ int udp_get_file_handle(URLContext *h)
     return s->udp_fd;
 }
 
+/**
+ * Return the counters of the datagrams lost when receiving in a thread.
+ * @param overruns number of times the ring was full
+ * @param dropped datagrams dropped because the ring was full
+ * @param kernel_dropped datagrams dropped by the kernel, if it tells
+ */
+void udp_get_receive_stats(URLContext *h, unsigned int *overruns,
+                           unsigned int *dropped, unsigned int *kernel_dropped)
+{
+    UDPContext *s = h->priv_data;
+
+    *overruns = *dropped = *kernel_dropped = 0;
+#ifdef UDP_THREADS
+    if (s->ring) {
+        pthread_mutex_lock(&s->mutex);
+        *overruns       = s->overruns;
+        *dropped        = s->dropped;
+        *kernel_dropped = s->kernel_dropped;
+        pthread_mutex_unlock(&s->mutex);
+    }
+#endif
+}
+
+#ifdef UDP_THREADS
+/* drain the socket into the ring, many datagrams at a time, so that
+   bursts are not lost while the reader is busy */
+static void *udp_receive_thread(void *arg)
+{
+    UDPContext *s = arg;
+    UDPMsgHdr msgs[UDP_RECV_BATCH];
+    struct iovec iov[UDP_RECV_BATCH];
+#ifdef SO_RXQ_OVFL
+    uint8_t control[UDP_RECV_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+    struct cmsghdr *cmsg;
+#endif
+    uint32_t kernel_dropped = 0;
+    int i, n, w, ret;
+
+    memset(msgs, 0, sizeof(msgs));
+    for(;;) {
+        pthread_mutex_lock(&s->mutex);
+        if (s->stop) {
+            pthread_mutex_unlock(&s->mutex);
+            break;
+        }
+        n = s->nb_slots - (s->head - s->tail);
+        w = s->head % s->nb_slots;
+        pthread_mutex_unlock(&s->mutex);
+
+        /* receive into the free slots up to the end of the ring, or into
+           the spare slot if it is full */
+        n = FFMIN(FFMIN(n, s->nb_slots - w), UDP_RECV_BATCH);
+        for(i = 0; i < (n ? n : UDP_RECV_BATCH); i++) {
+            iov[i].iov_base = s->ring + (n ? w + i : s->nb_slots) * s->slot_size;
+            iov[i].iov_len  = s->slot_size;
+            msgs[i].msg_hdr.msg_iov    = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef SO_RXQ_OVFL
+            msgs[i].msg_hdr.msg_control    = control[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+#endif
+        }
+        /* the receive timeout of the socket lets the thread check for stop */
+        ret = udp_recvmmsg(s->udp_fd, msgs, i, MSG_WAITFORONE, NULL);
+        if (ret < 0) {
+            if (ff_neterrno() != FF_NETERROR(EAGAIN) &&
+                ff_neterrno() != FF_NETERROR(EINTR))
+                break;
+            continue;
+        }
+
+#ifdef SO_RXQ_OVFL
+        /* the kernel gives the total of the datagrams it dropped */
+        for(cmsg = CMSG_FIRSTHDR(&msgs[ret - 1].msg_hdr); cmsg;
+            cmsg = CMSG_NXTHDR(&msgs[ret - 1].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+                memcpy(&kernel_dropped, CMSG_DATA(cmsg), sizeof(kernel_dropped));
+        }
+#endif
+
+        pthread_mutex_lock(&s->mutex);
+        s->kernel_dropped = kernel_dropped;
+        if (n) {
+            for(i = 0; i < ret; i++)
+                s->ring_len[w + i] = msgs[i].msg_len;
+            s->head += ret;
+            s->overrun = 0;
+            pthread_cond_signal(&s->cond);
+        } else {
+            if (!s->overrun) {
+                av_log(NULL, AV_LOG_WARNING, "udp: receive ring overrun, dropping datagrams\n");
+                s->overruns++;
+            }
+            s->overrun = 1;
+            s->dropped += ret;
+        }
+        pthread_mutex_unlock(&s->mutex);
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    s->thread_done = 1;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+/** @return a monotonic time in microseconds */
+static int64_t udp_clock(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000) + ts.tv_nsec / 1000;
+#else
+    return av_gettime();
+#endif
+}
+
+/* send the queued datagrams at bitrate: each one is due when the bits
+   before it took their time, and all those due within burst_bits go out
+   in one batch */
+static void *udp_send_thread(void *arg)
+{
+    UDPContext *s = arg;
+    UDPMsgHdr msgs[UDP_SEND_BATCH];
+    struct iovec iov[UDP_SEND_BATCH];
+    int64_t start = 0, bits = 0, bits1, burst_time, now, due;
+    int i, n, r, ret;
+
+    memset(msgs, 0, sizeof(msgs));
+    burst_time = av_rescale(s->burst_bits, 1000000, s->bitrate);
+    for(;;) {
+        pthread_mutex_lock(&s->mutex);
+        while (s->head == s->tail && !s->stop)
+            pthread_cond_wait(&s->cond, &s->mutex);
+        n = s->head - s->tail;
+        r = s->tail % s->nb_slots;
+        pthread_mutex_unlock(&s->mutex);
+        /* on close, the queued datagrams are sent first */
+        if (!n)
+            break;
+
+        now = udp_clock();
+        due = start + av_rescale(bits, 1000000, s->bitrate);
+        if (due < now - burst_time - UDP_SEND_LATE) {
+            /* the queue ran dry, do not catch up on the time lost */
+            start = now;
+            bits  = 0;
+        } else if (due > now + burst_time) {
+            usleep(due - burst_time - now);
+            continue;
+        }
+
+        n = FFMIN(FFMIN(n, s->nb_slots - r), UDP_SEND_BATCH);
+        bits1 = bits;
+        for(i = 0; i < n; i++) {
+            if (i && start + av_rescale(bits1, 1000000, s->bitrate) > now + burst_time)
+                break;
+            iov[i].iov_base = s->ring + (r + i) * s->slot_size;
+            iov[i].iov_len  = s->ring_len[r + i];
+            msgs[i].msg_hdr.msg_name    = &s->dest_addr;
+            msgs[i].msg_hdr.msg_namelen = s->dest_addr_len;
+            msgs[i].msg_hdr.msg_iov     = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen  = 1;
+            bits1 += 8 * s->ring_len[r + i];
+        }
+        ret = udp_sendmmsg(s->udp_fd, msgs, i, 0);
+        if (ret < 0) {
+            if (ff_neterrno() != FF_NETERROR(EAGAIN) &&
+                ff_neterrno() != FF_NETERROR(EINTR))
+                break;
+            continue;
+        }
+        for(i = 0; i < ret; i++)
+            bits += 8 * s->ring_len[r + i];
+
+        pthread_mutex_lock(&s->mutex);
+        s->tail += ret;
+        pthread_cond_signal(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    s->thread_done = 1;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+static int udp_start_thread(URLContext *h, int fifo_size, int is_output)
+{
+    UDPContext *s = h->priv_data;
+    struct timeval tv = { 0, 100 * 1000 };
+#ifdef SO_RXQ_OVFL
+    int one = 1;
+#endif
+
+    if (h->max_packet_size <= 0)
+        return -1;
+    s->slot_size = h->max_packet_size;
+    if (is_output) {
+        if (!fifo_size)
+            fifo_size = UDP_SEND_SLOTS * s->slot_size;
+    } else {
+#ifdef SO_RXQ_OVFL
+        setsockopt(s->udp_fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+#endif
+        if (setsockopt(s->udp_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+            return -1;
+    }
+    s->nb_slots  = FFMAX(fifo_size / s->slot_size, UDP_RECV_BATCH);
+    s->ring      = av_malloc((s->nb_slots + 1) * s->slot_size);
+    s->ring_len  = av_malloc(s->nb_slots * sizeof(int));
+    if (!s->ring || !s->ring_len)
+        goto fail;
+
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    if (pthread_create(&s->thread, NULL,
+                       is_output ? udp_send_thread : udp_receive_thread, s)) {
+        pthread_mutex_destroy(&s->mutex);
+        pthread_cond_destroy(&s->cond);
+        goto fail;
+    }
+    return 0;
+ fail:
+    av_freep(&s->ring);
+    av_freep(&s->ring_len);
+    return -1;
+}
+
+static int udp_read_ring(UDPContext *s, uint8_t *buf, int size)
+{
+    int r, len;
+
+    pthread_mutex_lock(&s->mutex);
+    while (s->head == s->tail && !s->thread_done)
+        pthread_cond_wait(&s->cond, &s->mutex);
+    if (s->head == s->tail) {
+        pthread_mutex_unlock(&s->mutex);
+        return AVERROR(EIO);
+    }
+    r = s->tail % s->nb_slots;
+    pthread_mutex_unlock(&s->mutex);
+
+    /* the thread does not touch the slot until it is released */
+    len = FFMIN(size, s->ring_len[r]);
+    memcpy(buf, s->ring + r * s->slot_size, len);
+
+    pthread_mutex_lock(&s->mutex);
+    s->tail++;
+    pthread_mutex_unlock(&s->mutex);
+    return len;
+}
+
+static int udp_write_ring(UDPContext *s, const uint8_t *buf, int size)
+{
+    int w;
+
+    if (size > s->slot_size)
+        return AVERROR(EINVAL);
+
+    pthread_mutex_lock(&s->mutex);
+    while (s->head - s->tail == s->nb_slots && !s->thread_done)
+        pthread_cond_wait(&s->cond, &s->mutex);
+    if (s->thread_done) {
+        pthread_mutex_unlock(&s->mutex);
+        return AVERROR(EIO);
+    }
+    w = s->head % s->nb_slots;
+    pthread_mutex_unlock(&s->mutex);
+
+    memcpy(s->ring + w * s->slot_size, buf, size);
+    s->ring_len[w] = size;
+
+    pthread_mutex_lock(&s->mutex);
+    s->head++;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    return size;
+}
+#endif
+
 /* put it in UDP context */
 /* return non zero if error */
 static int udp_open(URLContext *h, const char *uri, int flags)
 {
     char hostname[1024];
-    int port, udp_fd = -1, tmp;
+    int port, udp_fd = -1, tmp, buffer_size = UDP_MAX_PKT_SIZE, fifo_size = 0;
     UDPContext *s = NULL;
     int is_output;
     const char *p;
@@ -366,6 +732,20 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         if (find_info_tag(buf, sizeof(buf), "pkt_size", p)) {
             h->max_packet_size = strtol(buf, NULL, 10);
         }
+        if (find_info_tag(buf, sizeof(buf), "buffer_size", p)) {
+            buffer_size = strtol(buf, NULL, 10);
+        }
+        if (find_info_tag(buf, sizeof(buf), "fifo_size", p)) {
+            fifo_size = strtol(buf, NULL, 10);
+        }
+#ifdef UDP_THREADS
+        if (find_info_tag(buf, sizeof(buf), "bitrate", p)) {
+            s->bitrate = strtoll(buf, NULL, 10);
+        }
+        if (find_info_tag(buf, sizeof(buf), "burst_bits", p)) {
+            s->burst_bits = strtoll(buf, NULL, 10);
+        }
+#endif
     }
 
     /* fill the dest addr */
@@ -423,11 +803,16 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     } else {
         /* set udp recv buffer size to the largest possible udp packet size to
          * avoid losing data on OSes that set this too low by default. */
-        tmp = UDP_MAX_PKT_SIZE;
+        tmp = buffer_size;
         setsockopt(udp_fd, SOL_SOCKET, SO_RCVBUF, &tmp, sizeof(tmp));
     }
 
     s->udp_fd = udp_fd;
+#ifdef UDP_THREADS
+    if (is_output ? s->bitrate > 0 : fifo_size > 0)
+        if (udp_start_thread(h, fifo_size, is_output) < 0)
+            goto fail;
+#endif
     return 0;
  fail:
     if (udp_fd >= 0)
@@ -441,6 +826,10 @@ static int udp_read(URLContext *h, uint8_t *buf, int size)
     UDPContext *s = h->priv_data;
     int len;
 
+#ifdef UDP_THREADS
+    if (s->ring)
+        return udp_read_ring(s, buf, size);
+#endif
     for(;;) {
         len = recv(s->udp_fd, buf, size, 0);
         if (len < 0) {
@@ -459,6 +848,10 @@ static int udp_write(URLContext *h, uint8_t *buf, int size)
     UDPContext *s = h->priv_data;
     int ret;
 
+#ifdef UDP_THREADS
+    if (s->ring)
+        return udp_write_ring(s, buf, size);
+#endif
     for(;;) {
         ret = sendto (s->udp_fd, buf, size, 0,
                       (struct sockaddr *) &s->dest_addr,
@@ -478,6 +871,23 @@ static int udp_close(URLContext *h)
 {
     UDPContext *s = h->priv_data;
 
+#ifdef UDP_THREADS
+    if (s->ring) {
+        pthread_mutex_lock(&s->mutex);
+        s->stop = 1;
+        pthread_cond_signal(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+        pthread_join(s->thread, NULL);
+        pthread_mutex_destroy(&s->mutex);
+        pthread_cond_destroy(&s->cond);
+        if (s->dropped || s->kernel_dropped)
+            av_log(NULL, AV_LOG_WARNING,
+                   "udp: %u datagrams dropped in %u ring overruns, %u dropped by the kernel\n",
+                   s->dropped, s->overruns, s->kernel_dropped);
+        av_free(s->ring);
+        av_free(s->ring_len);
+    }
+#endif
     if (s->is_multicast && !(h->flags & URL_WRONLY))
         udp_leave_multicast_group(s->udp_fd, (struct sockaddr *)&s->dest_addr);
     closesocket(s->udp_fd);
@@ -21,7 +21,9 @@
 #include "avformat.h"
 #include "libavcodec/opt.h"
 #include "libavutil/avstring.h"
+#include "libavutil/trace.h"
 #include "riff.h"
+#include "pktpool.h"
 #include <sys/time.h>
 #include <time.h>
 
@@ -187,8 +189,12 @@ AVInputFormat *av_find_input_format(const char *short_name)
 
 void av_destruct_packet(AVPacket *pkt)
 {
-    av_free(pkt->data);
+    if (pkt->priv)
+        ff_packet_unref_payload(pkt);
+    else
+        av_free(pkt->data);
     pkt->data = NULL; pkt->size = 0;
+    pkt->priv = NULL;
 }
 
 void av_init_packet(AVPacket *pkt)
@@ -200,25 +206,58 @@ void av_init_packet(AVPacket *pkt)
     pkt->flags = 0;
     pkt->stream_index = 0;
     pkt->destruct= av_destruct_packet_nofree;
+    pkt->priv  = NULL;
 }
 
 int av_new_packet(AVPacket *pkt, int size)
 {
-    uint8_t *data;
+    int ret;
     if((unsigned)size > (unsigned)size + FF_INPUT_BUFFER_PADDING_SIZE)
         return AVERROR(ENOMEM);
-    data = av_malloc(size + FF_INPUT_BUFFER_PADDING_SIZE);
-    if (!data)
-        return AVERROR(ENOMEM);
-    memset(data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
 
     av_init_packet(pkt);
-    pkt->data = data;
+    ret = ff_packet_alloc_payload(pkt, size + FF_INPUT_BUFFER_PADDING_SIZE);
+    if (ret < 0)
+        return ret;
+    memset(pkt->data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+
     pkt->size = size;
     pkt->destruct = av_destruct_packet;
     return 0;
 }
 
+int av_grow_packet(AVPacket *pkt, int grow_by)
+{
+    AVPacket new_pkt;
+    int size;
+
+    if (grow_by < 0 || (unsigned)pkt->size + grow_by > INT_MAX - FF_INPUT_BUFFER_PADDING_SIZE)
+        return AVERROR(ENOMEM);
+    size = pkt->size + grow_by;
+
+    if (pkt->destruct == av_destruct_packet && pkt->priv &&
+        ff_packet_payload_room(pkt) >= size + FF_INPUT_BUFFER_PADDING_SIZE) {
+        /* enough room left in the pooled buffer */
+    } else if (pkt->destruct == av_destruct_packet && !pkt->priv) {
+        uint8_t *data = av_realloc(pkt->data, size + FF_INPUT_BUFFER_PADDING_SIZE);
+        if (!data)
+            return AVERROR(ENOMEM);
+        pkt->data = data;
+    } else {
+        if (ff_packet_alloc_payload(&new_pkt, size + FF_INPUT_BUFFER_PADDING_SIZE) < 0)
+            return AVERROR(ENOMEM);
+        memcpy(new_pkt.data, pkt->data, pkt->size);
+        if (pkt->destruct)
+            pkt->destruct(pkt);
+        pkt->data = new_pkt.data;
+        pkt->priv = new_pkt.priv;
+        pkt->destruct = av_destruct_packet;
+    }
+    pkt->size = size;
+    memset(pkt->data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    return 0;
+}
+
 int av_get_packet(ByteIOContext *s, AVPacket *pkt, int size)
 {
     int ret= av_new_packet(pkt, size);
@@ -239,18 +278,21 @@ int av_get_packet(ByteIOContext *s, AVPacket *pkt, int size)
 
 int av_dup_packet(AVPacket *pkt)
 {
-    if (pkt->destruct != av_destruct_packet) {
-        uint8_t *data;
+    if (pkt->destruct == av_destruct_packet_nofree && pkt->priv) {
+        /* the data lies within a refcounted buffer, share it */
+        ff_packet_ref_payload(pkt);
+        pkt->destruct = av_destruct_packet;
+    } else if (pkt->destruct != av_destruct_packet) {
+        AVPacket new_pkt;
         /* We duplicate the packet and don't forget to add the padding again. */
         if((unsigned)pkt->size > (unsigned)pkt->size + FF_INPUT_BUFFER_PADDING_SIZE)
             return AVERROR(ENOMEM);
-        data = av_malloc(pkt->size + FF_INPUT_BUFFER_PADDING_SIZE);
-        if (!data) {
+        if (ff_packet_alloc_payload(&new_pkt, pkt->size + FF_INPUT_BUFFER_PADDING_SIZE) < 0)
             return AVERROR(ENOMEM);
-        }
-        memcpy(data, pkt->data, pkt->size);
-        memset(data + pkt->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
-        pkt->data = data;
+        memcpy(new_pkt.data, pkt->data, pkt->size);
+        memset(new_pkt.data + pkt->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+        pkt->data = new_pkt.data;
+        pkt->priv = new_pkt.priv;
         pkt->destruct = av_destruct_packet;
     }
     return 0;
@@ -326,6 +368,12 @@ static const AVOption options[]={
 {"cryptokey", "decryption key", OFFSET(key), FF_OPT_TYPE_BINARY, 0, 0, 0, D},
 {"indexmem", "max memory used for timestamp index (per stream)", OFFSET(max_index_size), FF_OPT_TYPE_INT, 1<<20, 0, INT_MAX, D},
 {"rtbufsize", "max memory used for buffering real-time frames", OFFSET(max_picture_buffer), FF_OPT_TYPE_INT, 3041280, 0, INT_MAX, D}, /* defaults to 1s of 15fps 352x288 YUYV422 video */
+{"max_interleave_delta", "maximum dts span in microseconds buffered by the interleaver, 0 means unlimited", OFFSET(max_interleave_delta), FF_OPT_TYPE_INT64, DEFAULT, 0, INT64_MAX, E},
+{"hash", "hash functions of the framehash muxer per stream: adler32, crc32, md5 or sha1", OFFSET(hash), FF_OPT_TYPE_STRING, DEFAULT, CHAR_MIN, CHAR_MAX, E},
+{"hashref", "framehash or framemd5 reference file to stop at the first difference with", OFFSET(hash_ref), FF_OPT_TYPE_STRING, DEFAULT, CHAR_MIN, CHAR_MAX, E},
+{"hashthreads", "number of threads hashing frames in the framehash and framemd5 muxers", OFFSET(hash_threads), FF_OPT_TYPE_INT, DEFAULT, 0, INT_MAX, E},
+{"memsoftlimit", "bytes of queued packets and decoded pictures above which less is buffered, 0 means unlimited", OFFSET(mem.soft_limit), FF_OPT_TYPE_INT64, DEFAULT, 0, INT64_MAX, E|D},
+{"memhardlimit", "bytes of queued packets and decoded pictures above which buffering fails, 0 means unlimited", OFFSET(mem.hard_limit), FF_OPT_TYPE_INT64, DEFAULT, 0, INT64_MAX, E|D},
 {NULL},
 };
 
@@ -498,7 +546,9 @@ int av_read_packet(AVFormatContext *s, AVPacket *pkt)
     int ret;
     AVStream *st;
     av_init_packet(pkt);
+    AV_TRACE_BEGIN("demux");
     ret= s->iformat->read_packet(s, pkt);
+    AV_TRACE_END("demux");
     if (ret < 0)
         return ret;
     st= s->streams[pkt->stream_index];
@@ -814,9 +864,11 @@ static int av_read_frame_internal(AVFormatContext *s, AVPacket *pkt)
                 s->cur_st = NULL;
                 break;
             } else if (s->cur_len > 0 && st->discard < AVDISCARD_ALL) {
+                AV_TRACE_BEGIN("parse");
                 len = av_parser_parse(st->parser, st->codec, &pkt->data, &pkt->size,
                                       s->cur_ptr, s->cur_len,
                                       s->cur_pkt.pts, s->cur_pkt.dts);
+                AV_TRACE_END("parse");
                 s->cur_pkt.pts = AV_NOPTS_VALUE;
                 s->cur_pkt.dts = AV_NOPTS_VALUE;
                 /* increment read pointer */
@@ -832,6 +884,10 @@ static int av_read_frame_internal(AVFormatContext *s, AVPacket *pkt)
                     pkt->pts = st->parser->pts;
                     pkt->dts = st->parser->dts;
                     pkt->destruct = av_destruct_packet_nofree;
+                    if (s->cur_st)
+                        ff_packet_set_parent(pkt, &s->cur_pkt);
+                    else
+                        pkt->priv = NULL;
                     compute_pkt_fields(s, st, st->parser, pkt);
 
                     if((s->iformat->flags & AVFMT_GENERIC_INDEX) && pkt->flags & PKT_FLAG_KEY){
@@ -869,6 +925,13 @@ static int av_read_frame_internal(AVFormatContext *s, AVPacket *pkt)
                 return ret;
             }
 
+            /* drop discarded streams before any parsing or copying */
+            st = s->streams[s->cur_pkt.stream_index];
+            if (st->discard >= AVDISCARD_ALL) {
+                av_free_packet(&s->cur_pkt);
+                continue;
+            }
+
             if(s->cur_pkt.pts != AV_NOPTS_VALUE &&
                s->cur_pkt.dts != AV_NOPTS_VALUE &&
                s->cur_pkt.pts < s->cur_pkt.dts){
@@ -917,15 +980,23 @@ static int av_read_frame_internal(AVFormatContext *s, AVPacket *pkt)
     return 0;
 }
 
+#define PKTL_MEM(pkt) (sizeof(AVPacketList) + (pkt)->size)
+
 static AVPacket *add_to_pktbuf(AVFormatContext *s, AVPacket *pkt){
     AVPacketList *pktl= s->packet_buffer;
     AVPacketList **plast_pktl= &s->packet_buffer;
 
     while(*plast_pktl) plast_pktl= &(*plast_pktl)->next; //FIXME maybe maintain pointer to the last?
 
+    if (av_mem_account_charge(&s->mem, PKTL_MEM(pkt)) < 0) {
+        av_log(s, AV_LOG_ERROR, "memory limit exceeded, cannot buffer packet\n");
+        return NULL;
+    }
     pktl = av_mallocz(sizeof(AVPacketList));
-    if (!pktl)
+    if (!pktl) {
+        av_mem_account_release(&s->mem, PKTL_MEM(pkt));
         return NULL;
+    }
 
     /* add the packet in the buffered packet list */
     *plast_pktl = pktl;
@@ -963,11 +1034,13 @@ int av_read_frame(AVFormatContext *s, AVPacket *pkt)
                 /* read packet from packet buffer, if there is data */
                 *pkt = *next_pkt;
                 s->packet_buffer = pktl->next;
+                av_mem_account_release(&s->mem, PKTL_MEM(pkt));
                 av_free(pktl);
                 return 0;
             }
         }
         if(genpts){
+            AVPacket *buffered;
             int ret= av_read_frame_internal(s, pkt);
             if(ret<0){
                 if(pktl && ret != AVERROR(EAGAIN)){
@@ -977,8 +1050,12 @@ int av_read_frame(AVFormatContext *s, AVPacket *pkt)
                     return ret;
             }
 
-            if(av_dup_packet(add_to_pktbuf(s, pkt)) < 0)
+            buffered= add_to_pktbuf(s, pkt);
+            if(!buffered || av_dup_packet(buffered) < 0){
+                if(!buffered)
+                    av_free_packet(pkt);
                 return AVERROR(ENOMEM);
+            }
         }else{
             assert(!s->packet_buffer);
             return av_read_frame_internal(s, pkt);
@@ -996,6 +1073,7 @@ static void flush_packet_queue(AVFormatContext *s)
         if (!pktl)
             break;
         s->packet_buffer = pktl->next;
+        av_mem_account_release(&s->mem, PKTL_MEM(&pktl->pkt));
         av_free_packet(&pktl->pkt);
         av_free(pktl);
     }
@@ -1769,7 +1847,7 @@ static int has_codec_parameters(AVCodecContext *enc)
     return enc->codec_id != CODEC_ID_NONE && val != 0;
 }
 
-static int try_decode_frame(AVStream *st, const uint8_t *data, int size)
+static int try_decode_frame(AVFormatContext *s, AVStream *st, const uint8_t *data, int size)
 {
     int16_t *samples;
     AVCodec *codec;
@@ -1783,6 +1861,9 @@ static int try_decode_frame(AVStream *st, const uint8_t *data, int size)
     ret = avcodec_open(st->codec, codec);
     if (ret < 0)
         return ret;
+    /* the pictures decoded while probing count for the format context,
+       the link is dropped on close so copies of the context hold none */
+    st->codec->mem.parent = &s->mem;
   }
 
   if(!has_codec_parameters(st->codec)){
@@ -1918,22 +1999,54 @@ static int tb_unreliable(AVCodecContext *c){
     return 0;
 }
 
+/**
+ * per stream state of av_find_stream_info()
+ */
+typedef struct StreamInfo {
+    int64_t last_dts;
+    int duration_count;
+    double duration_error[MAX_STD_TIMEBASES];
+    int64_t codec_info_duration;
+    int codec_info_nb_frames;
+    AVProbeData probe_data;
+    int codec_identified;
+} StreamInfo;
+
+/**
+ * Make sure there is a StreamInfo for each stream of the context,
+ * streams can be added while reading if the format has no header.
+ */
+static int grow_stream_info(StreamInfo **info, int *nb_info, int nb_streams)
+{
+    StreamInfo *tmp;
+    int i;
+
+    if (nb_streams <= *nb_info)
+        return 0;
+    if ((unsigned)nb_streams >= UINT_MAX / sizeof(StreamInfo))
+        return AVERROR(ENOMEM);
+    tmp = av_realloc(*info, nb_streams * sizeof(StreamInfo));
+    if (!tmp)
+        return AVERROR(ENOMEM);
+    memset(tmp + *nb_info, 0, (nb_streams - *nb_info) * sizeof(StreamInfo));
+    for (i = *nb_info; i < nb_streams; i++)
+        tmp[i].last_dts = AV_NOPTS_VALUE;
+    *info    = tmp;
+    *nb_info = nb_streams;
+    return 0;
+}
+
 int av_find_stream_info(AVFormatContext *ic)
 {
     int i, count, ret, read_size, j;
     AVStream *st;
     AVPacket pkt1, *pkt;
-    int64_t last_dts[MAX_STREAMS];
-    int duration_count[MAX_STREAMS]={0};
-    double (*duration_error)[MAX_STD_TIMEBASES];
     offset_t old_offset = url_ftell(ic->pb);
-    int64_t codec_info_duration[MAX_STREAMS]={0};
-    int codec_info_nb_frames[MAX_STREAMS]={0};
-    AVProbeData probe_data[MAX_STREAMS];
-    int codec_identified[MAX_STREAMS]={0};
+    StreamInfo *info = NULL;
+    int nb_info = 0;
 
-    duration_error = av_mallocz(MAX_STREAMS * sizeof(*duration_error));
-    if (!duration_error) return AVERROR(ENOMEM);
+    if (grow_stream_info(&info, &nb_info, ic->nb_streams) < 0)
+        return AVERROR(ENOMEM);
 
     for(i=0;i<ic->nb_streams;i++) {
         st = ic->streams[i];
@@ -1952,22 +2065,20 @@ int av_find_stream_info(AVFormatContext *ic)
         }
     }
 
-    for(i=0;i<MAX_STREAMS;i++){
-        last_dts[i]= AV_NOPTS_VALUE;
-    }
-
-    memset(probe_data, 0, sizeof(probe_data));
     count = 0;
     read_size = 0;
     for(;;) {
         /* check if one codec still needs to be handled */
         for(i=0;i<ic->nb_streams;i++) {
             st = ic->streams[i];
+            /* discarded streams never deliver packets */
+            if (st->discard >= AVDISCARD_ALL)
+                continue;
             if (!has_codec_parameters(st->codec))
                 break;
             /* variable fps and no guess at the real fps */
             if(   tb_unreliable(st->codec)
-               && duration_count[i]<20 && st->codec->codec_type == CODEC_TYPE_VIDEO)
+               && info[i].duration_count<20 && st->codec->codec_type == CODEC_TYPE_VIDEO)
                 break;
             if(st->parser && st->parser->parser->split && !st->codec->extradata)
                 break;
@@ -1989,10 +2100,22 @@ int av_find_stream_info(AVFormatContext *ic)
             ret = count;
             break;
         }
+        /* or buffered as much as we should */
+        if (av_mem_account_over_soft_limit(&ic->mem)) {
+            av_log(ic, AV_LOG_WARNING, "memory soft limit reached, probed %d bytes\n", read_size);
+            ret = count;
+            break;
+        }
 
         /* NOTE: a new stream can be added there if no header in file
            (AVFMTCTX_NOHEADER) */
         ret = av_read_frame_internal(ic, &pkt1);
+        if (grow_stream_info(&info, &nb_info, ic->nb_streams) < 0) {
+            if (ret >= 0)
+                av_free_packet(&pkt1);
+            ret = AVERROR(ENOMEM);
+            break;
+        }
         if (ret < 0) {
             /* EOF or error */
             ret = -1; /* we could not have all the codec parameters before EOF */
@@ -2010,20 +2133,24 @@ int av_find_stream_info(AVFormatContext *ic)
         }
 
         pkt= add_to_pktbuf(ic, &pkt1);
-        if(av_dup_packet(pkt) < 0)
-            return AVERROR(ENOMEM);
+        if(!pkt || av_dup_packet(pkt) < 0) {
+            if(!pkt)
+                av_free_packet(&pkt1);
+            ret = AVERROR(ENOMEM);
+            break;
+        }
 
         read_size += pkt->size;
 
         st = ic->streams[pkt->stream_index];
-        if(codec_info_nb_frames[st->index]>1)
-            codec_info_duration[st->index] += pkt->duration;
+        if(info[st->index].codec_info_nb_frames>1)
+            info[st->index].codec_info_duration += pkt->duration;
         if (pkt->duration != 0)
-            codec_info_nb_frames[st->index]++;
+            info[st->index].codec_info_nb_frames++;
 
         {
-            int index= pkt->stream_index;
-            int64_t last= last_dts[index];
+            StreamInfo *si= &info[pkt->stream_index];
+            int64_t last= si->last_dts;
             int64_t duration= pkt->dts - last;
 
             if(pkt->dts != AV_NOPTS_VALUE && last != AV_NOPTS_VALUE && duration>0){
@@ -2031,21 +2158,21 @@ int av_find_stream_info(AVFormatContext *ic)
 
 //                if(st->codec->codec_type == CODEC_TYPE_VIDEO)
 //                    av_log(NULL, AV_LOG_ERROR, "%f\n", dur);
-                if(duration_count[index] < 2)
-                    memset(duration_error[index], 0, sizeof(*duration_error));
+                if(si->duration_count < 2)
+                    memset(si->duration_error, 0, sizeof(si->duration_error));
                 for(i=1; i<MAX_STD_TIMEBASES; i++){
                     int framerate= get_std_framerate(i);
                     int ticks= lrintf(dur*framerate/(1001*12));
                     double error= dur - ticks*1001*12/(double)framerate;
-                    duration_error[index][i] += error*error;
+                    si->duration_error[i] += error*error;
                 }
-                duration_count[index]++;
+                si->duration_count++;
             }
-            if(last == AV_NOPTS_VALUE || duration_count[index]<=1)
-                last_dts[pkt->stream_index]= pkt->dts;
+            if(last == AV_NOPTS_VALUE || si->duration_count<=1)
+                si->last_dts= pkt->dts;
 
             if (st->codec->codec_id == CODEC_ID_NONE) {
-                AVProbeData *pd = &(probe_data[st->index]);
+                AVProbeData *pd = &si->probe_data;
                 pd->buf = av_realloc(pd->buf, pd->buf_size+pkt->size+AVPROBE_PADDING_SIZE);
                 memcpy(pd->buf+pd->buf_size, pkt->data, pkt->size);
                 pd->buf_size += pkt->size;
@@ -2081,9 +2208,9 @@ int av_find_stream_info(AVFormatContext *ic)
              st->codec->codec_id == CODEC_ID_PPM ||
              st->codec->codec_id == CODEC_ID_SHORTEN ||
              (st->codec->codec_id == CODEC_ID_MPEG4 && !st->need_parsing))*/)
-            try_decode_frame(st, pkt->data, pkt->size);
+            try_decode_frame(ic, st, pkt->data, pkt->size);
 
-        if (st->time_base.den > 0 && av_rescale_q(codec_info_duration[st->index], st->time_base, AV_TIME_BASE_Q) >= ic->max_analyze_duration) {
+        if (st->time_base.den > 0 && av_rescale_q(info[st->index].codec_info_duration, st->time_base, AV_TIME_BASE_Q) >= ic->max_analyze_duration) {
             break;
         }
         count++;
@@ -2092,8 +2219,10 @@ int av_find_stream_info(AVFormatContext *ic)
     // close codecs which were opened in try_decode_frame()
     for(i=0;i<ic->nb_streams;i++) {
         st = ic->streams[i];
-        if(st->codec->codec)
+        if(st->codec->codec) {
             avcodec_close(st->codec);
+            st->codec->mem.parent = NULL;
+        }
     }
     for(i=0;i<ic->nb_streams;i++) {
         st = ic->streams[i];
@@ -2101,15 +2230,15 @@ int av_find_stream_info(AVFormatContext *ic)
             if(st->codec->codec_id == CODEC_ID_RAWVIDEO && !st->codec->codec_tag && !st->codec->bits_per_sample)
                 st->codec->codec_tag= avcodec_pix_fmt_to_codec_tag(st->codec->pix_fmt);
 
-            if(duration_count[i]
+            if(info[i].duration_count
                && tb_unreliable(st->codec) /*&&
                //FIXME we should not special-case MPEG-2, but this needs testing with non-MPEG-2 ...
                st->time_base.num*duration_sum[i]/duration_count[i]*101LL > st->time_base.den*/){
                 double best_error= 2*av_q2d(st->time_base);
-                best_error= best_error*best_error*duration_count[i]*1000*12*30;
+                best_error= best_error*best_error*info[i].duration_count*1000*12*30;
 
                 for(j=1; j<MAX_STD_TIMEBASES; j++){
-                    double error= duration_error[i][j] * get_std_framerate(j);
+                    double error= info[i].duration_error[j] * get_std_framerate(j);
 //                    if(st->codec->codec_type == CODEC_TYPE_VIDEO)
 //                        av_log(NULL, AV_LOG_ERROR, "%f %f\n", get_std_framerate(j) / 12.0/1001, error);
                     if(error < best_error){
@@ -2130,9 +2259,9 @@ int av_find_stream_info(AVFormatContext *ic)
                 }
             }
         }else if(st->codec->codec_type == CODEC_TYPE_AUDIO) {
-            if (st->codec->codec_id == CODEC_ID_NONE && probe_data[st->index].buf_size > 0) {
-                codec_identified[st->index] = set_codec_from_probe_data(st, &(probe_data[st->index]), 1);
-                if (codec_identified[st->index]) {
+            if (st->codec->codec_id == CODEC_ID_NONE && info[st->index].probe_data.buf_size > 0) {
+                info[st->index].codec_identified = set_codec_from_probe_data(st, &info[st->index].probe_data, 1);
+                if (info[st->index].codec_identified) {
                     st->need_parsing = AVSTREAM_PARSE_FULL;
                 }
             }
@@ -2145,7 +2274,7 @@ int av_find_stream_info(AVFormatContext *ic)
 
     for(i=0;i<ic->nb_streams;i++) {
         st = ic->streams[i];
-        if (codec_identified[st->index])
+        if (info[st->index].codec_identified)
             break;
     }
     //FIXME this is a mess
@@ -2153,7 +2282,7 @@ int av_find_stream_info(AVFormatContext *ic)
         av_read_frame_flush(ic);
         for(i=0;i<ic->nb_streams;i++) {
             st = ic->streams[i];
-            if (codec_identified[st->index]) {
+            if (info[st->index].codec_identified) {
                 av_seek_frame(ic, st->index, 0.0, 0);
             }
             st->cur_dts= st->first_dts;
@@ -2188,10 +2317,10 @@ int av_find_stream_info(AVFormatContext *ic)
     }
 #endif
 
-    av_free(duration_error);
-    for(i=0;i<MAX_STREAMS;i++){
-        av_freep(&(probe_data[i].buf));
+    for(i=0;i<nb_info;i++){
+        av_freep(&info[i].probe_data.buf);
     }
+    av_free(info);
 
     return ret;
 }
@@ -2239,6 +2368,7 @@ void av_close_input_stream(AVFormatContext *s)
         av_free(st->filename);
         av_free(st);
     }
+    av_freep(&s->streams);
     for(i=s->nb_programs-1; i>=0; i--) {
         av_freep(&s->programs[i]->provider_name);
         av_freep(&s->programs[i]->name);
@@ -2266,11 +2396,15 @@ void av_close_input_file(AVFormatContext *s)
 
 AVStream *av_new_stream(AVFormatContext *s, int id)
 {
-    AVStream *st;
+    AVStream *st, **streams;
     int i;
 
-    if (s->nb_streams >= MAX_STREAMS)
+    if ((unsigned)s->nb_streams >= UINT_MAX / sizeof(*s->streams) - 1)
         return NULL;
+    streams = av_realloc(s->streams, (s->nb_streams + 1) * sizeof(*s->streams));
+    if (!streams)
+        return NULL;
+    s->streams = streams;
 
     st = av_mallocz(sizeof(AVStream));
     if (!st)
@@ -2549,58 +2683,177 @@ int av_write_frame(AVFormatContext *s, AVPacket *pkt)
 
     truncate_ts(s->streams[pkt->stream_index], pkt);
 
+    AV_TRACE_BEGIN("mux");
     ret= s->oformat->write_packet(s, pkt);
+    AV_TRACE_END("mux");
     if(!ret)
         ret= url_ferror(s->pb);
     return ret;
 }
 
-int av_interleave_packet_per_dts(AVFormatContext *s, AVPacket *out, AVPacket *pkt, int flush){
-    AVPacketList *pktl, **next_point, *this_pktl;
-    int stream_count=0;
-    int streams[MAX_STREAMS];
+typedef struct AVInterleaveEntry {
+    AVPacket pkt;
+    int64_t seq; ///< insertion order, orders packets with equal dts
+    struct AVInterleaveEntry *next;
+} AVInterleaveEntry;
 
-    if(pkt){
-        AVStream *st= s->streams[ pkt->stream_index];
+/**
+ * Compare the first queued packets of two streams.
+ * @return nonzero if the packet of a must be output before the one of b
+ */
+static int interleave_before(AVStream *a, AVStream *b)
+{
+    AVInterleaveEntry *ea= a->interleave_head;
+    AVInterleaveEntry *eb= b->interleave_head;
+    int64_t left = a->time_base.num * (int64_t)b->time_base.den;
+    int64_t right= b->time_base.num * (int64_t)a->time_base.den;
 
-//        assert(pkt->destruct != av_destruct_packet); //FIXME
+    if(ea->pkt.dts * left != eb->pkt.dts * right) //FIXME this can overflow
+        return ea->pkt.dts * left < eb->pkt.dts * right;
+    return ea->seq < eb->seq;
+}
 
-        this_pktl = av_mallocz(sizeof(AVPacketList));
-        this_pktl->pkt= *pkt;
-        if(pkt->destruct == av_destruct_packet)
-            pkt->destruct= NULL; // not shared -> must keep original from being freed
-        else
-            av_dup_packet(&this_pktl->pkt);  //shared -> must dup
-
-        next_point = &s->packet_buffer;
-        while(*next_point){
-            AVStream *st2= s->streams[ (*next_point)->pkt.stream_index];
-            int64_t left=  st2->time_base.num * (int64_t)st ->time_base.den;
-            int64_t right= st ->time_base.num * (int64_t)st2->time_base.den;
-            if((*next_point)->pkt.dts * left > pkt->dts * right) //FIXME this can overflow
-                break;
+static void interleave_heap_up(AVFormatContext *s, int i)
+{
+    AVStream **heap= s->interleave_heap;
+
+    while(i > 0){
+        int parent= (i - 1) >> 1;
+        AVStream *tmp;
+        if(!interleave_before(heap[i], heap[parent]))
+            break;
+        tmp= heap[i]; heap[i]= heap[parent]; heap[parent]= tmp;
+        i= parent;
+    }
+}
+
+static void interleave_heap_down(AVFormatContext *s, int i)
+{
+    AVStream **heap= s->interleave_heap;
+    int n= s->nb_interleave_heap;
+
+    for(;;){
+        int child= 2*i + 1;
+        AVStream *tmp;
+        if(child >= n)
+            break;
+        if(child + 1 < n && interleave_before(heap[child + 1], heap[child]))
+            child++;
+        if(!interleave_before(heap[child], heap[i]))
+            break;
+        tmp= heap[i]; heap[i]= heap[child]; heap[child]= tmp;
+        i= child;
+    }
+}
+
+/**
+ * Queue a packet in the FIFO of its stream.
+ * Packets normally arrive in dts order per stream, so this is O(1) except
+ * for streams with non monotone timestamps.
+ */
+#define IENTRY_MEM(pkt) (sizeof(AVInterleaveEntry) + (pkt)->size)
+
+static int interleave_add_packet(AVFormatContext *s, AVPacket *pkt)
+{
+    AVStream *st= s->streams[pkt->stream_index];
+    AVInterleaveEntry *e, **next_point;
+    int i;
+
+    if(!s->interleave_heap){
+        s->interleave_heap= av_malloc(s->nb_streams * sizeof(*s->interleave_heap));
+        if(!s->interleave_heap)
+            return AVERROR(ENOMEM);
+    }
+
+    if(av_mem_account_charge(&s->mem, IENTRY_MEM(pkt)) < 0){
+        av_log(s, AV_LOG_ERROR, "memory limit exceeded, cannot queue packet\n");
+        return AVERROR(ENOMEM);
+    }
+    e = av_mallocz(sizeof(AVInterleaveEntry));
+    if(!e){
+        av_mem_account_release(&s->mem, IENTRY_MEM(pkt));
+        return AVERROR(ENOMEM);
+    }
+    e->pkt= *pkt;
+    e->seq= s->interleave_seq++;
+    if(pkt->destruct == av_destruct_packet)
+        pkt->destruct= NULL; // not shared -> must keep original from being freed
+    else
+        av_dup_packet(&e->pkt);  //shared -> must dup
+
+    if(!st->interleave_head){
+        st->interleave_head= st->interleave_tail= e;
+        s->interleave_heap[s->nb_interleave_heap++]= st;
+        interleave_heap_up(s, s->nb_interleave_heap - 1);
+    }else if(st->interleave_tail->pkt.dts <= pkt->dts){
+        st->interleave_tail->next= e;
+        st->interleave_tail= e;
+    }else{
+        next_point= &st->interleave_head;
+        while(*next_point && (*next_point)->pkt.dts <= pkt->dts)
             next_point= &(*next_point)->next;
+        e->next= *next_point;
+        *next_point= e;
+        if(st->interleave_head == e){
+            for(i=0; s->interleave_heap[i] != st; i++);
+            interleave_heap_up(s, i);
         }
-        this_pktl->next= *next_point;
-        *next_point= this_pktl;
     }
+    st->nb_interleaved_packets++;
+    return 0;
+}
+
+/**
+ * @return nonzero if the queued packets span more than max_interleave_delta
+ */
+static int interleave_delta_exceeded(AVFormatContext *s)
+{
+    AVStream *st= s->interleave_heap[0];
+    int64_t first, last= INT64_MIN;
+    int i;
 
-    memset(streams, 0, sizeof(streams));
-    pktl= s->packet_buffer;
-    while(pktl){
-//av_log(s, AV_LOG_DEBUG, "show st:%d dts:%"PRId64"\n", pktl->pkt.stream_index, pktl->pkt.dts);
-        if(streams[ pktl->pkt.stream_index ] == 0)
-            stream_count++;
-        streams[ pktl->pkt.stream_index ]++;
-        pktl= pktl->next;
+    first= av_rescale_q(st->interleave_head->pkt.dts, st->time_base, AV_TIME_BASE_Q);
+    for(i=0; i<s->nb_interleave_heap; i++){
+        st= s->interleave_heap[i];
+        last= FFMAX(last, av_rescale_q(st->interleave_tail->pkt.dts, st->time_base, AV_TIME_BASE_Q));
     }
+    if(last - first > s->max_interleave_delta){
+        av_log(s, AV_LOG_DEBUG, "interleaving delta %"PRId64" exceeded, not waiting for all streams\n",
+               last - first);
+        return 1;
+    }
+    return 0;
+}
 
-    if(s->nb_streams == stream_count || (flush && stream_count)){
-        pktl= s->packet_buffer;
-        *out= pktl->pkt;
+int av_interleave_packet_per_dts(AVFormatContext *s, AVPacket *out, AVPacket *pkt, int flush){
+    int stream_count;
+
+    if(pkt){
+        int ret= interleave_add_packet(s, pkt);
+        if(ret < 0)
+            return ret;
+    }
+
+    stream_count= s->nb_interleave_heap;
+    if(s->nb_streams == stream_count || (flush && stream_count) ||
+       (stream_count && s->max_interleave_delta > 0 && interleave_delta_exceeded(s)) ||
+       (stream_count && av_mem_account_over_soft_limit(&s->mem))){
+        AVStream *st= s->interleave_heap[0];
+        AVInterleaveEntry *e= st->interleave_head;
 
-        s->packet_buffer= pktl->next;
-        av_freep(&pktl);
+        *out= e->pkt;
+        st->interleave_head= e->next;
+        st->nb_interleaved_packets--;
+        av_mem_account_release(&s->mem, IENTRY_MEM(out));
+        av_free(e);
+
+        if(st->interleave_head){
+            interleave_heap_down(s, 0);
+        }else{
+            st->interleave_tail= NULL;
+            s->interleave_heap[0]= s->interleave_heap[--s->nb_interleave_heap];
+            interleave_heap_down(s, 0);
+        }
         return 1;
     }else{
         av_init_packet(out);
@@ -2645,7 +2898,9 @@ int av_interleaved_write_frame(AVFormatContext *s, AVPacket *pkt){
             return ret;
 
         truncate_ts(s->streams[opkt.stream_index], &opkt);
+        AV_TRACE_BEGIN("mux");
         ret= s->oformat->write_packet(s, &opkt);
+        AV_TRACE_END("mux");
 
         av_free_packet(&opkt);
         pkt= NULL;
@@ -2670,7 +2925,9 @@ int av_write_trailer(AVFormatContext *s)
             break;
 
         truncate_ts(s->streams[pkt.stream_index], &pkt);
+        AV_TRACE_BEGIN("mux");
         ret= s->oformat->write_packet(s, &pkt);
+        AV_TRACE_END("mux");
 
         av_free_packet(&pkt);
 
@@ -2685,8 +2942,21 @@ int av_write_trailer(AVFormatContext *s)
 fail:
     if(ret == 0)
        ret=url_ferror(s->pb);
-    for(i=0;i<s->nb_streams;i++)
-        av_freep(&s->streams[i]->priv_data);
+    for(i=0;i<s->nb_streams;i++){
+        AVStream *st= s->streams[i];
+        while(st->interleave_head){
+            AVInterleaveEntry *e= st->interleave_head;
+            st->interleave_head= e->next;
+            av_mem_account_release(&s->mem, IENTRY_MEM(&e->pkt));
+            av_free_packet(&e->pkt);
+            av_free(e);
+        }
+        st->interleave_tail= NULL;
+        st->nb_interleaved_packets= 0;
+        av_freep(&st->priv_data);
+    }
+    av_freep(&s->interleave_heap);
+    s->nb_interleave_heap= 0;
     av_freep(&s->priv_data);
     return ret;
 }
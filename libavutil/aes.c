@@ -22,6 +22,9 @@
 
 #include "common.h"
 #include "aes.h"
+#if defined(ARCH_X86_64) && defined(HAVE_AESNI)
+#include "x86_cpu.h"
+#endif
 
 typedef struct AVAES{
     // Note: round_key[16] is accessed in the init code, but this only
@@ -47,7 +50,11 @@ static uint32_t enc_multbl[4][256];
 static uint32_t dec_multbl[4][256];
 #endif
 
-static inline void addkey(uint64_t dst[2], uint64_t src[2], uint64_t round_key[2]){
+/* the blocks are accessed as bytes and as 32 and 64 bit words */
+typedef uint32_t __attribute__((may_alias)) aes_word32;
+typedef uint64_t __attribute__((may_alias)) aes_word64;
+
+static inline void addkey(aes_word64 dst[2], aes_word64 src[2], aes_word64 round_key[2]){
     dst[0] = src[0] ^ round_key[0];
     dst[1] = src[1] ^ round_key[1];
 }
@@ -71,10 +78,10 @@ static inline int mix_core(uint32_t multbl[4][256], int a, int b, int c, int d){
 }
 
 static inline void mix(uint8_t state[2][4][4], uint32_t multbl[4][256], int s1, int s3){
-    ((uint32_t *)(state))[0] = mix_core(multbl, state[1][0][0], state[1][s1  ][1], state[1][2][2], state[1][s3  ][3]);
-    ((uint32_t *)(state))[1] = mix_core(multbl, state[1][1][0], state[1][s3-1][1], state[1][3][2], state[1][s1-1][3]);
-    ((uint32_t *)(state))[2] = mix_core(multbl, state[1][2][0], state[1][s3  ][1], state[1][0][2], state[1][s1  ][3]);
-    ((uint32_t *)(state))[3] = mix_core(multbl, state[1][3][0], state[1][s1-1][1], state[1][1][2], state[1][s3-1][3]);
+    ((aes_word32 *)(state))[0] = mix_core(multbl, state[1][0][0], state[1][s1  ][1], state[1][2][2], state[1][s3  ][3]);
+    ((aes_word32 *)(state))[1] = mix_core(multbl, state[1][1][0], state[1][s3-1][1], state[1][3][2], state[1][s1-1][3]);
+    ((aes_word32 *)(state))[2] = mix_core(multbl, state[1][2][0], state[1][s3  ][1], state[1][0][2], state[1][s1  ][3]);
+    ((aes_word32 *)(state))[3] = mix_core(multbl, state[1][3][0], state[1][s1-1][1], state[1][1][2], state[1][s3-1][3]);
 }
 
 static inline void crypt(AVAES *a, int s, uint8_t *sbox, uint32_t *multbl){
@@ -87,7 +94,118 @@ static inline void crypt(AVAES *a, int s, uint8_t *sbox, uint32_t *multbl){
     subshift(a->state[0][0], s, sbox);
 }
 
+static void ctr_increment(uint8_t *counter){
+    int i;
+    for(i=15; i>=0 && !++counter[i]; i--);
+}
+
+#if defined(ARCH_X86_64) && defined(HAVE_AESNI)
+static int aes_cpu_caps = -1;
+
+#define AESENC(x, k)     asm("aesenc %1, %0"     : "+x"(x) : "x"(k))
+#define AESENCLAST(x, k) asm("aesenclast %1, %0" : "+x"(x) : "x"(k))
+#define AESDEC(x, k)     asm("aesdec %1, %0"     : "+x"(x) : "x"(k))
+#define AESDECLAST(x, k) asm("aesdeclast %1, %0" : "+x"(x) : "x"(k))
+
+/**
+ * Runs the rounds on 1 to 4 blocks, interleaved so that the rounds of
+ * the different blocks overlap. The round keys are in the order of the
+ * C code, the last round first.
+ */
+static av_always_inline void aesni_blocks(ff_xmm *x, const ff_xmm *rk, int rounds, int n, int decrypt){
+    int r, i;
+
+    for(i=0; i<n; i++)
+        x[i] ^= rk[rounds];
+    for(r=rounds-1; r>0; r--)
+        for(i=0; i<n; i++){
+            if(decrypt) AESDEC(x[i], rk[r]);
+            else        AESENC(x[i], rk[r]);
+        }
+    for(i=0; i<n; i++){
+        if(decrypt) AESDECLAST(x[i], rk[0]);
+        else        AESENCLAST(x[i], rk[0]);
+    }
+}
+
+static void aesni_crypt(AVAES *a, uint8_t *dst, const uint8_t *src, int count, uint8_t *iv, int decrypt){
+    ff_xmm rk[15], x[4], c[4], v = {0, 0};
+    int i;
+
+    memcpy(rk, a->round_key, (a->rounds + 1) * 16);
+    if(iv && !decrypt){
+        memcpy(&v, iv, 16);
+        for(; count > 0; count--, src += 16, dst += 16){
+            memcpy(x, src, 16);
+            x[0] ^= v;
+            aesni_blocks(x, rk, a->rounds, 1, 0);
+            v = x[0];
+            memcpy(dst, x, 16);
+        }
+        memcpy(iv, &v, 16);
+        return;
+    }
+    if(iv)
+        memcpy(&v, iv, 16);
+    for(; count >= 4; count -= 4, src += 64, dst += 64){
+        memcpy(c, src, 64);
+        memcpy(x, c, 64);
+        if(decrypt) aesni_blocks(x, rk, a->rounds, 4, 1);
+        else        aesni_blocks(x, rk, a->rounds, 4, 0);
+        if(iv){
+            x[0] ^= v;
+            for(i=1; i<4; i++)
+                x[i] ^= c[i-1];
+            v = c[3];
+        }
+        memcpy(dst, x, 64);
+    }
+    for(; count > 0; count--, src += 16, dst += 16){
+        memcpy(c, src, 16);
+        x[0] = c[0];
+        if(decrypt) aesni_blocks(x, rk, a->rounds, 1, 1);
+        else        aesni_blocks(x, rk, a->rounds, 1, 0);
+        if(iv){
+            x[0] ^= v;
+            v = c[0];
+        }
+        memcpy(dst, x, 16);
+    }
+    if(iv)
+        memcpy(iv, &v, 16);
+}
+
+static void aesni_ctr(AVAES *a, uint8_t *dst, const uint8_t *src, int size, uint8_t *counter){
+    ff_xmm rk[15], x[4], d[4];
+    int i, n;
+
+    memcpy(rk, a->round_key, (a->rounds + 1) * 16);
+    for(; size > 0; size -= n, src += n, dst += n){
+        n = FFMIN(size, 64);
+        for(i=0; i < (n + 15) >> 4; i++){
+            memcpy(&x[i], counter, 16);
+            ctr_increment(counter);
+        }
+        for(; i<4; i++)
+            x[i] = x[0];
+        aesni_blocks(x, rk, a->rounds, 4, 0);
+        if(n < 64)
+            memset(d, 0, sizeof(d));
+        memcpy(d, src, n);
+        for(i=0; i<4; i++)
+            d[i] ^= x[i];
+        memcpy(dst, d, n);
+    }
+}
+#endif
+
 void av_aes_crypt(AVAES *a, uint8_t *dst, uint8_t *src, int count, uint8_t *iv, int decrypt){
+#if defined(ARCH_X86_64) && defined(HAVE_AESNI)
+    if(aes_cpu_caps & FF_X86_AESNI){
+        aesni_crypt(a, dst, src, count, iv, decrypt);
+        return;
+    }
+#endif
     while(count--){
         addkey(a->state[1], src, a->round_key[a->rounds]);
         if(decrypt) {
@@ -108,6 +226,25 @@ void av_aes_crypt(AVAES *a, uint8_t *dst, uint8_t *src, int count, uint8_t *iv,
     }
 }
 
+void av_aes_ctr_crypt(AVAES *a, uint8_t *dst, const uint8_t *src, int size, uint8_t *counter){
+    uint8_t key[16];
+    int i, n;
+
+#if defined(ARCH_X86_64) && defined(HAVE_AESNI)
+    if(aes_cpu_caps & FF_X86_AESNI){
+        aesni_ctr(a, dst, src, size, counter);
+        return;
+    }
+#endif
+    for(; size > 0; size -= n, src += n, dst += n){
+        n = FFMIN(size, 16);
+        av_aes_crypt(a, key, counter, 1, NULL, 0);
+        ctr_increment(counter);
+        for(i=0; i<n; i++)
+            dst[i] = src[i] ^ key[i];
+    }
+}
+
 static void init_multbl2(uint8_t tbl[1024], int c[4], uint8_t *log8, uint8_t *alog8, uint8_t *sbox){
     int i, j;
     for(i=0; i<1024; i++){
@@ -153,6 +290,11 @@ int av_aes_init(AVAES *a, const uint8_t *key, int key_bits, int decrypt) {
     if(key_bits!=128 && key_bits!=192 && key_bits!=256)
         return -1;
 
+#if defined(ARCH_X86_64) && defined(HAVE_AESNI)
+    if(aes_cpu_caps < 0)
+        aes_cpu_caps = ff_x86_cpu_caps();
+#endif
+
     a->rounds= rounds;
 
     memcpy(tk, key, KC*4);
@@ -192,10 +334,83 @@ int av_aes_init(AVAES *a, const uint8_t *key, int key_bits, int decrypt) {
 }
 
 #ifdef TEST
+#include <sys/time.h>
 #include "log.h"
 
 #undef random
 
+#if defined(ARCH_X86_64) && defined(HAVE_AESNI)
+/* the AES instructions against the C code, in all modes */
+static int test_aesni(void){
+    AVAES e, d;
+    uint8_t key[32], iv[2][16], ctr[2][16], src[16*67], out[2][16*67];
+    int i, bits, count, mode, err = 0;
+    int caps = ff_x86_cpu_caps();
+
+    if(!(caps & FF_X86_AESNI))
+        return 0;
+    for(i=0; i<sizeof(src); i++)
+        src[i] = random();
+    for(bits=128; bits<=256; bits+=64){
+        for(i=0; i<32; i++)
+            key[i] = random();
+        av_aes_init(&e, key, bits, 0);
+        av_aes_init(&d, key, bits, 1);
+        for(count=1; count<=67; count+=count/2+1){
+            for(mode=0; mode<5; mode++){
+                for(i=0; i<2; i++){
+                    aes_cpu_caps = i ? caps : 0;
+                    memset(iv[i], 0x5A, 16);
+                    memset(ctr[i], 0xFF, 16);
+                    ctr[i][0] = 0;
+                    if(mode == 4){
+                        av_aes_ctr_crypt(&e, out[i], src, 16*count - 5, ctr[i]);
+                    }else
+                        av_aes_crypt(mode&1 ? &d : &e, out[i], src, count, mode&2 ? iv[i] : NULL, mode&1);
+                }
+                if(memcmp(out[0], out[1], 16*count - 5*(mode == 4)) || memcmp(iv[0], iv[1], 16) || memcmp(ctr[0], ctr[1], 16)){
+                    av_log(NULL, AV_LOG_ERROR, "aes-ni mismatch: %d bits, %d blocks, mode %d\n", bits, count, mode);
+                    err = 1;
+                }
+            }
+        }
+    }
+    aes_cpu_caps = caps;
+    return err;
+}
+#endif
+
+static void test_ctr(void){
+    AVAES e;
+    uint8_t ctr[16], ctr2[16], ks[16], buf[100], out[100];
+    int i, j;
+
+    av_aes_init(&e, "PI=3.141592654..", 128, 0);
+    for(i=0; i<100; i++)
+        buf[i] = i;
+    memset(ctr, 0, 16);
+    ctr[15] = 0xFE;
+    ctr[14] = 0xFF;
+    memcpy(ctr2, ctr, 16);
+    av_aes_ctr_crypt(&e, out, buf, 48, ctr);
+    av_aes_ctr_crypt(&e, out + 48, buf + 48, 52, ctr);
+    for(i=0; i<100; i+=16){
+        av_aes_crypt(&e, ks, ctr2, 1, NULL, 0);
+        ctr_increment(ctr2);
+        for(j=i; j<FFMIN(i+16, 100); j++)
+            if((out[j] ^ buf[j]) != ks[j-i])
+                av_log(NULL, AV_LOG_ERROR, "ctr %d %02X %02X\n", j, out[j] ^ buf[j], ks[j-i]);
+    }
+    if(memcmp(ctr, ctr2, 16) || ctr[13] != 1 || ctr[15] != 5)
+        av_log(NULL, AV_LOG_ERROR, "ctr counter %02X %02X\n", ctr[13], ctr[15]);
+}
+
+static int64_t gettime(void){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
 int main(void){
     int i,j;
     AVAES ae, ad, b;
@@ -238,6 +453,25 @@ STOP_TIMER("aes")}
             }
         }
     }
+
+    test_ctr();
+#if defined(ARCH_X86_64) && defined(HAVE_AESNI)
+    if(test_aesni())
+        return 1;
+#endif
+    for(j=0; j<2; j++){
+        static uint8_t buf[1<<16];
+        uint8_t iv[16] = {0};
+        int64_t t;
+#if defined(ARCH_X86_64) && defined(HAVE_AESNI)
+        aes_cpu_caps = j ? ff_x86_cpu_caps() : 0;
+#endif
+        t = gettime();
+        for(i=0; i<256; i++)
+            av_aes_crypt(&ad, buf, buf, sizeof(buf)/16, iv, 1);
+        t = gettime() - t;
+        av_log(NULL, AV_LOG_ERROR, "%s: aes-128 cbc decryption %d MB/s\n", j ? "aes" : "aes C", (int)(16 * INT64_C(1000000) / FFMAX(t, 1)));
+    }
     return 0;
 }
 #endif
@@ -44,4 +44,14 @@ int av_aes_init(struct AVAES *a, const uint8_t *key, int key_bits, int decrypt);
  */
 void av_aes_crypt(struct AVAES *a, uint8_t *dst, uint8_t *src, int count, uint8_t *iv, int decrypt);
 
+/**
+ * Encrypts / decrypts in counter (CTR) mode, which is the same operation
+ * both ways.
+ * @param a context initialized for encryption
+ * @param size number of bytes, only the last call may give a partial block
+ * @param counter 16 byte counter block, incremented as a big-endian number
+ *                after each block
+ */
+void av_aes_ctr_crypt(struct AVAES *a, uint8_t *dst, const uint8_t *src, int size, uint8_t *counter);
+
 #endif /* FFMPEG_AES_H */
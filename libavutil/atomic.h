@@ -0,0 +1,104 @@
+/*
+ * Atomic integer and pointer operations
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file atomic.h
+ * Atomic operations, internal to the libraries.
+ *
+ * HAVE_ATOMICS is only defined if the operations really are atomic,
+ * otherwise they are plain memory accesses and code sharing data between
+ * threads has to take another path.
+ */
+
+#ifndef FFMPEG_ATOMIC_H
+#define FFMPEG_ATOMIC_H
+
+#include "config.h"
+
+#ifdef HAVE_PTHREADS
+#include <sched.h>
+#endif
+
+#ifdef HAVE_SYNC_VAL_COMPARE_AND_SWAP
+
+#define HAVE_ATOMICS 1
+
+static inline int ff_atomic_int_add_and_fetch(volatile int *ptr, int inc)
+{
+    return __sync_add_and_fetch(ptr, inc);
+}
+
+static inline int ff_atomic_int_cas(volatile int *ptr, int oldval, int newval)
+{
+    return __sync_val_compare_and_swap(ptr, oldval, newval);
+}
+
+static inline void *ff_atomic_ptr_cas(void * volatile *ptr, void *oldval, void *newval)
+{
+    return __sync_val_compare_and_swap(ptr, oldval, newval);
+}
+
+static inline void ff_atomic_barrier(void)
+{
+    __sync_synchronize();
+}
+
+#else
+
+static inline int ff_atomic_int_add_and_fetch(volatile int *ptr, int inc)
+{
+    *ptr += inc;
+    return *ptr;
+}
+
+static inline int ff_atomic_int_cas(volatile int *ptr, int oldval, int newval)
+{
+    int ret = *ptr;
+    if (ret == oldval)
+        *ptr = newval;
+    return ret;
+}
+
+static inline void *ff_atomic_ptr_cas(void * volatile *ptr, void *oldval, void *newval)
+{
+    void *ret = *ptr;
+    if (ret == oldval)
+        *ptr = newval;
+    return ret;
+}
+
+static inline void ff_atomic_barrier(void)
+{
+}
+
+#endif /* HAVE_SYNC_VAL_COMPARE_AND_SWAP */
+
+/**
+ * Lets other threads run, in a loop waiting for a lock which one of them
+ * holds.
+ */
+static inline void ff_atomic_yield(void)
+{
+#ifdef HAVE_PTHREADS
+    sched_yield();
+#endif
+}
+
+#endif /* FFMPEG_ATOMIC_H */
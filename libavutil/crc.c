@@ -20,6 +20,21 @@
 
 #include "common.h"
 #include "crc.h"
+#if defined(ARCH_X86_64) && defined(HAVE_PCLMUL)
+#include <string.h>
+#include "x86_cpu.h"
+#endif
+
+/* Layout of the tables av_crc() reads 8 bytes at a time with: the table of
+   one byte, then CRC_SLICE8 as a marker where the tables of 257 entries
+   have 1 and those of 1024 entries have 0, then the tables of one byte
+   followed by 1 to 7 zero bytes. The standard tables are followed by the
+   constants for folding with PCLMULQDQ. */
+#define CRC_SLICE8       8
+#define CRC_SLICE(ctx,j) ((j) ? (ctx) + 257 + 256*((j)-1) : (ctx))
+#define CRC_FOLD_MODE    (257 + 7*256)      ///< 0: none, 1: bit reflected, 2: normal
+#define CRC_FOLD_K       (CRC_FOLD_MODE + 1)///< folding across 512 then 128 bits
+#define CRC_TABLE_SIZE   (CRC_FOLD_K + 8)
 
 #ifdef CONFIG_HARDCODED_TABLES
 #include "crc_data.h"
@@ -35,7 +50,87 @@ static struct {
     [AV_CRC_32_IEEE]    = { 0, 32, 0x04C11DB7 },
     [AV_CRC_32_IEEE_LE] = { 1, 32, 0xEDB88320 },
 };
+#ifdef CONFIG_SMALL
 static AVCRC av_crc_table[AV_CRC_MAX][257];
+#else
+static AVCRC av_crc_table[AV_CRC_MAX][CRC_TABLE_SIZE];
+#endif
+#endif
+
+#if defined(ARCH_X86_64) && defined(HAVE_PCLMUL)
+static int crc_cpu_caps = -1;
+#endif
+
+static void init_table(AVCRC *ctx, int le, int bits, uint32_t poly)
+{
+    int i, j;
+    uint32_t c;
+
+    for (i = 0; i < 256; i++) {
+        if (le) {
+            for (c = i, j = 0; j < 8; j++)
+                c = (c>>1)^(poly & (-(c&1)));
+            ctx[i] = c;
+        } else {
+            for (c = i << 24, j = 0; j < 8; j++)
+                c = (c<<1) ^ ((poly<<(32-bits)) & (((int32_t)c)>>31) );
+            ctx[i] = bswap_32(c);
+        }
+    }
+}
+
+#ifndef CONFIG_SMALL
+static uint32_t bitreverse_32(uint32_t x)
+{
+    uint32_t r = 0;
+    int i;
+
+    for (i = 0; i < 32; i++)
+        r |= ((x >> i) & 1) << (31 - i);
+    return r;
+}
+
+/** @return x^n modulo x^32 + poly, with bit i the coefficient of x^i */
+static uint32_t xpow_mod(int n, uint32_t poly)
+{
+    uint32_t r = 1;
+
+    while (n--)
+        r = (r << 1) ^ ((r >> 31) ? poly : 0);
+    return r;
+}
+
+/**
+ * Computes the folding constants x^(d+64) and x^d mod the polynomial for
+ * d = 512 and 128, in the order pclmulqdq multiplies them with the halves
+ * of a 128 bit block. For a bit reflected CRC, a block holding the bytes
+ * of the message in order has its coefficients reflected like the CRC,
+ * the first half holding the highest ones, and the product of two such
+ * polynomials by pclmulqdq is shifted by one bit, which x^(n-1) makes up
+ * for. For other CRCs the bytes of the block are reversed, which leaves
+ * the highest coefficients in the second half.
+ */
+static void init_fold(AVCRC *ctx, int le, int bits, uint32_t poly)
+{
+    uint64_t k[4];
+    int i, d[4] = { 512 + 64, 512, 128 + 64, 128 };
+
+    if (le && bits != 32) {
+        ctx[CRC_FOLD_MODE] = 0;
+        return;
+    }
+    for (i = 0; i < 4; i++) {
+        if (le)
+            k[i] = (uint64_t)bitreverse_32(xpow_mod(d[i] - 1, bitreverse_32(poly))) << 32;
+        else
+            k[i] = xpow_mod(d[i ^ 1], poly << (32 - bits));
+    }
+    for (i = 0; i < 4; i++) {
+        ctx[CRC_FOLD_K + 2*i    ] = k[i];
+        ctx[CRC_FOLD_K + 2*i + 1] = k[i] >> 32;
+    }
+    ctx[CRC_FOLD_MODE] = le ? 1 : 2;
+}
 #endif
 
 /**
@@ -55,24 +150,13 @@ static AVCRC av_crc_table[AV_CRC_MAX][257];
  */
 int av_crc_init(AVCRC *ctx, int le, int bits, uint32_t poly, int ctx_size){
     int i, j;
-    uint32_t c;
 
     if (bits < 8 || bits > 32 || poly >= (1LL<<bits))
         return -1;
     if (ctx_size != sizeof(AVCRC)*257 && ctx_size != sizeof(AVCRC)*1024)
         return -1;
 
-    for (i = 0; i < 256; i++) {
-        if (le) {
-            for (c = i, j = 0; j < 8; j++)
-                c = (c>>1)^(poly & (-(c&1)));
-            ctx[i] = c;
-        } else {
-            for (c = i << 24, j = 0; j < 8; j++)
-                c = (c<<1) ^ ((poly<<(32-bits)) & (((int32_t)c)>>31) );
-            ctx[i] = bswap_32(c);
-        }
-    }
+    init_table(ctx, le, bits, poly);
     ctx[256]=1;
 #ifndef CONFIG_SMALL
     if(ctx_size >= sizeof(AVCRC)*1024)
@@ -91,17 +175,120 @@ int av_crc_init(AVCRC *ctx, int le, int bits, uint32_t poly, int ctx_size){
  */
 const AVCRC *av_crc_get_table(AVCRCId crc_id){
 #ifndef CONFIG_HARDCODED_TABLES
-    if (!av_crc_table[crc_id][sizeof(av_crc_table[crc_id])/sizeof(av_crc_table[crc_id][0])-1])
-        if (av_crc_init(av_crc_table[crc_id],
-                        av_crc_table_params[crc_id].le,
-                        av_crc_table_params[crc_id].bits,
-                        av_crc_table_params[crc_id].poly,
-                        sizeof(av_crc_table[crc_id])) < 0)
+    AVCRC *ctx = av_crc_table[crc_id];
+    int le   = av_crc_table_params[crc_id].le;
+    int bits = av_crc_table_params[crc_id].bits;
+    uint32_t poly = av_crc_table_params[crc_id].poly;
+
+#ifdef CONFIG_SMALL
+    if (!ctx[256])
+        if (av_crc_init(ctx, le, bits, poly, sizeof(av_crc_table[crc_id])) < 0)
             return NULL;
+#else
+    /* the marker is written last */
+    if (ctx[256] != CRC_SLICE8) {
+        int i, j;
+
+        init_table(ctx, le, bits, poly);
+        for (j = 1; j < 8; j++)
+            for (i = 0; i < 256; i++)
+                CRC_SLICE(ctx, j)[i] = (CRC_SLICE(ctx, j-1)[i] >> 8) ^ ctx[CRC_SLICE(ctx, j-1)[i] & 0xFF];
+        init_fold(ctx, le, bits, poly);
+        ctx[256] = CRC_SLICE8;
+    }
+#endif
 #endif
     return av_crc_table[crc_id];
 }
 
+#ifndef CONFIG_SMALL
+static uint32_t crc_slice8(const AVCRC *ctx, uint32_t crc, const uint8_t *buffer, size_t length)
+{
+    for (; length >= 8; length -= 8, buffer += 8) {
+        uint32_t a = crc ^ le2me_32(*(const uint32_t*)buffer);
+        uint32_t b =       le2me_32(*(const uint32_t*)(buffer + 4));
+        crc = CRC_SLICE(ctx, 7)[ a      &0xFF] ^ CRC_SLICE(ctx, 6)[(a>>8 )&0xFF]
+            ^ CRC_SLICE(ctx, 5)[(a>>16)&0xFF] ^ CRC_SLICE(ctx, 4)[ a>>24      ]
+            ^ CRC_SLICE(ctx, 3)[ b      &0xFF] ^ CRC_SLICE(ctx, 2)[(b>>8 )&0xFF]
+            ^ CRC_SLICE(ctx, 1)[(b>>16)&0xFF] ^ CRC_SLICE(ctx, 0)[ b>>24      ];
+    }
+    while (length--)
+        crc = ctx[((uint8_t)crc) ^ *buffer++] ^ (crc >> 8);
+    return crc;
+}
+#endif
+
+#if defined(ARCH_X86_64) && defined(HAVE_PCLMUL)
+#define PCLMUL(dst, a, b, imm) asm("pclmulqdq $"#imm", %1, %0" : "=x"(dst) : "x"(b), "0"(a))
+
+static inline ff_xmm reverse_block(ff_xmm x, ff_xmm rev)
+{
+    asm("pshufb %1, %0" : "+x"(x) : "x"(rev));
+    return x;
+}
+
+static inline ff_xmm load_block(const uint8_t *p, int reverse, ff_xmm rev)
+{
+    ff_xmm x;
+
+    memcpy(&x, p, 16);
+    return reverse ? reverse_block(x, rev) : x;
+}
+
+static inline ff_xmm fold(ff_xmm x, ff_xmm k)
+{
+    ff_xmm hi, lo;
+
+    PCLMUL(lo, x, k, 0x00);
+    PCLMUL(hi, x, k, 0x11);
+    return lo ^ hi;
+}
+
+/**
+ * Folds the message 64 bytes at a time into 4 blocks with PCLMULQDQ, then
+ * these into one, and computes the CRC of that block and of the remaining
+ * bytes with the tables.
+ */
+static uint32_t crc_fold(const AVCRC *ctx, uint32_t crc, const uint8_t *buffer, size_t length)
+{
+    int reverse = ctx[CRC_FOLD_MODE] == 2;
+    ff_xmm rev = { 0x08090a0b0c0d0e0fLL, 0x0001020304050607LL };
+    ff_xmm k512, k128, x0, x1, x2, x3, c = { crc, 0 };
+    uint8_t block[16];
+
+    memcpy(&k512, ctx + CRC_FOLD_K,     16);
+    memcpy(&k128, ctx + CRC_FOLD_K + 4, 16);
+
+    /* the CRC of the previous blocks is added to the first bytes */
+    x0 = load_block(buffer, 0, rev) ^ c;
+    if (reverse)
+        x0 = reverse_block(x0, rev);
+    x1 = load_block(buffer + 16, reverse, rev);
+    x2 = load_block(buffer + 32, reverse, rev);
+    x3 = load_block(buffer + 48, reverse, rev);
+    buffer += 64;
+    length -= 64;
+
+    for (; length >= 64; length -= 64, buffer += 64) {
+        x0 = fold(x0, k512) ^ load_block(buffer,      reverse, rev);
+        x1 = fold(x1, k512) ^ load_block(buffer + 16, reverse, rev);
+        x2 = fold(x2, k512) ^ load_block(buffer + 32, reverse, rev);
+        x3 = fold(x3, k512) ^ load_block(buffer + 48, reverse, rev);
+    }
+    x0 = fold(x0, k128) ^ x1;
+    x0 = fold(x0, k128) ^ x2;
+    x0 = fold(x0, k128) ^ x3;
+    for (; length >= 16; length -= 16, buffer += 16)
+        x0 = fold(x0, k128) ^ load_block(buffer, reverse, rev);
+
+    if (reverse)
+        x0 = reverse_block(x0, rev);
+    memcpy(block, &x0, 16);
+    crc = crc_slice8(ctx, 0, block, 16);
+    return crc_slice8(ctx, crc, buffer, length);
+}
+#endif
+
 /**
  * Calculate the CRC of a block
  * @param crc CRC of previous blocks if any or initial value for CRC.
@@ -113,6 +300,16 @@ uint32_t av_crc(const AVCRC *ctx, uint32_t crc, const uint8_t *buffer, size_t le
     const uint8_t *end= buffer+length;
 
 #ifndef CONFIG_SMALL
+    if(ctx[256] == CRC_SLICE8){
+#if defined(ARCH_X86_64) && defined(HAVE_PCLMUL)
+        if (crc_cpu_caps < 0)
+            crc_cpu_caps = ff_x86_cpu_caps();
+        if (length >= 128 && ctx[CRC_FOLD_MODE] &&
+            (crc_cpu_caps & (FF_X86_PCLMUL|FF_X86_SSSE3)) == (FF_X86_PCLMUL|FF_X86_SSSE3))
+            return crc_fold(ctx, crc, buffer, length);
+#endif
+        return crc_slice8(ctx, crc, buffer, length);
+    }
     if(!ctx[256])
         while(buffer<end-3){
             crc ^= le2me_32(*(const uint32_t*)buffer); buffer+=4;
@@ -130,14 +327,36 @@ uint32_t av_crc(const AVCRC *ctx, uint32_t crc, const uint8_t *buffer, size_t le
 
 #ifdef TEST
 #undef printf
+#undef random
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static int64_t gettime(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * INT64_C(1000000) + tv.tv_usec;
+}
+
+/* one byte at a time, with the first table only */
+static uint32_t crc_ref(const AVCRC *ctx, uint32_t crc, const uint8_t *buffer, size_t length)
+{
+    while (length--)
+        crc = ctx[((uint8_t)crc) ^ *buffer++] ^ (crc >> 8);
+    return crc;
+}
+
 int main(void){
-    uint8_t buf[1999];
-    int i;
+    uint8_t buf[1999], *big;
+    int i, j, ret = 0;
     int p[4][3]={{AV_CRC_32_IEEE_LE, 0xEDB88320, 0x3D5CDD04},
                  {AV_CRC_32_IEEE   , 0x04C11DB7, 0xC0F5BAE0},
                  {AV_CRC_16_ANSI   , 0x8005,     0x1FBB    },
                  {AV_CRC_8_ATM     , 0x07,       0xE3      },};
     const AVCRC *ctx;
+    uint32_t sum = 0;
+    int64_t t;
 
     for(i=0; i<sizeof(buf); i++)
         buf[i]= i+i*i;
@@ -146,6 +365,50 @@ int main(void){
         ctx = av_crc_get_table(p[i][0]);
         printf("crc %08X =%X\n", p[i][1], av_crc(ctx, 0, buf, sizeof(buf)));
     }
-    return 0;
+
+    /* all lengths and alignments, with each implementation */
+    big = av_malloc(1 << 20);
+    for (i = 0; i < 1 << 20; i++)
+        big[i] = random();
+    for (i = 0; i < AV_CRC_MAX; i++) {
+        ctx = av_crc_get_table(i);
+        for (j = 0; j < 3000; j++) {
+            int offset = j & 15, len = j < 1000 ? j : random() % 100000;
+            uint32_t start = random(), ref = crc_ref(ctx, start, big + offset, len), crc;
+
+            crc = av_crc(ctx, start, big + offset, len);
+#if defined(ARCH_X86_64) && defined(HAVE_PCLMUL)
+            crc_cpu_caps = 0;
+            if (av_crc(ctx, start, big + offset, len) != ref)
+                crc = ~ref;
+            crc_cpu_caps = -1;
+#endif
+            if (crc != ref) {
+                printf("crc %d: mismatch for %d bytes at %d\n", i, len, offset);
+                ret = 1;
+                break;
+            }
+        }
+    }
+
+    ctx = av_crc_get_table(AV_CRC_32_IEEE);
+    t = gettime();
+    for (i = 0; i < 100; i++)
+        sum += av_crc(ctx, i, big, 1 << 20);
+    printf("crc32: %.0f MB/s\n", 100.0 * (1 << 20) / (gettime() - t));
+#if defined(ARCH_X86_64) && defined(HAVE_PCLMUL)
+    crc_cpu_caps = 0;
+    t = gettime();
+    for (i = 0; i < 100; i++)
+        sum += av_crc(ctx, i, big, 1 << 20);
+    printf("crc32 without pclmulqdq: %.0f MB/s\n", 100.0 * (1 << 20) / (gettime() - t));
+#endif
+    t = gettime();
+    for (i = 0; i < 10; i++)
+        sum += crc_ref(ctx, i, big, 1 << 20);
+    printf("crc32 one byte at a time: %.0f MB/s (%08X)\n", 10.0 * (1 << 20) / (gettime() - t), sum);
+    av_free(big);
+
+    return ret;
 }
 #endif
@@ -1,5 +1,5 @@
 /*
- * LZO 1x decompression
+ * LZO 1x compression and decompression
  * Copyright (c) 2006 Reimar Doeffinger
  *
  * This file is part of FFmpeg.
@@ -19,6 +19,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 #include "common.h"
+#include "mem.h"
+#include "intreadwrite.h"
 //! avoid e.g. MPlayers fast_memcpy, it slows things down here
 #undef memcpy
 #include <string.h>
@@ -71,21 +73,43 @@ static inline int get_len(LZOContext *c, int x, int mask) {
 #ifdef UNALIGNED_LOADSTORE
 #define COPY2(d, s) *(uint16_t *)(d) = *(uint16_t *)(s);
 #define COPY4(d, s) *(uint32_t *)(d) = *(uint32_t *)(s);
+#define COPY8(d, s) *(uint64_t *)(d) = *(uint64_t *)(s);
 #elif defined(BUILTIN_MEMCPY)
 #define COPY2(d, s) memcpy(d, s, 2);
 #define COPY4(d, s) memcpy(d, s, 4);
+#define COPY8(d, s) memcpy(d, s, 8);
 #else
 #define COPY2(d, s) (d)[0] = (s)[0]; (d)[1] = (s)[1];
 #define COPY4(d, s) (d)[0] = (s)[0]; (d)[1] = (s)[1]; (d)[2] = (s)[2]; (d)[3] = (s)[3];
+#define COPY8(d, s) COPY4(d, s) COPY4((d) + 4, (s) + 4)
 #endif
 
+//! longest copy done in 8 byte blocks, memcpy() is faster for longer ones
+#define WIDE_MAX 32
+
+//! copy cnt bytes in 8 byte blocks, writing up to 7 bytes more
+#define COPY_WIDE(dst, src, cnt) \
+    do {                         \
+        COPY8(dst, src);         \
+        dst += 8;                \
+        src += 8;                \
+        cnt -= 8;                \
+    } while (cnt > 0)
+
 /**
  * \brief copy bytes from input to output buffer with checking
  * \param cnt number of bytes to copy, must be >= 0
+ * \param fast use wide copies for short runs not close to the end of a buffer
  */
-static inline void copy(LZOContext *c, int cnt) {
+static av_always_inline void copy(LZOContext *c, int cnt, int fast) {
     register const uint8_t *src = c->in;
     register uint8_t *dst = c->out;
+    if (fast && cnt <= WIDE_MAX && cnt < c->in_end - src - 8 && cnt < c->out_end - dst - 8) {
+        c->in = src + cnt;
+        c->out = dst + cnt;
+        COPY_WIDE(dst, src, cnt);
+        return;
+    }
     if (cnt > c->in_end - src) {
         cnt = FFMAX(c->in_end - src, 0);
         c->error |= LZO_INPUT_DEPLETED;
@@ -114,13 +138,18 @@ static inline void copy(LZOContext *c, int cnt) {
  * cnt > back is valid, this will copy the bytes we just copied,
  * thus creating a repeating pattern with a period length of back.
  */
-static inline void copy_backptr(LZOContext *c, int back, int cnt) {
+static av_always_inline void copy_backptr(LZOContext *c, int back, int cnt, int fast) {
     register const uint8_t *src = &c->out[-back];
     register uint8_t *dst = c->out;
     if (src < c->out_start || src > dst) {
         c->error |= LZO_INVALID_BACKPTR;
         return;
     }
+    if (fast && back >= 8 && cnt <= WIDE_MAX && cnt < c->out_end - dst - 8) {
+        c->out = dst + cnt;
+        COPY_WIDE(dst, src, cnt);
+        return;
+    }
     if (cnt > c->out_end - dst) {
         cnt = FFMAX(c->out_end - dst, 0);
         c->error |= LZO_OUTPUT_FULL;
@@ -160,18 +189,7 @@ static inline void copy_backptr(LZOContext *c, int back, int cnt) {
     c->out = dst;
 }
 
-/**
- * \brief decode LZO 1x compressed data
- * \param out output buffer
- * \param outlen size of output buffer, number of bytes left are returned here
- * \param in input buffer
- * \param inlen size of input buffer, number of bytes left are returned here
- * \return 0 on success, otherwise error flags, see lzo.h
- *
- * make sure all buffers are appropriately padded, in must provide
- * LZO_INPUT_PADDING, out must provide LZO_OUTPUT_PADDING additional bytes
- */
-int lzo1x_decode(void *out, int *outlen, const void *in, int *inlen) {
+static av_always_inline int decode(void *out, int *outlen, const void *in, int *inlen, int fast) {
     int state= 0;
     int x;
     LZOContext c;
@@ -182,7 +200,7 @@ int lzo1x_decode(void *out, int *outlen, const void *in, int *inlen) {
     c.error = 0;
     x = GETB(c);
     if (x > 17) {
-        copy(&c, x - 17);
+        copy(&c, x - 17, fast);
         x = GETB(c);
         if (x < 16) c.error |= LZO_ERROR;
     }
@@ -211,7 +229,7 @@ int lzo1x_decode(void *out, int *outlen, const void *in, int *inlen) {
             }
         } else if(!state){
                 cnt = get_len(&c, x, 15);
-                copy(&c, cnt + 3);
+                copy(&c, cnt + 3, fast);
                 x = GETB(c);
                 if (x > 15)
                     continue;
@@ -221,10 +239,10 @@ int lzo1x_decode(void *out, int *outlen, const void *in, int *inlen) {
                 cnt = 0;
                 back = (GETB(c) << 2) + (x >> 2) + 1;
         }
-        copy_backptr(&c, back, cnt + 2);
+        copy_backptr(&c, back, cnt + 2, fast);
         state=
         cnt = x & 3;
-        copy(&c, cnt);
+        copy(&c, cnt, fast);
         x = GETB(c);
     }
     *inlen = c.in_end - c.in;
@@ -234,40 +252,442 @@ int lzo1x_decode(void *out, int *outlen, const void *in, int *inlen) {
     return c.error;
 }
 
+/**
+ * \brief decode LZO 1x compressed data
+ * \param out output buffer
+ * \param outlen size of output buffer, number of bytes left are returned here
+ * \param in input buffer
+ * \param inlen size of input buffer, number of bytes left are returned here
+ * \return 0 on success, otherwise error flags, see lzo.h
+ *
+ * make sure all buffers are appropriately padded, in must provide
+ * LZO_INPUT_PADDING, out must provide LZO_OUTPUT_PADDING additional bytes
+ *
+ * literals and matches of up to 32 bytes are copied in blocks of 8 bytes,
+ * except close to the end of the buffers
+ */
+int lzo1x_decode(void *out, int *outlen, const void *in, int *inlen) {
+    return decode(out, outlen, in, inlen, 1);
+}
+
+#define MAX_DIST    49151   ///< largest distance an M4 match can code
+#define M2_MAX_DIST  2048
+#define M3_MAX_DIST 16384
+#define HASH_BITS      14
+
+struct LZOEncoder {
+    int hash[1 << HASH_BITS];   ///< last position of each hashed 4 byte sequence, -1 if none
+    uint8_t *buf;               ///< input kept for matches and pending literals, streaming only
+    int buf_size, buf_len;
+    int ip;                     ///< position to look for the next match at
+    int lit;                    ///< start of the literals after the pending match
+    int match_len, match_dist;  ///< pending match, written once the literals after it are known
+    int copy_pos, copy_left;    ///< literals which did not fit into the output buffer yet
+    int started;                ///< set once the first instruction has been written
+};
+
+/**
+ * \brief encode a length value in the coding used by lzo, see get_len()
+ */
+static uint8_t *put_len(uint8_t *o, int cnt, int mask, int marker) {
+    if (cnt <= mask) {
+        *o++ = marker | cnt;
+    } else {
+        *o++ = marker;
+        cnt -= mask;
+        while (cnt > 255) {
+            *o++ = 0;
+            cnt -= 255;
+        }
+        *o++ = cnt;
+    }
+    return o;
+}
+
+/**
+ * \brief write a match of at least 4 bytes
+ * \param state number of literals (0-3) following the match
+ */
+static uint8_t *put_match(uint8_t *o, int len, int dist, int state) {
+    if (len <= 8 && dist <= M2_MAX_DIST) {
+        dist--;
+        *o++ = (len - 1) << 5 | (dist & 7) << 2 | state;
+        *o++ = dist >> 3;
+    } else if (dist <= M3_MAX_DIST) {
+        dist--;
+        o = put_len(o, len - 2, 31, 32);
+        *o++ = (dist & 63) << 2 | state;
+        *o++ = dist >> 6;
+    } else {
+        dist -= 1 << 14;
+        o = put_len(o, len - 2, 7, 16 | (dist >> 11 & 8));
+        *o++ = (dist & 63) << 2 | state;
+        *o++ = (dist >> 6) & 255;
+    }
+    return o;
+}
+
+/**
+ * \brief copy as many of the literals left over as fit into the output buffer
+ * \return 0 if all were copied, LZO_OUTPUT_FULL otherwise
+ */
+static int put_literals(LZOEncoder *c, const uint8_t *buf, uint8_t **op, uint8_t *out_end) {
+    int n = FFMIN(c->copy_left, out_end - *op);
+
+    memcpy(*op, buf + c->copy_pos, n);
+    *op += n;
+    c->copy_pos  += n;
+    c->copy_left -= n;
+    return c->copy_left ? LZO_OUTPUT_FULL : 0;
+}
+
+/**
+ * \brief write the pending match followed by the literals up to end
+ * \return 0 on success, -1 if the output buffer is too small for the
+ *         instructions; literals which do not fit are left in c->copy_left
+ */
+static int put_pending(LZOEncoder *c, const uint8_t *buf, int end,
+                       uint8_t **op, uint8_t *out_end) {
+    uint8_t *o = *op;
+    int lit = end - c->lit;
+
+    if (out_end - o < lit / 255 + c->match_len / 255 + 8)
+        return -1;
+    if (c->match_len)
+        o = put_match(o, c->match_len, c->match_dist, lit <= 3 ? lit : 0);
+    if (lit) {
+        if (!c->started && lit <= 238)
+            *o++ = 17 + lit;
+        else if (lit > 3 || !c->match_len)
+            o = put_len(o, lit - 3, 15, 0);
+    }
+    c->started = 1;
+    c->copy_pos = c->lit;
+    c->copy_left = lit;
+    *op = o;
+    put_literals(c, buf, op, out_end);
+    return 0;
+}
+
+/**
+ * \brief greedily compress buf from c->ip on
+ * \param flush also write the trailing literals and the end of stream marker
+ * \return 0 on success, LZO_OUTPUT_FULL if compression stopped early
+ */
+static int compress(LZOEncoder *c, const uint8_t *buf, int end, int flush,
+                    uint8_t **op, uint8_t *out_end) {
+    int ip = c->ip;
+
+    if (put_literals(c, buf, op, out_end))
+        return LZO_OUTPUT_FULL;
+    while (ip <= end - 4) {
+        uint32_t v = AV_RN32(buf + ip);
+        int h = (v * 2654435761U) >> (32 - HASH_BITS);
+        int cand = c->hash[h];
+
+        if (cand >= 0 && ip - cand <= MAX_DIST && AV_RN32(buf + cand) == v) {
+            int len = 4;
+            while (ip + len < end && buf[cand + len] == buf[ip + len])
+                len++;
+            if (put_pending(c, buf, ip, op, out_end) < 0) {
+                c->ip = ip;
+                return LZO_OUTPUT_FULL;
+            }
+            c->hash[h] = ip;
+            c->match_len = len;
+            c->match_dist = ip - cand;
+            ip += len;
+            c->lit = ip;
+            if (c->copy_left) {
+                c->ip = ip;
+                return LZO_OUTPUT_FULL;
+            }
+        } else {
+            c->hash[h] = ip;
+            // skip faster through data which does not compress
+            ip += 1 + ((ip - c->lit) >> 5);
+        }
+    }
+    c->ip = FFMIN(ip, end);
+    if (flush) {
+        if (c->match_len || c->lit < end) {
+            if (put_pending(c, buf, end, op, out_end) < 0)
+                return LZO_OUTPUT_FULL;
+            c->match_len = 0;
+            c->ip = c->lit = end;
+            if (c->copy_left)
+                return LZO_OUTPUT_FULL;
+        }
+        if (out_end - *op < 3)
+            return LZO_OUTPUT_FULL;
+        *(*op)++ = 17;
+        *(*op)++ = 0;
+        *(*op)++ = 0;
+    }
+    return 0;
+}
+
+/**
+ * \brief allocate the state of a streaming LZO 1x encoder
+ * \return encoder, NULL if it cannot be allocated
+ */
+LZOEncoder *lzo1x_encoder_alloc(void) {
+    LZOEncoder *c = av_mallocz(sizeof(LZOEncoder));
+    if (c)
+        memset(c->hash, -1, sizeof(c->hash));
+    return c;
+}
+
+/**
+ * \brief free a streaming LZO 1x encoder and set the pointer to it to NULL
+ */
+void lzo1x_encoder_free(LZOEncoder **c) {
+    if (*c)
+        av_free((*c)->buf);
+    av_freep(c);
+}
+
+/**
+ * \brief compress one part of an LZO 1x stream
+ * \param out output buffer
+ * \param outlen size of output buffer, number of bytes left are returned here
+ * \param in input, all of it is consumed
+ * \param inlen size of the input
+ * \param flush nonzero to end the stream, the next call starts a new one
+ * \return 0 on success, LZO_OUTPUT_FULL if the output buffer is full, in which
+ *         case the call should be repeated with a new output buffer and no
+ *         new input, or LZO_ERROR if memory cannot be allocated
+ *
+ * the output of all calls up to the flushing one forms one LZO 1x stream.
+ * the end of the input is kept until the next call, so that matches can
+ * reach across calls; at most LZO_ENCODE_BOUND(total input size) bytes are
+ * written for one stream
+ */
+int lzo1x_encode_stream(LZOEncoder *c, void *out, int *outlen, const void *in, int inlen, int flush) {
+    uint8_t *o = out;
+    int ret;
+
+    if (inlen > 0) {
+        /* drop what neither a match nor the pending literals can refer to */
+        int i, keep = FFMIN(c->copy_left ? c->copy_pos : c->lit, c->ip - MAX_DIST);
+        if (keep >= 1 << 16) {
+            memmove(c->buf, c->buf + keep, c->buf_len - keep);
+            c->buf_len -= keep;
+            c->ip      -= keep;
+            c->lit     -= keep;
+            for (i = 0; i < 1 << HASH_BITS; i++)
+                c->hash[i] = FFMAX(c->hash[i] - keep, -1);
+        }
+        if (inlen > c->buf_size - c->buf_len) {
+            int size = FFMAX(c->buf_len + inlen, 2 * c->buf_size);
+            uint8_t *buf;
+            if ((unsigned)inlen > INT_MAX / 2 - c->buf_len)
+                return LZO_ERROR;
+            buf = av_realloc(c->buf, size);
+            if (!buf)
+                return LZO_ERROR;
+            c->buf = buf;
+            c->buf_size = size;
+        }
+        memcpy(c->buf + c->buf_len, in, inlen);
+        c->buf_len += inlen;
+    }
+    ret = compress(c, c->buf, c->buf_len, flush, &o, o + *outlen);
+    *outlen -= o - (uint8_t *)out;
+    if (flush && !ret) {
+        memset(c->hash, -1, sizeof(c->hash));
+        c->buf_len = c->ip = c->lit = 0;
+        c->started = 0;
+    }
+    return ret;
+}
+
+/**
+ * \brief compress data into one LZO 1x stream
+ * \param out output buffer
+ * \param outlen size of output buffer, number of bytes left are returned here
+ * \param in input buffer
+ * \param inlen size of input buffer, number of bytes left are returned here
+ * \return 0 on success, otherwise error flags, see lzo.h
+ *
+ * out should provide LZO_ENCODE_BOUND(*inlen) bytes, no padding is needed
+ */
+int lzo1x_encode(void *out, int *outlen, const void *in, int *inlen) {
+    LZOEncoder *c = lzo1x_encoder_alloc();
+    uint8_t *o = out;
+    int ret;
+
+    if (!c)
+        return LZO_ERROR;
+    ret = compress(c, in, *inlen, 1, &o, o + *outlen);
+    *inlen -= c->lit;
+    *outlen -= o - (uint8_t *)out;
+    lzo1x_encoder_free(&c);
+    return ret;
+}
+
 #ifdef TEST
 #include <stdio.h>
-#include <lzo/lzo1x.h>
+#include <stdlib.h>
+#include <sys/time.h>
 #include "log.h"
+#undef printf
+#undef fprintf
+#undef malloc
+#undef free
 #define MAXSZ (10*1024*1024)
+
+static int64_t gettime(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* words, runs and noise, which compresses about as well as typical payloads */
+static int fill(uint8_t *buf, int size, unsigned seed) {
+    static const char *words[] = { "matroska ", "block ", "lace ", "cluster ", "frame ", "\n" };
+    int i = 0;
+    while (i < size) {
+        int n, type = (seed = seed * 1664525 + 1013904223) >> 29;
+        if (type < 5) {
+            const char *w = words[(seed >> 8) % 6];
+            n = FFMIN(strlen(w), size - i);
+            memcpy(buf + i, w, n);
+        } else if (type < 6) {
+            n = FFMIN((seed >> 8) & 63, size - i);
+            memset(buf + i, seed >> 20, n);
+        } else {
+            n = FFMIN((seed >> 8) & 31, size - i);
+            for (n += i; i < n; i++)
+                buf[i] = (seed = seed * 1664525 + 1013904223) >> 24;
+            continue;
+        }
+        i += n;
+    }
+    return size;
+}
+
+static int check(const char *name, const uint8_t *comp, int clen, const uint8_t *orig, int s, uint8_t *decomp) {
+    int inlen = clen, outlen = s, ret;
+    ret = lzo1x_decode(decomp, &outlen, comp, &inlen);
+    if (ret || outlen || inlen || memcmp(orig, decomp, s)) {
+        printf("%s: decompression incorrect (%d %d %d)\n", name, ret, outlen, inlen);
+        return 1;
+    }
+    printf("%s: %d -> %d bytes, ok\n", name, s, clen);
+    return 0;
+}
+
+/* decodes the data compressed in blocks, as Matroska stores laces, with the
+ * exact and with the wide copies */
+static int bench_blocks(const uint8_t *orig, int s, int block_size, uint8_t *decomp) {
+    int nb = (s + block_size - 1) / block_size;
+    int *clens = av_malloc(nb * sizeof(int));
+    uint8_t *comp = av_malloc(nb * LZO_ENCODE_BOUND(block_size) + 16);
+    int i, j, k, pos, clen = 0, ret = 0;
+
+    if (!clens || !comp)
+        return 1;
+    for (k = 0; k < nb; k++) {
+        int inlen = FFMIN(block_size, s - k * block_size);
+        int outlen = LZO_ENCODE_BOUND(inlen);
+        ret |= lzo1x_encode(comp + clen, &outlen, orig + k * block_size, &inlen);
+        clens[k] = LZO_ENCODE_BOUND(FFMIN(block_size, s - k * block_size)) - outlen;
+        clen += clens[k];
+    }
+    for (i = 0; i < 2; i++) {
+        int64_t t, best = INT64_MAX;
+        for (j = 0; j < 30; j++) {
+            t = gettime();
+            for (k = pos = 0; k < nb; k++) {
+                int inlen = clens[k], outlen = FFMIN(block_size, s - k * block_size);
+                if (i ? lzo1x_decode(decomp + k * block_size, &outlen, comp + pos, &inlen)
+                      : decode(decomp + k * block_size, &outlen, comp + pos, &inlen, 0))
+                    printf("decompression error\n");
+                pos += clens[k];
+            }
+            best = FFMIN(best, gettime() - t);
+        }
+        if (memcmp(orig, decomp, s))
+            ret |= printf("decompression incorrect\n");
+        printf("%d byte blocks, %s decompression: %"PRId64" MB/s\n",
+               block_size, i ? "wide" : "exact", best ? s / best : 0);
+    }
+    av_free(clens);
+    av_free(comp);
+    return ret;
+}
+
 int main(int argc, char *argv[]) {
-    FILE *in = fopen(argv[1], "rb");
     uint8_t *orig = av_malloc(MAXSZ + 16);
-    uint8_t *comp = av_malloc(2*MAXSZ + 16);
+    uint8_t *comp = av_malloc(LZO_ENCODE_BOUND(MAXSZ) + 16);
     uint8_t *decomp = av_malloc(MAXSZ + 16);
-    size_t s = fread(orig, 1, MAXSZ, in);
-    lzo_uint clen = 0;
-    long tmp[LZO1X_MEM_COMPRESS];
-    int inlen, outlen;
-    int i;
-    av_log_level = AV_LOG_DEBUG;
-    lzo1x_999_compress(orig, s, comp, &clen, tmp);
-    for (i = 0; i < 300; i++) {
-START_TIMER
-        inlen = clen; outlen = MAXSZ;
-#ifdef LIBLZO
-        if (lzo1x_decompress_safe(comp, inlen, decomp, &outlen, NULL))
-#elif defined(LIBLZO_UNSAFE)
-        if (lzo1x_decompress(comp, inlen, decomp, &outlen, NULL))
-#else
-        if (lzo1x_decode(decomp, &outlen, comp, &inlen))
-#endif
-            av_log(NULL, AV_LOG_ERROR, "decompression error\n");
-STOP_TIMER("lzod")
+    LZOEncoder *enc = lzo1x_encoder_alloc();
+    int s, clen, inlen, outlen, i, pos, ret = 0;
+    int64_t t;
+
+    if (argc > 1) {
+        FILE *in = fopen(argv[1], "rb");
+        if (!in)
+            return 1;
+        s = fread(orig, 1, MAXSZ, in);
+    } else
+        s = fill(orig, 4*1024*1024, 1);
+
+    inlen = s; outlen = LZO_ENCODE_BOUND(s);
+    t = gettime();
+    if (lzo1x_encode(comp, &outlen, orig, &inlen))
+        printf("compression error\n");
+    t = gettime() - t;
+    clen = LZO_ENCODE_BOUND(s) - outlen;
+    printf("compression: %"PRId64" MB/s\n", t ? s / t : 0);
+    ret |= check("one-shot", comp, clen, orig, s, decomp);
+
+    /* subtitle events and uncompressed video frames */
+    ret |= bench_blocks(orig, s, 128, decomp);
+    ret |= bench_blocks(orig, s, 152064, decomp);
+
+    /* the same data in pieces of random size into output buffers of random
+     * size, twice to check that the encoder starts a new stream */
+    for (i = 0; i < 2; i++) {
+        unsigned seed = i;
+        int flush = 0, err;
+        clen = pos = 0;
+        while (!flush) {
+            int n;
+            seed = seed * 1664525 + 1013904223;
+            n = FFMIN(seed >> 15, s - pos);
+            flush = pos + n == s;
+            do {
+                int room = FFMIN(LZO_ENCODE_BOUND(MAXSZ) - clen, 4096 + (seed >> 18));
+                outlen = room;
+                err = lzo1x_encode_stream(enc, comp + clen, &outlen, orig + pos, n, flush);
+                clen += room - outlen;
+                pos += n;
+                n = 0;
+            } while (err == LZO_OUTPUT_FULL);
+            if (err)
+                return 1;
+        }
+        ret |= check("streaming", comp, clen, orig, s, decomp);
     }
-    if (memcmp(orig, decomp, s))
-        av_log(NULL, AV_LOG_ERROR, "decompression incorrect\n");
-    else
-        av_log(NULL, AV_LOG_ERROR, "decompression ok\n");
-    return 0;
+
+    /* incompressible data must stay within the bound and decode exactly */
+    for (i = 0; i < s; i++)
+        orig[i] = (i * 2654435761U) >> 23 ^ i;
+    inlen = s; outlen = LZO_ENCODE_BOUND(s);
+    ret |= lzo1x_encode(comp, &outlen, orig, &inlen);
+    ret |= check("noise", comp, LZO_ENCODE_BOUND(s) - outlen, orig, s, decomp);
+
+    /* truncated input must be detected, not read past */
+    inlen = (LZO_ENCODE_BOUND(s) - outlen) / 2; outlen = s;
+    if (!lzo1x_decode(decomp, &outlen, comp, &inlen))
+        ret |= printf("truncation not detected\n");
+
+    lzo1x_encoder_free(&enc);
+    av_free(orig);
+    av_free(comp);
+    av_free(decomp);
+    return ret;
 }
 #endif
@@ -1,5 +1,5 @@
 /*
- * LZO 1x decompression
+ * LZO 1x compression and decompression
  * copyright (c) 2006 Reimar Doeffinger
  *
  * This file is part of FFmpeg.
@@ -30,6 +30,17 @@
 #define LZO_INPUT_PADDING 8
 #define LZO_OUTPUT_PADDING 12
 
+//! largest size of the LZO 1x stream compressed from size bytes
+#define LZO_ENCODE_BOUND(size) ((size) + (size) / 16 + 64 + 3)
+
 int lzo1x_decode(void *out, int *outlen, const void *in, int *inlen);
 
+int lzo1x_encode(void *out, int *outlen, const void *in, int *inlen);
+
+typedef struct LZOEncoder LZOEncoder;
+
+LZOEncoder *lzo1x_encoder_alloc(void);
+int lzo1x_encode_stream(LZOEncoder *c, void *out, int *outlen, const void *in, int inlen, int flush);
+void lzo1x_encoder_free(LZOEncoder **c);
+
 #endif /* FFMPEG_LZO_H */
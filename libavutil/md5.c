@@ -32,6 +32,7 @@
 
 #include "common.h"
 #include <string.h>
+#include "intreadwrite.h"
 #include "md5.h"
 
 typedef struct AVMD5{
@@ -84,7 +85,7 @@ static const uint32_t T[64] = { // T[i]= fabs(sin(i+1)<<32)
         }\
         a = b + (( a << t ) | ( a >> (32 - t) ));
 
-static void body(uint32_t ABCD[4], uint32_t X[16]){
+static void body(uint32_t ABCD[4], const uint8_t *block){
 
     int t;
     int i av_unused;
@@ -92,10 +93,13 @@ static void body(uint32_t ABCD[4], uint32_t X[16]){
     unsigned int b= ABCD[2];
     unsigned int c= ABCD[1];
     unsigned int d= ABCD[0];
-
 #ifdef WORDS_BIGENDIAN
+    uint32_t X[16];
+
     for(i=0; i<16; i++)
-        X[i]= bswap_32(X[i]);
+        X[i]= AV_RL32(block + 4*i);
+#else
+    const uint32_t *X= (const uint32_t*)block;
 #endif
 
 #ifdef CONFIG_SMALL
@@ -130,13 +134,16 @@ void av_md5_update(AVMD5 *ctx, const uint8_t *src, const int len){
     j= ctx->len & 63;
     ctx->len += len;
 
-    for( i = 0; i < len; i++ ){
-        ctx->block[j++] = src[i];
-        if( 64 == j ){
-            body(ctx->ABCD, (uint32_t*) ctx->block);
-            j = 0;
-        }
-    }
+    /* whole blocks are hashed in place */
+    if(j + len > 63){
+        memcpy(ctx->block + j, src, i = 64 - j);
+        body(ctx->ABCD, ctx->block);
+        for(; i + 63 < len; i += 64)
+            body(ctx->ABCD, src + i);
+        j = 0;
+    }else
+        i = 0;
+    memcpy(ctx->block + j, src + i, len - i);
 }
 
 void av_md5_final(AVMD5 *ctx, uint8_t *dst){
@@ -150,7 +157,7 @@ void av_md5_final(AVMD5 *ctx, uint8_t *dst){
     av_md5_update(ctx, (uint8_t*)&finalcount, 8);
 
     for(i=0; i<4; i++)
-        ((uint32_t*)dst)[i]= le2me_32(ctx->ABCD[3-i]);
+        AV_WL32(dst + 4*i, ctx->ABCD[3-i]);
 }
 
 void av_md5_sum(uint8_t *dst, const uint8_t *src, const int len){
@@ -163,19 +170,59 @@ void av_md5_sum(uint8_t *dst, const uint8_t *src, const int len){
 
 #ifdef TEST
 #include <stdio.h>
+#include <sys/time.h>
 #undef printf
-int main(void){
-    uint64_t md5val;
+
+/* the first 8 bytes as a signed little-endian integer */
+static void print_md5(const uint8_t *md5){
+    uint64_t v= 0;
     int i;
-    uint8_t in[1000];
+
+    for(i=7; i>=0; i--)
+        v= (v<<8) | md5[i];
+    printf("%"PRId64"\n", v);
+}
+
+int main(void){
+    uint8_t md5val[16];
+    int i, j;
+    uint8_t in[1000], *big, sum[2][16];
+    AVMD5 ctx[1];
+    struct timeval t0, t1;
 
     for(i=0; i<1000; i++) in[i]= i*i;
-    av_md5_sum( (uint8_t*)&md5val, in,  1000); printf("%"PRId64"\n", md5val);
-    av_md5_sum( (uint8_t*)&md5val, in,  63); printf("%"PRId64"\n", md5val);
-    av_md5_sum( (uint8_t*)&md5val, in,  64); printf("%"PRId64"\n", md5val);
-    av_md5_sum( (uint8_t*)&md5val, in,  65); printf("%"PRId64"\n", md5val);
+    av_md5_sum( md5val, in,  1000); print_md5(md5val);
+    av_md5_sum( md5val, in,  63); print_md5(md5val);
+    av_md5_sum( md5val, in,  64); print_md5(md5val);
+    av_md5_sum( md5val, in,  65); print_md5(md5val);
     for(i=0; i<1000; i++) in[i]= i % 127;
-    av_md5_sum( (uint8_t*)&md5val, in,  999); printf("%"PRId64"\n", md5val);
+    av_md5_sum( md5val, in,  999); print_md5(md5val);
+
+    av_md5_sum(sum[0], "abc", 3);
+    if(memcmp(sum[0], "\x90\x01\x50\x98\x3c\xd2\x4f\xb0\xd6\x96\x3f\x7d\x28\xe1\x7f\x72", 16)){
+        printf("wrong md5 of abc\n");
+        return 1;
+    }
+
+    /* the same in pieces of all sizes and alignments */
+    big= av_malloc(1<<20);
+    for(i=0; i<1<<20; i++) big[i]= i*i + (i>>10);
+    av_md5_sum(sum[0], big, 1<<20);
+    av_md5_init(ctx);
+    for(i=j=0; i<1<<20; i+=j, j=(j*7+1)%200)
+        av_md5_update(ctx, big+i, FFMIN(j, (1<<20)-i));
+    av_md5_final(ctx, sum[1]);
+    if(memcmp(sum[0], sum[1], 16)){
+        printf("md5 of pieces differs\n");
+        return 1;
+    }
+
+    gettimeofday(&t0, NULL);
+    for(i=0; i<100; i++)
+        av_md5_sum(sum[0], big, 1<<20);
+    gettimeofday(&t1, NULL);
+    printf("md5: %.0f MB/s\n", 100.0*(1<<20) / ((t1.tv_sec - t0.tv_sec)*1000000.0 + t1.tv_usec - t0.tv_usec));
+    av_free(big);
 
     return 0;
 }
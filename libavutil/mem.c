@@ -25,6 +25,7 @@
  */
 
 #include "common.h"
+#include "atomic.h"
 
 /* here we can use OS dependent allocation functions */
 #undef malloc
@@ -39,6 +40,334 @@
    memory allocator. You do not need to suppress this file because the
    linker will do it automatically */
 
+#ifdef CONFIG_MEMPOOL
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+/* Each block has a header giving its size class. The freed blocks are
+   kept in per thread caches, one list per class, and the caches give
+   batches of them to a pool shared by the threads when they hold too
+   much, and take batches back from it when they run out. The blocks are
+   only returned to the system when the pool is full, and blocks larger
+   than the largest class are always. */
+
+#define POOL_HEADER     16          ///< bytes in front of each block, keeps it aligned on 16
+#define POOL_CLASSES    60          ///< 4 per power of 2 from 64, up to POOL_MAX_SIZE
+#define POOL_MAX_SIZE   (1 << 20)
+#define POOL_LARGE      -1          ///< class of the blocks larger than POOL_MAX_SIZE
+#define POOL_BATCH      16          ///< blocks moved at once between a cache and the pool
+#define POOL_BYTES      (32 << 20)  ///< bytes kept by the pool
+#define CACHE_BLOCKS    64          ///< blocks of a class kept by a cache
+#define CACHE_BYTES     (4 << 20)   ///< bytes kept by a cache
+
+typedef struct BlockHeader {
+    void *raw;                  ///< system allocation holding the block
+    int class;
+    unsigned int size;          ///< usable size
+} BlockHeader;
+
+#define HEADER(ptr) ((BlockHeader *)((uint8_t *)(ptr) - POOL_HEADER))
+
+/** free block, linked through its first bytes */
+typedef struct Block {
+    struct Block *next;
+} Block;
+
+typedef struct FreeList {
+    Block *first;
+    int count;
+} FreeList;
+
+typedef struct ThreadCache {
+    struct ThreadCache *next;
+    FreeList lists[POOL_CLASSES];
+    int64_t bytes;              ///< in the lists
+    AVMemStats stats;
+} ThreadCache;
+
+static FreeList pool[POOL_CLASSES];
+static int64_t pool_bytes;
+static ThreadCache *caches;             ///< of the running threads
+static AVMemStats exited_stats;         ///< of the threads which exited
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+#define LOCK()   pthread_mutex_lock(&pool_mutex)
+#define UNLOCK() pthread_mutex_unlock(&pool_mutex)
+#else
+static ThreadCache main_cache;
+#define LOCK()
+#define UNLOCK()
+#endif
+
+static int size_class(unsigned int size)
+{
+    int k;
+
+    if (size <= 64)
+        return size ? (size - 1) >> 4 : 0;
+    k = av_log2(size - 1);      /* 2^k < size <= 2^(k+1) */
+    return 4 + 4 * (k - 6) + ((size - 1 - (1 << k)) >> (k - 2));
+}
+
+static unsigned int class_size(int class)
+{
+    int k;
+
+    if (class < 4)
+        return (class + 1) << 4;
+    k = 6 + ((class - 4) >> 2);
+    return (1 << k) + ((((class - 4) & 3) + 1) << (k - 2));
+}
+
+static void *system_alloc(unsigned int size)
+{
+    uint8_t *raw, *ptr;
+
+#ifdef HAVE_MEMALIGN
+    raw = memalign(16, size + POOL_HEADER);
+    ptr = raw + POOL_HEADER;
+#else
+    raw = malloc(size + POOL_HEADER + 15);
+    ptr = (uint8_t *)(((intptr_t)raw + POOL_HEADER + 15) & ~15);
+#endif
+    if (!raw)
+        return NULL;
+    HEADER(ptr)->raw = raw;
+    return ptr;
+}
+
+static void system_free(void *ptr)
+{
+    free(HEADER(ptr)->raw);
+}
+
+/* called with the pool locked */
+static void release_blocks(FreeList *list, int class, int count)
+{
+    unsigned int size = class_size(class);
+    Block *b;
+
+    while (count-- && (b = list->first)) {
+        list->first = b->next;
+        list->count--;
+        if (pool_bytes + size <= POOL_BYTES) {
+            b->next = pool[class].first;
+            pool[class].first = b;
+            pool[class].count++;
+            pool_bytes += size;
+        } else
+            system_free(b);
+    }
+}
+
+#ifdef HAVE_PTHREADS
+static void cache_exit(void *opaque)
+{
+    ThreadCache *cache = opaque, **p;
+    int i;
+
+    LOCK();
+    for (i = 0; i < POOL_CLASSES; i++)
+        release_blocks(&cache->lists[i], i, INT_MAX);
+    exited_stats.nb_allocs        += cache->stats.nb_allocs;
+    exited_stats.nb_frees         += cache->stats.nb_frees;
+    exited_stats.nb_cache_hits    += cache->stats.nb_cache_hits;
+    exited_stats.nb_pool_hits     += cache->stats.nb_pool_hits;
+    exited_stats.nb_system_allocs += cache->stats.nb_system_allocs;
+    exited_stats.bytes_in_use     += cache->stats.bytes_in_use;
+    for (p = &caches; *p != cache; p = &(*p)->next);
+    *p = cache->next;
+    UNLOCK();
+    free(cache);
+}
+
+static void pool_init(void)
+{
+    pthread_key_create(&cache_key, cache_exit);
+}
+#endif
+
+static ThreadCache *get_cache(void)
+{
+#ifdef HAVE_PTHREADS
+    ThreadCache *cache;
+
+    pthread_once(&pool_once, pool_init);
+    cache = pthread_getspecific(cache_key);
+    if (cache)
+        return cache;
+    cache = calloc(1, sizeof(*cache));
+    if (!cache)
+        return NULL;
+    pthread_setspecific(cache_key, cache);
+    LOCK();
+    cache->next = caches;
+    caches = cache;
+    UNLOCK();
+    return cache;
+#else
+    caches = &main_cache;
+    return &main_cache;
+#endif
+}
+
+void *av_malloc(unsigned int size)
+{
+    ThreadCache *cache;
+    FreeList *list;
+    Block *b;
+    void *ptr;
+    int class;
+
+    /* let's disallow possible ambiguous cases */
+    if(size > (INT_MAX-16) )
+        return NULL;
+
+    cache = get_cache();
+    if (size > POOL_MAX_SIZE || !cache) {
+        ptr = system_alloc(size);
+        if (!ptr)
+            return NULL;
+        HEADER(ptr)->class = POOL_LARGE;
+        HEADER(ptr)->size  = size;
+        if (cache) {
+            cache->stats.nb_allocs++;
+            cache->stats.nb_system_allocs++;
+            cache->stats.bytes_in_use += size;
+        }
+        return ptr;
+    }
+
+    class = size_class(size);
+    size  = class_size(class);
+    list  = &cache->lists[class];
+    if (list->first) {
+        cache->stats.nb_cache_hits++;
+    } else {
+        LOCK();
+        while (pool[class].first && list->count < POOL_BATCH) {
+            b = pool[class].first;
+            pool[class].first = b->next;
+            pool[class].count--;
+            pool_bytes -= size;
+            b->next = list->first;
+            list->first = b;
+            list->count++;
+            cache->bytes += size;
+        }
+        UNLOCK();
+        if (list->first)
+            cache->stats.nb_pool_hits++;
+    }
+
+    if (list->first) {
+        b = list->first;
+        list->first = b->next;
+        list->count--;
+        cache->bytes -= size;
+        ptr = b;
+    } else {
+        ptr = system_alloc(size);
+        if (!ptr)
+            return NULL;
+        cache->stats.nb_system_allocs++;
+    }
+    HEADER(ptr)->class = class;
+    HEADER(ptr)->size  = size;
+    cache->stats.nb_allocs++;
+    cache->stats.bytes_in_use += size;
+    return ptr;
+}
+
+void *av_realloc(void *ptr, unsigned int size)
+{
+    unsigned int old_size;
+    void *new_ptr;
+
+    /* let's disallow possible ambiguous cases */
+    if(size > (INT_MAX-16) )
+        return NULL;
+
+    if (!ptr)
+        return av_malloc(size);
+    if (!size) {
+        av_free(ptr);
+        return NULL;
+    }
+    old_size = HEADER(ptr)->size;
+    if (size <= old_size && size >= old_size / 2)
+        return ptr;
+    new_ptr = av_malloc(size);
+    if (!new_ptr)
+        return NULL;
+    memcpy(new_ptr, ptr, FFMIN(size, old_size));
+    av_free(ptr);
+    return new_ptr;
+}
+
+void av_free(void *ptr)
+{
+    ThreadCache *cache;
+    FreeList *list;
+    Block *b = ptr;
+    int class;
+
+    if (!ptr)
+        return;
+
+    cache = get_cache();
+    class = HEADER(ptr)->class;
+    if (cache) {
+        cache->stats.nb_frees++;
+        cache->stats.bytes_in_use -= HEADER(ptr)->size;
+    }
+    if (class == POOL_LARGE || !cache) {
+        system_free(ptr);
+        return;
+    }
+
+    list = &cache->lists[class];
+    b->next = list->first;
+    list->first = b;
+    list->count++;
+    cache->bytes += HEADER(ptr)->size;
+    if (list->count > CACHE_BLOCKS || cache->bytes > CACHE_BYTES) {
+        int count = list->count;
+
+        LOCK();
+        release_blocks(list, class, POOL_BATCH);
+        UNLOCK();
+        cache->bytes -= (int64_t)(count - list->count) * class_size(class);
+    }
+}
+
+int av_mem_get_stats(AVMemStats *stats)
+{
+    ThreadCache *cache;
+
+    LOCK();
+    *stats = exited_stats;
+    stats->bytes_cached = pool_bytes;
+    for (cache = caches; cache; cache = cache->next) {
+        stats->nb_allocs        += cache->stats.nb_allocs;
+        stats->nb_frees         += cache->stats.nb_frees;
+        stats->nb_cache_hits    += cache->stats.nb_cache_hits;
+        stats->nb_pool_hits     += cache->stats.nb_pool_hits;
+        stats->nb_system_allocs += cache->stats.nb_system_allocs;
+        stats->bytes_in_use     += cache->stats.bytes_in_use;
+        stats->bytes_cached     += cache->bytes;
+    }
+    UNLOCK();
+    return 0;
+}
+
+#else /* CONFIG_MEMPOOL */
+
 void *av_malloc(unsigned int size)
 {
     void *ptr;
@@ -122,6 +451,14 @@ void av_free(void *ptr)
 #endif
 }
 
+int av_mem_get_stats(AVMemStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    return -1;
+}
+
+#endif /* CONFIG_MEMPOOL */
+
 void av_freep(void *arg)
 {
     void **ptr= (void**)arg;
@@ -149,3 +486,358 @@ char *av_strdup(const char *s)
     return ptr;
 }
 
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    unsigned int size;
+    unsigned int used;
+} ArenaChunk;
+
+#define ARENA_HEADER ((sizeof(ArenaChunk) + 15) & ~15)
+
+struct AVArena {
+    ArenaChunk *chunks;         ///< the last allocated first
+    unsigned int chunk_size;
+};
+
+AVArena *av_arena_alloc(unsigned int chunk_size)
+{
+    AVArena *arena = av_mallocz(sizeof(AVArena));
+
+    if (arena)
+        arena->chunk_size = FFMAX(chunk_size, 16);
+    return arena;
+}
+
+void *av_arena_malloc(AVArena *arena, unsigned int size)
+{
+    ArenaChunk *c = arena->chunks;
+    uint8_t *ptr;
+
+    if (size > INT_MAX - 16 - ARENA_HEADER)
+        return NULL;
+    size = (size + 15) & ~15;
+    if (!c || c->size - c->used < size) {
+        unsigned int chunk_size = FFMAX(arena->chunk_size, size);
+
+        c = av_malloc(ARENA_HEADER + chunk_size);
+        if (!c)
+            return NULL;
+        c->size = chunk_size;
+        c->used = 0;
+        c->next = arena->chunks;
+        arena->chunks = c;
+    }
+    ptr = (uint8_t *)c + ARENA_HEADER + c->used;
+    c->used += size;
+    return ptr;
+}
+
+void av_arena_reset(AVArena *arena)
+{
+    ArenaChunk *c, *next;
+    int64_t total = 0;
+
+    if (!arena->chunks)
+        return;
+    if (!arena->chunks->next) {
+        arena->chunks->used = 0;
+        return;
+    }
+    /* the next chunk will hold what needed several */
+    for (c = arena->chunks; c; c = next) {
+        next = c->next;
+        total += c->size;
+        av_free(c);
+    }
+    arena->chunks = NULL;
+    arena->chunk_size = FFMIN(total, INT_MAX / 2);
+}
+
+void av_arena_free(AVArena **arena)
+{
+    ArenaChunk *c, *next;
+
+    if (!*arena)
+        return;
+    for (c = (*arena)->chunks; c; c = next) {
+        next = c->next;
+        av_free(c);
+    }
+    av_freep(arena);
+}
+
+static void lock_account(AVMemAccount *acct)
+{
+    while (ff_atomic_int_cas(&acct->lock, 0, 1))
+        ff_atomic_yield();
+}
+
+static void unlock_account(AVMemAccount *acct)
+{
+    ff_atomic_barrier();
+    acct->lock = 0;
+}
+
+int av_mem_account_charge(AVMemAccount *acct, int64_t size)
+{
+    AVMemAccount *a;
+
+    for (a = acct; a; a = a->parent) {
+        lock_account(a);
+        if (a->hard_limit && a->used + size > a->hard_limit) {
+            unlock_account(a);
+            /* undo the charges of the children */
+            for (; acct != a; acct = acct->parent) {
+                lock_account(acct);
+                acct->used -= size;
+                unlock_account(acct);
+            }
+            return -1;
+        }
+        a->used += size;
+        a->peak  = FFMAX(a->peak, a->used);
+        unlock_account(a);
+    }
+    return 0;
+}
+
+void av_mem_account_release(AVMemAccount *acct, int64_t size)
+{
+    for (; acct; acct = acct->parent) {
+        lock_account(acct);
+        acct->used -= size;
+        unlock_account(acct);
+    }
+}
+
+int av_mem_account_over_soft_limit(AVMemAccount *acct)
+{
+    for (; acct; acct = acct->parent)
+        if (acct->soft_limit && av_mem_account_used(acct) > acct->soft_limit)
+            return 1;
+    return 0;
+}
+
+int64_t av_mem_account_used(AVMemAccount *acct)
+{
+    int64_t used;
+
+    lock_account(acct);
+    used = acct->used;
+    unlock_account(acct);
+    return used;
+}
+
+void av_mem_account_reset(AVMemAccount *acct, AVMemAccount *parent)
+{
+    acct->used   = 0;
+    acct->peak   = 0;
+    acct->parent = parent;
+    acct->lock   = 0;
+}
+
+
+#ifdef TEST
+#undef printf
+#undef random
+#include <stdio.h>
+#include <sys/time.h>
+
+#define THREADS 4
+#define SLOTS   256
+
+static int64_t gettime(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * INT64_C(1000000) + tv.tv_usec;
+}
+
+static unsigned int test_size(unsigned int *seed)
+{
+    *seed = *seed * 1664525 + 1013904223;
+    /* mostly small blocks, some up to twice the largest class */
+    return (*seed >> 8) % ((*seed >> 28) ? 4096 : 2 << 20);
+}
+
+static int fill(uint8_t *p, unsigned int size, int v)
+{
+    if ((intptr_t)p & 15)
+        return -1;
+    memset(p, v, FFMIN(size, 64));
+    if (size > 64)
+        memset(p + size - 64, v, 64);
+    return 0;
+}
+
+static int check(const uint8_t *p, unsigned int size, int v)
+{
+    unsigned int i;
+
+    for (i = 0; i < FFMIN(size, 64); i++)
+        if (p[i] != (uint8_t)v || (size > 64 && p[size - 1 - i] != (uint8_t)v))
+            return -1;
+    return 0;
+}
+
+/* frees the blocks of the previous thread, so that blocks cross threads */
+static uint8_t *volatile shared[THREADS][SLOTS];
+static unsigned int shared_size[THREADS][SLOTS];
+
+static int stress(int id, int iterations)
+{
+    uint8_t *ptr[SLOTS] = { NULL };
+    unsigned int size[SLOTS];
+    unsigned int seed = id;
+    int i, j;
+
+    for (i = 0; i < iterations; i++) {
+        j = i % SLOTS;
+        if (ptr[j]) {
+            if (check(ptr[j], size[j], j + i / SLOTS - 1))
+                return -1;
+            if (i & 1) {
+                av_free(ptr[j]);
+            } else {
+                unsigned int s = test_size(&seed);
+                uint8_t *p = av_realloc(ptr[j], s);
+
+                if (!p && s)
+                    return -1;
+                if (check(p, FFMIN(FFMIN(s, size[j]), 64), j + i / SLOTS - 1))
+                    return -1;
+                ptr[j] = p;
+                size[j] = s;
+                if (fill(p, s, j + i / SLOTS))
+                    return -1;
+                continue;
+            }
+        }
+        size[j] = test_size(&seed);
+        ptr[j] = av_malloc(size[j]);
+        if (!ptr[j] || fill(ptr[j], size[j], j + i / SLOTS))
+            return -1;
+    }
+    for (j = 0; j < SLOTS; j++) {
+        shared[id][j] = ptr[j];
+        shared_size[id][j] = size[j];
+    }
+    return 0;
+}
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+
+static void *stress_thread(void *arg)
+{
+    return (void *)(intptr_t)stress((intptr_t)arg, 100000);
+}
+#endif
+
+int main(void)
+{
+    AVMemStats stats0, stats;
+    AVArena *arena;
+    int64_t t;
+    int i, j, ret = 0;
+
+#ifdef CONFIG_MEMPOOL
+    for (i = 1; i <= POOL_MAX_SIZE; i++) {
+        int c = size_class(i);
+        if (c >= POOL_CLASSES || class_size(c) < i || (c && class_size(c - 1) >= i)) {
+            printf("size %d: wrong class %d\n", i, c);
+            return 1;
+        }
+    }
+#endif
+    av_mem_get_stats(&stats0);
+
+#ifdef HAVE_PTHREADS
+    {
+        pthread_t threads[THREADS];
+        void *r;
+
+        for (i = 0; i < THREADS; i++)
+            pthread_create(&threads[i], NULL, stress_thread, (void *)(intptr_t)i);
+        for (i = 0; i < THREADS; i++) {
+            pthread_join(threads[i], &r);
+            if (r) {
+                printf("thread %d: corrupted block\n", i);
+                ret = 1;
+            }
+        }
+    }
+#else
+    for (i = 0; i < THREADS; i++)
+        if (stress(i, 100000)) {
+            printf("corrupted block\n");
+            ret = 1;
+        }
+#endif
+    for (i = 0; i < THREADS; i++)
+        for (j = 0; j < SLOTS; j++)
+            av_free(shared[i][j]);
+
+    av_mem_get_stats(&stats);
+    printf("allocs %"PRId64" frees %"PRId64" cache hits %"PRId64" pool hits %"PRId64
+           " system %"PRId64" in use %"PRId64" cached %"PRId64"\n",
+           stats.nb_allocs - stats0.nb_allocs, stats.nb_frees - stats0.nb_frees,
+           stats.nb_cache_hits, stats.nb_pool_hits, stats.nb_system_allocs,
+           stats.bytes_in_use - stats0.bytes_in_use, stats.bytes_cached);
+    if (stats.nb_allocs - stats0.nb_allocs != stats.nb_frees - stats0.nb_frees ||
+        stats.bytes_in_use != stats0.bytes_in_use) {
+        printf("leaked blocks\n");
+        ret = 1;
+    }
+
+    t = gettime();
+    for (i = 0; i < 1000000; i++)
+        av_free(av_malloc(i & 4095));
+    printf("malloc+free: %.1f ns\n", (gettime() - t) / 1000.0);
+
+    arena = av_arena_alloc(1000);
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 100; j++) {
+            uint8_t *p = av_arena_malloc(arena, j * 3);
+            if (!p || fill(p, j * 3, j)) {
+                printf("arena block misaligned\n");
+                ret = 1;
+            }
+        }
+        av_arena_reset(arena);
+    }
+    if (!arena->chunks || arena->chunks->next) {
+        printf("arena not merged into one chunk\n");
+        ret = 1;
+    }
+    av_arena_free(&arena);
+
+    {
+        AVMemAccount parent = { .hard_limit = 1000, .soft_limit = 500 };
+        AVMemAccount child  = { .hard_limit = 800, .parent = &parent };
+        AVMemAccount other  = { .parent = &parent };
+
+        if (av_mem_account_charge(&child, 600) || av_mem_account_over_soft_limit(&child) != 1 ||
+            !av_mem_account_charge(&child, 300) || !av_mem_account_charge(&other, 500) ||
+            av_mem_account_charge(&other, 400) || parent.used != 1000 || child.used != 600) {
+            printf("memory account limits not enforced\n");
+            ret = 1;
+        }
+        av_mem_account_release(&child, 600);
+        av_mem_account_release(&other, 400);
+        if (parent.used || parent.peak != 1000 || av_mem_account_over_soft_limit(&child)) {
+            printf("memory account not released\n");
+            ret = 1;
+        }
+        child.used = 100;
+        child.lock = 1;
+        av_mem_account_reset(&child, NULL);
+        if (child.used || child.lock || child.parent || child.hard_limit != 800) {
+            printf("memory account not reset\n");
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
+#endif /* TEST */
@@ -26,6 +26,8 @@
 #ifndef FFMPEG_MEM_H
 #define FFMPEG_MEM_H
 
+#include <stdint.h>
+
 #ifdef __ICC
     #define DECLARE_ALIGNED(n,t,v)      t v __attribute__ ((aligned (n)))
     #define DECLARE_ASM_CONST(n,t,v)    const t __attribute__ ((aligned (n))) v
@@ -116,4 +118,106 @@ char *av_strdup(const char *s) av_malloc_attrib;
  */
 void av_freep(void *ptr);
 
+/**
+ * Statistics of the memory allocator, summed over all the threads.
+ * They are only kept if FFmpeg was configured with --enable-mempool,
+ * which caches the freed blocks in size classes in each thread and in a
+ * pool shared by the threads, to serve the next allocations.
+ */
+typedef struct AVMemStats {
+    int64_t nb_allocs;          ///< blocks allocated
+    int64_t nb_frees;           ///< blocks freed
+    int64_t nb_cache_hits;      ///< allocations served by the cache of the thread
+    int64_t nb_pool_hits;       ///< allocations served by the shared pool
+    int64_t nb_system_allocs;   ///< allocations passed to the system allocator
+    int64_t bytes_in_use;       ///< allocated and not freed, rounded up to the size classes
+    int64_t bytes_cached;       ///< freed and kept in the caches and the pool
+} AVMemStats;
+
+/**
+ * Gets the statistics of the memory allocator. While other threads
+ * allocate, they are approximate.
+ * @return 0 on success, a negative value if the allocator keeps no
+ * statistics
+ */
+int av_mem_get_stats(AVMemStats *stats);
+
+/**
+ * An arena hands out blocks of memory which are all freed at once, for
+ * the temporaries of the processing of a frame for example.
+ */
+typedef struct AVArena AVArena;
+
+/**
+ * Allocates an arena.
+ * @param chunk_size size of the chunks of memory the blocks are carved
+ * out of, a chunk is allocated when the last one is full
+ * @return the arena, NULL if it cannot be allocated
+ */
+AVArena *av_arena_alloc(unsigned int chunk_size);
+
+/**
+ * Allocates a block of \p size bytes from an arena, with the alignment
+ * of av_malloc(). The block must not be freed with av_free(), it remains
+ * valid until the arena is reset or freed.
+ * @return the block, NULL if it cannot be allocated
+ */
+void *av_arena_malloc(AVArena *arena, unsigned int size) av_malloc_attrib av_alloc_size(2);
+
+/**
+ * Frees all the blocks of an arena at once. The memory is kept for the
+ * next blocks: if the blocks needed several chunks, they are replaced by
+ * a single chunk large enough for all of them.
+ */
+void av_arena_reset(AVArena *arena);
+
+/**
+ * Frees an arena and all its blocks, and sets the pointer to it to NULL.
+ * @param arena pointer to the pointer to the arena, which may be NULL
+ */
+void av_arena_free(AVArena **arena);
+
+/**
+ * Memory charged to a context, such as the packets it queues or the
+ * pictures it decodes into, with optional budgets. The limits may be set
+ * at any time, the other fields are maintained by the av_mem_account
+ * functions.
+ */
+typedef struct AVMemAccount {
+    int64_t used;                   ///< bytes currently charged, see av_mem_account_used()
+    int64_t peak;                   ///< largest value used had
+    int64_t soft_limit;             ///< bytes above which the owner should hold less, 0 for no limit
+    int64_t hard_limit;             ///< bytes above which charges fail, 0 for no limit
+    struct AVMemAccount *parent;    ///< account charged along with this one, may be NULL
+    volatile int lock;              ///< private
+} AVMemAccount;
+
+/**
+ * Charges size bytes to an account and all its parents.
+ * @return 0 on success, a negative value if this would take one of them
+ * over its hard limit, nothing is charged then
+ */
+int av_mem_account_charge(AVMemAccount *acct, int64_t size);
+
+/**
+ * Releases size bytes charged with av_mem_account_charge().
+ */
+void av_mem_account_release(AVMemAccount *acct, int64_t size);
+
+/**
+ * @return nonzero if an account or one of its parents is over its soft limit
+ */
+int av_mem_account_over_soft_limit(AVMemAccount *acct);
+
+/**
+ * @return the bytes currently charged to an account
+ */
+int64_t av_mem_account_used(AVMemAccount *acct);
+
+/**
+ * Clears the usage of an account and links it to a new parent, keeping its
+ * limits, for an account copied along with the structure holding it.
+ */
+void av_mem_account_reset(AVMemAccount *acct, AVMemAccount *parent);
+
 #endif /* FFMPEG_MEM_H */
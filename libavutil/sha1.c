@@ -22,6 +22,10 @@
 #include "common.h"
 #include "bswap.h"
 #include "sha1.h"
+#if defined(ARCH_X86_64) && defined(HAVE_SHA_NI)
+#include <string.h>
+#include "x86_cpu.h"
+#endif
 
 typedef struct AVSHA1 {
     uint64_t count;
@@ -96,6 +100,107 @@ static void transform(uint32_t state[5], const uint8_t buffer[64]){
     state[4] += e;
 }
 
+#if defined(ARCH_X86_64) && defined(HAVE_SHA_NI)
+static int sha1_cpu_caps = -1;
+
+#define PADDD(a, b)        asm("paddd %1, %0"         : "+x"(a) : "x"(b))
+#define PSHUFB(a, b)       asm("pshufb %1, %0"        : "+x"(a) : "x"(b))
+#define PSHUFD(a, imm)     asm("pshufd $"#imm", %0, %0" : "+x"(a))
+#define SHA1RNDS4(a, e, f) asm("sha1rnds4 $"#f", %1, %0" : "+x"(a) : "x"(e))
+#define SHA1NEXTE(e, m)    asm("sha1nexte %1, %0"     : "+x"(e) : "x"(m))
+#define SHA1MSG1(a, b)     asm("sha1msg1 %1, %0"      : "+x"(a) : "x"(b))
+#define SHA1MSG2(a, b)     asm("sha1msg2 %1, %0"      : "+x"(a) : "x"(b))
+
+/* 4 rounds with the message words of cur, e the sum of e and them so far;
+   next, m1 and x are the words of the next 3 rounds, in the making */
+#define ROUNDS4(e, e_next, f, cur, next, m1, x) \
+    SHA1NEXTE(e, cur);                          \
+    e_next = abcd;                              \
+    SHA1MSG2(next, cur);                        \
+    SHA1RNDS4(abcd, e, f);                      \
+    SHA1MSG1(m1, cur);                          \
+    x ^= cur;
+
+/**
+ * Hashes blocks with the SHA instructions, which compute 4 rounds and
+ * the message schedule 4 words at a time.
+ */
+static void transform_sha_ni(uint32_t state[5], const uint8_t *buffer, int nb_blocks){
+    ff_xmm bswap = { 0x08090a0b0c0d0e0fLL, 0x0001020304050607LL };
+    ff_xmm abcd, e0, e1, m0, m1, m2, m3, abcd_save, e_save;
+
+    memcpy(&abcd, state, 16);
+    PSHUFD(abcd, 0x1B);
+    e0 = (ff_xmm){ 0, (int64_t)state[4] << 32 };
+
+    for(; nb_blocks > 0; nb_blocks--, buffer += 64){
+        abcd_save = abcd;
+        e_save    = e0;
+        memcpy(&m0, buffer     , 16);
+        memcpy(&m1, buffer + 16, 16);
+        memcpy(&m2, buffer + 32, 16);
+        memcpy(&m3, buffer + 48, 16);
+        PSHUFB(m0, bswap);
+        PSHUFB(m1, bswap);
+        PSHUFB(m2, bswap);
+        PSHUFB(m3, bswap);
+
+        PADDD(e0, m0);
+        e1 = abcd;
+        SHA1RNDS4(abcd, e0, 0);
+
+        SHA1NEXTE(e1, m1);
+        e0 = abcd;
+        SHA1RNDS4(abcd, e1, 0);
+        SHA1MSG1(m0, m1);
+
+        SHA1NEXTE(e0, m2);
+        e1 = abcd;
+        SHA1RNDS4(abcd, e0, 0);
+        SHA1MSG1(m1, m2);
+        m0 ^= m2;
+
+        ROUNDS4(e1, e0, 0, m3, m0, m2, m1)
+        ROUNDS4(e0, e1, 0, m0, m1, m3, m2)
+        ROUNDS4(e1, e0, 1, m1, m2, m0, m3)
+        ROUNDS4(e0, e1, 1, m2, m3, m1, m0)
+        ROUNDS4(e1, e0, 1, m3, m0, m2, m1)
+        ROUNDS4(e0, e1, 1, m0, m1, m3, m2)
+        ROUNDS4(e1, e0, 1, m1, m2, m0, m3)
+        ROUNDS4(e0, e1, 2, m2, m3, m1, m0)
+        ROUNDS4(e1, e0, 2, m3, m0, m2, m1)
+        ROUNDS4(e0, e1, 2, m0, m1, m3, m2)
+        ROUNDS4(e1, e0, 2, m1, m2, m0, m3)
+        ROUNDS4(e0, e1, 2, m2, m3, m1, m0)
+        ROUNDS4(e1, e0, 3, m3, m0, m2, m1)
+        ROUNDS4(e0, e1, 3, m0, m1, m3, m2)
+        ROUNDS4(e1, e0, 3, m1, m2, m0, m3)
+        ROUNDS4(e0, e1, 3, m2, m3, m1, m0)
+        ROUNDS4(e1, e0, 3, m3, m0, m2, m1)
+
+        SHA1NEXTE(e0, e_save);
+        PADDD(abcd, abcd_save);
+    }
+
+    PSHUFD(abcd, 0x1B);
+    memcpy(state, &abcd, 16);
+    state[4] = e0[1] >> 32;
+}
+#endif
+
+static void transform_blocks(uint32_t state[5], const uint8_t *buffer, int nb_blocks){
+#if defined(ARCH_X86_64) && defined(HAVE_SHA_NI)
+    if (sha1_cpu_caps < 0)
+        sha1_cpu_caps = ff_x86_cpu_caps();
+    if ((sha1_cpu_caps & (FF_X86_SHA|FF_X86_SSSE3)) == (FF_X86_SHA|FF_X86_SSSE3)) {
+        transform_sha_ni(state, buffer, nb_blocks);
+        return;
+    }
+#endif
+    for(; nb_blocks > 0; nb_blocks--, buffer += 64)
+        transform(state, buffer);
+}
+
 void av_sha1_init(AVSHA1* ctx){
     ctx->state[0] = 0x67452301;
     ctx->state[1] = 0xEFCDAB89;
@@ -114,17 +219,16 @@ void av_sha1_update(AVSHA1* ctx, const uint8_t* data, unsigned int len){
     for( i = 0; i < len; i++ ){
         ctx->buffer[ j++ ] = data[i];
         if( 64 == j ){
-            transform(ctx->state, ctx->buffer);
+            transform_blocks(ctx->state, ctx->buffer, 1);
             j = 0;
         }
     }
 #else
     if ((j + len) > 63) {
         memcpy(&ctx->buffer[j], data, (i = 64-j));
-        transform(ctx->state, ctx->buffer);
-        for ( ; i + 63 < len; i += 64) {
-            transform(ctx->state, &data[i]);
-        }
+        transform_blocks(ctx->state, ctx->buffer, 1);
+        transform_blocks(ctx->state, &data[i], (len - i) >> 6);
+        i += (len - i) & ~63;
         j=0;
     }
     else i = 0;
@@ -149,12 +253,36 @@ void av_sha1_final(AVSHA1* ctx, uint8_t digest[20]){
 // gcc -DTEST -DHAVE_AV_CONFIG_H -I.. sha1.c -O2 -W -Wall -o sha1 && time ./sha1
 #ifdef TEST
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
 #undef printf
+#undef fprintf
+#undef malloc
+#undef free
+
+static void hash(uint8_t *digest, const uint8_t *buf, int len, int piece){
+    AVSHA1 ctx;
+    int i;
+
+    av_sha1_init(&ctx);
+    for(i=0; i<len; i+=piece)
+        av_sha1_update(&ctx, buf + i, FFMIN(piece, len - i));
+    av_sha1_final(&ctx, digest);
+}
+
+static int64_t gettime(void){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
 int main(void){
-    int i, k;
+    int i, k, len, err = 0;
     AVSHA1 ctx;
-    unsigned char digest[20];
+    unsigned char digest[20], ref[20];
+    uint8_t *buf = malloc(1 << 20);
+    int64_t t;
 
     for(k=0; k<3; k++){
         av_sha1_init(&ctx);
@@ -175,6 +303,38 @@ int main(void){
            "84983E44 1C3BD26E BAAE4AA1 F95129E5 E54670F1\n"
            "34AA973C D4C4DAA4 F61EEB2B DBAD2731 6534016F\n");
 
-    return 0;
+    for(i=0; i<1<<20; i++)
+        buf[i] = i * 2654435761U >> 24;
+    /* hashing in pieces, with the SHA instructions if any, against hashing
+       in one go with the C code */
+    for(len=0; len<3000; len+=7){
+#if defined(ARCH_X86_64) && defined(HAVE_SHA_NI)
+        sha1_cpu_caps = 0;
+#endif
+        hash(ref, buf + (len & 15), len, len + 1);
+#if defined(ARCH_X86_64) && defined(HAVE_SHA_NI)
+        sha1_cpu_caps = -1;
+#endif
+        for(k=1; k<=len+1; k+=len/3+13){
+            hash(digest, buf + (len & 15), len, k);
+            if(memcmp(digest, ref, 20)){
+                printf("mismatch with length %d, pieces of %d\n", len, k);
+                err = 1;
+            }
+        }
+    }
+    for(k=0; k<2; k++){
+#if defined(ARCH_X86_64) && defined(HAVE_SHA_NI)
+        sha1_cpu_caps = k ? -1 : 0;
+#endif
+        t = gettime();
+        for(i=0; i<64; i++)
+            hash(digest, buf, 1<<20, 1<<20);
+        t = gettime() - t;
+        fprintf(stderr, "%s: %"PRId64" MB/s\n", k ? "sha1" : "sha1 C", 64 * INT64_C(1000000) / FFMAX(t, 1));
+    }
+    free(buf);
+
+    return err;
 }
 #endif
@@ -0,0 +1,952 @@
+/*
+ * Lock-free FIFOs shared between threads
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file threadfifo.c
+ * Lock-free FIFOs shared between threads.
+ *
+ * The single producer, single consumer ring has a write index owned by the
+ * producer and a read index owned by the consumer, which each publishes
+ * after copying the data. The multiple producer, multiple consumer queue
+ * is the bounded queue of Dmitry Vyukov: each cell has a sequence number
+ * which tells whether it was written for the current lap, and threads
+ * claim cells with a compare and swap of the write or read index.
+ *
+ * The indexes grow without bound and wrap around as unsigned integers, the
+ * capacity being a power of 2.
+ */
+
+#include <limits.h>
+#include <string.h>
+#include "common.h"
+#include "atomic.h"
+#include "threadfifo.h"
+#ifdef HAVE_LINUX_FUTEX_H
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#if defined(HAVE_LINUX_FUTEX_H) && defined(SYS_futex)
+#define USE_FUTEX 1
+#ifndef FUTEX_WAIT_PRIVATE
+#define FUTEX_WAIT_PRIVATE FUTEX_WAIT
+#define FUTEX_WAKE_PRIVATE FUTEX_WAKE
+#endif
+#elif defined(HAVE_PTHREADS)
+#define USE_COND 1
+#endif
+
+/* without threads, nothing would end a wait */
+#if defined(USE_FUTEX) || defined(USE_COND)
+#define CAN_WAIT 1
+#else
+#define CAN_WAIT 0
+#endif
+
+#define CACHE_LINE 64           ///< keeps what each side writes apart
+#define MAX_ELEMS  (1 << 30)
+#define CELL_DATA  8            ///< offset of the element in an MPMC cell
+
+#if defined(HAVE_ATOMICS) || !defined(HAVE_PTHREADS)
+#ifdef ARCH_X86
+/* x86 does not move loads before older loads, so only the compiler has to
+   be kept from doing it */
+#define acquire_barrier() __asm__ volatile("" ::: "memory")
+#else
+#define acquire_barrier ff_atomic_barrier
+#endif
+
+/** reads an index before the data it covers */
+static inline int load_acquire(volatile int *p)
+{
+    int v = *p;
+    acquire_barrier();
+    return v;
+}
+
+#define full_barrier  ff_atomic_barrier
+#define cas           ff_atomic_int_cas
+#define add_and_fetch ff_atomic_int_add_and_fetch
+#else
+/* without atomic operations, a mutex orders the accesses to the indexes */
+static pthread_mutex_t atomic_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int load_acquire(volatile int *p)
+{
+    int v;
+    pthread_mutex_lock(&atomic_mutex);
+    v = *p;
+    pthread_mutex_unlock(&atomic_mutex);
+    return v;
+}
+
+static void full_barrier(void)
+{
+    pthread_mutex_lock(&atomic_mutex);
+    pthread_mutex_unlock(&atomic_mutex);
+}
+
+static int cas(volatile int *p, int oldval, int newval)
+{
+    int v;
+    pthread_mutex_lock(&atomic_mutex);
+    v = *p;
+    if (v == oldval)
+        *p = newval;
+    pthread_mutex_unlock(&atomic_mutex);
+    return v;
+}
+
+static int add_and_fetch(volatile int *p, int inc)
+{
+    int v;
+    pthread_mutex_lock(&atomic_mutex);
+    v = *p += inc;
+    pthread_mutex_unlock(&atomic_mutex);
+    return v;
+}
+#endif
+
+/**
+ * Eventcount the threads blocked on a full or empty FIFO sleep on.
+ * A waiter raises a flag before it checks the FIFO a last time, and a
+ * thread which changed the FIFO only makes a system call if it sees the
+ * flag after that change. The first such thread lowers the flag, so that
+ * the following changes are free until a thread waits again.
+ * Both sides write then read, so each needs a full barrier in between: the
+ * waiter has one after raising the flag, and the FIFO is changed with an
+ * atomic operation, which is one, so that checking the flag is a plain load.
+ */
+typedef struct FifoEvent {
+    volatile int seq;           ///< incremented by each wake up
+    volatile int waiting;       ///< set by the waiters, cleared by the waker
+#ifdef USE_COND
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+} FifoEvent;
+
+static void event_init(FifoEvent *ev)
+{
+    ev->seq = ev->waiting = 0;
+#ifdef USE_COND
+    pthread_mutex_init(&ev->mutex, NULL);
+    pthread_cond_init(&ev->cond, NULL);
+#endif
+}
+
+static void event_uninit(FifoEvent *ev)
+{
+#ifdef USE_COND
+    pthread_mutex_destroy(&ev->mutex);
+    pthread_cond_destroy(&ev->cond);
+#endif
+}
+
+/** @return the value to give event_wait() */
+static int event_prepare(FifoEvent *ev)
+{
+    ev->waiting = 1;
+    full_barrier();
+    return load_acquire(&ev->seq);
+}
+
+/** sleeps unless the event was signaled since event_prepare() */
+static void event_wait(FifoEvent *ev, int seq)
+{
+#ifdef USE_FUTEX
+    syscall(SYS_futex, &ev->seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+#elif defined(USE_COND)
+    pthread_mutex_lock(&ev->mutex);
+    while (ev->seq == seq)
+        pthread_cond_wait(&ev->cond, &ev->mutex);
+    pthread_mutex_unlock(&ev->mutex);
+#endif
+}
+
+/** wakes up the waiters, after the FIFO was changed by an atomic operation */
+static void event_signal(FifoEvent *ev)
+{
+    if (!load_acquire(&ev->waiting) || cas(&ev->waiting, 1, 0) != 1)
+        return;
+#ifdef USE_FUTEX
+    add_and_fetch(&ev->seq, 1);
+    syscall(SYS_futex, &ev->seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#elif defined(USE_COND)
+    pthread_mutex_lock(&ev->mutex);
+    ev->seq++;
+    pthread_cond_broadcast(&ev->cond);
+    pthread_mutex_unlock(&ev->mutex);
+#endif
+}
+
+static unsigned int round_capacity(unsigned int nb_elems)
+{
+    unsigned int n = 1;
+
+    while (n < nb_elems)
+        n <<= 1;
+    return n;
+}
+
+struct AVSPSCFifo {
+    uint8_t *buffer;
+    unsigned int mask;          ///< capacity - 1
+    int elem_size;
+    volatile int closed;
+    FifoEvent readable, writable;
+
+    uint8_t pad0[CACHE_LINE];
+    volatile int head;          ///< elements written, by the producer
+    unsigned int cached_tail;   ///< tail as last read by the producer
+
+    uint8_t pad1[CACHE_LINE];
+    volatile int tail;          ///< elements read, by the consumer
+    unsigned int cached_head;   ///< head as last read by the consumer
+
+    uint8_t pad2[CACHE_LINE];
+};
+
+AVSPSCFifo *av_spsc_fifo_alloc(unsigned int nb_elems, unsigned int elem_size)
+{
+    AVSPSCFifo *f;
+
+    if (!nb_elems || nb_elems > MAX_ELEMS || !elem_size ||
+        round_capacity(nb_elems) > INT_MAX / elem_size)
+        return NULL;
+    f = av_mallocz(sizeof(*f));
+    if (!f)
+        return NULL;
+    f->mask      = round_capacity(nb_elems) - 1;
+    f->elem_size = elem_size;
+    f->buffer    = av_malloc((f->mask + 1) * elem_size);
+    if (!f->buffer) {
+        av_free(f);
+        return NULL;
+    }
+    event_init(&f->readable);
+    event_init(&f->writable);
+    return f;
+}
+
+void av_spsc_fifo_free(AVSPSCFifo **f)
+{
+    if (!*f)
+        return;
+    event_uninit(&(*f)->readable);
+    event_uninit(&(*f)->writable);
+    av_free((*f)->buffer);
+    av_freep(f);
+}
+
+/** copies n elements into the ring, starting at index pos */
+static void ring_write(AVSPSCFifo *f, unsigned int pos, const uint8_t *buf, int n)
+{
+    unsigned int i = pos & f->mask;
+    int k = FFMIN(n, f->mask + 1 - i);
+
+    memcpy(f->buffer + i * f->elem_size, buf, k * f->elem_size);
+    memcpy(f->buffer, buf + k * f->elem_size, (n - k) * f->elem_size);
+}
+
+/** copies n elements out of the ring, starting at index pos */
+static void ring_read(AVSPSCFifo *f, unsigned int pos, uint8_t *buf, int n)
+{
+    unsigned int i = pos & f->mask;
+    int k = FFMIN(n, f->mask + 1 - i);
+
+    memcpy(buf, f->buffer + i * f->elem_size, k * f->elem_size);
+    memcpy(buf + k * f->elem_size, f->buffer, (n - k) * f->elem_size);
+}
+
+int av_spsc_fifo_write(AVSPSCFifo *f, const void *buf, int nb_elems, int flags)
+{
+    const uint8_t *src = buf;
+    unsigned int head = f->head;
+    int done = 0;
+
+    while (done < nb_elems) {
+        int space, seq;
+
+        if (load_acquire(&f->closed))
+            return done ? done : -1;
+        space = f->mask + 1 - (head - f->cached_tail);
+        if (!space) {
+            f->cached_tail = load_acquire(&f->tail);
+            space = f->mask + 1 - (head - f->cached_tail);
+        }
+        if (!space) {
+            if (!(flags & AV_THREAD_FIFO_BLOCK) || !CAN_WAIT)
+                break;
+            seq = event_prepare(&f->writable);
+            if (!f->closed && load_acquire(&f->tail) == f->cached_tail)
+                event_wait(&f->writable, seq);
+            continue;
+        }
+        space = FFMIN(space, nb_elems - done);
+        ring_write(f, head, src + done * f->elem_size, space);
+        head = add_and_fetch(&f->head, space);
+        event_signal(&f->readable);
+        done += space;
+    }
+    return done;
+}
+
+int av_spsc_fifo_read(AVSPSCFifo *f, void *buf, int nb_elems, int flags)
+{
+    uint8_t *dst = buf;
+    unsigned int tail = f->tail;
+    int done = 0;
+
+    while (done < nb_elems) {
+        int avail = f->cached_head - tail;
+
+        if (!avail) {
+            /* the last writes are seen if closed is */
+            int closed = load_acquire(&f->closed);
+            int seq;
+
+            f->cached_head = load_acquire(&f->head);
+            avail = f->cached_head - tail;
+            if (!avail) {
+                if (closed)
+                    return done ? done : -1;
+                if (!(flags & AV_THREAD_FIFO_BLOCK) || !CAN_WAIT)
+                    break;
+                seq = event_prepare(&f->readable);
+                if (!f->closed && load_acquire(&f->head) == tail)
+                    event_wait(&f->readable, seq);
+                continue;
+            }
+        }
+        avail = FFMIN(avail, nb_elems - done);
+        ring_read(f, tail, dst + done * f->elem_size, avail);
+        tail = add_and_fetch(&f->tail, avail);
+        event_signal(&f->writable);
+        done += avail;
+    }
+    return done;
+}
+
+int av_spsc_fifo_peek(AVSPSCFifo *f, void *buf, int nb_elems, int flags)
+{
+    unsigned int tail = f->tail;
+    int avail, closed, seq;
+
+    if ((flags & AV_THREAD_FIFO_BLOCK) && nb_elems > f->mask + 1)
+        return -1;
+    for (;;) {
+        closed = load_acquire(&f->closed);
+        f->cached_head = load_acquire(&f->head);
+        avail = f->cached_head - tail;
+        if (avail >= nb_elems || closed || !(flags & AV_THREAD_FIFO_BLOCK) || !CAN_WAIT)
+            break;
+        seq = event_prepare(&f->readable);
+        if (!f->closed && load_acquire(&f->head) == f->cached_head)
+            event_wait(&f->readable, seq);
+    }
+    if (!avail && closed)
+        return nb_elems ? -1 : 0;
+    avail = FFMIN(avail, nb_elems);
+    ring_read(f, tail, buf, avail);
+    return avail;
+}
+
+int av_spsc_fifo_can_read(AVSPSCFifo *f)
+{
+    return load_acquire(&f->head) - (unsigned int)load_acquire(&f->tail);
+}
+
+int av_spsc_fifo_can_write(AVSPSCFifo *f)
+{
+    return f->mask + 1 - (load_acquire(&f->head) - (unsigned int)load_acquire(&f->tail));
+}
+
+void av_spsc_fifo_close(AVSPSCFifo *f)
+{
+    cas(&f->closed, 0, 1);
+    event_signal(&f->readable);
+    event_signal(&f->writable);
+}
+
+struct AVMPMCFifo {
+    uint8_t *cells;             ///< sequence number followed by the element
+    unsigned int mask;          ///< capacity - 1
+    int elem_size;
+    int cell_size;
+    volatile int closed;
+    FifoEvent readable, writable;
+
+    uint8_t pad0[CACHE_LINE];
+    volatile int write_pos;
+
+    uint8_t pad1[CACHE_LINE];
+    volatile int read_pos;
+
+    uint8_t pad2[CACHE_LINE];
+};
+
+/* the sequence number of a cell is its index when it is free for the
+   current lap of the writers, index + 1 when it holds an element */
+#define CELL(f, pos) ((f)->cells + ((pos) & (f)->mask) * (f)->cell_size)
+#define CELL_SEQ(c)  ((volatile int *)(c))
+
+AVMPMCFifo *av_mpmc_fifo_alloc(unsigned int nb_elems, unsigned int elem_size)
+{
+    AVMPMCFifo *f;
+    unsigned int i, cell_size = (CELL_DATA + elem_size + 7) & ~7;
+
+    if (!nb_elems || nb_elems > MAX_ELEMS || !elem_size || elem_size > INT_MAX / 2 ||
+        round_capacity(nb_elems) > INT_MAX / cell_size)
+        return NULL;
+    f = av_mallocz(sizeof(*f));
+    if (!f)
+        return NULL;
+    f->mask      = round_capacity(nb_elems) - 1;
+    f->elem_size = elem_size;
+    f->cell_size = cell_size;
+    f->cells     = av_malloc((f->mask + 1) * cell_size);
+    if (!f->cells) {
+        av_free(f);
+        return NULL;
+    }
+    for (i = 0; i <= f->mask; i++)
+        *CELL_SEQ(CELL(f, i)) = i;
+    event_init(&f->readable);
+    event_init(&f->writable);
+    return f;
+}
+
+void av_mpmc_fifo_free(AVMPMCFifo **f)
+{
+    if (!*f)
+        return;
+    event_uninit(&(*f)->readable);
+    event_uninit(&(*f)->writable);
+    av_free((*f)->cells);
+    av_freep(f);
+}
+
+/** @return 1 if the element was written, 0 if the FIFO is full */
+static int mpmc_try_write(AVMPMCFifo *f, const void *elem)
+{
+    unsigned int pos = load_acquire(&f->write_pos);
+
+    for (;;) {
+        uint8_t *cell = CELL(f, pos);
+        int dif = load_acquire(CELL_SEQ(cell)) - pos;
+
+        if (!dif) {
+            unsigned int cur = cas(&f->write_pos, pos, pos + 1);
+            if (cur == pos) {
+                memcpy(cell + CELL_DATA, elem, f->elem_size);
+                add_and_fetch(CELL_SEQ(cell), 1);
+                return 1;
+            }
+            pos = cur;
+        } else if (dif < 0) {
+            return 0;
+        } else
+            pos = load_acquire(&f->write_pos);
+    }
+}
+
+/** @return 1 if an element was read, 0 if the FIFO is empty */
+static int mpmc_try_read(AVMPMCFifo *f, void *elem)
+{
+    unsigned int pos = load_acquire(&f->read_pos);
+
+    for (;;) {
+        uint8_t *cell = CELL(f, pos);
+        int dif = load_acquire(CELL_SEQ(cell)) - (pos + 1);
+
+        if (!dif) {
+            unsigned int cur = cas(&f->read_pos, pos, pos + 1);
+            if (cur == pos) {
+                memcpy(elem, cell + CELL_DATA, f->elem_size);
+                add_and_fetch(CELL_SEQ(cell), f->mask);
+                return 1;
+            }
+            pos = cur;
+        } else if (dif < 0) {
+            return 0;
+        } else
+            pos = load_acquire(&f->read_pos);
+    }
+}
+
+static int mpmc_full(AVMPMCFifo *f)
+{
+    unsigned int pos = load_acquire(&f->write_pos);
+    return (int)(load_acquire(CELL_SEQ(CELL(f, pos))) - pos) < 0;
+}
+
+static int mpmc_empty(AVMPMCFifo *f)
+{
+    unsigned int pos = load_acquire(&f->read_pos);
+    return (int)(load_acquire(CELL_SEQ(CELL(f, pos))) - (pos + 1)) < 0;
+}
+
+int av_mpmc_fifo_write(AVMPMCFifo *f, const void *elem, int flags)
+{
+    for (;;) {
+        int seq;
+
+        if (load_acquire(&f->closed))
+            return -1;
+        if (mpmc_try_write(f, elem)) {
+            event_signal(&f->readable);
+            return 1;
+        }
+        if (!(flags & AV_THREAD_FIFO_BLOCK) || !CAN_WAIT)
+            return 0;
+        seq = event_prepare(&f->writable);
+        if (!f->closed && mpmc_full(f))
+            event_wait(&f->writable, seq);
+    }
+}
+
+int av_mpmc_fifo_read(AVMPMCFifo *f, void *elem, int flags)
+{
+    for (;;) {
+        int closed = load_acquire(&f->closed);
+        int seq;
+
+        if (mpmc_try_read(f, elem)) {
+            event_signal(&f->writable);
+            return 1;
+        }
+        if (closed)
+            return -1;
+        if (!(flags & AV_THREAD_FIFO_BLOCK) || !CAN_WAIT)
+            return 0;
+        seq = event_prepare(&f->readable);
+        if (!f->closed && mpmc_empty(f))
+            event_wait(&f->readable, seq);
+    }
+}
+
+int av_mpmc_fifo_peek(AVMPMCFifo *f, void *elem, int flags)
+{
+    for (;;) {
+        int closed = load_acquire(&f->closed);
+        unsigned int pos = load_acquire(&f->read_pos);
+        uint8_t *cell = CELL(f, pos);
+        int seq = load_acquire(CELL_SEQ(cell));
+        int dif = seq - (pos + 1);
+
+        if (!dif) {
+            memcpy(elem, cell + CELL_DATA, f->elem_size);
+            /* a reader took the element and a writer reused the cell */
+            if (load_acquire(CELL_SEQ(cell)) == seq)
+                return 1;
+        } else if (dif < 0) {
+            if (closed)
+                return -1;
+            if (!(flags & AV_THREAD_FIFO_BLOCK) || !CAN_WAIT)
+                return 0;
+            seq = event_prepare(&f->readable);
+            if (!f->closed && mpmc_empty(f))
+                event_wait(&f->readable, seq);
+        }
+    }
+}
+
+void av_mpmc_fifo_close(AVMPMCFifo *f)
+{
+    cas(&f->closed, 0, 1);
+    event_signal(&f->readable);
+    event_signal(&f->writable);
+}
+
+#ifdef TEST
+#undef printf
+#include <stdio.h>
+#include <sys/time.h>
+#include "fifo.h"
+#ifdef HAVE_PTHREADS
+#include <sched.h>
+#endif
+
+#define SPSC_BYTES   (16 << 20)
+#define SPSC_ELEMS   (1 << 20)
+#define MPMC_THREADS 4
+#define MPMC_ELEMS   (1 << 18)      ///< per producer
+
+static int64_t gettime(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * INT64_C(1000000) + tv.tv_usec;
+}
+
+static unsigned int rnd(unsigned int *seed)
+{
+    *seed = *seed * 1664525 + 1013904223;
+    return *seed >> 8;
+}
+
+static uint8_t stream_byte(unsigned int i)
+{
+    return i * 7 + (i >> 11);
+}
+
+#ifdef HAVE_PTHREADS
+static void *spsc_byte_writer(void *arg)
+{
+    AVSPSCFifo *f = arg;
+    uint8_t buf[1000];
+    unsigned int seed = 1, pos = 0;
+
+    while (pos < SPSC_BYTES) {
+        int i, n = FFMIN(rnd(&seed) % sizeof(buf) + 1, SPSC_BYTES - pos);
+        for (i = 0; i < n; i++)
+            buf[i] = stream_byte(pos + i);
+        if (av_spsc_fifo_write(f, buf, n, AV_THREAD_FIFO_BLOCK) != n)
+            return (void *)1;
+        pos += n;
+    }
+    av_spsc_fifo_close(f);
+    return NULL;
+}
+
+/* reads the byte stream in random sizes, peeking some of it first */
+static int spsc_byte_reader(AVSPSCFifo *f)
+{
+    uint8_t buf[1000], buf2[1000];
+    unsigned int seed = 2, pos = 0;
+    int i, n, ret;
+
+    for (;;) {
+        n = rnd(&seed) % sizeof(buf) + 1;
+        if (n & 1) {
+            ret = av_spsc_fifo_peek(f, buf2, FFMIN(n, 256), AV_THREAD_FIFO_BLOCK);
+            if (ret < 0)
+                break;
+            if (ret > FFMIN(n, 256) || av_spsc_fifo_read(f, buf, ret, 0) != ret ||
+                memcmp(buf, buf2, ret))
+                return -1;
+        } else {
+            ret = av_spsc_fifo_read(f, buf, n, AV_THREAD_FIFO_BLOCK);
+            if (ret < 0)
+                break;
+            if (ret != n && pos + ret != SPSC_BYTES)
+                return -1;
+        }
+        for (i = 0; i < ret; i++)
+            if (buf[i] != stream_byte(pos + i))
+                return -1;
+        pos += ret;
+    }
+    return pos == SPSC_BYTES ? 0 : -1;
+}
+
+typedef struct MPMCTest {
+    AVMPMCFifo *f;
+    int id;
+    int *seen;                      ///< times each element was read
+    int ret;
+} MPMCTest;
+
+static void *mpmc_writer(void *arg)
+{
+    MPMCTest *t = arg;
+    int i;
+
+    for (i = 0; i < MPMC_ELEMS; i++) {
+        int v = t->id * MPMC_ELEMS + i;
+        /* mix the blocking and the spinning waits */
+        if (i & 1) {
+            if (av_mpmc_fifo_write(t->f, &v, AV_THREAD_FIFO_BLOCK) != 1)
+                t->ret = -1;
+        } else {
+            while (!av_mpmc_fifo_write(t->f, &v, 0))
+                sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *mpmc_reader(void *arg)
+{
+    MPMCTest *t = arg;
+    int last[MPMC_THREADS], v, i;
+
+    for (i = 0; i < MPMC_THREADS; i++)
+        last[i] = -1;
+    for (;;) {
+        if (av_mpmc_fifo_read(t->f, &v, AV_THREAD_FIFO_BLOCK) < 0)
+            break;
+        if ((unsigned)v >= MPMC_THREADS * MPMC_ELEMS || v <= last[v / MPMC_ELEMS]) {
+            t->ret = -1;
+            break;
+        }
+        /* the elements of a writer are read in order */
+        last[v / MPMC_ELEMS] = v;
+        add_and_fetch(&t->seen[v], 1);
+    }
+    return NULL;
+}
+
+/* the same with a mutex around an AVFifoBuffer */
+typedef struct LockedFifo {
+    AVFifoBuffer fifo;
+    int size;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int closed;
+} LockedFifo;
+
+static void locked_write(LockedFifo *f, void *buf, int size)
+{
+    pthread_mutex_lock(&f->mutex);
+    while (f->size - av_fifo_size(&f->fifo) < size)
+        pthread_cond_wait(&f->cond, &f->mutex);
+    av_fifo_generic_write(&f->fifo, buf, size, NULL);
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->mutex);
+}
+
+static int locked_read(LockedFifo *f, void *buf, int size)
+{
+    pthread_mutex_lock(&f->mutex);
+    while (av_fifo_size(&f->fifo) < size && !f->closed)
+        pthread_cond_wait(&f->cond, &f->mutex);
+    if (av_fifo_size(&f->fifo) < size) {
+        pthread_mutex_unlock(&f->mutex);
+        return -1;
+    }
+    av_fifo_read(&f->fifo, buf, size);
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->mutex);
+    return size;
+}
+
+static void locked_close(LockedFifo *f)
+{
+    pthread_mutex_lock(&f->mutex);
+    f->closed = 1;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->mutex);
+}
+
+typedef struct BenchTest {
+    AVSPSCFifo *spsc;
+    AVMPMCFifo *mpmc;
+    LockedFifo *locked;
+    int nb_elems;
+} BenchTest;
+
+static void *bench_writer(void *arg)
+{
+    BenchTest *b = arg;
+    int64_t v;
+    int i;
+
+    for (i = 0; i < b->nb_elems; i++) {
+        v = i;
+        if (b->spsc)
+            av_spsc_fifo_write(b->spsc, &v, 1, AV_THREAD_FIFO_BLOCK);
+        else if (b->mpmc)
+            av_mpmc_fifo_write(b->mpmc, &v, AV_THREAD_FIFO_BLOCK);
+        else
+            locked_write(b->locked, &v, sizeof(v));
+    }
+    return NULL;
+}
+
+static void *bench_reader(void *arg)
+{
+    BenchTest *b = arg;
+    int64_t v;
+
+    if (b->spsc)
+        while (av_spsc_fifo_read(b->spsc, &v, 1, AV_THREAD_FIFO_BLOCK) > 0);
+    else if (b->mpmc)
+        while (av_mpmc_fifo_read(b->mpmc, &v, AV_THREAD_FIFO_BLOCK) > 0);
+    else
+        while (locked_read(b->locked, &v, sizeof(v)) > 0);
+    return NULL;
+}
+
+/** prints the time per element of nb_threads writers and readers */
+static void bench(const char *name, AVSPSCFifo *spsc, AVMPMCFifo *mpmc, int nb_threads)
+{
+    BenchTest b;
+    LockedFifo locked;
+    pthread_t writers[MPMC_THREADS], readers[MPMC_THREADS];
+    int64_t t;
+    int i;
+
+    b.spsc     = spsc;
+    b.mpmc     = mpmc;
+    b.locked   = NULL;
+    b.nb_elems = SPSC_ELEMS / nb_threads;
+    if (!spsc && !mpmc) {
+        av_fifo_init(&locked.fifo, 1024 * sizeof(int64_t));
+        locked.size   = 1024 * sizeof(int64_t);
+        locked.closed = 0;
+        pthread_mutex_init(&locked.mutex, NULL);
+        pthread_cond_init(&locked.cond, NULL);
+        b.locked = &locked;
+    }
+
+    t = gettime();
+    for (i = 0; i < nb_threads; i++) {
+        pthread_create(&writers[i], NULL, bench_writer, &b);
+        pthread_create(&readers[i], NULL, bench_reader, &b);
+    }
+    for (i = 0; i < nb_threads; i++)
+        pthread_join(writers[i], NULL);
+    if (spsc)
+        av_spsc_fifo_close(spsc);
+    else if (mpmc)
+        av_mpmc_fifo_close(mpmc);
+    else
+        locked_close(&locked);
+    for (i = 0; i < nb_threads; i++)
+        pthread_join(readers[i], NULL);
+    t = gettime() - t;
+
+    if (b.locked) {
+        av_fifo_free(&locked.fifo);
+        pthread_mutex_destroy(&locked.mutex);
+        pthread_cond_destroy(&locked.cond);
+    }
+    printf("%-28s %6.1f ns/element\n", name, t * 1000.0 / (b.nb_elems * nb_threads));
+}
+#endif
+
+int main(void)
+{
+    AVSPSCFifo *spsc;
+    AVMPMCFifo *mpmc;
+    int64_t buf[8];
+    int i, ret = 0;
+
+    /* single threaded semantics */
+    spsc = av_spsc_fifo_alloc(5, sizeof(int64_t));
+    for (i = 0; i < 8; i++)
+        buf[i] = i;
+    if (av_spsc_fifo_can_write(spsc) != 8 || av_spsc_fifo_write(spsc, buf, 6, 0) != 6 ||
+        av_spsc_fifo_write(spsc, buf, 6, 0) != 2 || av_spsc_fifo_can_read(spsc) != 8 ||
+        av_spsc_fifo_peek(spsc, buf, 3, 0) != 3 || buf[2] != 2 ||
+        av_spsc_fifo_read(spsc, buf, 7, 0) != 7 || buf[6] != 0 ||
+        av_spsc_fifo_read(spsc, buf, 7, 0) != 1 || buf[0] != 1 ||
+        av_spsc_fifo_read(spsc, buf, 1, 0) != 0) {
+        printf("spsc: wrong counts\n");
+        ret = 1;
+    }
+    av_spsc_fifo_write(spsc, buf, 1, 0);
+    av_spsc_fifo_close(spsc);
+    if (av_spsc_fifo_write(spsc, buf, 1, 0) != -1 ||
+        av_spsc_fifo_read(spsc, buf, 2, AV_THREAD_FIFO_BLOCK) != 1 ||
+        av_spsc_fifo_read(spsc, buf, 1, AV_THREAD_FIFO_BLOCK) != -1) {
+        printf("spsc: wrong closing\n");
+        ret = 1;
+    }
+    av_spsc_fifo_free(&spsc);
+
+    mpmc = av_mpmc_fifo_alloc(3, sizeof(int64_t));
+    for (i = 0; i < 5; i++)
+        if (av_mpmc_fifo_write(mpmc, &buf[i], 0) != (i < 4)) {
+            printf("mpmc: wrong write\n");
+            ret = 1;
+        }
+    av_mpmc_fifo_close(mpmc);
+    for (i = 0; i < 5; i++) {
+        int64_t v = -1, v2 = -1;
+        if (av_mpmc_fifo_peek(mpmc, &v2, 0) != (i < 4 ? 1 : -1) ||
+            av_mpmc_fifo_read(mpmc, &v, AV_THREAD_FIFO_BLOCK) != (i < 4 ? 1 : -1) ||
+            v != (i < 4 ? buf[i] : -1) || v != v2) {
+            printf("mpmc: wrong read\n");
+            ret = 1;
+        }
+    }
+    av_mpmc_fifo_free(&mpmc);
+
+#ifdef HAVE_PTHREADS
+    {
+        MPMCTest t[2 * MPMC_THREADS];
+        pthread_t threads[2 * MPMC_THREADS];
+        int *seen;
+        void *r;
+
+        /* a byte stream through a ring smaller than most reads */
+        spsc = av_spsc_fifo_alloc(512, 1);
+        pthread_create(&threads[0], NULL, spsc_byte_writer, spsc);
+        if (spsc_byte_reader(spsc)) {
+            printf("spsc: corrupted byte stream\n");
+            ret = 1;
+            av_spsc_fifo_close(spsc);
+        }
+        pthread_join(threads[0], &r);
+        av_spsc_fifo_free(&spsc);
+
+        /* each element read once, in order for each writer */
+        mpmc = av_mpmc_fifo_alloc(64, sizeof(int));
+        seen = av_mallocz(MPMC_THREADS * MPMC_ELEMS * sizeof(*seen));
+        for (i = 0; i < 2 * MPMC_THREADS; i++) {
+            t[i].f    = mpmc;
+            t[i].id   = i % MPMC_THREADS;
+            t[i].seen = seen;
+            t[i].ret  = 0;
+            pthread_create(&threads[i], NULL, i < MPMC_THREADS ? mpmc_writer : mpmc_reader, &t[i]);
+        }
+        for (i = 0; i < MPMC_THREADS; i++)
+            pthread_join(threads[i], NULL);
+        av_mpmc_fifo_close(mpmc);
+        for (i = MPMC_THREADS; i < 2 * MPMC_THREADS; i++)
+            pthread_join(threads[i], NULL);
+        for (i = 0; i < 2 * MPMC_THREADS; i++)
+            if (t[i].ret) {
+                printf("mpmc: thread %d failed\n", i);
+                ret = 1;
+            }
+        for (i = 0; i < MPMC_THREADS * MPMC_ELEMS; i++)
+            if (seen[i] != 1) {
+                printf("mpmc: element %d read %d times\n", i, seen[i]);
+                ret = 1;
+                break;
+            }
+        av_free(seen);
+        av_mpmc_fifo_free(&mpmc);
+
+        spsc = av_spsc_fifo_alloc(1024, sizeof(int64_t));
+        bench("spsc fifo", spsc, NULL, 1);
+        av_spsc_fifo_free(&spsc);
+        bench("mutex fifo", NULL, NULL, 1);
+        mpmc = av_mpmc_fifo_alloc(1024, sizeof(int64_t));
+        bench("mpmc fifo, 1 writer", NULL, mpmc, 1);
+        av_mpmc_fifo_free(&mpmc);
+        mpmc = av_mpmc_fifo_alloc(1024, sizeof(int64_t));
+        bench("mpmc fifo, 4 writers", NULL, mpmc, MPMC_THREADS);
+        av_mpmc_fifo_free(&mpmc);
+        bench("mutex fifo, 4 writers", NULL, NULL, MPMC_THREADS);
+    }
+#endif
+
+    return ret;
+}
+#endif /* TEST */
@@ -0,0 +1,144 @@
+/*
+ * Lock-free FIFOs shared between threads
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FFMPEG_THREADFIFO_H
+#define FFMPEG_THREADFIFO_H
+
+/**
+ * @file threadfifo.h
+ * Bounded FIFOs which threads share without a mutex.
+ *
+ * AVSPSCFifo is a ring of bytes or of fixed size elements, written by one
+ * thread and read by one other thread. AVMPMCFifo is a queue of fixed
+ * size elements which any number of threads write and read.
+ *
+ * Reads and writes copy the data and do not block unless
+ * AV_THREAD_FIFO_BLOCK is given. Blocked threads sleep on a futex where
+ * the system has one, on a condition variable otherwise. Without threads
+ * AV_THREAD_FIFO_BLOCK is ignored.
+ *
+ * Closing a FIFO wakes up the blocked threads: writes fail from then on,
+ * reads return what remains and then fail.
+ */
+
+/** wait until the whole request can be served or the FIFO is closed */
+#define AV_THREAD_FIFO_BLOCK 1
+
+typedef struct AVSPSCFifo AVSPSCFifo;
+typedef struct AVMPMCFifo AVMPMCFifo;
+
+/**
+ * Allocates a single producer, single consumer FIFO.
+ *
+ * @param nb_elems  capacity, rounded up to a power of 2
+ * @param elem_size size of an element in bytes, 1 for a byte stream
+ * @return the FIFO or NULL on failure
+ */
+AVSPSCFifo *av_spsc_fifo_alloc(unsigned int nb_elems, unsigned int elem_size);
+
+/**
+ * Frees a FIFO and sets *f to NULL. No thread may use it anymore.
+ */
+void av_spsc_fifo_free(AVSPSCFifo **f);
+
+/**
+ * Writes elements, from the producer thread only.
+ *
+ * @param buf   nb_elems elements
+ * @param flags AV_THREAD_FIFO_BLOCK or 0
+ * @return number of elements written, which is less than nb_elems only
+ *         without AV_THREAD_FIFO_BLOCK or if the FIFO was closed meanwhile,
+ *         -1 if it is closed and nothing was written
+ */
+int av_spsc_fifo_write(AVSPSCFifo *f, const void *buf, int nb_elems, int flags);
+
+/**
+ * Reads elements, from the consumer thread only.
+ *
+ * @param buf   room for nb_elems elements
+ * @param flags AV_THREAD_FIFO_BLOCK or 0
+ * @return number of elements read, which is less than nb_elems only
+ *         without AV_THREAD_FIFO_BLOCK or if the FIFO was closed meanwhile,
+ *         -1 if it is closed and empty
+ */
+int av_spsc_fifo_read(AVSPSCFifo *f, void *buf, int nb_elems, int flags);
+
+/**
+ * Copies the oldest elements without removing them, from the consumer
+ * thread only. With AV_THREAD_FIFO_BLOCK, nb_elems may not exceed the
+ * capacity. Returns like av_spsc_fifo_read().
+ */
+int av_spsc_fifo_peek(AVSPSCFifo *f, void *buf, int nb_elems, int flags);
+
+/** @return number of elements which can be read */
+int av_spsc_fifo_can_read(AVSPSCFifo *f);
+
+/** @return number of elements which can be written */
+int av_spsc_fifo_can_write(AVSPSCFifo *f);
+
+/**
+ * Closes a FIFO, from either thread, and wakes up the other one.
+ */
+void av_spsc_fifo_close(AVSPSCFifo *f);
+
+/**
+ * Allocates a multiple producer, multiple consumer FIFO.
+ *
+ * @param nb_elems  capacity, rounded up to a power of 2
+ * @param elem_size size of an element in bytes
+ * @return the FIFO or NULL on failure
+ */
+AVMPMCFifo *av_mpmc_fifo_alloc(unsigned int nb_elems, unsigned int elem_size);
+
+/**
+ * Frees a FIFO and sets *f to NULL. No thread may use it anymore.
+ */
+void av_mpmc_fifo_free(AVMPMCFifo **f);
+
+/**
+ * Writes one element.
+ *
+ * @param flags AV_THREAD_FIFO_BLOCK or 0
+ * @return 1 if the element was written, 0 if the FIFO is full,
+ *         -1 if it is closed
+ */
+int av_mpmc_fifo_write(AVMPMCFifo *f, const void *elem, int flags);
+
+/**
+ * Reads one element.
+ *
+ * @param flags AV_THREAD_FIFO_BLOCK or 0
+ * @return 1 if an element was read, 0 if the FIFO is empty,
+ *         -1 if it is closed and empty
+ */
+int av_mpmc_fifo_read(AVMPMCFifo *f, void *elem, int flags);
+
+/**
+ * Copies the oldest element without removing it. Another thread may read
+ * it in the meantime. Returns like av_mpmc_fifo_read().
+ */
+int av_mpmc_fifo_peek(AVMPMCFifo *f, void *elem, int flags);
+
+/**
+ * Closes a FIFO and wakes up the blocked threads.
+ */
+void av_mpmc_fifo_close(AVMPMCFifo *f);
+
+#endif /* FFMPEG_THREADFIFO_H */
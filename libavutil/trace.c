@@ -0,0 +1,335 @@
+/*
+ * Runtime tracing of named scopes
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file trace.c
+ * Runtime tracing of named scopes.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "common.h"
+#include "log.h"
+#include "trace.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#undef fprintf
+
+#define TRACE_EVENTS 4096       ///< events buffered by a thread before they are written out
+#define TRACE_DEPTH  32         ///< nesting of the scopes of a thread
+#define TRACE_SCOPES 32         ///< scope names counted by a thread
+
+typedef struct TraceEvent {
+    const char *name;
+    int64_t time;
+    int phase;                  ///< 'B'egin or 'E'nd
+} TraceEvent;
+
+typedef struct TraceThread {
+    struct TraceThread *next;
+    int tid;
+    TraceEvent events[TRACE_EVENTS];
+    int nb_events;
+    const char *scope[TRACE_DEPTH];     ///< entered and not yet left
+    int64_t scope_start[TRACE_DEPTH];
+    int depth;
+    AVTraceStat stats[TRACE_SCOPES];
+    int nb_stats;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_t mutex;              ///< taken by the thread around each event
+#endif
+} TraceThread;
+
+int av_trace_enabled;
+
+static FILE *trace_file;
+static int64_t trace_epoch;
+static int nb_written;                  ///< events in trace_file
+static TraceThread *threads;
+static int nb_threads;
+static AVTraceStat retired[TRACE_SCOPES];   ///< of the threads which exited
+static int nb_retired;
+
+/* threads_mutex protects the list of threads and the statistics of the
+   threads which exited, it is taken before the mutex of a thread, and
+   file_mutex after it */
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t file_mutex    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+#define LOCK(m)   pthread_mutex_lock(m)
+#define UNLOCK(m) pthread_mutex_unlock(m)
+#else
+static TraceThread main_thread;
+#define LOCK(m)
+#define UNLOCK(m)
+#endif
+
+/** @return a monotonic time in nanoseconds */
+static int64_t trace_time(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * INT64_C(1000000000) + tv.tv_usec * 1000;
+#endif
+}
+
+static void add_stat(AVTraceStat *stats, int *nb_stats, const char *name,
+                     int64_t count, int64_t total, int64_t max)
+{
+    int i;
+
+    for(i = 0; i < *nb_stats; i++)
+        if (stats[i].name == name || !strcmp(stats[i].name, name))
+            break;
+    if (i == *nb_stats) {
+        if (i == TRACE_SCOPES)
+            return;
+        memset(&stats[i], 0, sizeof(stats[i]));
+        stats[i].name = name;
+        (*nb_stats)++;
+    }
+    stats[i].count += count;
+    stats[i].total += total;
+    stats[i].max    = FFMAX(stats[i].max, max);
+}
+
+/* called with the mutex of the thread */
+static void write_events(TraceThread *t)
+{
+    int i;
+
+    LOCK(&file_mutex);
+    if (trace_file) {
+        for(i = 0; i < t->nb_events; i++)
+            fprintf(trace_file,
+                    "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                    nb_written++ ? ",\n" : "", t->events[i].name, t->events[i].phase,
+                    (t->events[i].time - trace_epoch) / 1000.0, t->tid);
+    }
+    UNLOCK(&file_mutex);
+    t->nb_events = 0;
+}
+
+#ifdef HAVE_PTHREADS
+/* keep the statistics of an exiting thread */
+static void thread_exit(void *opaque)
+{
+    TraceThread *t = opaque, **p;
+    int i;
+
+    LOCK(&threads_mutex);
+    for(p = &threads; *p != t; p = &(*p)->next);
+    *p = t->next;
+    LOCK(&t->mutex);
+    write_events(t);
+    for(i = 0; i < t->nb_stats; i++)
+        add_stat(retired, &nb_retired, t->stats[i].name,
+                 t->stats[i].count, t->stats[i].total, t->stats[i].max);
+    UNLOCK(&t->mutex);
+    UNLOCK(&threads_mutex);
+
+    pthread_mutex_destroy(&t->mutex);
+    av_free(t);
+}
+
+static void trace_init(void)
+{
+    pthread_key_create(&trace_key, thread_exit);
+}
+#endif
+
+static TraceThread *get_thread(void)
+{
+#ifdef HAVE_PTHREADS
+    TraceThread *t;
+
+    pthread_once(&trace_once, trace_init);
+    t = pthread_getspecific(trace_key);
+    if (t)
+        return t;
+
+    t = av_mallocz(sizeof(*t));
+    if (!t)
+        return NULL;
+    pthread_mutex_init(&t->mutex, NULL);
+    pthread_setspecific(trace_key, t);
+    LOCK(&threads_mutex);
+    t->tid  = ++nb_threads;
+    t->next = threads;
+    threads = t;
+    UNLOCK(&threads_mutex);
+    return t;
+#else
+    if (!main_thread.tid) {
+        main_thread.tid = ++nb_threads;
+        threads = &main_thread;
+    }
+    return &main_thread;
+#endif
+}
+
+static void add_event(TraceThread *t, const char *name, int64_t time, int phase)
+{
+    if (!trace_file)
+        return;
+    if (t->nb_events == TRACE_EVENTS)
+        write_events(t);
+    t->events[t->nb_events].name  = name;
+    t->events[t->nb_events].time  = time;
+    t->events[t->nb_events].phase = phase;
+    t->nb_events++;
+}
+
+void av_trace_begin(const char *name)
+{
+    TraceThread *t = get_thread();
+    int64_t time = trace_time();
+
+    if (!t)
+        return;
+    LOCK(&t->mutex);
+    if (t->depth < TRACE_DEPTH) {
+        t->scope[t->depth]       = name;
+        t->scope_start[t->depth] = time;
+    }
+    t->depth++;
+    add_event(t, name, time, 'B');
+    UNLOCK(&t->mutex);
+}
+
+void av_trace_end(const char *name)
+{
+    TraceThread *t = get_thread();
+    int64_t time = trace_time();
+
+    if (!t)
+        return;
+    LOCK(&t->mutex);
+    /* the scope was entered before tracing started */
+    if (!t->depth)
+        goto end;
+    t->depth--;
+    if (t->depth < TRACE_DEPTH) {
+        if (t->scope[t->depth] != name && strcmp(t->scope[t->depth], name))
+            av_log(NULL, AV_LOG_DEBUG, "trace: end of %s within %s\n",
+                   name, t->scope[t->depth]);
+        add_stat(t->stats, &t->nb_stats, t->scope[t->depth], 1,
+                 time - t->scope_start[t->depth], time - t->scope_start[t->depth]);
+        name = t->scope[t->depth];
+    }
+    add_event(t, name, time, 'E');
+ end:
+    UNLOCK(&t->mutex);
+}
+
+int av_trace_start(const char *filename)
+{
+    TraceThread *t;
+    int ret = 0;
+
+    LOCK(&threads_mutex);
+    if (av_trace_enabled) {
+        ret = -1;
+        goto end;
+    }
+    if (filename) {
+        trace_file = fopen(filename, "w");
+        if (!trace_file) {
+            av_log(NULL, AV_LOG_ERROR, "trace: cannot create %s\n", filename);
+            ret = -1;
+            goto end;
+        }
+        fprintf(trace_file, "{\"traceEvents\":[\n");
+        nb_written = 0;
+    }
+    trace_epoch = trace_time();
+    /* forget the scopes of an earlier trace which were not left */
+    for(t = threads; t; t = t->next) {
+        LOCK(&t->mutex);
+        t->depth = 0;
+        UNLOCK(&t->mutex);
+    }
+    av_trace_enabled = 1;
+ end:
+    UNLOCK(&threads_mutex);
+    return ret;
+}
+
+void av_trace_stop(void)
+{
+    TraceThread *t;
+
+    LOCK(&threads_mutex);
+    av_trace_enabled = 0;
+    for(t = threads; t; t = t->next) {
+        LOCK(&t->mutex);
+        write_events(t);
+        UNLOCK(&t->mutex);
+    }
+    LOCK(&file_mutex);
+    if (trace_file) {
+        fprintf(trace_file, "\n]}\n");
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+    UNLOCK(&file_mutex);
+    UNLOCK(&threads_mutex);
+}
+
+int av_trace_get_stats(AVTraceStat *stats, int nb_stats, int reset)
+{
+    AVTraceStat all[TRACE_SCOPES];
+    TraceThread *t;
+    int nb_all = 0, i;
+
+    LOCK(&threads_mutex);
+    for(i = 0; i < nb_retired; i++)
+        add_stat(all, &nb_all, retired[i].name,
+                 retired[i].count, retired[i].total, retired[i].max);
+    if (reset)
+        nb_retired = 0;
+    for(t = threads; t; t = t->next) {
+        LOCK(&t->mutex);
+        for(i = 0; i < t->nb_stats; i++)
+            add_stat(all, &nb_all, t->stats[i].name,
+                     t->stats[i].count, t->stats[i].total, t->stats[i].max);
+        if (reset)
+            t->nb_stats = 0;
+        UNLOCK(&t->mutex);
+    }
+    UNLOCK(&threads_mutex);
+
+    nb_stats = FFMIN(nb_stats, nb_all);
+    memcpy(stats, all, nb_stats * sizeof(*stats));
+    return nb_stats;
+}
@@ -0,0 +1,95 @@
+/*
+ * Runtime tracing of named scopes
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FFMPEG_TRACE_H
+#define FFMPEG_TRACE_H
+
+/**
+ * @file trace.h
+ * Runtime tracing of named scopes.
+ *
+ * The libraries mark where they demux, parse, decode, decode slices,
+ * filter, encode, mux and wait for I/O with AV_TRACE_BEGIN() and
+ * AV_TRACE_END(). Those cost a test of av_trace_enabled until
+ * av_trace_start() is called. Then each thread buffers the begin and end
+ * events of its scopes, which are written out to a file in the Chrome
+ * trace event format (chrome://tracing), and sums the time spent in each
+ * scope, which av_trace_get_stats() returns.
+ *
+ * START_TIMER/STOP_TIMER remain for counting the cycles of a piece of code
+ * in a test build.
+ */
+
+#include <stdint.h>
+
+/** non zero between av_trace_start() and av_trace_stop() */
+extern int av_trace_enabled;
+
+#define AV_TRACE_BEGIN(name) do { if (av_trace_enabled) av_trace_begin(name); } while (0)
+#define AV_TRACE_END(name)   do { if (av_trace_enabled) av_trace_end(name); } while (0)
+
+/** time spent in a scope, summed over all the threads */
+typedef struct AVTraceStat {
+    const char *name;
+    int64_t count;              ///< scopes ended
+    int64_t total;              ///< time spent in them, in nanoseconds
+    int64_t max;                ///< longest of them, in nanoseconds
+} AVTraceStat;
+
+/**
+ * Starts tracing.
+ *
+ * @param filename file to write the events to, or NULL to only sum up
+ *                 the time spent in the scopes
+ * @return 0 on success, a negative value if tracing already is started or
+ *         the file cannot be created
+ */
+int av_trace_start(const char *filename);
+
+/**
+ * Stops tracing, writes out the buffered events and closes the file.
+ * The statistics are kept.
+ */
+void av_trace_stop(void);
+
+/**
+ * Enters a scope of the calling thread. name must remain valid until the
+ * end of the process, a string literal usually.
+ */
+void av_trace_begin(const char *name);
+
+/**
+ * Leaves the innermost scope of the calling thread, which should be
+ * called name. Scopes entered before tracing started are not reported.
+ */
+void av_trace_end(const char *name);
+
+/**
+ * Gets the time spent in each scope since tracing first started or since
+ * the last reset, as a snapshot that can be polled periodically.
+ *
+ * @param stats     array filled with one entry per scope name
+ * @param nb_stats  size of stats
+ * @param reset     if non zero, the statistics start over
+ * @return number of entries filled
+ */
+int av_trace_get_stats(AVTraceStat *stats, int nb_stats, int reset);
+
+#endif /* FFMPEG_TRACE_H */
@@ -125,20 +125,90 @@ void *av_tree_insert(AVTreeNode **tp, void *key, int (*cmp)(void *key, const voi
 }
 
 void av_tree_destroy(AVTreeNode *t){
-    av_tree_destroy(t->child[0]);
-    av_tree_destroy(t->child[1]);
-    av_free(t);
+    if(t){
+        av_tree_destroy(t->child[0]);
+        av_tree_destroy(t->child[1]);
+        av_free(t);
+    }
 }
 
-#if 0
-void av_tree_enumerate(AVTreeNode *t, void *opaque, int (*f)(void *opaque, void *elem)){
-    int v= f(opaque, t->elem);
-    if(v>=0) av_tree_enumerate(t->child[0], opaque, f);
-    if(v<=0) av_tree_enumerate(t->child[1], opaque, f);
+static AVTreeNode *build(void * const *elems, int nb_elems, AVTreeNode **nodes, int *height){
+    AVTreeNode *t= *nodes;
+    int left, right, mid= nb_elems>>1;
+
+    if(!nb_elems){
+        *height= 0;
+        return NULL;
+    }
+    (*nodes)++;
+    t->child[0]= build(elems        , mid             , nodes, &left );
+    t->child[1]= build(elems + mid+1, nb_elems - mid-1, nodes, &right);
+    t->elem= elems[mid];
+    t->state= right - left;
+    *height= FFMAX(left, right) + 1;
+    return t;
+}
+
+AVTreeNode *av_tree_build(void * const *elems, int nb_elems, AVTreeNode *nodes){
+    int height;
+    return build(elems, nb_elems, &nodes, &height);
+}
+
+int av_tree_enumerate(AVTreeNode *t, void *opaque, int (*cmp)(void *opaque, void *elem), int (*enu)(void *opaque, void *elem)){
+    int v, ret;
+
+    if(!t)
+        return 0;
+    v= cmp ? cmp(opaque, t->elem) : 0;
+    if(v>=0 && (ret= av_tree_enumerate(t->child[0], opaque, cmp, enu)))
+        return ret;
+    if(!v && (ret= enu(opaque, t->elem)))
+        return ret;
+    if(v<=0)
+        return av_tree_enumerate(t->child[1], opaque, cmp, enu);
+    return 0;
+}
+
+static void push_left(AVTreeIterator *it, const AVTreeNode *t){
+    for(; t; t= t->child[0])
+        it->stack[it->depth++]= t;
+}
+
+void *av_tree_iter_first(AVTreeIterator *it, const AVTreeNode *t, void *key, int (*cmp)(void *key, const void *b)){
+    it->depth= 0;
+    if(!key){
+        push_left(it, t);
+    }else{
+        while(t){
+            int v= cmp(key, t->elem);
+            if(v>0){
+                t= t->child[1];
+            }else{
+                it->stack[it->depth++]= t;
+                if(!v)
+                    break;
+                t= t->child[0];
+            }
+        }
+    }
+    return it->depth ? it->stack[it->depth-1]->elem : NULL;
+}
+
+void *av_tree_iter_next(AVTreeIterator *it){
+    if(!it->depth)
+        return NULL;
+    it->depth--;
+    push_left(it, it->stack[it->depth]->child[1]);
+    return it->depth ? it->stack[it->depth-1]->elem : NULL;
 }
-#endif
 
 #ifdef TEST
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#undef printf
+#undef malloc
+#undef free
 #undef random
 static int check(AVTreeNode *t){
     if(t){
@@ -171,9 +241,33 @@ int cmp(const void *a, const void *b){
     return a-b;
 }
 
+static int count_elem(void *opaque, void *elem){
+    (*(int*)opaque)++;
+    return 0;
+}
+
+static int in_range(void *opaque, void *elem){
+    int v= (int)(intptr_t)elem;
+    if(v < 1000) return -1;
+    if(v > 2000) return  1;
+    return 0;
+}
+
+static int64_t gettime(void){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+#define BULK 1000000
+
 int main(void){
     int i,k;
-    AVTreeNode *root= NULL, *node=NULL;
+    AVTreeNode *root= NULL, *node=NULL, *nodes;
+    AVTreeIterator it;
+    void **elems;
+    int64_t t;
+    int count, range, prev;
 
     for(i=0; i<10000; i++){
         int j= (random()%86294);
@@ -198,6 +292,54 @@ int main(void){
                 av_log(NULL, AV_LOG_ERROR, "removial failure %d\n", i);
         }
     }
+
+    count= 0;
+    av_tree_enumerate(root, &count, NULL, count_elem);
+    range= 0;
+    av_tree_enumerate(root, &range, in_range, count_elem);
+    prev= 0;
+    for(k=0, node= av_tree_iter_first(&it, root, NULL, NULL); node; node= av_tree_iter_next(&it), k++){
+        if((intptr_t)node <= prev)
+            av_log(NULL, AV_LOG_ERROR, "iteration order failure %d\n", k);
+        if((intptr_t)node >= 1000 && (intptr_t)node <= 2000)
+            range--;
+        prev= (intptr_t)node;
+    }
+    if(k != count || range)
+        av_log(NULL, AV_LOG_ERROR, "iteration count failure %d %d %d\n", k, count, range);
+    for(i=0; i<86294; i+=97){
+        void *next[2]= {NULL, NULL};
+        av_tree_find(root, (void*)(intptr_t)i, cmp, next);
+        if(av_tree_iter_first(&it, root, (void*)(intptr_t)i, cmp) != (av_tree_find(root, (void*)(intptr_t)i, cmp, NULL) ? (void*)(intptr_t)i : next[1]))
+            av_log(NULL, AV_LOG_ERROR, "lower bound failure %d\n", i);
+    }
+    av_tree_destroy(root);
+
+    elems= av_malloc(BULK * sizeof(*elems));
+    nodes= av_malloc(BULK * av_tree_node_size);
+    for(i=0; i<BULK; i++)
+        elems[i]= (void*)(intptr_t)(2*i+1);
+    t= gettime();
+    root= av_tree_build(elems, BULK, nodes);
+    t= gettime() - t;
+    if(check(root) > 999)
+        av_log(NULL, AV_LOG_ERROR, "bulk build is not balanced\n");
+    for(i=0; i<=2*BULK; i++)
+        if(!av_tree_find(root, (void*)(intptr_t)i, cmp, NULL) != !(i&1))
+            av_log(NULL, AV_LOG_ERROR, "bulk find failure %d\n", i);
+    printf("build of %d elements: %"PRId64" us\n", BULK, t);
+
+    root= NULL;
+    memset(nodes, 0, BULK * av_tree_node_size);
+    t= gettime();
+    for(i=0; i<BULK; i++){
+        node= nodes + i;
+        av_tree_insert(&root, elems[i], cmp, &node);
+    }
+    t= gettime() - t;
+    printf("%d inserts: %"PRId64" us\n", BULK, t);
+    av_free(nodes);
+    av_free(elems);
     return 0;
 }
 #endif
@@ -23,6 +23,8 @@
  * A tree container.
  * Insertion, Removial, Finding equal, largest which is smaller than and
  * smallest which is larger than all have O(log n) worst case time.
+ * Building a tree from n sorted elements takes O(n) time and iterating
+ * over n elements O(n + log n).
  * @author Michael Niedermayer <michaelni@gmx.at>
  */
 
@@ -77,6 +79,65 @@ void *av_tree_find(const struct AVTreeNode *root, void *key, int (*cmp)(void *ke
  *         should make no assumptions that it's one or the other in the code.
  */
 void *av_tree_insert(struct AVTreeNode **rootp, void *key, int (*cmp)(void *key, const void *b), struct AVTreeNode **next);
+
+/**
+ * Frees all the nodes of a tree with av_free(), but not the elements.
+ * @param t root node, may be NULL
+ */
 void av_tree_destroy(struct AVTreeNode *t);
 
+/**
+ * Builds a balanced tree out of sorted elements.
+ * The nodes are taken from an array, in which the nodes visited by a
+ * search lie close to each other. Elements can be inserted and removed
+ * afterwards, but the nodes of the array must not be freed one by one with
+ * av_tree_destroy(): an AVArena is a convenient place for the array and
+ * the nodes inserted later, the node returned by a removal can be reused
+ * for the next insertion.
+ * @param elems nb_elems elements in increasing order, without duplicates
+ * @param nodes array of nb_elems * av_tree_node_size bytes, which need not
+ *              be zeroed
+ * @return the root node, NULL if nb_elems is 0
+ */
+struct AVTreeNode *av_tree_build(void * const *elems, int nb_elems, struct AVTreeNode *nodes);
+
+/**
+ * Calls enu on the elements in increasing order, or on the elements of a
+ * range if cmp is not NULL.
+ * @param cmp compares an element to the range: negative if the element
+ *            lies below it, positive above, 0 inside
+ * @param enu called on each element, stops the enumeration by returning
+ *            non zero
+ * @return the last value returned by enu
+ */
+int av_tree_enumerate(struct AVTreeNode *t, void *opaque,
+                      int (*cmp)(void *opaque, void *elem),
+                      int (*enu)(void *opaque, void *elem));
+
+/** Maximum height of a tree, enough for more nodes than fit in memory. */
+#define AV_TREE_MAX_DEPTH 96
+
+/**
+ * Position of an iteration over the elements of a tree in increasing order.
+ * Inserting into or removing from the tree invalidates it.
+ */
+typedef struct AVTreeIterator {
+    const struct AVTreeNode *stack[AV_TREE_MAX_DEPTH]; ///< current node, under it its ancestors whose element comes later
+    int depth;
+} AVTreeIterator;
+
+/**
+ * Starts an iteration at the smallest element which is not smaller than
+ * key, or at the smallest element if key is NULL.
+ * @param cmp compares key to an element like for av_tree_find()
+ * @return that element, NULL if there is none
+ */
+void *av_tree_iter_first(AVTreeIterator *it, const struct AVTreeNode *root,
+                         void *key, int (*cmp)(void *key, const void *b));
+
+/**
+ * @return the next element, NULL at the end of the tree
+ */
+void *av_tree_iter_next(AVTreeIterator *it);
+
 #endif /* FFMPEG_TREE_H */
@@ -72,4 +72,50 @@ typedef int32_t x86_reg;
 #    define BROKEN_RELOCATIONS 1
 #endif
 
+#ifdef ARCH_X86_64
+/* instructions libavutil checks for at runtime */
+#define FF_X86_SSSE3  0x0001
+#define FF_X86_SSE41  0x0002
+#define FF_X86_PCLMUL 0x0004
+#define FF_X86_AESNI  0x0008
+#define FF_X86_SHA    0x0010
+
+/** an SSE register, for the operands of inline asm */
+typedef int64_t ff_xmm __attribute__((vector_size(16)));
+
+static inline void ff_x86_cpuid(int index, int *eax, int *ebx, int *ecx, int *edx)
+{
+    asm volatile ("mov %%"REG_b", %%"REG_S"\n\t"
+                  "cpuid\n\t"
+                  "xchg %%"REG_b", %%"REG_S
+                  : "=a" (*eax), "=S" (*ebx), "=c" (*ecx), "=d" (*edx)
+                  : "0" (index), "2" (0));
+}
+
+/** @return the FF_X86_ flags of the CPU */
+static inline int ff_x86_cpu_caps(void)
+{
+    int max_std_level, eax, ebx, ecx, edx, caps = 0;
+
+    ff_x86_cpuid(0, &max_std_level, &ebx, &ecx, &edx);
+    if (max_std_level >= 1) {
+        ff_x86_cpuid(1, &eax, &ebx, &ecx, &edx);
+        if (ecx & (1 << 9))
+            caps |= FF_X86_SSSE3;
+        if (ecx & (1 << 19))
+            caps |= FF_X86_SSE41;
+        if (ecx & (1 << 1))
+            caps |= FF_X86_PCLMUL;
+        if (ecx & (1 << 25))
+            caps |= FF_X86_AESNI;
+    }
+    if (max_std_level >= 7) {
+        ff_x86_cpuid(7, &eax, &ebx, &ecx, &edx);
+        if (ebx & (1 << 29))
+            caps |= FF_X86_SHA;
+    }
+    return caps;
+}
+#endif
+
 #endif /* FFMPEG_X86CPU_H */
@@ -535,6 +535,7 @@ int main(int argc, char **argv)
         av_freep(&oc->streams[i]->codec);
         av_freep(&oc->streams[i]);
     }
+    av_freep(&oc->streams);
 
     if (!(fmt->flags & AVFMT_NOFILE)) {
         /* close the output file */
@@ -0,0 +1,65 @@
+#!/bin/sh
+#
+# feed ffserver with ffmpeg and check the packets stored in the feed
+#
+
+# Make sure that the data directory exists
+mkdir -p tests/data
+
+conf=tests/data/feed.conf
+log=tests/data/feed.log
+
+# start ffserver on the first free port, it exits if it cannot bind it
+start_ffserver()
+{
+    for port in 9998 9988 9978 9968 9958 9948 9938 9928 ; do
+        sed "s/^Port .*/Port $port/" "$1" > $conf
+        ./ffserver -f $conf > $log 2>&1 &
+        FFSERVER_PID=$!
+        tries=0
+        while kill -0 $FFSERVER_PID 2> /dev/null ; do
+            grep -q "ffserver started" $log && return 0
+            tries=$(($tries + 1))
+            if [ $tries -ge 30 ] ; then
+                kill -9 $FFSERVER_PID > /dev/null 2>&1
+                break
+            fi
+            sleep 1
+        done
+        wait $FFSERVER_PID > /dev/null 2>&1
+    done
+    return 1
+}
+
+rm -f tests/data/feed1.ffm
+if ! start_ffserver "$2" ; then
+    echo
+    echo Feed regression test: Could not start ffserver.
+    exit 1
+fi
+
+# a hung feeder must not hang the test
+./ffmpeg_g -y -flags +bitexact -dct fastint -idct simple -f pgmyuv \
+    -i tests/vsynth1/%02d.pgm http://127.0.0.1:$port/feed1.ffm 2> /dev/null &
+FFMPEG_PID=$!
+( sleep 60; kill -9 $FFMPEG_PID ) > /dev/null 2>&1 &
+WATCHDOG_PID=$!
+wait $FFMPEG_PID
+status=$?
+kill $WATCHDOG_PID $FFSERVER_PID > /dev/null 2>&1
+wait > /dev/null 2>&1
+
+(
+    echo "feeder exit status $status"
+    ./ffmpeg_g -i tests/data/feed1.ffm -vcodec copy -f framecrc - 2> /dev/null
+) > tests/data/feed.regression
+rm -f tests/data/feed1.ffm $conf $log
+if diff -u tests/data/feed.regression "$1" ; then
+    echo
+    echo Feed regression test succeeded.
+    exit 0
+else
+    echo
+    echo Feed regression test: Error.
+    exit 1
+fi
@@ -0,0 +1,178 @@
+#!/bin/sh
+#
+# throughput and latency regression test for ffmpeg
+#
+# usage: perf.sh <results> <baseline>
+#
+# Generates video sequences from CIF to 1080p with videogen, and times
+# encoding, decoding, remuxing and transcoding them, and encoding and
+# decoding the audio of audiogen. Each scenario writes one line:
+#
+#   name  frames  fps  fpcs  maxrss  p50  p90  p99
+#
+# fps is frames per second of wall clock time, fpcs frames per second of
+# CPU time, maxrss the peak resident memory in kB, and p50/p90/p99 are
+# percentiles of the time taken by each frame in the main step of the
+# scenario, in ms: encode, decode or, for remuxing, mux. A frame is a
+# packet for remuxing and audio. Each scenario is run PERF_RUNS times and
+# the best value of each column is kept. The audio is repeated 10 times
+# so that it takes long enough to be timed.
+#
+# The results are compared to the baseline, if it exists, and the test
+# fails if one is worse by more than PERF_TOLERANCE percent for fps, fpcs
+# and maxrss, or by more than PERF_LATENCY_TOLERANCE percent for the
+# latencies. The frame rates of scenarios which took less than 0.1 second
+# are not compared. Without a baseline, the results become the baseline.
+
+LC_ALL=C
+export LC_ALL
+
+results="$1"
+baseline="$2"
+
+: ${PERF_SIZES:="352x288 704x576 1280x720 1920x1080"}
+: ${PERF_FRAMES:=25}
+: ${PERF_RUNS:=3}
+: ${PERF_TOLERANCE:=10}
+: ${PERF_LATENCY_TOLERANCE:=25}
+
+datadir="./tests/data/perf"
+ffmpeg="./ffmpeg_g"
+videogen="tests/videogen"
+pcm_src="tests/asynth1.sw"
+bench="$datadir/bench.tmp"
+trace="$datadir/trace.tmp"
+log="$datadir/log.tmp"
+runs="$datadir/runs.tmp"
+
+mkdir -p $datadir
+rm -f "$results"
+echo "# name                        frames      fps     fpcs   maxrss      p50      p90      p99" > "$results"
+
+# count and percentiles of the durations of a step in the trace
+step_latency()
+{
+    awk -F'"' -v step="$1" '
+        $4 == step {
+            ts = $11; gsub(/[^0-9.]/, "", ts)
+            tid = $15; gsub(/[^0-9]/, "", tid)
+            if ($8 == "B")
+                begin[tid] = ts
+            else if (tid in begin) {
+                printf "%.6f\n", (ts - begin[tid]) / 1000
+                delete begin[tid]
+            }
+        }' $trace | sort -n | awk '
+        { v[NR] = $1 }
+        END {
+            if (!NR) { print 0, 0, 0, 0; exit }
+            print NR, v[int((NR - 1) * 0.50) + 1], v[int((NR - 1) * 0.90) + 1], v[int((NR - 1) * 0.99) + 1]
+        }'
+}
+
+# run <name> <step> <ffmpeg options>
+run()
+{
+    name="$1"
+    step="$2"
+    shift 2
+    echo $ffmpeg $*
+    rm -f $runs
+    i=0
+    while [ $i -lt $PERF_RUNS ]; do
+        if ! $ffmpeg -y -benchmark -trace $trace "$@" > $bench 2> $log; then
+            cat $log
+            exit 1
+        fi
+        times=`sed -n 's/^bench: utime=\([0-9.]*\)s rtime=\([0-9.]*\)s maxrss=\([0-9]*\)kB$/\1 \2 \3/p' $bench`
+        echo $times `step_latency $step` >> $runs
+        i=`expr $i + 1`
+    done
+    # keep the best value of each column
+    awk -v name=$name '
+        {
+            utime = $1 > 0 ? $1 : 0.001; rtime = $2 > 0 ? $2 : 0.001
+            frames = $4
+            v[1] = $4 / rtime; v[2] = $4 / utime; v[3] = $3; v[4] = $5; v[5] = $6; v[6] = $7
+            for (i = 1; i <= 6; i++)
+                if (NR == 1 || (i <= 2 ? v[i] > best[i] : v[i] < best[i]))
+                    best[i] = v[i]
+        }
+        END {
+            printf "%-28s %6d %8.1f %8.1f %8d %8.3f %8.3f %8.3f\n", name, frames, best[1], best[2], best[3], best[4], best[5], best[6]
+        }' $runs >> "$results"
+}
+
+for size in $PERF_SIZES; do
+    w=${size%x*}
+    h=${size#*x}
+    src="$datadir/$size"
+    if [ ! -f $src/`printf %02d \`expr $PERF_FRAMES - 1\``.pgm ]; then
+        rm -rf $src
+        mkdir -p $src
+        $videogen $src/ $w $h $PERF_FRAMES
+    fi
+
+    run encode-mpeg4-$size      encode -f image2 -i $src/%02d.pgm -vcodec mpeg4 -qscale 5 $datadir/$size.mpeg4.avi
+    run encode-mpeg2video-$size encode -f image2 -i $src/%02d.pgm -vcodec mpeg2video -qscale 5 $datadir/$size.mpeg2.mpg
+    run encode-mjpeg-$size      encode -f image2 -i $src/%02d.pgm -vcodec mjpeg -qscale 5 $datadir/$size.mjpeg.avi
+
+    run decode-mpeg4-$size      decode -i $datadir/$size.mpeg4.avi -f null /dev/null
+    run decode-mpeg2video-$size decode -i $datadir/$size.mpeg2.mpg -f null /dev/null
+    run decode-mjpeg-$size      decode -i $datadir/$size.mjpeg.avi -f null /dev/null
+
+    run remux-mpegts-$size      mux -i $datadir/$size.mpeg4.avi -vcodec copy -f mpegts $datadir/$size.remux.ts
+    run remux-mov-$size         mux -i $datadir/$size.mpeg4.avi -vcodec copy $datadir/$size.remux.mov
+
+    run transcode-$size         encode -i $datadir/$size.mpeg2.mpg -vcodec mpeg4 -qscale 5 $datadir/$size.transcode.avi
+done
+
+pcm_long="$datadir/audio.sw"
+for i in 0 1 2 3 4 5 6 7 8 9; do cat $pcm_src; done > $pcm_long
+
+run encode-mp2 encode -f s16le -ar 44100 -ac 2 -i $pcm_long -acodec mp2 -ab 128k $datadir/audio.mp2
+run encode-ac3 encode -f s16le -ar 44100 -ac 2 -i $pcm_long -acodec ac3 -ab 128k $datadir/audio.ac3
+run decode-mp2 decode -i $datadir/audio.mp2 -f null /dev/null
+run decode-ac3 decode -i $datadir/audio.ac3 -f null /dev/null
+
+rm -f $bench $trace $log $runs
+
+if [ ! -f "$baseline" ]; then
+    cp "$results" "$baseline"
+    echo
+    echo "perf regression test: no baseline, $baseline created"
+    exit 0
+fi
+
+if awk -v tol=$PERF_TOLERANCE -v ltol=$PERF_LATENCY_TOLERANCE '
+    BEGIN { split("name frames fps fpcs maxrss p50 p90 p99", col) }
+    /^#/ { next }
+    FNR == NR { for (i = 2; i <= 8; i++) base[$1, i] = $i; known[$1] = 1; next }
+    {
+        if (!($1 in known)) {
+            printf "%-28s not in the baseline\n", $1
+            next
+        }
+        for (i = 3; i <= 8; i++) {
+            b = base[$1, i]
+            if (i <= 4)
+                worse = $i < b * (100 - tol) / 100 && base[$1, 2] / b >= 0.1
+            else if (i == 5)
+                worse = $i > b * (100 + tol) / 100
+            else    # ignore the jitter of the shortest steps
+                worse = $i > b * (100 + ltol) / 100 && $i - b > 0.1
+            if (worse) {
+                printf "%-28s %-6s %10s -> %10s\n", $1, col[i], b, $i
+                failed = 1
+            }
+        }
+    }
+    END { exit failed }' "$baseline" "$results"; then
+    echo
+    echo perf regression test: success
+    exit 0
+else
+    echo
+    echo perf regression test: error
+    exit 1
+fi
@@ -59,7 +59,7 @@ do_ffmpeg()
     else
         wc -c $f >> $logfile
     fi
-    expr "`cat $bench`" : '.*utime=\(.*s\)' > $bench2
+    expr "`cat $bench`" : '.*utime=\([0-9.]*s\)' > $bench2
     echo `cat $bench2` $f >> $benchfile
 }
 
@@ -78,7 +78,7 @@ do_ffmpeg_nomd5()
     else
         wc -c $f >> $logfile
     fi
-    expr "`cat $bench`" : '.*utime=\(.*s\)' > $bench2
+    expr "`cat $bench`" : '.*utime=\([0-9.]*s\)' > $bench2
     echo `cat $bench2` $f >> $benchfile
 }
 
@@ -102,7 +102,7 @@ do_ffmpeg_nocheck()
     $ffmpeg $FFMPEG_OPTS -benchmark $* > $bench 2> /tmp/ffmpeg$$
     egrep -v "^(Stream|Press|Input|Output|frame|  Stream|  Duration|video:)" /tmp/ffmpeg$$ || true
     rm -f /tmp/ffmpeg$$
-    expr "`cat $bench`" : '.*utime=\(.*s\)' > $bench2
+    expr "`cat $bench`" : '.*utime=\([0-9.]*s\)' > $bench2
     echo `cat $bench2` $f >> $benchfile
 }
 
@@ -487,6 +487,37 @@ if [ -n "$do_mkv" ] ; then
 do_libav mkv
 fi
 
+if [ -n "$do_framemd5" ] ; then
+file=${outfile}libav.framemd5
+do_ffmpeg $file -t 1 -f image2 -vcodec pgmyuv -i $raw_src -f s16le -i $pcm_src -f framemd5 $file
+# hash in threads and fail on any difference with the first run
+do_ffmpeg_nocheck $file -t 1 -f image2 -vcodec pgmyuv -i $raw_src -f s16le -i $pcm_src -hashthreads 2 -hashref $file -f framemd5 /dev/null
+fi
+
+if [ -n "$do_vfilters" ] ; then
+# the mpeg2 decoder renders directly into the pictures of the filters
+src=${outfile}vfilters.mpg
+do_ffmpeg_nocheck $src -t 1 -qscale 10 -f image2 -vcodec pgmyuv -i $raw_src -vcodec mpeg2video -f mpeg1video $src
+do_vfilters()
+{
+    file=${outfile}vfilters-$1.framecrc
+    # do_ffmpeg splits its arguments, the graphs have no spaces and their
+    # labels must not be taken for patterns; -vsync 0 keeps the pictures
+    # output by the filters
+    set -f
+    do_ffmpeg $file $2 -vsync 0 -i $src -vfilters $3 -f framecrc $file
+    set +f
+}
+do_vfilters crop    "" crop=16:32:256:192
+do_vfilters pad     "" pad=384:320:16:16:ff8000
+do_vfilters scale   "" scale=176:144
+do_vfilters fps     "" fps=10
+do_vfilters overlay "" "split[main][over];[over]crop=0:0:64:64[small];[main][small]overlay=16:16"
+do_vfilters chain   "" crop=8:8:320:256,scale=240:176,pad=256:192:8:8,fps=15
+# slices in threads have to give the same pictures
+do_vfilters chain   "-threads 2" crop=8:8:320:256,scale=240:176,pad=256:192:8:8,fps=15
+fi
+
 
 # streamed images
 # mjpeg
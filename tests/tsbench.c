@@ -0,0 +1,233 @@
+/*
+ * MPEG-TS demuxer throughput benchmark
+ *
+ * Writes a synthetic transport stream carrying one program with 100
+ * elementary streams, then demuxes it with av_read_packet() and prints
+ * the throughput. Optionally all but the first streams are discarded.
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavformat/avformat.h"
+#include "libavutil/crc.h"
+
+#undef exit
+
+#define NB_PIDS       100
+#define FIRST_PID     0x100
+#define PMT_PID       0x1000
+#define PES_PAYLOAD   2000
+#define FILE_SIZE     (64 << 20)
+#define PSI_INTERVAL  4000      ///< packets between PAT/PMT repetitions
+#define JUNK_INTERVAL 100000    ///< packets between lost sync positions
+
+static FILE *outfile;
+static int nb_packets;
+static int cc[8192];
+
+static void put_ts_packet(int pid, int is_start, const uint8_t *payload, int len)
+{
+    uint8_t buf[188];
+    uint8_t *q = buf;
+    int stuffing = 184 - len;
+
+    *q++ = 0x47;
+    *q++ = (is_start ? 0x40 : 0) | (pid >> 8);
+    *q++ = pid;
+    *q++ = (stuffing > 0 ? 0x30 : 0x10) | cc[pid];
+    cc[pid] = (cc[pid] + 1) & 15;
+    if (stuffing > 0) {
+        *q++ = stuffing - 1;
+        if (stuffing > 1) {
+            *q++ = 0x00;
+            memset(q, 0xff, stuffing - 2);
+            q += stuffing - 2;
+        }
+    }
+    memcpy(q, payload, len);
+    fwrite(buf, 1, 188, outfile);
+
+    if (++nb_packets % JUNK_INTERVAL == 0)
+        fwrite("junk to resync over", 1, 19, outfile);
+}
+
+static void put_section(int pid, uint8_t *section, int len)
+{
+    uint8_t buf[184];
+    unsigned int crc;
+    int first = 1, l;
+
+    crc = av_crc(av_crc_get_table(AV_CRC_32_IEEE), -1, section, len - 4);
+    section[len - 4] = crc;
+    section[len - 3] = crc >> 8;
+    section[len - 2] = crc >> 16;
+    section[len - 1] = crc >> 24;
+
+    while (len > 0) {
+        uint8_t *q = buf;
+        if (first)
+            *q++ = 0; /* pointer field */
+        l = FFMIN(len, buf + sizeof(buf) - q);
+        memcpy(q, section, l);
+        q += l;
+        memset(q, 0xff, buf + sizeof(buf) - q);
+        put_ts_packet(pid, first, buf, sizeof(buf));
+        section += l;
+        len -= l;
+        first = 0;
+    }
+}
+
+static void put_psi(void)
+{
+    uint8_t section[1024];
+    uint8_t *q;
+    int i, len;
+
+    q = section;
+    *q++ = 0x00; /* table id */
+    q += 2;
+    *q++ = 0; *q++ = 1; /* transport stream id */
+    *q++ = 0xc1; *q++ = 0; *q++ = 0;
+    *q++ = 0; *q++ = 1; /* program number */
+    *q++ = 0xe0 | (PMT_PID >> 8); *q++ = PMT_PID & 0xff;
+    len = q - section + 4;
+    section[1] = 0xb0 | ((len - 3) >> 8);
+    section[2] = len - 3;
+    put_section(0, section, len);
+
+    q = section;
+    *q++ = 0x02; /* table id */
+    q += 2;
+    *q++ = 0; *q++ = 1; /* program number */
+    *q++ = 0xc1; *q++ = 0; *q++ = 0;
+    *q++ = 0xe0 | (FIRST_PID >> 8); *q++ = FIRST_PID & 0xff; /* PCR pid */
+    *q++ = 0xf0; *q++ = 0;
+    for (i = 0; i < NB_PIDS; i++) {
+        *q++ = 0x03; /* MPEG-1 audio */
+        *q++ = 0xe0 | ((FIRST_PID + i) >> 8);
+        *q++ = (FIRST_PID + i) & 0xff;
+        *q++ = 0xf0; *q++ = 0;
+    }
+    len = q - section + 4;
+    section[1] = 0xb0 | ((len - 3) >> 8);
+    section[2] = len - 3;
+    put_section(PMT_PID, section, len);
+}
+
+static void put_pes(int pid, int64_t pts, unsigned int *seed)
+{
+    uint8_t pes[14 + PES_PAYLOAD];
+    uint8_t *q = pes;
+    int i, len, is_start = 1;
+
+    *q++ = 0x00; *q++ = 0x00; *q++ = 0x01; *q++ = 0xc0;
+    *q++ = (PES_PAYLOAD + 8) >> 8; *q++ = (PES_PAYLOAD + 8) & 0xff;
+    *q++ = 0x80; *q++ = 0x80; *q++ = 5;
+    *q++ = 0x21 | ((pts >> 29) & 0x0e);
+    *q++ = pts >> 22; *q++ = (pts >> 14) | 1;
+    *q++ = pts >> 7;  *q++ = (pts << 1) | 1;
+    for (i = 0; i < PES_PAYLOAD; i++) {
+        *seed = *seed * 1664525 + 1013904223;
+        /* avoid long runs of sync bytes in the payload */
+        *q++ = (*seed >> 24) == 0x47 ? 0x48 : *seed >> 24;
+    }
+
+    for (q = pes; q < pes + sizeof(pes); q += len) {
+        len = FFMIN(184, pes + sizeof(pes) - q);
+        put_ts_packet(pid, is_start, q, len);
+        is_start = 0;
+    }
+}
+
+static int write_stream(const char *filename)
+{
+    unsigned int seed = 1;
+    int64_t pts = 0;
+    int i, last_psi = -PSI_INTERVAL;
+
+    outfile = fopen(filename, "wb");
+    if (!outfile) {
+        fprintf(stderr, "cannot create %s\n", filename);
+        return -1;
+    }
+    while (ftell(outfile) < FILE_SIZE) {
+        for (i = 0; i < NB_PIDS; i++) {
+            if (nb_packets - last_psi >= PSI_INTERVAL) {
+                put_psi();
+                last_psi = nb_packets;
+            }
+            put_pes(FIRST_PID + i, pts, &seed);
+        }
+        pts += 3003;
+    }
+    fclose(outfile);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    AVFormatContext *ic;
+    AVInputFormat *fmt;
+    AVPacket pkt;
+    int64_t start, bytes = 0, t;
+    int i, nb_kept, count = 0;
+
+    if (argc < 2) {
+        printf("usage: %s file.ts [kept_streams]\n"
+               "Write a %d pid transport stream to file.ts and measure how fast it is demuxed.\n"
+               "If kept_streams is given, all other streams are discarded.\n",
+               argv[0], NB_PIDS);
+        exit(1);
+    }
+    nb_kept = argc > 2 ? atoi(argv[2]) : NB_PIDS;
+
+    av_register_all();
+
+    if (write_stream(argv[1]) < 0)
+        exit(1);
+
+    fmt = av_find_input_format("mpegts");
+    if (av_open_input_file(&ic, argv[1], fmt, 0, NULL) < 0) {
+        fprintf(stderr, "cannot open %s\n", argv[1]);
+        exit(1);
+    }
+    for (i = nb_kept; i < ic->nb_streams; i++)
+        ic->streams[i]->discard = AVDISCARD_ALL;
+
+    start = av_gettime();
+    while (av_read_packet(ic, &pkt) >= 0) {
+        bytes += pkt.size;
+        count++;
+        av_free_packet(&pkt);
+    }
+    t = av_gettime() - start;
+
+    printf("%d streams, %d kept: %d packets, %"PRId64" payload bytes, "
+           "%"PRId64" file bytes in %0.3f s, %0.1f MB/s\n",
+           ic->nb_streams, FFMIN(nb_kept, ic->nb_streams), count, bytes,
+           url_fsize(ic->pb), t / 1000000.0,
+           url_fsize(ic->pb) / (double)FFMAX(t, 1));
+
+    av_close_input_file(ic);
+    return 0;
+}
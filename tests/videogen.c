@@ -264,12 +264,13 @@ void gen_image(int num, int w, int h)
 
 int main(int argc, char **argv)
 {
-    int w, h, i;
+    int w, h, nb_pict, i;
     char buf[1024];
 
-    if (argc != 2) {
-        printf("usage: %s file\n"
-               "generate a test video stream\n", argv[0]);
+    if (argc != 2 && argc != 4 && argc != 5) {
+        printf("usage: %s file [width height [frames]]\n"
+               "generate a test video stream, %dx%d with %d frames by default\n",
+               argv[0], DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_NB_PICT);
         exit(1);
     }
 
@@ -280,13 +281,24 @@ int main(int argc, char **argv)
 
     w = DEFAULT_WIDTH;
     h = DEFAULT_HEIGHT;
+    nb_pict = DEFAULT_NB_PICT;
+    if (argc >= 4) {
+        w = atoi(argv[2]) & ~1;
+        h = atoi(argv[3]) & ~1;
+        if (argc == 5)
+            nb_pict = atoi(argv[4]);
+        if (w <= 0 || h <= 0 || nb_pict <= 0 || nb_pict > 100) {
+            printf("invalid size or number of frames\n");
+            exit(1);
+        }
+    }
 
     rgb_tab = malloc(w * h * 3);
     wrap = w * 3;
     width = w;
     height = h;
 
-    for(i=0;i<DEFAULT_NB_PICT;i++) {
+    for(i=0;i<nb_pict;i++) {
         snprintf(buf, sizeof(buf), "%s%02d.pgm", argv[1], i);
         gen_image(i, w, h);
         pgmyuv_save(buf, w, h, rgb_tab);